@@ -0,0 +1,262 @@
+#define _POSIX_C_SOURCE 200809L
+
+/*
+* Allocations per parsed response, counted through mistral_set_allocator.
+* "total" includes the cJSON tree, "kept" is what the response holds
+* until mistral_response_free
+*/
+
+#include "../include/mistral.h"
+#include "../src/mistral_arena.h"
+#include "../src/mistral_helpers.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ROUNDS 200
+#define EMBEDDINGS 16
+#define DIMENSIONS 1024
+#define REPLY_SIZE (1 << 20)
+
+typedef struct {
+  long mallocs;
+  long frees;
+  long live;
+  size_t bytes;
+} alloc_count_t;
+
+static alloc_count_t count;
+
+static void *count_malloc(size_t size, void *user_data) {
+  (void)user_data;
+  count.mallocs++;
+  count.live++;
+  count.bytes += size;
+  return malloc(size);
+}
+
+static void *count_realloc(void *ptr, size_t size, void *user_data) {
+  (void)user_data;
+  count.mallocs++;
+  count.live += ptr == NULL ? 1 : 0;
+  count.bytes += size;
+  return realloc(ptr, size);
+}
+
+static void count_free(void *ptr, void *user_data) {
+  (void)user_data;
+  if (ptr != NULL) {
+    count.frees++;
+    count.live--;
+  }
+  free(ptr);
+}
+
+static double now_us(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void report(const char *name, const alloc_count_t *parsed,
+                   const alloc_count_t *freed, double us) {
+  printf("%-28s %8.1f total %6.1f kept %6.1f freed %10.1f us\n", name,
+         (double)parsed->mallocs / ROUNDS, (double)parsed->live / ROUNDS,
+         (double)freed->frees / ROUNDS, us / ROUNDS);
+}
+
+static char *chat_json(size_t content_size) {
+  char *json = (char *)malloc(content_size + 256);
+  int len = 0;
+
+  if (json == NULL) {
+    return NULL;
+  }
+  len = sprintf(json, "{\"id\":\"cmpl-1\",\"object\":\"chat.completion\","
+                      "\"model\":\"mistral-small\",\"choices\":[{\"index\":0,"
+                      "\"message\":{\"role\":\"assistant\",\"content\":\"");
+  memset(json + len, 'a', content_size);
+  sprintf(json + len + content_size,
+          "\"},\"finish_reason\":\"stop\"}],\"usage\":{\"prompt_tokens\":5,"
+          "\"completion_tokens\":7,\"total_tokens\":12}}");
+  return json;
+}
+
+static char *embeddings_json(void) {
+  char *json = (char *)malloc(EMBEDDINGS * (DIMENSIONS * 10 + 64) + 128);
+  size_t len = 0;
+  int i;
+  int j;
+
+  if (json == NULL) {
+    return NULL;
+  }
+  len = sprintf(json, "{\"id\":\"e-1\",\"object\":\"list\",\"data\":[");
+  for (i = 0; i < EMBEDDINGS; i++) {
+    len += sprintf(json + len,
+                   "%s{\"object\":\"embedding\",\"index\":%d,\"embedding\":[",
+                   i > 0 ? "," : "", i);
+    for (j = 0; j < DIMENSIONS; j++) {
+      len += sprintf(json + len, "%s%.5f", j > 0 ? "," : "",
+                     (double)(i + j) / DIMENSIONS);
+    }
+    len += sprintf(json + len, "]}");
+  }
+  sprintf(json + len, "],\"usage\":{\"prompt_tokens\":4,\"total_tokens\":4}}");
+  return json;
+}
+
+static void bench_chat(const char *json) {
+  alloc_count_t parsed = {0, 0, 0, 0};
+  alloc_count_t freed = {0, 0, 0, 0};
+  alloc_count_t start;
+  mistral_response_t response;
+  double us = 0;
+  double t0 = 0;
+  int i;
+
+  for (i = 0; i < ROUNDS; i++) {
+    memset(&response, 0, sizeof(response));
+    start = count;
+    t0 = now_us();
+    if (parse_response(json, 200, &response) != 0) {
+      fprintf(stderr, "parse_response failed\n");
+      exit(1);
+    }
+    us += now_us() - t0;
+    parsed.mallocs += count.mallocs - start.mallocs;
+    parsed.live += count.live - start.live;
+    start = count;
+    mistral_response_free(&response);
+    freed.frees += count.frees - start.frees;
+  }
+  report("chat reply", &parsed, &freed, us);
+}
+
+static void bench_chat_view(const char *json) {
+  alloc_count_t parsed = {0, 0, 0, 0};
+  alloc_count_t freed = {0, 0, 0, 0};
+  alloc_count_t start;
+  mistral_response_t response;
+  size_t size = strlen(json);
+  char *body = NULL;
+  double us = 0;
+  double t0 = 0;
+  int i;
+
+  for (i = 0; i < ROUNDS; i++) {
+    memset(&response, 0, sizeof(response));
+    /* the receive buffer the response adopts is not counted */
+    body = (char *)mistral_malloc(size + 1);
+    if (body == NULL) {
+      exit(1);
+    }
+    memcpy(body, json, size + 1);
+    start = count;
+    t0 = now_us();
+    if (parse_response_view(&body, size, size + 1, &response) != 0) {
+      fprintf(stderr, "parse_response_view failed\n");
+      exit(1);
+    }
+    us += now_us() - t0;
+    parsed.mallocs += count.mallocs - start.mallocs;
+    parsed.live += count.live - start.live;
+    start = count;
+    mistral_response_free(&response);
+    /* the adopted body is freed with it */
+    freed.frees += count.frees - start.frees - 1;
+  }
+  report("chat reply in place", &parsed, &freed, us);
+}
+
+static void bench_embeddings(const char *json) {
+  alloc_count_t parsed = {0, 0, 0, 0};
+  alloc_count_t freed = {0, 0, 0, 0};
+  alloc_count_t start;
+  mistral_embeddings_response_t response;
+  double us = 0;
+  double t0 = 0;
+  int i;
+
+  for (i = 0; i < ROUNDS; i++) {
+    memset(&response, 0, sizeof(response));
+    start = count;
+    t0 = now_us();
+    if (parse_embenddings(json, 200, &response) != 0) {
+      fprintf(stderr, "parse_embenddings failed\n");
+      exit(1);
+    }
+    us += now_us() - t0;
+    parsed.mallocs += count.mallocs - start.mallocs;
+    parsed.live += count.live - start.live;
+    start = count;
+    mistral_embeddings_response_free(&response);
+    freed.frees += count.frees - start.frees;
+  }
+  report("16 x 1024-dim embeddings", &parsed, &freed, us);
+}
+
+/*
+* What a conversation pays to keep a 1 MiB reply: a copy out of the
+* arena, or the arena itself
+*/
+static void bench_take(const char *json, int adopt) {
+  mistral_response_t response;
+  response_arena_t *arena = NULL;
+  char *content = NULL;
+  long mallocs = 0;
+  size_t bytes = 0;
+  alloc_count_t start;
+  int i;
+
+  for (i = 0; i < ROUNDS; i++) {
+    memset(&response, 0, sizeof(response));
+    if (parse_response(json, 200, &response) != 0) {
+      exit(1);
+    }
+    start = count;
+    arena = adopt ? response_take_arena(&response, &content) : NULL;
+    if (arena == NULL) {
+      content = response_take_content(&response);
+    }
+    mallocs += count.mallocs - start.mallocs;
+    bytes += count.bytes - start.bytes;
+    mistral_response_free(&response);
+    if (arena != NULL) {
+      response_arena_free(arena);
+    } else {
+      mistral_free(content);
+    }
+  }
+  printf("%-28s %8.1f mallocs %10zu bytes\n",
+         adopt ? "keep reply: adopt arena" : "keep reply: copy content",
+         (double)mallocs / ROUNDS, bytes / ROUNDS);
+}
+
+int main(void) {
+  char *chat = chat_json(64);
+  char *reply = chat_json(REPLY_SIZE);
+  char *embeddings = embeddings_json();
+
+  if (chat == NULL || reply == NULL || embeddings == NULL ||
+      mistral_set_allocator(count_malloc, count_realloc, count_free, NULL) !=
+          0) {
+    fprintf(stderr, "bench setup failed\n");
+    return 1;
+  }
+
+  printf("allocations per response, %d rounds\n", ROUNDS);
+  bench_chat(chat);
+  bench_chat_view(chat);
+  bench_embeddings(embeddings);
+  bench_take(reply, 0);
+  bench_take(reply, 1);
+
+  mistral_set_allocator(NULL, NULL, NULL, NULL);
+  free(chat);
+  free(reply);
+  free(embeddings);
+  return 0;
+}
@@ -0,0 +1,327 @@
+#define _POSIX_C_SOURCE 200809L
+
+/*
+* Receive buffer cost of multi-MB embedding responses, fetched from a
+* local server with and without Content-Length. The allocator moves every
+* realloc, so "copied" is the worst case a libc realloc could reach.
+* "big" counts allocations of receive buffer size, "re" every realloc,
+* libcurl's small ones included
+*/
+
+#include "../include/mistral.h"
+#include "../src/http_client.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define EMBEDDINGS 512
+#define DIMENSIONS 1024
+#define ROUNDS 5
+#define CHUNK_SIZE 16384
+/* receive buffers, not libcurl's or the headers' */
+#define LARGE_ALLOC (64 << 10)
+
+typedef union {
+  size_t size;
+  double align;
+} alloc_header_t;
+
+typedef struct {
+  long reallocs;
+  long large_mallocs;
+  size_t copied;
+} alloc_count_t;
+
+static alloc_count_t count;
+static pthread_mutex_t count_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *count_malloc(size_t size, void *user_data) {
+  alloc_header_t *header = (alloc_header_t *)malloc(sizeof(*header) + size);
+
+  (void)user_data;
+  if (header == NULL) {
+    return NULL;
+  }
+  header->size = size;
+  if (size >= LARGE_ALLOC) {
+    pthread_mutex_lock(&count_lock);
+    count.large_mallocs++;
+    pthread_mutex_unlock(&count_lock);
+  }
+  return header + 1;
+}
+
+static void count_free(void *ptr, void *user_data) {
+  (void)user_data;
+  if (ptr != NULL) {
+    free((alloc_header_t *)ptr - 1);
+  }
+}
+
+static void *count_realloc(void *ptr, size_t size, void *user_data) {
+  size_t old_size = 0;
+  void *moved = NULL;
+
+  if (ptr == NULL) {
+    return count_malloc(size, user_data);
+  }
+  old_size = ((alloc_header_t *)ptr - 1)->size;
+  moved = count_malloc(size, NULL);
+  if (moved == NULL) {
+    return NULL;
+  }
+  memcpy(moved, ptr, old_size < size ? old_size : size);
+  count_free(ptr, NULL);
+  pthread_mutex_lock(&count_lock);
+  count.reallocs++;
+  count.copied += old_size < size ? old_size : size;
+  pthread_mutex_unlock(&count_lock);
+  return moved;
+}
+
+typedef struct {
+  int fd;
+  int chunked;
+  const char *body;
+  size_t size;
+} server_t;
+
+static int send_all(int fd, const char *data, size_t size) {
+  ssize_t n = 0;
+
+  while (size > 0) {
+    n = send(fd, data, size, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return -1;
+    }
+    data += n;
+    size -= (size_t)n;
+  }
+  return 0;
+}
+
+/*
+* Read the request head and its Content-Length body, then answer with
+* the embeddings body, whole or in chunks
+*/
+static void serve(server_t *server, int fd) {
+  char request[8192];
+  char head[256];
+  size_t used = 0;
+  size_t length = 0;
+  size_t offset = 0;
+  size_t size = 0;
+  char *end = NULL;
+  char *field = NULL;
+  ssize_t n = 0;
+
+  request[0] = '\0';
+  while ((end = strstr(request, "\r\n\r\n")) == NULL) {
+    n = recv(fd, request + used, sizeof(request) - used - 1, 0);
+    if (n <= 0) {
+      return;
+    }
+    used += (size_t)n;
+    request[used] = '\0';
+  }
+  field = strstr(request, "Content-Length:");
+  if (field != NULL) {
+    length = strtoul(field + 15, NULL, 10);
+  }
+  used -= (size_t)(end + 4 - request);
+  while (used < length) {
+    n = recv(fd, request, sizeof(request), 0);
+    if (n <= 0) {
+      return;
+    }
+    used += (size_t)n;
+  }
+
+  if (!server->chunked) {
+    snprintf(head, sizeof(head),
+             "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+             "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+             server->size);
+    if (send_all(fd, head, strlen(head)) == 0) {
+      send_all(fd, server->body, server->size);
+    }
+    return;
+  }
+
+  snprintf(head, sizeof(head),
+           "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+           "Transfer-Encoding: chunked\r\nConnection: close\r\n\r\n");
+  if (send_all(fd, head, strlen(head)) != 0) {
+    return;
+  }
+  for (offset = 0; offset < server->size; offset += size) {
+    size = server->size - offset < CHUNK_SIZE ? server->size - offset
+                                              : CHUNK_SIZE;
+    snprintf(head, sizeof(head), "%zx\r\n", size);
+    if (send_all(fd, head, strlen(head)) != 0 ||
+        send_all(fd, server->body + offset, size) != 0 ||
+        send_all(fd, "\r\n", 2) != 0) {
+      return;
+    }
+  }
+  send_all(fd, "0\r\n\r\n", 5);
+}
+
+static void *accept_loop(void *arg) {
+  server_t *server = (server_t *)arg;
+  int fd = -1;
+
+  while ((fd = accept(server->fd, NULL, NULL)) >= 0) {
+    serve(server, fd);
+    close(fd);
+  }
+  return NULL;
+}
+
+static char *embeddings_json(size_t *size) {
+  char *json = (char *)malloc(EMBEDDINGS * (DIMENSIONS * 10 + 64) + 128);
+  size_t len = 0;
+  int i;
+  int j;
+
+  if (json == NULL) {
+    return NULL;
+  }
+  len = sprintf(json, "{\"id\":\"e-1\",\"object\":\"list\",\"data\":[");
+  for (i = 0; i < EMBEDDINGS; i++) {
+    len += sprintf(json + len,
+                   "%s{\"object\":\"embedding\",\"index\":%d,\"embedding\":[",
+                   i > 0 ? "," : "", i);
+    for (j = 0; j < DIMENSIONS; j++) {
+      len += sprintf(json + len, "%s%.5f", j > 0 ? "," : "",
+                     (double)(i + j) / DIMENSIONS);
+    }
+    len += sprintf(json + len, "]}");
+  }
+  len += sprintf(json + len,
+                 "],\"usage\":{\"prompt_tokens\":4,\"total_tokens\":4}}");
+  *size = len;
+  return json;
+}
+
+typedef struct {
+  const char *name;
+  const char *url;
+  size_t size;
+  alloc_count_t first;
+  alloc_count_t rest;
+} run_t;
+
+/*
+* Fetch ROUNDS times on a fresh thread, so no buffer is kept from an
+* earlier run: the first request, then the others that may start from
+* the buffer the thread kept
+*/
+static void *fetch(void *arg) {
+  run_t *run = (run_t *)arg;
+  const char *headers[] = {"Content-Type: application/json", NULL};
+  http_response_t response;
+  int i;
+
+  for (i = 0; i < ROUNDS; i++) {
+    memset(&count, 0, sizeof(count));
+    memset(&response, 0, sizeof(response));
+    if (http_post(run->url, headers, "{\"input\":[\"x\"]}", &response) !=
+            0 ||
+        response.size != run->size) {
+      fprintf(stderr, "%s: request failed\n", run->name);
+      exit(1);
+    }
+    http_response_free(&response);
+    if (i == 0) {
+      run->first = count;
+    } else {
+      run->rest.reallocs += count.reallocs;
+      run->rest.large_mallocs += count.large_mallocs;
+      run->rest.copied += count.copied;
+    }
+  }
+  return NULL;
+}
+
+static void bench(const char *name, server_t *server, const char *url,
+                  int chunked, size_t retention) {
+  run_t run;
+  pthread_t thread;
+
+  memset(&run, 0, sizeof(run));
+  run.name = name;
+  run.url = url;
+  run.size = server->size;
+  server->chunked = chunked;
+  mistral_set_buffer_retention(retention);
+  if (pthread_create(&thread, NULL, fetch, &run) != 0) {
+    fprintf(stderr, "%s: no thread\n", name);
+    exit(1);
+  }
+  pthread_join(thread, NULL);
+
+  printf("%-34s %4ld %4ld %10zu %6.1f %6.1f %10.0f\n", name,
+         run.first.large_mallocs, run.first.reallocs, run.first.copied,
+         (double)run.rest.large_mallocs / (ROUNDS - 1),
+         (double)run.rest.reallocs / (ROUNDS - 1),
+         (double)run.rest.copied / (ROUNDS - 1));
+}
+
+int main(void) {
+  server_t server;
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  pthread_t thread;
+  char url[64];
+
+  memset(&server, 0, sizeof(server));
+  server.body = embeddings_json(&server.size);
+  if (server.body == NULL ||
+      mistral_set_allocator(count_malloc, count_realloc, count_free, NULL) !=
+          0 ||
+      mistral_init() != 0) {
+    fprintf(stderr, "bench setup failed\n");
+    return 1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  server.fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (server.fd < 0 ||
+      bind(server.fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(server.fd, 8) != 0 ||
+      getsockname(server.fd, (struct sockaddr *)&addr, &addr_len) != 0 ||
+      pthread_create(&thread, NULL, accept_loop, &server) != 0) {
+    fprintf(stderr, "bench server failed\n");
+    return 1;
+  }
+  snprintf(url, sizeof(url), "http://127.0.0.1:%d/v1/embeddings",
+           ntohs(addr.sin_port));
+
+  printf("%d x %d-dim embeddings, %zu byte body\n", EMBEDDINGS, DIMENSIONS,
+         server.size);
+  printf("%-34s %-21s  %s\n", "", "first request",
+         "later requests (average)");
+  printf("%-34s %4s %4s %10s %6s %6s %10s\n", "", "big", "re", "copied",
+         "big", "re", "copied");
+  bench("Content-Length, no retention", &server, url, 0, 0);
+  bench("chunked, no retention", &server, url, 1, 0);
+  bench("Content-Length, 16 MiB retention", &server, url, 0, 16 << 20);
+  bench("chunked, 16 MiB retention", &server, url, 1, 16 << 20);
+
+  shutdown(server.fd, SHUT_RDWR);
+  close(server.fd);
+  pthread_join(thread, NULL);
+  mistral_set_buffer_retention(0);
+  mistral_cleanup();
+  mistral_set_allocator(NULL, NULL, NULL, NULL);
+  free((char *)server.body);
+  return 0;
+}
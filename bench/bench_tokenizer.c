@@ -0,0 +1,111 @@
+#define _POSIX_C_SOURCE 200809L
+
+/*
+* Token counting throughput: bench_tokenizer tekken.json text-file, or
+* MISTRAL_TEKKEN and MISTRAL_CORPUS. The text is counted whole, then in
+* 4 KiB messages like a conversation would pass them
+*/
+
+#include "../include/mistral.h"
+#include "../src/mistral_tokenizer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ROUNDS 5
+#define MESSAGE_SIZE 4096
+
+static double now_s(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *read_text(const char *path, size_t *size) {
+  FILE *file = fopen(path, "rb");
+  char *text = NULL;
+  long length = 0;
+
+  if (file == NULL) {
+    return NULL;
+  }
+  if (fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) > 0 &&
+      fseek(file, 0, SEEK_SET) == 0) {
+    text = (char *)malloc((size_t)length + 1);
+    if (text != NULL &&
+        fread(text, 1, (size_t)length, file) != (size_t)length) {
+      free(text);
+      text = NULL;
+    }
+  }
+  fclose(file);
+  if (text != NULL) {
+    text[length] = '\0';
+    *size = (size_t)length;
+  }
+  return text;
+}
+
+static void bench(const char *name, const mistral_tokenizer_t *tokenizer,
+                  const char *text, size_t size, size_t piece) {
+  double best = 0;
+  double started = 0;
+  double elapsed = 0;
+  long tokens = 0;
+  size_t offset = 0;
+  int round;
+
+  for (round = 0; round < ROUNDS; round++) {
+    tokens = 0;
+    started = now_s();
+    for (offset = 0; offset < size; offset += piece) {
+      tokens += tokenizer_count_range(tokenizer, text + offset,
+                                      size - offset < piece ? size - offset
+                                                            : piece);
+    }
+    elapsed = now_s() - started;
+    if (round == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  printf("%-22s %10ld tokens %8.1f MB/s %6.2f bytes/token\n", name, tokens,
+         size / best / 1e6, (double)size / (double)tokens);
+}
+
+int main(int argc, char **argv) {
+  const char *vocab = argc > 2 ? argv[1] : getenv("MISTRAL_TEKKEN");
+  const char *corpus = argc > 2 ? argv[2] : getenv("MISTRAL_CORPUS");
+  mistral_tokenizer_t *tokenizer = NULL;
+  double started = 0;
+  size_t size = 0;
+  char *text = NULL;
+
+  if (vocab == NULL || corpus == NULL) {
+    printf("SKIPPED - pass tekken.json and a text file, or set "
+           "MISTRAL_TEKKEN and MISTRAL_CORPUS\n");
+    return 0;
+  }
+
+  started = now_s();
+  tokenizer = mistral_tokenizer_load(vocab);
+  if (tokenizer == NULL) {
+    return 1;
+  }
+  printf("loaded %s in %.0f ms\n", vocab, (now_s() - started) * 1e3);
+  text = read_text(corpus, &size);
+  if (text == NULL) {
+    fprintf(stderr, "failed to read %s\n", corpus);
+    mistral_tokenizer_free(tokenizer);
+    return 1;
+  }
+
+  printf("%s, %zu bytes\n", corpus, size);
+  bench("whole text", tokenizer, text, size, size);
+  bench("4 KiB messages", tokenizer, text, size, MESSAGE_SIZE);
+
+  free(text);
+  mistral_tokenizer_free(tokenizer);
+  return 0;
+}
@@ -18,8 +18,88 @@ typedef struct{
   char *param;
   char *code;
 } mistral_api_error_t;
+
+/*
+* Shares one round trip between identical in-flight requests
+*/
+typedef struct mistral_coalescer mistral_coalescer_t;
+
+/*
+* Exact-match cache of chat and FIM responses
+*/
+typedef struct mistral_response_cache mistral_response_cache_t;
+
+/*
+* Per-endpoint concurrency limit adapted from 429s, 5xx and latency
+*/
+typedef struct mistral_adaptive_limiter mistral_adaptive_limiter_t;
+
+/*
+* Duplicates slow idempotent requests to cut tail latency
+*/
+typedef struct mistral_hedge_policy mistral_hedge_policy_t;
+
+/*
+* Fails calls fast while an endpoint and model keep failing
+*/
+typedef struct mistral_circuit_breaker mistral_circuit_breaker_t;
+
+/*
+* Aborts requests from another thread
+*/
+typedef struct mistral_cancel_token mistral_cancel_token_t;
+
+/*
+* Spreads attempts over several base URLs and API keys
+*/
+typedef struct mistral_backend_pool mistral_backend_pool_t;
+
+/*
+* Resends a failed chat or FIM request with the next model of a chain
+*/
+typedef struct mistral_fallback_policy mistral_fallback_policy_t;
+
+/*
+* Picks the model for each request from latency and quality targets
+*/
+typedef struct mistral_model_router mistral_model_router_t;
+
+/*
+* Trims chat history to fit a model's context window before sending
+*/
+typedef struct mistral_context_policy mistral_context_policy_t;
+
+/*
+* Bump allocator holding a response's parsed strings and data
+*/
+typedef struct mistral_response_arena mistral_response_arena_t;
+
 /*
 * Client config
+* coalescer, response_cache, limiter, hedge_policy, circuit_breaker,
+* backend_pool, fallback_policy, model_router, context_policy: optional, not
+* owned by config
+* cancel_token: optional, not owned. Per-call settings like this one can be
+* set on a stack copy of the shared config
+* cacheable: set to 1 to let response_cache serve and store this call
+* timeout_sec bounds each attempt. connect_timeout_ms, first_byte_timeout_ms
+* and idle_timeout_ms limit the phases of an attempt, 0 is off (connect
+* falls back to 10 s). deadline_ms bounds the whole call including retries
+* and backoff, 0 is off. Timeouts end with MISTRAL_ERR_TIMEOUT
+* latency_target_ms, min_quality_tier: what model_router must meet for
+* chat and FIM calls, 0 for no constraint
+* response_views: set to 1 to parse chat and FIM replies in place: the
+* response keeps the received body and id, model and content point into
+* it; read them with mistral_response_view
+* reuse_responses: set to 1 to keep a response's memory across calls: the
+* caller zeroes the response once and calls mistral_response_free (or
+* mistral_embeddings_response_free) only when done, each call resets it
+* stream_request_bytes: the _n calls send a body whose text is at least
+* this many bytes as it is written, escaping the caller's slices during
+* the upload instead of building the body first. 0 never streams
+* compress_request_bytes: gzip request bodies of at least this many bytes
+* while they are sent, for servers that accept Content-Encoding: gzip. 0
+* never compresses. Compressed replies are always accepted and decoded
 */
 typedef struct {
   char *api_key;
@@ -30,6 +110,27 @@ typedef struct {
   int retry_delay_ms;
   int timeout_sec;
   int debug_mode;
+  mistral_coalescer_t *coalescer;
+  mistral_response_cache_t *response_cache;
+  int cacheable;
+  mistral_adaptive_limiter_t *limiter;
+  mistral_hedge_policy_t *hedge_policy;
+  mistral_circuit_breaker_t *circuit_breaker;
+  mistral_cancel_token_t *cancel_token;
+  int connect_timeout_ms;
+  int first_byte_timeout_ms;
+  int idle_timeout_ms;
+  int deadline_ms;
+  mistral_backend_pool_t *backend_pool;
+  mistral_fallback_policy_t *fallback_policy;
+  mistral_model_router_t *model_router;
+  int latency_target_ms;
+  int min_quality_tier;
+  mistral_context_policy_t *context_policy;
+  int response_views;
+  int reuse_responses;
+  size_t stream_request_bytes;
+  size_t compress_request_bytes;
 } mistral_config_t;
 
 /*
@@ -52,6 +153,29 @@ typedef struct{
   char *input;
 } mistral_embeddings_t;
 
+/*
+* Length-delimited message, FIM and embeddings input for the _n calls:
+* each string is [ptr, ptr + len) of a larger buffer, no NUL needed
+*/
+typedef struct {
+  const char *role;
+  size_t role_len;
+  const char *content;
+  size_t content_len;
+} mistral_message_n_t;
+
+typedef struct {
+  const char *prompt;
+  size_t prompt_len;
+  const char *suffix;
+  size_t suffix_len;
+} mistral_fim_n_t;
+
+typedef struct {
+  const char *input;
+  size_t input_len;
+} mistral_embeddings_n_t;
+
 /*Errors code*/
 typedef enum {
   MISTRAL_OK = 0,
@@ -62,11 +186,16 @@ typedef enum {
   MISTRAL_ERR_SERVER,
   MISTRAL_ERR_PARSE,
   MISTRAL_ERR_TIMEOUT,
-  MISTRAL_ERR_MEM
+  MISTRAL_ERR_MEM,
+  MISTRAL_ERR_CIRCUIT_OPEN,
+  MISTRAL_ERR_CANCELLED
 } mistral_error_code_t;
 
 /*
 * Response from fim or chat/completions
+* fallback_index: position in config->fallback_policy of the model that
+* answered, 0 without a policy
+* arena: internal, holds the parsed strings until mistral_response_free
 */
 typedef struct {
   char *id;
@@ -79,12 +208,16 @@ typedef struct {
   mistral_error_code_t error_code;
   long http_code;
   mistral_api_error_t *api_error;
+  int cached;
+  int fallback_index;
+  mistral_response_arena_t *arena;
 } mistral_response_t;
 
 typedef struct {
   float *embending;
   int index;
   char *object; 
+  int dimensions;
 } embedding_response_data;
 
 typedef struct {
@@ -95,7 +228,10 @@ typedef struct {
 } usage_info_t;
 
 /*
-* Response from embeddings 
+* Response from embeddings
+* arena: internal, holds id, model, object, data and usage until
+* mistral_embeddings_response_free; they are never allocated on their own,
+* so only error_message and api_error are freed separately
 */
 typedef struct {
   long http_code;
@@ -107,8 +243,66 @@ typedef struct {
   char *model;
   char *object;
   usage_info_t *usage;
+  mistral_response_arena_t *arena;
 } mistral_embeddings_response_t;
 
+/*
+* Allocator for everything the library allocates, cJSON and libcurl
+* included. realloc_cb follows realloc(): NULL ptr allocates
+*/
+typedef void *(*mistral_malloc_cb)(size_t size, void *user_data);
+typedef void *(*mistral_realloc_cb)(void *ptr, size_t size, void *user_data);
+typedef void (*mistral_free_cb)(void *ptr, void *user_data);
+
+/*
+* Route all allocations through the callbacks, all three or none; NULLs
+* restore malloc. Call before mistral_init and before any other call, the
+* hooks must stay until mistral_cleanup. Strings handed to the library to
+* free, like summaries or response fields set by hand, must then come
+* from mistral_malloc
+* Return 0 if ok, -1 if error
+*/
+int mistral_set_allocator(mistral_malloc_cb malloc_cb,
+                          mistral_realloc_cb realloc_cb,
+                          mistral_free_cb free_cb, void *user_data);
+
+/*
+* Allocate and free with the library's allocator
+*/
+void *mistral_malloc(size_t size);
+
+void mistral_free(void *ptr);
+
+/*
+* Receive buffer bytes each thread keeps for its next request and its
+* retries, 1 MiB by default; 0 frees every buffer after use. Set before
+* requests start
+*/
+void mistral_set_buffer_retention(size_t max_bytes);
+
+/*
+* Bytes the library moved for one endpoint: request_bytes and
+* response_bytes as it built and parsed the bodies, the _wire_ counts as
+* they went over the connection after compression. Coalesced requests
+* share the transfer they waited for and are not counted
+*/
+typedef struct {
+  unsigned long requests;
+  unsigned long compressed_requests;
+  size_t request_bytes;
+  size_t request_wire_bytes;
+  size_t response_bytes;
+  size_t response_wire_bytes;
+} mistral_transfer_stats_t;
+
+/*
+* Read the counters of endpoint: "chat/completions", "fim/completions" or
+* "embeddings"
+* Return 0 if ok, -1 if the endpoint is not tracked
+*/
+int mistral_get_transfer_stats(const char *endpoint,
+                               mistral_transfer_stats_t *stats);
+
 /*
 * Call first
 * Return 0 if ok, -1 if error 
@@ -170,11 +364,58 @@ int mistral_embeddings(const mistral_config_t *config,
                        size_t message_count,
                        mistral_embeddings_response_t *response);
 
+/*
+* The same calls on length-delimited strings: each one is escaped into the
+* request body once, straight from the caller's buffer. With a context
+* policy, chat messages are copied into terminated strings first
+*/
+int mistral_chat_completions_n(const mistral_config_t *config,
+                               const mistral_message_n_t *messages,
+                               size_t message_count,
+                               mistral_response_t *response);
+
+int mistral_fim_completions_n(const mistral_config_t *config,
+                              const mistral_fim_n_t *fim,
+                              mistral_response_t *response);
+
+int mistral_embeddings_n(const mistral_config_t *config,
+                         const mistral_embeddings_n_t *inputs,
+                         size_t input_count,
+                         mistral_embeddings_response_t *response);
+
 /*
 * Clear request
 */
 void mistral_response_free(mistral_response_t *response);
 
+/*
+* Clear a response but keep its memory for the next call, which then
+* needs no allocation for a reply of similar size
+*/
+void mistral_response_reset(mistral_response_t *response);
+
+/*
+* Length-delimited string, data is NUL-terminated but may hold NUL bytes
+*/
+typedef struct {
+  const char *data;
+  size_t length;
+} mistral_string_view_t;
+
+typedef enum {
+  MISTRAL_FIELD_ID,
+  MISTRAL_FIELD_MODEL,
+  MISTRAL_FIELD_CONTENT
+} mistral_response_field_t;
+
+/*
+* View of a response string, valid until mistral_response_free. Exact
+* for replies parsed with config->response_views, strlen otherwise
+* Return {NULL, 0} if the field is not set
+*/
+mistral_string_view_t mistral_response_view(const mistral_response_t *response,
+                                            mistral_response_field_t field);
+
 /*
 * Get text error
 */
@@ -195,6 +436,694 @@ void mistral_api_error_free(mistral_api_error_t *error);
 */
 void mistral_embeddings_response_free(mistral_embeddings_response_t *response);
 
+/*
+* Clear an embeddings response but keep its memory for the next call
+*/
+void mistral_embeddings_response_reset(
+    mistral_embeddings_response_t *response);
+
+typedef struct {
+  unsigned long requests;
+  unsigned long coalesced;
+} mistral_coalescer_stats_t;
+
+/*
+* Create coalescer, attach it to config->coalescer to enable
+* Embeddings are always coalesced, chat and FIM only with temperature 0
+* Duplicates wait for the first caller and get a copy of its response
+*/
+mistral_coalescer_t *mistral_coalescer_create(void);
+
+/*
+* Read counters: requests seen and requests served by another call
+*/
+void mistral_coalescer_get_stats(mistral_coalescer_t *coalescer,
+                                 mistral_coalescer_stats_t *stats);
+
+/*
+* Free coalescer, no request may be using it
+*/
+void mistral_coalescer_free(mistral_coalescer_t *coalescer);
+
+typedef struct {
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  size_t entries;
+  size_t bytes;
+} mistral_response_cache_stats_t;
+
+/*
+* Create response cache, attach it to config->response_cache
+* max_bytes: memory budget, least recently used entries are evicted
+* ttl_sec: entry lifetime, 0 for no expiry
+* backing_file: optional path, entries are loaded from and appended to it;
+* once it holds twice their size the live entries are written to
+* <backing_file>.tmp, which is renamed over it. Loading stops at the first
+* corrupt record; a file that is not a response cache file is left as is
+* and the cache stays in memory
+* Cached responses keep usage fields and have cached set to 1
+*/
+mistral_response_cache_t *mistral_response_cache_create(
+    size_t max_bytes, int ttl_sec, const char *backing_file);
+
+/*
+* Read hit, miss and size counters
+*/
+void mistral_response_cache_get_stats(mistral_response_cache_t *cache,
+                                      mistral_response_cache_stats_t *stats);
+
+/*
+* Free response cache, no request may be using it
+*/
+void mistral_response_cache_free(mistral_response_cache_t *cache);
+
+/*
+* Chat cache matching paraphrased questions by embedding similarity
+*/
+typedef struct mistral_semantic_cache mistral_semantic_cache_t;
+
+/*
+* Called on every semantic hit so false hits can be audited, without the
+* cache lock held, so it may call back into the cache
+* query: last user message of the request
+* matched_query: cached question that served it
+*/
+typedef void (*mistral_semantic_audit_cb)(const char *query,
+                                          const char *matched_query,
+                                          double similarity, void *user_data);
+
+typedef struct {
+  unsigned long lookups;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long embedding_failures;
+  size_t entries;
+  double avg_chat_ms;
+  double avg_embedding_ms;
+  double saved_ms;
+} mistral_semantic_cache_stats_t;
+
+/*
+* Create semantic cache
+* embed_config: config used for /embeddings calls, not owned, must outlive
+* the cache
+* threshold: min cosine similarity for a hit, in (0, 1]
+* max_entries: least recently hit entries are replaced when full
+*/
+mistral_semantic_cache_t *mistral_semantic_cache_create(
+    const mistral_config_t *embed_config, double threshold,
+    size_t max_entries);
+
+/*
+* Set callback invoked on every hit
+*/
+void mistral_semantic_cache_set_audit(mistral_semantic_cache_t *cache,
+                                      mistral_semantic_audit_cb audit,
+                                      void *user_data);
+
+/*
+* Chat completion through the semantic cache
+* The last user message is embedded and matched against earlier questions
+* sent with the same model, temperature, max_tokens and preceding
+* messages. On a hit the
+* cached answer is returned with cached set to 1, on a miss
+* mistral_chat_completions is called and its answer stored
+*/
+int mistral_semantic_chat_completions(mistral_semantic_cache_t *cache,
+                                      const mistral_config_t *config,
+                                      const mistral_message_t *messages,
+                                      size_t message_count,
+                                      mistral_response_t *response);
+
+/*
+* Read hit rate and latency counters
+*/
+void mistral_semantic_cache_get_stats(mistral_semantic_cache_t *cache,
+                                      mistral_semantic_cache_stats_t *stats);
+
+/*
+* Free semantic cache
+*/
+void mistral_semantic_cache_free(mistral_semantic_cache_t *cache);
+
+typedef struct {
+  double limit;
+  int in_flight;
+  unsigned long increases;
+  unsigned long decreases;
+  double baseline_latency_ms;
+} mistral_adaptive_limiter_stats_t;
+
+/*
+* Create adaptive limiter, attach it to config->limiter
+* Every endpoint starts at initial_limit requests in flight. The limit
+* grows by about one per round of successful requests while latency stays
+* near its baseline and is halved on 429, 5xx or network failure, within
+* [min_limit, max_limit]
+*/
+mistral_adaptive_limiter_t *mistral_adaptive_limiter_create(int initial_limit,
+                                                            int min_limit,
+                                                            int max_limit);
+
+/*
+* Read state of one endpoint, e.g. MISTRAL_BASE_API "/chat/completions"
+* Return 0 if ok, -1 if the endpoint has not been used yet
+*/
+int mistral_adaptive_limiter_get_stats(mistral_adaptive_limiter_t *limiter,
+                                       const char *endpoint,
+                                       mistral_adaptive_limiter_stats_t *stats);
+
+/*
+* Free adaptive limiter, no request may be using it
+*/
+void mistral_adaptive_limiter_free(mistral_adaptive_limiter_t *limiter);
+
+typedef struct {
+  unsigned long requests;
+  unsigned long hedges;
+  unsigned long hedge_wins;
+  double hedge_after_ms;
+} mistral_hedge_stats_t;
+
+/*
+* Create hedge policy, attach it to config->hedge_policy
+* Applies to embeddings and to chat and FIM with temperature 0
+* hedge_after_ms: fixed delay before the duplicate is sent, 0 to learn it
+* percentile: first-byte latency percentile used when learning, e.g. 95
+* budget_percent: max duplicates as a percentage of requests, e.g. 5
+*/
+mistral_hedge_policy_t *mistral_hedge_policy_create(int hedge_after_ms,
+                                                    double percentile,
+                                                    double budget_percent);
+
+/*
+* Read hedge counters, hedge_after_ms is the current delay (0 while still
+* learning)
+*/
+void mistral_hedge_policy_get_stats(mistral_hedge_policy_t *policy,
+                                    mistral_hedge_stats_t *stats);
+
+/*
+* Free hedge policy, no request may be using it
+*/
+void mistral_hedge_policy_free(mistral_hedge_policy_t *policy);
+
+typedef enum {
+  MISTRAL_CIRCUIT_CLOSED = 0,
+  MISTRAL_CIRCUIT_OPEN,
+  MISTRAL_CIRCUIT_HALF_OPEN
+} mistral_circuit_state_t;
+
+/*
+* Create circuit breaker, attach it to config->circuit_breaker
+* Every endpoint and model pair has its own circuit. It opens when the
+* share of failed attempts among the last window_size reaches
+* failure_rate; network errors, 5xx and attempts slower than slow_call_ms
+* (0 to disable) count as failures. After open_ms one probe is let through
+* and its result closes or reopens the circuit. While open, calls fail
+* with MISTRAL_ERR_CIRCUIT_OPEN without network traffic
+*/
+mistral_circuit_breaker_t *mistral_circuit_breaker_create(double failure_rate,
+                                                          int window_size,
+                                                          int open_ms,
+                                                          int slow_call_ms);
+
+/*
+* Current state of one circuit, e.g. for MISTRAL_BASE_API "/chat/completions"
+*/
+mistral_circuit_state_t
+mistral_circuit_breaker_get_state(mistral_circuit_breaker_t *breaker,
+                                  const char *endpoint, const char *model);
+
+/*
+* Free circuit breaker, no request may be using it
+*/
+void mistral_circuit_breaker_free(mistral_circuit_breaker_t *breaker);
+
+/*
+* Create cancel token, set it as config->cancel_token for the calls it
+* should control
+*/
+mistral_cancel_token_t *mistral_cancel_token_create(void);
+
+/*
+* Cancel from any thread. Running transfers are aborted, retry sleeps are
+* interrupted and the calls return MISTRAL_ERR_CANCELLED
+*/
+void mistral_cancel_token_cancel(mistral_cancel_token_t *token);
+
+/*
+* Return 1 if cancelled, 0 otherwise
+*/
+int mistral_cancel_token_is_cancelled(mistral_cancel_token_t *token);
+
+/*
+* Make the token usable again, no call may be using it
+*/
+void mistral_cancel_token_reset(mistral_cancel_token_t *token);
+
+/*
+* Free cancel token, no call may be using it
+*/
+void mistral_cancel_token_free(mistral_cancel_token_t *token);
+
+typedef enum {
+  MISTRAL_BALANCE_P2C = 0,
+  MISTRAL_BALANCE_LEAST_OUTSTANDING
+} mistral_balance_policy_t;
+
+typedef struct {
+  unsigned long requests;
+  unsigned long failures;
+  int outstanding;
+  int healthy;
+  double latency_ms;
+} mistral_backend_stats_t;
+
+/*
+* Create backend pool, attach it to config->backend_pool
+* Every attempt goes to one (base URL, API key) backend instead of
+* MISTRAL_BASE_API and config->api_key. P2C compares two weighted random
+* picks, LEAST_OUTSTANDING scans all; both prefer the fewest requests in
+* flight per unit of weight. A backend answering 401, 403, 429, 5xx or
+* failing the transfer cools down for 1 s, doubling up to 30 s, and
+* retries go to another backend without the backoff sleep. 401 and 403
+* are retried only while another backend is ready
+*/
+mistral_backend_pool_t *
+mistral_backend_pool_create(mistral_balance_policy_t policy);
+
+/*
+* Add backend, base_url like MISTRAL_BASE_API, weight at least 1
+* Return index of the backend, -1 if error
+*/
+int mistral_backend_pool_add(mistral_backend_pool_t *pool,
+                             const char *base_url, const char *api_key,
+                             int weight);
+
+/*
+* Read state of the backend at index
+* Return 0 if ok, -1 if there is no such backend
+*/
+int mistral_backend_pool_get_stats(mistral_backend_pool_t *pool, int index,
+                                   mistral_backend_stats_t *stats);
+
+/*
+* Free backend pool, no request may be using it
+*/
+void mistral_backend_pool_free(mistral_backend_pool_t *pool);
+
+/* Conditions that move a call on to the next model of the chain */
+#define MISTRAL_FALLBACK_ON_RATE_LIMIT 0x01
+#define MISTRAL_FALLBACK_ON_SERVER_ERROR 0x02
+#define MISTRAL_FALLBACK_ON_TIMEOUT 0x04
+#define MISTRAL_FALLBACK_ON_NETWORK 0x08
+#define MISTRAL_FALLBACK_ON_CIRCUIT_OPEN 0x10
+
+/*
+* One model of a fallback chain
+* model: NULL for config->model, only allowed in the first entry
+* max_retries: retries on this model, replaces config->max_retries
+* triggers: MISTRAL_FALLBACK_ON_* flags for giving up on this model
+*/
+typedef struct {
+  const char *model;
+  int max_retries;
+  int triggers;
+} mistral_fallback_model_t;
+
+/*
+* Create fallback policy, attach it to config->fallback_policy
+* Chat and FIM calls try the chain in order: when a model fails with one of
+* its triggers, the same request is resent with only the model replaced.
+* config->deadline_ms spans the whole chain. The chain is copied
+*/
+mistral_fallback_policy_t *
+mistral_fallback_policy_create(const mistral_fallback_model_t *chain,
+                               size_t count);
+
+/*
+* Free fallback policy, no request may be using it
+*/
+void mistral_fallback_policy_free(mistral_fallback_policy_t *policy);
+
+typedef struct {
+  const char *model;
+  double predicted_ms;
+  double estimated_cost;
+  int met_target;
+} mistral_route_decision_t;
+
+typedef struct {
+  unsigned long samples;
+  double latency_ms;
+  double tokens_per_sec;
+  double error_rate;
+  double completion_tokens;
+} mistral_model_route_stats_t;
+
+/*
+* Create model router, attach it to config->model_router
+* Chat and FIM calls then go to the cheapest registered model whose
+* predicted latency meets config->latency_target_ms and whose tier is at
+* least config->min_quality_tier, or to the fastest eligible one if none
+* does. Predictions come from moving averages of latency, tokens per
+* second and error rate fed by every call; models without recent
+* measurements are tried as if they met the target
+*/
+mistral_model_router_t *mistral_model_router_create(void);
+
+/*
+* Register model, price_per_mtok: blended price per million tokens
+* quality_tier: higher is better
+* Return 0 if ok, -1 if error
+*/
+int mistral_model_router_add(mistral_model_router_t *router,
+                             const char *model, double price_per_mtok,
+                             int quality_tier);
+
+/*
+* Decision the router would make now, without sending anything
+* decision->model is owned by the router, predicted_ms is 0 while the
+* model is unmeasured
+* Return 0 if ok, -1 if no model has the tier
+*/
+int mistral_model_router_select(mistral_model_router_t *router,
+                                int latency_target_ms, int min_quality_tier,
+                                int max_tokens,
+                                mistral_route_decision_t *decision);
+
+/*
+* Read estimates of one model
+* Return 0 if ok, -1 if the model is not registered
+*/
+int mistral_model_router_get_stats(mistral_model_router_t *router,
+                                   const char *model,
+                                   mistral_model_route_stats_t *stats);
+
+/*
+* Free model router, no request may be using it
+*/
+void mistral_model_router_free(mistral_model_router_t *router);
+
+/*
+* Chat history that keeps every message JSON-escaped once, so a turn only
+* escapes the new text and the request body is assembled from cached
+* fragments. Not thread safe
+*/
+typedef struct mistral_conversation mistral_conversation_t;
+
+mistral_conversation_t *mistral_conversation_create(void);
+
+/*
+* Append a message, role and content are copied
+* Return 0 if ok, -1 if error
+*/
+int mistral_conversation_append(mistral_conversation_t *conversation,
+                                const char *role, const char *content);
+
+/*
+* Send the whole history as a chat request
+* On success the assistant reply moves into the conversation:
+* response->content is NULL, read the reply with
+* mistral_conversation_get at index mistral_conversation_count() - 1
+* Return 0 if ok, -1 if error
+*/
+int mistral_conversation_chat(const mistral_config_t *config,
+                              mistral_conversation_t *conversation,
+                              mistral_response_t *response);
+
+size_t mistral_conversation_count(const mistral_conversation_t *conversation);
+
+/*
+* Borrow message at index, valid until the conversation is freed
+* Return 0 if ok, -1 if index is out of range
+*/
+int mistral_conversation_get(const mistral_conversation_t *conversation,
+                             size_t index, mistral_message_t *message);
+
+void mistral_conversation_free(mistral_conversation_t *conversation);
+
+/*
+* Tokenizer for Mistral's Tekken vocabularies, used to size prompts and
+* max_tokens before sending
+*/
+typedef struct mistral_tokenizer mistral_tokenizer_t;
+
+/*
+* Load a tekken.json vocabulary file
+* Counts are exact for most Latin, Greek, Cyrillic, Armenian, Hebrew,
+* Arabic, Devanagari, Thai, CJK and Korean text; characters of other
+* scripts are taken as uncased letters, which can differ slightly
+*/
+mistral_tokenizer_t *mistral_tokenizer_load(const char *path);
+
+/*
+* Return number of tokens in text, -1 if error
+*/
+long mistral_count_tokens(const mistral_tokenizer_t *tokenizer,
+                          const char *text);
+
+/*
+* Tokens of a chat prompt under the instruct template: <s>, [INST] [/INST]
+* around user turns, </s> after assistant turns and [SYSTEM_PROMPT] markers
+* when the vocabulary has them
+* Return number of tokens, -1 if error
+*/
+long mistral_count_chat_tokens(const mistral_tokenizer_t *tokenizer,
+                               const mistral_message_t *messages,
+                               size_t message_count);
+
+void mistral_tokenizer_free(mistral_tokenizer_t *tokenizer);
+
+/*
+* How a chat prompt over budget is cut. System messages always stay
+* KEEP_RECENT: keep the newest messages that fit
+* DROP_MIDDLE: also keep the first user message and its reply
+* SUMMARIZE: like KEEP_RECENT, the dropped messages are replaced by one
+* system message from the summarizer
+*/
+typedef enum {
+  MISTRAL_CONTEXT_KEEP_RECENT = 0,
+  MISTRAL_CONTEXT_DROP_MIDDLE,
+  MISTRAL_CONTEXT_SUMMARIZE
+} mistral_context_strategy_t;
+
+/*
+* Summarize messages that are about to be dropped
+* Return a malloc'd summary the library frees (mistral_malloc'd with a
+* custom allocator), NULL to drop them as is
+*/
+typedef char *(*mistral_context_summarizer_t)(const mistral_message_t *messages,
+                                              size_t count, void *user_data);
+
+/*
+* Create context policy, attach it to config->context_policy
+* Chat calls and conversations are trimmed to max_prompt_tokens before the
+* request is built; leave room for max_tokens of reply below the model's
+* context window. max_recent_messages: limit on kept non-system messages,
+* 0 for none. A prompt whose newest message alone does not fit fails with
+* MISTRAL_ERR_INVALID_PARAM without a round trip. Per-message counts are
+* cached, conversations count each message once
+*/
+mistral_context_policy_t *
+mistral_context_policy_create(mistral_context_strategy_t strategy,
+                              long max_prompt_tokens,
+                              size_t max_recent_messages);
+
+/*
+* Count with tokenizer instead of estimating 4 bytes per token
+* Set before the policy is used; the tokenizer must outlive it
+* Return 0 if ok, -1 if error
+*/
+int mistral_context_policy_set_tokenizer(mistral_context_policy_t *policy,
+                                         const mistral_tokenizer_t *tokenizer);
+
+/*
+* Hook for MISTRAL_CONTEXT_SUMMARIZE, may be called from several threads.
+* Conversations keep the summary in place of the dropped messages, plain
+* chat calls ask again whenever they trim
+* Return 0 if ok, -1 if error
+*/
+int mistral_context_policy_set_summarizer(
+    mistral_context_policy_t *policy, mistral_context_summarizer_t summarizer,
+    void *user_data);
+
+/*
+* Free context policy, no request may be using it
+*/
+void mistral_context_policy_free(mistral_context_policy_t *policy);
+
+/*
+* Part of a source buffer around the cursor that fits a FIM prompt budget:
+* prompt is buffer[prefix_start, cursor), suffix is buffer[cursor, suffix_end)
+*/
+typedef struct {
+  size_t prefix_start;
+  size_t suffix_end;
+  long prefix_tokens;
+  long suffix_tokens;
+} mistral_fim_window_t;
+
+/*
+* Choose the FIM window for cursor in buffer[0, length), which need not be
+* NUL-terminated (an mmap'd file works). About three quarters of
+* max_prompt_tokens go before the cursor, a side that runs out of text
+* leaves the rest to the other. Windows grow a line at a time from the
+* cursor and end on a blank line or a line opening a block at column 0
+* when that costs little of the budget. Only the window is scanned, so the
+* cost does not grow with the file
+* tokenizer: exact counts, NULL to estimate 4 bytes per token
+* Return 0 if ok, -1 if error
+*/
+int mistral_fim_select_window(const char *buffer, size_t length, size_t cursor,
+                              long max_prompt_tokens,
+                              const mistral_tokenizer_t *tokenizer,
+                              mistral_fim_window_t *window);
+
+/*
+* FIM completion at cursor in a whole file: the window is escaped into the
+* request straight from buffer, nothing else is copied
+* Return 0 if ok, -1 if error
+*/
+int mistral_fim_completions_window(const mistral_config_t *config,
+                                   const char *buffer, size_t length,
+                                   size_t cursor, long max_prompt_tokens,
+                                   const mistral_tokenizer_t *tokenizer,
+                                   mistral_response_t *response);
+
+/*
+* Completions as an editor types: updates are debounced, outdated requests
+* are cancelled and only the freshest reply is delivered
+*/
+typedef struct mistral_fim_session mistral_fim_session_t;
+
+/*
+* Called on the session's worker thread with a completion for the update
+* at cursor; completion is only valid during the call. Never called for
+* an update older than one mistral_fim_session_update has returned from,
+* which waits for a call in progress, so the callback must not update
+*/
+typedef void (*mistral_fim_session_cb)(const char *completion, size_t cursor,
+                                       void *user_data);
+
+typedef struct {
+  unsigned long updates;
+  unsigned long requests;
+  unsigned long delivered;
+  unsigned long reused;    /* answered from the previous prediction */
+  unsigned long debounced; /* replaced before being sent */
+  unsigned long cancelled; /* outdated while in flight */
+  unsigned long failed;
+} mistral_fim_session_stats_t;
+
+/*
+* Create FIM session with its worker thread
+* config: used for every request, must outlive the session; its
+* cancel_token is replaced by the session's own
+* debounce_ms: quiet time after an update before it is sent
+* max_prompt_tokens, tokenizer: window budget as in mistral_fim_select_window
+*/
+mistral_fim_session_t *
+mistral_fim_session_create(const mistral_config_t *config, int debounce_ms,
+                           long max_prompt_tokens,
+                           const mistral_tokenizer_t *tokenizer,
+                           mistral_fim_session_cb callback, void *user_data);
+
+/*
+* New buffer and cursor, only the window is copied. Cancels the request in
+* flight. If the text since the last delivered completion is a start of
+* that completion, the rest of it is delivered without a request
+* Return 0 if ok, -1 if error
+*/
+int mistral_fim_session_update(mistral_fim_session_t *session,
+                               const char *buffer, size_t length,
+                               size_t cursor);
+
+void mistral_fim_session_get_stats(mistral_fim_session_t *session,
+                                   mistral_fim_session_stats_t *stats);
+
+/*
+* Cancel pending work, stop the worker and free the session; no callback
+* runs after it returns
+*/
+void mistral_fim_session_free(mistral_fim_session_t *session);
+
+/*
+* Token bucket shared between threads
+*/
+typedef struct mistral_rate_limiter mistral_rate_limiter_t;
+
+/*
+* Create rate limiter
+* requests_per_sec: sustained rate
+* burst: max requests allowed at once, at least 1
+*/
+mistral_rate_limiter_t *mistral_rate_limiter_create(double requests_per_sec,
+                                                    int burst);
+
+/*
+* Block until a request may be sent
+*/
+void mistral_rate_limiter_acquire(mistral_rate_limiter_t *limiter);
+
+/*
+* Free rate limiter
+*/
+void mistral_rate_limiter_free(mistral_rate_limiter_t *limiter);
+
+/*
+* One conversation of a batch
+*/
+typedef struct {
+  const mistral_message_t *messages;
+  size_t message_count;
+} mistral_batch_item_t;
+
+/*
+* Called after each batch item is finished, never concurrently
+* completed: qty finished items, total: batch size
+* index: position of the finished item in the input
+*/
+typedef void (*mistral_batch_progress_cb)(size_t completed, size_t total,
+                                          size_t index,
+                                          const mistral_response_t *result,
+                                          void *user_data);
+
+/*
+* Optional batch settings, all fields may be NULL
+*/
+typedef struct {
+  mistral_rate_limiter_t *rate_limiter;
+  mistral_batch_progress_cb on_progress;
+  void *user_data;
+} mistral_batch_options_t;
+
+/* Most batch requests run at the same time, whatever max_in_flight is */
+#define MISTRAL_BATCH_MAX_IN_FLIGHT 256
+
+/*
+* Send many chat requests concurrently
+* conversations: array of count items
+* max_in_flight: max requests running at the same time, capped at
+* MISTRAL_BATCH_MAX_IN_FLIGHT
+* results: array of count responses, filled in input order
+* options: may be NULL
+* Every item is retried and fails on its own, check results[i].error_code.
+* config->deadline_ms spans an item's rate limiter wait and its call.
+* With config->reuse_responses, results from the last batch are reset and
+* keep their memory, as for a single call.
+* Once config->cancel_token is cancelled no further item is started, those
+* left get MISTRAL_ERR_CANCELLED without an on_progress call
+* Return 0 if all items succeeded, -1 otherwise
+*/
+int mistral_chat_completions_batch(const mistral_config_t *config,
+                                   const mistral_batch_item_t *conversations,
+                                   size_t count, int max_in_flight,
+                                   mistral_response_t *results,
+                                   const mistral_batch_options_t *options);
+
 #ifdef __cplusplus
 }
 #endif
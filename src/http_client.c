@@ -1,9 +1,32 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "http_client.h"
+#include "http_gzip.h"
+#include "mistral_alloc.h"
 #include <curl/curl.h>
 #include <curl/easy.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define DEFAULT_CONNECT_TIMEOUT_MS 10000L
+#define DEFAULT_TIMEOUT_MS 60000L
+#define MIN_RECEIVE_CAPACITY 16384
+#define DEFAULT_BUFFER_RETENTION (1024 * 1024)
+/* a larger Content-Length is trusted only as the body arrives */
+#define MAX_LENGTH_HINT (256 * 1024 * 1024)
+
+/*
+* Each thread keeps its last receive buffer for the next request or
+* retry. A spare buffer stores its own capacity in its first bytes
+*/
+static pthread_once_t spare_once = PTHREAD_ONCE_INIT;
+static pthread_key_t spare_key;
+static int spare_key_ok = 0;
+static size_t buffer_retention = DEFAULT_BUFFER_RETENTION;
 
 static int is_valid_url(const char *url) {
   if (url == NULL || strlen(url) == 0)
@@ -11,19 +34,108 @@ static int is_valid_url(const char *url) {
   return strncmp(url, "http://", 7) == 0 || strncmp(url, "https://", 8) == 0;
 }
 
+static void make_spare_key(void) {
+  spare_key_ok = pthread_key_create(&spare_key, mem_free) == 0;
+}
+
+static char *take_spare(size_t *capacity) {
+  char *data = NULL;
+
+  pthread_once(&spare_once, make_spare_key);
+  if (!spare_key_ok) {
+    return NULL;
+  }
+
+  data = (char *)pthread_getspecific(spare_key);
+  if (data != NULL) {
+    memcpy(capacity, data, sizeof(size_t));
+    pthread_setspecific(spare_key, NULL);
+  }
+  return data;
+}
+
+static void keep_spare(char *data, size_t capacity) {
+  char *old = NULL;
+
+  if (data == NULL) {
+    return;
+  }
+
+  pthread_once(&spare_once, make_spare_key);
+  if (!spare_key_ok || capacity > buffer_retention ||
+      capacity < sizeof(size_t)) {
+    mem_free(data);
+    return;
+  }
+
+  /* one per thread, the larger one is the more useful */
+  old = (char *)pthread_getspecific(spare_key);
+  if (old != NULL) {
+    size_t old_capacity = 0;
+    memcpy(&old_capacity, old, sizeof(size_t));
+    if (old_capacity >= capacity) {
+      mem_free(data);
+      return;
+    }
+    mem_free(old);
+  }
+  memcpy(data, &capacity, sizeof(size_t));
+  pthread_setspecific(spare_key, data);
+}
+
+/*
+* Room for needed bytes: the thread's spare buffer first, then doubling
+* Return 0 if ok, -1 if out of memory
+*/
+static int reserve_receive(http_response_t *response, size_t needed) {
+  size_t capacity = response->capacity;
+  char *data = NULL;
+
+  if (needed <= capacity) {
+    return 0;
+  }
+
+  if (response->data == NULL) {
+    response->data = take_spare(&response->capacity);
+    if (response->data != NULL && needed <= response->capacity) {
+      return 0;
+    }
+    capacity = response->capacity;
+  }
+
+  capacity = capacity < MIN_RECEIVE_CAPACITY ? MIN_RECEIVE_CAPACITY
+                                             : capacity * 2;
+  if (capacity < needed) {
+    capacity = needed;
+  }
+
+  /* nothing received yet, so nothing worth copying */
+  if (response->size == 0) {
+    mem_free(response->data);
+    response->data = NULL;
+    response->capacity = 0;
+    data = (char *)mem_malloc(capacity);
+  } else {
+    data = (char *)mem_realloc(response->data, capacity);
+  }
+  if (data == NULL) {
+    return -1;
+  }
+  response->data = data;
+  response->capacity = capacity;
+  return 0;
+}
+
 static size_t write_callback(void *ptr, size_t size, size_t nmemb,
                              void *userdata) {
   size_t total_size = size * nmemb;
   http_response_t *response = (http_response_t *)userdata;
 
-  char *new_data = realloc(response->data, response->size + total_size + 1);
-  if (new_data == NULL) {
+  if (reserve_receive(response, response->size + total_size + 1) != 0) {
     fprintf(stderr, "failed to allocate memory in cb\n");
     return 0;
   }
 
-  response->data = new_data;
-
   memcpy(&(response->data[response->size]), ptr, total_size);
   response->size += total_size;
   response->data[response->size] = '\0';
@@ -31,8 +143,55 @@ static size_t write_callback(void *ptr, size_t size, size_t nmemb,
   return total_size;
 }
 
+/*
+* Size the buffer once from Content-Length instead of growing it
+*/
+static size_t header_callback(char *buffer, size_t size, size_t nitems,
+                              void *userdata) {
+  static const char name[] = "content-length:";
+  size_t total_size = size * nitems;
+  size_t length = 0;
+  size_t i = sizeof(name) - 1;
+  http_response_t *response = (http_response_t *)userdata;
+
+  if (total_size <= i || strncasecmp(buffer, name, i) != 0) {
+    return total_size;
+  }
+
+  while (i < total_size && buffer[i] == ' ') {
+    i++;
+  }
+  for (; i < total_size && buffer[i] >= '0' && buffer[i] <= '9'; i++) {
+    length = length * 10 + (size_t)(buffer[i] - '0');
+    if (length > MAX_LENGTH_HINT) {
+      return total_size;
+    }
+  }
+
+  /* a failed hint is not an error, the body still grows as it comes */
+  reserve_receive(response, response->size + length + 1);
+  return total_size;
+}
+
+/*
+* Hand the buffer to the thread's spare slot
+*/
+static void release_receive(http_response_t *response) {
+  keep_spare(response->data, response->capacity);
+  response->data = NULL;
+  response->size = 0;
+  response->capacity = 0;
+}
+
 int http_client_init(void) {
-  CURLcode res = curl_global_init(CURL_GLOBAL_DEFAULT);
+  CURLcode res;
+
+  if (mem_hooked()) {
+    res = curl_global_init_mem(CURL_GLOBAL_DEFAULT, mem_malloc, mem_free,
+                               mem_realloc, mem_strdup, mem_calloc);
+  } else {
+    res = curl_global_init(CURL_GLOBAL_DEFAULT);
+  }
   if (res != CURLE_OK) {
     fprintf(stderr, "curl global init failed: %s\n", curl_easy_strerror(res));
     return -1;
@@ -40,39 +199,68 @@ int http_client_init(void) {
   return 0;
 }
 
-void http_client_cleanup(void) { curl_global_cleanup(); }
+void http_client_cleanup(void) {
+  size_t capacity = 0;
 
-int http_post(const char *url, const char **headers, const char *body,
-              http_response_t *response) {
-  if (!is_valid_url(url)) {
-    fprintf(stderr, "incorrect URL\n");
+  mem_free(take_spare(&capacity));
+  curl_global_cleanup();
+}
+
+static size_t read_callback(char *buffer, size_t size, size_t nitems,
+                            void *userdata) {
+  const http_body_stream_t *stream = (const http_body_stream_t *)userdata;
+  long n = stream->read(buffer, size * nitems, stream->source);
+
+  return n < 0 ? CURL_READFUNC_ABORT : (size_t)n;
+}
+
+static int seek_callback(void *userdata, curl_off_t offset, int origin) {
+  const http_body_stream_t *stream = (const http_body_stream_t *)userdata;
+
+  if (offset != 0 || origin != SEEK_SET ||
+      stream->rewind(stream->source) != 0) {
+    return CURL_SEEKFUNC_CANTSEEK;
   }
+  return CURL_SEEKFUNC_OK;
+}
 
+/*
+* body: whole request body, or NULL to read it from stream
+*/
+static CURL *create_post_handle(const char *url,
+                                struct curl_slist *header_list,
+                                const char *body,
+                                const http_body_stream_t *stream,
+                                const http_request_options_t *options,
+                                http_response_t *response) {
   CURL *curl = NULL;
   CURLcode res;
-  struct curl_slist *header_list = NULL;
-  int ret = -1;
+  long connect_timeout_ms = DEFAULT_CONNECT_TIMEOUT_MS;
+  long timeout_ms = DEFAULT_TIMEOUT_MS;
 
-  response->data = NULL;
-  response->size = 0;
-  response->http_code = 0;
+  if (options != NULL && options->connect_timeout_ms > 0) {
+    connect_timeout_ms = options->connect_timeout_ms;
+  }
+  if (options != NULL && options->timeout_ms > 0) {
+    timeout_ms = options->timeout_ms;
+  }
 
   curl = curl_easy_init();
   if (curl == NULL) {
     fprintf(stderr, "curl_easy_init failed\n");
-    return -1;
+    return NULL;
   }
 
   res = curl_easy_setopt(curl, CURLOPT_URL, url);
   if (res != CURLE_OK) {
     fprintf(stderr, "CURLOPT_URL failed: %s\n", curl_easy_strerror(res));
-    goto cleanup;
+    goto error;
   }
 
   res = curl_easy_setopt(curl, CURLOPT_POST, 1L);
   if (res != CURLE_OK) {
     fprintf(stderr, "CURLOPT_POST failed: %s\n", curl_easy_strerror(res));
-    goto cleanup;
+    goto error;
   }
 
   if (body != NULL) {
@@ -80,37 +268,327 @@ int http_post(const char *url, const char **headers, const char *body,
     if (res != CURLE_OK) {
       fprintf(stderr, "CURLOPT_POSTFIELDS failed: %s\n",
               curl_easy_strerror(res));
-      goto cleanup;
+      goto error;
     }
   }
 
-  if (headers != NULL) {
-    int i = 0;
-    while (headers[i] != NULL) {
-      header_list = curl_slist_append(header_list, headers[i]);
-      i++;
+  if (stream != NULL) {
+    res = curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_callback);
+    if (res != CURLE_OK) {
+      fprintf(stderr, "CURLOPT_READFUNCTION failed: %s\n",
+              curl_easy_strerror(res));
+      goto error;
     }
+    curl_easy_setopt(curl, CURLOPT_READDATA, (void *)stream);
+    curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, seek_callback);
+    curl_easy_setopt(curl, CURLOPT_SEEKDATA, (void *)stream);
+  }
+
+  if (header_list != NULL) {
     res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, header_list);
     if (res != CURLE_OK) {
       fprintf(stderr, "CURLOPT_HTTPHEADER failed: %s\n",
               curl_easy_strerror(res));
-      goto cleanup;
+      goto error;
     }
   }
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
   curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, response);
 
+  /* every encoding curl was built with, decoded as the body arrives */
+  curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
   curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
-  curl_easy_setopt(curl, CURLOPT_TIMEOUT, 60L);
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, connect_timeout_ms);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout_ms);
+
+  return curl;
+
+error:
+  curl_easy_cleanup(curl);
+  return NULL;
+}
+
+static void read_transfer_info(CURL *curl, http_response_t *response) {
+  curl_off_t ttfb_us = 0;
+  curl_off_t bytes = 0;
+
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response->http_code);
+  if (curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &bytes) == CURLE_OK) {
+    response->wire_sent_bytes = (size_t)bytes;
+  }
+  if (curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes) == CURLE_OK) {
+    response->wire_received_bytes = (size_t)bytes;
+  }
+  if (curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &ttfb_us) ==
+      CURLE_OK) {
+    response->ttfb_ms = (double)ttfb_us / 1000.0;
+  }
+}
+
+static int transfer_cancelled(const http_request_options_t *options) {
+  return options->is_cancelled != NULL &&
+         options->is_cancelled(options->cancel_data);
+}
+
+static long elapsed_ms_since(const struct timespec *started) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - started->tv_sec) * 1000L +
+         (now.tv_nsec - started->tv_nsec) / 1000000L;
+}
+
+/*
+* Milliseconds until the first-byte or idle limit runs out, 0 once it has,
+* -1 if neither applies
+*/
+static long stall_budget_ms(const http_request_options_t *options,
+                            size_t received, long elapsed_ms,
+                            long last_progress_ms) {
+  if (received == 0 && options->first_byte_timeout_ms > 0) {
+    long left = options->first_byte_timeout_ms - elapsed_ms;
+    return left > 0 ? left : 0;
+  }
+  if (received > 0 && options->idle_timeout_ms > 0) {
+    long left = options->idle_timeout_ms - (elapsed_ms - last_progress_ms);
+    return left > 0 ? left : 0;
+  }
+  return -1;
+}
+
+/*
+* Run the transfer on a multi handle so it can be interrupted through
+* cancel_fd or by the first-byte and idle limits. With hedge_after_ms set,
+* a duplicate is started on its own connection if the primary has not
+* delivered a body byte by then; the first transfer to complete wins and
+* the other one is aborted.
+*/
+static int perform_multi(const char *url, struct curl_slist *header_list,
+                         const char *body, const http_body_stream_t *stream,
+                         const http_request_options_t *options,
+                         http_response_t *response) {
+  CURLM *multi = NULL;
+  CURL *handles[2] = {NULL, NULL};
+  http_response_t results[2];
+  struct curl_waitfd cancel_wait;
+  int done[2] = {0, 0};
+  int active = 0;
+  int winner = -1;
+  int running = 0;
+  int i;
+  struct timespec started;
+  long elapsed_ms = 0;
+  long last_progress_ms = 0;
+  size_t received = 0;
+  int ret = -1;
+
+  memset(results, 0, sizeof(results));
+  memset(&cancel_wait, 0, sizeof(cancel_wait));
+  cancel_wait.fd = options->cancel_fd;
+  cancel_wait.events = CURL_WAIT_POLLIN;
+
+  multi = curl_multi_init();
+  if (multi == NULL) {
+    fprintf(stderr, "curl_multi_init failed\n");
+    return -1;
+  }
+
+  handles[0] = create_post_handle(url, header_list, body, stream, options,
+                                  &results[0]);
+  if (handles[0] == NULL) {
+    goto cleanup;
+  }
+  curl_multi_add_handle(multi, handles[0]);
+  active = 1;
+
+  clock_gettime(CLOCK_MONOTONIC, &started);
+
+  while (winner < 0) {
+    CURLMsg *msg = NULL;
+    int queued = 0;
+    long wait_ms = 1000;
+    long stall_ms = 0;
+
+    if (transfer_cancelled(options)) {
+      goto cleanup;
+    }
+
+    if (curl_multi_perform(multi, &running) != CURLM_OK) {
+      fprintf(stderr, "curl_multi_perform failed\n");
+      goto cleanup;
+    }
+
+    while ((msg = curl_multi_info_read(multi, &queued)) != NULL) {
+      if (msg->msg != CURLMSG_DONE) {
+        continue;
+      }
+      for (i = 0; i < active; i++) {
+        if (msg->easy_handle != handles[i] || done[i]) {
+          continue;
+        }
+        done[i] = 1;
+        if (msg->data.result == CURLE_OK) {
+          if (winner < 0) {
+            winner = i;
+          }
+        } else {
+          fprintf(stderr, "curl perform failed: %s\n",
+                  curl_easy_strerror(msg->data.result));
+          if (msg->data.result == CURLE_OPERATION_TIMEDOUT) {
+            response->timed_out = 1;
+          }
+        }
+      }
+    }
+
+    if (winner >= 0) {
+      break;
+    }
+
+    if (done[0] && (active == 1 || done[1])) {
+      goto cleanup;
+    }
+
+    elapsed_ms = elapsed_ms_since(&started);
+    if (results[0].size + results[1].size != received) {
+      received = results[0].size + results[1].size;
+      last_progress_ms = elapsed_ms;
+    }
+
+    stall_ms = stall_budget_ms(options, received, elapsed_ms, last_progress_ms);
+    if (stall_ms == 0) {
+      fprintf(stderr, "curl perform failed: %s timeout\n",
+              received == 0 ? "first byte" : "idle");
+      response->timed_out = 1;
+      goto cleanup;
+    }
+    if (stall_ms > 0 && stall_ms < wait_ms) {
+      wait_ms = stall_ms;
+    }
+
+    if (active == 1 && options->hedge_after_ms > 0 && stream == NULL) {
+      if (elapsed_ms >= options->hedge_after_ms && results[0].size == 0) {
+        handles[1] = create_post_handle(url, header_list, body, NULL,
+                                        options, &results[1]);
+        if (handles[1] != NULL) {
+          curl_multi_add_handle(multi, handles[1]);
+          active = 2;
+          response->hedged = 1;
+          continue;
+        }
+      } else if (elapsed_ms < options->hedge_after_ms &&
+                 options->hedge_after_ms - elapsed_ms < wait_ms) {
+        wait_ms = options->hedge_after_ms - elapsed_ms;
+      }
+    }
+
+    if (curl_multi_poll(multi, options->is_cancelled != NULL ? &cancel_wait
+                                                            : NULL,
+                        options->is_cancelled != NULL ? 1 : 0, (int)wait_ms,
+                        NULL) != CURLM_OK) {
+      fprintf(stderr, "curl_multi_poll failed\n");
+      goto cleanup;
+    }
+  }
+
+  response->data = results[winner].data;
+  response->size = results[winner].size;
+  response->capacity = results[winner].capacity;
+  results[winner].data = NULL;
+  read_transfer_info(handles[winner], response);
+  response->hedge_won = winner == 1;
+  ret = 0;
+
+cleanup:
+  for (i = 0; i < 2; i++) {
+    if (handles[i] != NULL) {
+      curl_multi_remove_handle(multi, handles[i]);
+      curl_easy_cleanup(handles[i]);
+    }
+    release_receive(&results[i]);
+  }
+  curl_multi_cleanup(multi);
+  return ret;
+}
+
+int http_post(const char *url, const char **headers, const char *body,
+              http_response_t *response) {
+  return http_post_ex(url, headers, body, NULL, response);
+}
+
+static int post(const char *url, const char **headers, const char *body,
+                const http_body_stream_t *stream,
+                const http_request_options_t *options,
+                http_response_t *response) {
+  if (!is_valid_url(url)) {
+    fprintf(stderr, "incorrect URL\n");
+  }
+
+  CURL *curl = NULL;
+  CURLcode res;
+  struct curl_slist *header_list = NULL;
+  http_body_stream_t compressed;
+  gzip_body_t gz;
+  int gzip = options != NULL && options->gzip_body;
+  int ret = -1;
+
+  response->data = NULL;
+  response->size = 0;
+  response->capacity = 0;
+  response->sent_bytes = 0;
+  response->wire_sent_bytes = 0;
+  response->wire_received_bytes = 0;
+  response->http_code = 0;
+  response->ttfb_ms = 0.0;
+  response->hedged = 0;
+  response->hedge_won = 0;
+  response->timed_out = 0;
+  response->coalesced = 0;
+
+  if (headers != NULL) {
+    int i = 0;
+    while (headers[i] != NULL) {
+      header_list = curl_slist_append(header_list, headers[i]);
+      i++;
+    }
+  }
+  if (gzip) {
+    if (gzip_begin(&gz, body, stream, &compressed) != 0) {
+      fprintf(stderr, "failed to start request compression\n");
+      curl_slist_free_all(header_list);
+      return -1;
+    }
+    header_list = curl_slist_append(header_list, "Content-Encoding: gzip");
+    body = NULL;
+    stream = &compressed;
+  }
+  /* the body starts right away instead of after a 100 Continue */
+  if (stream != NULL) {
+    header_list = curl_slist_append(header_list, "Expect:");
+  }
+
+  if (options != NULL &&
+      (options->hedge_after_ms > 0 || options->is_cancelled != NULL ||
+       options->first_byte_timeout_ms > 0 || options->idle_timeout_ms > 0)) {
+    ret = perform_multi(url, header_list, body, stream, options, response);
+    goto cleanup;
+  }
+
+  curl = create_post_handle(url, header_list, body, stream, options, response);
+  if (curl == NULL) {
+    goto cleanup;
+  }
 
   res = curl_easy_perform(curl);
   if (res != CURLE_OK) {
     fprintf(stderr, "curl perform failed: %s\n", curl_easy_strerror(res));
+    response->timed_out = res == CURLE_OPERATION_TIMEDOUT;
     goto cleanup;
   }
 
-  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response->http_code);
+  read_transfer_info(curl, response);
 
   ret = 0;
 
@@ -121,21 +599,51 @@ cleanup:
   if (curl != NULL) {
     curl_easy_cleanup(curl);
   }
+  response->sent_bytes = gzip ? gz.raw_bytes : response->wire_sent_bytes;
+  if (gzip) {
+    gzip_end(&gz);
+  }
 
-  if (ret != 0 && response->data != NULL) {
-    free(response->data);
-    response->data = NULL;
-    response->size = 0;
+  if (ret != 0) {
+    release_receive(response);
   }
 
   return ret;
 }
 
+int http_post_ex(const char *url, const char **headers, const char *body,
+                 const http_request_options_t *options,
+                 http_response_t *response) {
+  return post(url, headers, body, NULL, options, response);
+}
+
+int http_post_stream(const char *url, const char **headers,
+                     const http_body_stream_t *body,
+                     const http_request_options_t *options,
+                     http_response_t *response) {
+  if (body->rewind(body->source) != 0) {
+    fprintf(stderr, "failed to rewind request body\n");
+    return -1;
+  }
+  return post(url, headers, NULL, body, options, response);
+}
+
 void http_response_free(http_response_t *response) {
   if (response != NULL && response->data != NULL) {
-    free(response->data);
-    response->data = NULL;
-    response->size = 0;
+    release_receive(response);
     response->http_code = 0;
+    response->ttfb_ms = 0.0;
+    response->hedged = 0;
+    response->hedge_won = 0;
+    response->timed_out = 0;
+    response->coalesced = 0;
   }
 }
+
+void http_recycle_buffer(char *data, size_t capacity) {
+  keep_spare(data, capacity);
+}
+
+void http_set_buffer_retention(size_t max_bytes) {
+  buffer_retention = max_bytes;
+}
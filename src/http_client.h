@@ -7,12 +7,63 @@
 extern "C" {
 #endif
 
+/*
+* data holds size bytes plus a NUL in capacity bytes, decoded if the
+* server compressed it
+* sent_bytes: request body before compression; wire_sent_bytes and
+* wire_received_bytes: bodies as they went over the connection
+* coalesced: set by the coalescer when this caller sent nothing itself
+* and got a copy of another request's outcome
+*/
 typedef struct {
   char *data;
   size_t size;
+  size_t capacity;
+  size_t sent_bytes;
+  size_t wire_sent_bytes;
+  size_t wire_received_bytes;
   long http_code;
+  double ttfb_ms;
+  int hedged;
+  int hedge_won;
+  int timed_out;
+  int coalesced;
 } http_response_t;
 
+/*
+* Per-request transfer options, zero means default
+* hedge_after_ms: send a duplicate if no body byte arrived by then
+* is_cancelled: optional, polled during the transfer, nonzero aborts it
+* cancel_fd: becomes readable on cancellation, used with is_cancelled
+* connect_timeout_ms, timeout_ms: connection and whole-transfer limits,
+* 10 s and 60 s by default
+* first_byte_timeout_ms: abort if no body byte arrived by then, 0 is off
+* idle_timeout_ms: abort if the body stalls for that long, 0 is off
+* gzip_body: send the body gzip-compressed as it is read, never hedged
+*/
+typedef struct {
+  int hedge_after_ms;
+  int connect_timeout_ms;
+  int timeout_ms;
+  int first_byte_timeout_ms;
+  int idle_timeout_ms;
+  int (*is_cancelled)(void *cancel_data);
+  void *cancel_data;
+  int cancel_fd;
+  int gzip_body;
+} http_request_options_t;
+
+/*
+* Request body produced while it is sent. read fills up to size bytes of
+* buffer and returns how many, 0 at the end, -1 to abort; rewind starts
+* over for a redirect, 0 if ok
+*/
+typedef struct {
+  long (*read)(char *buffer, size_t size, void *source);
+  int (*rewind)(void *source);
+  void *source;
+} http_body_stream_t;
+
 /*
 * Global libcurl init client. Call once.
 */
@@ -29,10 +80,42 @@ void http_client_cleanup(void);
 int http_post(const char *url, const char **headers, const char *body, http_response_t *response);
 
 /*
-* libcurl free
+* http_post with transfer options, options may be NULL
+* Return 0 if ok, -1 if error, response->timed_out tells a timeout apart
+*/
+int http_post_ex(const char *url, const char **headers, const char *body,
+                 const http_request_options_t *options,
+                 http_response_t *response);
+
+/*
+* http_post_ex with a body read from body while the request is sent, in
+* chunked encoding. The body is rewound first, so a retry can pass it
+* again. Not hedged: a stream feeds one transfer at a time
+* Return 0 if ok, -1 if error
+*/
+int http_post_stream(const char *url, const char **headers,
+                     const http_body_stream_t *body,
+                     const http_request_options_t *options,
+                     http_response_t *response);
+
+/*
+* libcurl free. The buffer is kept for the next request on this thread
+* if it is within the retention cap
 */
 void http_response_free(http_response_t *response);
 
+/*
+* Free a receive buffer taken from an http_response_t, keeping it for the
+* next request on this thread like http_response_free would
+*/
+void http_recycle_buffer(char *data, size_t capacity);
+
+/*
+* Receive buffer bytes each thread keeps between requests, 0 frees them
+* right away
+*/
+void http_set_buffer_retention(size_t max_bytes);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,116 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "http_gzip.h"
+#include "mistral_alloc.h"
+#include <stdio.h>
+#include <string.h>
+
+/* upload time matters more than the last few percent of ratio */
+#define GZIP_LEVEL Z_BEST_SPEED
+#define GZIP_INPUT_CHUNK 16384
+
+static voidpf gzip_alloc(voidpf opaque, uInt items, uInt size) {
+  (void)opaque;
+  return mem_calloc(items, size);
+}
+
+static void gzip_free(voidpf opaque, voidpf address) {
+  (void)opaque;
+  mem_free(address);
+}
+
+/*
+* Feed the next piece of input to the deflater
+* Return 0 if ok, -1 if the source failed
+*/
+static int gzip_fill(gzip_body_t *gz) {
+  long n = 0;
+
+  if (gz->source == NULL) {
+    size_t rest = gz->body_len - gz->body_pos;
+    /* avail_in is 32 bits, a larger body goes in several pieces */
+    n = rest > (1UL << 30) ? (long)(1UL << 30) : (long)rest;
+    gz->z.next_in = (Bytef *)(gz->body + gz->body_pos);
+    gz->body_pos += (size_t)n;
+    gz->input_done = gz->body_pos == gz->body_len;
+  } else {
+    n = gz->source->read(gz->input, GZIP_INPUT_CHUNK, gz->source->source);
+    if (n < 0) {
+      return -1;
+    }
+    gz->z.next_in = (Bytef *)gz->input;
+    gz->input_done = n == 0;
+  }
+  gz->z.avail_in = (uInt)n;
+  gz->raw_bytes += (size_t)n;
+  return 0;
+}
+
+static long gzip_read(char *buffer, size_t size, void *source) {
+  gzip_body_t *gz = (gzip_body_t *)source;
+  int ret = Z_OK;
+
+  gz->z.next_out = (Bytef *)buffer;
+  gz->z.avail_out = (uInt)size;
+  while (gz->z.avail_out > 0 && !gz->finished) {
+    if (gz->z.avail_in == 0 && !gz->input_done && gzip_fill(gz) != 0) {
+      return -1;
+    }
+    ret = deflate(&gz->z, gz->input_done ? Z_FINISH : Z_NO_FLUSH);
+    if (ret == Z_STREAM_END) {
+      gz->finished = 1;
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      fprintf(stderr, "deflate failed: %d\n", ret);
+      return -1;
+    }
+  }
+  return (long)(size - gz->z.avail_out);
+}
+
+static int gzip_rewind(void *source) {
+  gzip_body_t *gz = (gzip_body_t *)source;
+
+  if (gz->source != NULL && gz->source->rewind(gz->source->source) != 0) {
+    return -1;
+  }
+  gz->body_pos = 0;
+  gz->input_done = 0;
+  gz->finished = 0;
+  gz->raw_bytes = 0;
+  gz->z.avail_in = 0;
+  return deflateReset(&gz->z) == Z_OK ? 0 : -1;
+}
+
+int gzip_begin(gzip_body_t *gz, const char *body,
+               const http_body_stream_t *source, http_body_stream_t *stream) {
+  memset(gz, 0, sizeof(gzip_body_t));
+  gz->body = body;
+  gz->body_len = body != NULL ? strlen(body) : 0;
+  gz->source = body != NULL ? NULL : source;
+  gz->z.zalloc = gzip_alloc;
+  gz->z.zfree = gzip_free;
+
+  if (gz->source != NULL) {
+    gz->input = (char *)mem_malloc(GZIP_INPUT_CHUNK);
+    if (gz->input == NULL) {
+      return -1;
+    }
+  }
+  /* 16 + 15 window bits: gzip framing rather than raw zlib */
+  if (deflateInit2(&gz->z, GZIP_LEVEL, Z_DEFLATED, 16 + 15, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    mem_free(gz->input);
+    gz->input = NULL;
+    return -1;
+  }
+
+  stream->read = gzip_read;
+  stream->rewind = gzip_rewind;
+  stream->source = gz;
+  return 0;
+}
+
+void gzip_end(gzip_body_t *gz) {
+  deflateEnd(&gz->z);
+  mem_free(gz->input);
+}
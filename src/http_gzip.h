@@ -0,0 +1,42 @@
+#ifndef HTTP_GZIP_H
+#define HTTP_GZIP_H
+
+#include "http_client.h"
+#include <stddef.h>
+#include <zlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* Request body deflated while curl reads it, from a string or a stream
+* raw_bytes: input taken so far, the whole body once finished
+*/
+typedef struct {
+  z_stream z;
+  const char *body;
+  size_t body_len;
+  size_t body_pos;
+  const http_body_stream_t *source;
+  char *input;
+  int input_done;
+  int finished;
+  size_t raw_bytes;
+} gzip_body_t;
+
+/*
+* Compress body, or source when body is NULL. stream then reads the gzip
+* data and rewinds to its start
+* Return 0 if ok, -1 if out of memory
+*/
+int gzip_begin(gzip_body_t *gz, const char *body,
+               const http_body_stream_t *source, http_body_stream_t *stream);
+
+void gzip_end(gzip_body_t *gz);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HTTP_GZIP_H */
@@ -0,0 +1,357 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "json_view.h"
+#include <string.h>
+
+/* same bound as cJSON */
+#define MAX_DEPTH 1000
+
+static const char *skip_ws(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+    p++;
+  }
+  return p;
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+static long read_hex4(const char *p) {
+  long value = 0;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    int digit = hex_value(p[i]);
+    if (digit < 0) {
+      return -1;
+    }
+    value = value * 16 + digit;
+  }
+  return value;
+}
+
+/* p at the opening quote */
+static const char *skip_string(const char *p, const char *end) {
+  for (p++; p < end; p++) {
+    if (*p == '"') {
+      return p + 1;
+    }
+    if (*p == '\\') {
+      p++;
+      if (p >= end) {
+        return NULL;
+      }
+      if (*p == 'u') {
+        if (end - p < 5 || read_hex4(p + 1) < 0) {
+          return NULL;
+        }
+        p += 4;
+      } else if (strchr("\"\\/bfnrt", *p) == NULL || *p == '\0') {
+        return NULL;
+      }
+    }
+  }
+  return NULL;
+}
+
+static const char *skip_number(const char *p, const char *end) {
+  const char *start = NULL;
+
+  if (p < end && *p == '-') {
+    p++;
+  }
+  start = p;
+  while (p < end && *p >= '0' && *p <= '9') {
+    p++;
+  }
+  if (p == start) {
+    return NULL;
+  }
+  if (p < end && *p == '.') {
+    start = ++p;
+    while (p < end && *p >= '0' && *p <= '9') {
+      p++;
+    }
+    if (p == start) {
+      return NULL;
+    }
+  }
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    p++;
+    if (p < end && (*p == '+' || *p == '-')) {
+      p++;
+    }
+    start = p;
+    while (p < end && *p >= '0' && *p <= '9') {
+      p++;
+    }
+    if (p == start) {
+      return NULL;
+    }
+  }
+  return p;
+}
+
+static const char *skip_literal(const char *p, const char *end,
+                                const char *literal) {
+  size_t len = strlen(literal);
+
+  if ((size_t)(end - p) < len || memcmp(p, literal, len) != 0) {
+    return NULL;
+  }
+  return p + len;
+}
+
+static const char *skip_value(const char *p, const char *end, int depth) {
+  char close = 0;
+
+  p = skip_ws(p, end);
+  if (p >= end) {
+    return NULL;
+  }
+
+  switch (*p) {
+  case '"':
+    return skip_string(p, end);
+  case 't':
+    return skip_literal(p, end, "true");
+  case 'f':
+    return skip_literal(p, end, "false");
+  case 'n':
+    return skip_literal(p, end, "null");
+  case '{':
+  case '[':
+    break;
+  default:
+    return skip_number(p, end);
+  }
+
+  if (depth >= MAX_DEPTH) {
+    return NULL;
+  }
+  close = *p == '{' ? '}' : ']';
+  p = skip_ws(p + 1, end);
+  if (p < end && *p == close) {
+    return p + 1;
+  }
+
+  for (;;) {
+    if (close == '}') {
+      p = skip_ws(p, end);
+      if (p >= end || *p != '"') {
+        return NULL;
+      }
+      p = skip_ws(skip_string(p, end), end);
+      if (p == NULL || p >= end || *p != ':') {
+        return NULL;
+      }
+      p++;
+    }
+    p = skip_value(p, end, depth + 1);
+    if (p == NULL) {
+      return NULL;
+    }
+    p = skip_ws(p, end);
+    if (p >= end) {
+      return NULL;
+    }
+    if (*p == close) {
+      return p + 1;
+    }
+    if (*p != ',') {
+      return NULL;
+    }
+    p++;
+  }
+}
+
+const char *json_view_skip(const char *p, const char *end) {
+  return skip_value(p, end, 0);
+}
+
+const char *json_view_member(const char *p, const char *end, const char *key) {
+  size_t key_len = strlen(key);
+
+  if (p == NULL) {
+    return NULL;
+  }
+  p = skip_ws(p, end);
+  if (p >= end || *p != '{') {
+    return NULL;
+  }
+  p = skip_ws(p + 1, end);
+
+  while (p < end && *p == '"') {
+    const char *name = p + 1;
+    const char *after = skip_string(p, end);
+    /* keys with escapes never match, the ones looked up have none */
+    int match = (size_t)(after - 1 - name) == key_len &&
+                memcmp(name, key, key_len) == 0;
+
+    p = skip_ws(skip_ws(after, end) + 1, end);
+    if (match) {
+      return p;
+    }
+    p = skip_ws(skip_value(p, end, 0), end);
+    if (p >= end || *p != ',') {
+      return NULL;
+    }
+    p = skip_ws(p + 1, end);
+  }
+  return NULL;
+}
+
+int json_view_members(const char *p, const char *end, const char **keys,
+                      const char **values, size_t count) {
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    values[i] = NULL;
+  }
+
+  p = skip_ws(p, end);
+  if (p >= end || *p != '{') {
+    return -1;
+  }
+  p = skip_ws(p + 1, end);
+  if (p < end && *p == '}') {
+    return 0;
+  }
+
+  for (;;) {
+    const char *name = p + 1;
+    const char *after = NULL;
+    const char *value = NULL;
+
+    if (p >= end || *p != '"') {
+      return -1;
+    }
+    after = skip_string(p, end);
+    p = skip_ws(after, end);
+    if (after == NULL || p >= end || *p != ':') {
+      return -1;
+    }
+    value = skip_ws(p + 1, end);
+    p = skip_value(value, end, 1);
+    if (p == NULL) {
+      return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+      if ((size_t)(after - 1 - name) == strlen(keys[i]) &&
+          memcmp(name, keys[i], (size_t)(after - 1 - name)) == 0) {
+        values[i] = value;
+      }
+    }
+
+    p = skip_ws(p, end);
+    if (p < end && *p == '}') {
+      return 0;
+    }
+    if (p >= end || *p != ',') {
+      return -1;
+    }
+    p = skip_ws(p + 1, end);
+  }
+}
+
+const char *json_view_first(const char *p, const char *end) {
+  if (p == NULL) {
+    return NULL;
+  }
+  p = skip_ws(p, end);
+  if (p >= end || *p != '[') {
+    return NULL;
+  }
+  p = skip_ws(p + 1, end);
+  return p < end && *p != ']' ? p : NULL;
+}
+
+static char *put_utf8(char *out, unsigned long code) {
+  if (code < 0x80) {
+    *out++ = (char)code;
+  } else if (code < 0x800) {
+    *out++ = (char)(0xc0 | (code >> 6));
+    *out++ = (char)(0x80 | (code & 0x3f));
+  } else if (code < 0x10000) {
+    *out++ = (char)(0xe0 | (code >> 12));
+    *out++ = (char)(0x80 | ((code >> 6) & 0x3f));
+    *out++ = (char)(0x80 | (code & 0x3f));
+  } else {
+    *out++ = (char)(0xf0 | (code >> 18));
+    *out++ = (char)(0x80 | ((code >> 12) & 0x3f));
+    *out++ = (char)(0x80 | ((code >> 6) & 0x3f));
+    *out++ = (char)(0x80 | (code & 0x3f));
+  }
+  return out;
+}
+
+size_t json_view_unescape(char *p) {
+  char *start = p + 1;
+  const char *in = start;
+  char *out = start;
+  unsigned long code = 0;
+  long low = 0;
+
+  /* the common case has nothing to rewrite */
+  while (*in != '"' && *in != '\\') {
+    in++;
+  }
+  out = (char *)in;
+
+  while (*in != '"') {
+    if (*in != '\\') {
+      *out++ = *in++;
+      continue;
+    }
+    in++;
+    switch (*in) {
+    case 'b':
+      *out++ = '\b';
+      break;
+    case 'f':
+      *out++ = '\f';
+      break;
+    case 'n':
+      *out++ = '\n';
+      break;
+    case 'r':
+      *out++ = '\r';
+      break;
+    case 't':
+      *out++ = '\t';
+      break;
+    case 'u':
+      code = (unsigned long)read_hex4(in + 1);
+      in += 4;
+      /* a high surrogate joins the low one after it, a lone one is kept */
+      if (code >= 0xd800 && code < 0xdc00 && in[1] == '\\' && in[2] == 'u') {
+        low = read_hex4(in + 3);
+        if (low >= 0xdc00 && low < 0xe000) {
+          code = 0x10000 + ((code - 0xd800) << 10) +
+                 ((unsigned long)low - 0xdc00);
+          in += 6;
+        }
+      }
+      out = put_utf8(out, code);
+      break;
+    default:
+      *out++ = *in;
+      break;
+    }
+    in++;
+  }
+
+  *out = '\0';
+  return (size_t)(out - start);
+}
@@ -0,0 +1,54 @@
+#ifndef JSON_VIEW_H
+#define JSON_VIEW_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* Read JSON where it lies, without building a tree. Pointers go into the
+* text, which must end with a NUL at end. Check the whole text once with
+* json_view_skip or json_view_members, the other lookups then assume it
+* is well formed
+*/
+
+/*
+* Skip whitespace and one value
+* Return the byte after it, NULL if malformed
+*/
+const char *json_view_skip(const char *p, const char *end);
+
+/*
+* Value of key in the object at p, leading whitespace skipped
+* Return NULL if p is NULL or not an object, or the key is absent
+*/
+const char *json_view_member(const char *p, const char *end, const char *key);
+
+/*
+* One pass over the object at p: values[i] is the value of keys[i], NULL
+* if absent, and every value is checked along the way
+* Return 0 if ok, -1 if malformed
+*/
+int json_view_members(const char *p, const char *end, const char **keys,
+                      const char **values, size_t count);
+
+/*
+* First element of the array at p
+* Return NULL if p is NULL or not an array, or the array is empty
+*/
+const char *json_view_first(const char *p, const char *end);
+
+/*
+* Unescape the string at p (its opening quote) into its own bytes and
+* NUL-terminate it there; the text is no longer JSON past that point
+* Return the unescaped length, which may count NUL bytes from \u0000
+*/
+size_t json_view_unescape(char *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JSON_VIEW_H */
@@ -0,0 +1,404 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "json_writer.h"
+#include "mistral_alloc.h"
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_CAPACITY 256
+
+void json_writer_init(json_writer_t *writer) {
+  writer->data = NULL;
+  writer->size = 0;
+  writer->capacity = 0;
+}
+
+int json_writer_reserve(json_writer_t *writer, size_t extra) {
+  size_t needed = writer->size + extra + 1;
+  size_t capacity = writer->capacity;
+  char *data = NULL;
+
+  if (needed <= capacity) {
+    return 0;
+  }
+
+  if (capacity < MIN_CAPACITY) {
+    capacity = MIN_CAPACITY;
+  }
+  while (capacity < needed) {
+    capacity *= 2;
+  }
+
+  data = (char *)mem_realloc(writer->data, capacity);
+  if (data == NULL) {
+    return -1;
+  }
+
+  writer->data = data;
+  writer->capacity = capacity;
+  return 0;
+}
+
+int json_writer_append(json_writer_t *writer, const char *data, size_t len) {
+  if (json_writer_reserve(writer, len) != 0) {
+    return -1;
+  }
+
+  memcpy(writer->data + writer->size, data, len);
+  writer->size += len;
+  writer->data[writer->size] = '\0';
+  return 0;
+}
+
+int json_writer_append_string(json_writer_t *writer, const char *value) {
+  return json_writer_append_string_n(writer, value, strlen(value));
+}
+
+/* 1 for bytes JSON strings must escape: controls, quote and backslash */
+static const unsigned char escaped[256] = {
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+/*
+* Two-character escape for c, 0 if it takes the \u00XX form
+*/
+static char short_escape(unsigned char c) {
+  switch (c) {
+  case '"':
+    return '"';
+  case '\\':
+    return '\\';
+  case '\b':
+    return 'b';
+  case '\f':
+    return 'f';
+  case '\n':
+    return 'n';
+  case '\r':
+    return 'r';
+  case '\t':
+    return 't';
+  default:
+    return 0;
+  }
+}
+
+/*
+* Write the escape of c to out, return its length, 2 or 6
+*/
+static size_t escape_char(unsigned char c, char *out) {
+  static const char hex[] = "0123456789abcdef";
+
+  out[0] = '\\';
+  if (short_escape(c) != 0) {
+    out[1] = short_escape(c);
+    return 2;
+  }
+  out[1] = 'u';
+  out[2] = '0';
+  out[3] = '0';
+  out[4] = hex[c >> 4];
+  out[5] = hex[c & 15];
+  return 6;
+}
+
+/*
+* Length of value[0, len) escaped, quotes excluded
+*/
+static size_t escaped_length(const char *value, size_t len) {
+  const unsigned char *p = (const unsigned char *)value;
+  const unsigned char *end = p + len;
+  size_t total = len;
+
+  for (; p < end; p++) {
+    if (escaped[*p]) {
+      total += short_escape(*p) != 0 ? 1 : 5;
+    }
+  }
+  return total;
+}
+
+int json_writer_append_string_n(json_writer_t *writer, const char *value,
+                                size_t len) {
+  const unsigned char *p = (const unsigned char *)value;
+  const unsigned char *end = p + len;
+  const unsigned char *run = NULL;
+  size_t escaped_len = escaped_length(value, len) + 2;
+  char *out = NULL;
+
+  if (json_writer_reserve(writer, escaped_len) != 0) {
+    return -1;
+  }
+
+  /* plain runs are copied whole, only the bytes between them one by one */
+  out = writer->data + writer->size;
+  *out++ = '"';
+  for (; p < end; p++) {
+    for (run = p; p < end && !escaped[*p]; p++) {
+    }
+    memcpy(out, run, (size_t)(p - run));
+    out += p - run;
+    if (p == end) {
+      break;
+    }
+    out += escape_char(*p, out);
+  }
+  *out++ = '"';
+  *out = '\0';
+
+  writer->size += escaped_len;
+  return 0;
+}
+
+int json_writer_append_number(json_writer_t *writer, double value) {
+  char number[32];
+  double check = 0.0;
+  int len = 0;
+
+  /* same formatting rules as cJSON */
+  if (isnan(value) || isinf(value)) {
+    len = snprintf(number, sizeof(number), "null");
+  } else if (value >= INT_MIN && value <= INT_MAX && value == (int)value) {
+    len = snprintf(number, sizeof(number), "%d", (int)value);
+  } else {
+    len = snprintf(number, sizeof(number), "%1.15g", value);
+    if (sscanf(number, "%lg", &check) != 1 || check != value) {
+      len = snprintf(number, sizeof(number), "%1.17g", value);
+    }
+  }
+
+  return json_writer_append(writer, number, (size_t)len);
+}
+
+char *json_writer_detach(json_writer_t *writer) {
+  char *data = writer->data;
+
+  json_writer_init(writer);
+  return data;
+}
+
+void json_writer_free(json_writer_t *writer) {
+  mem_free(writer->data);
+  json_writer_init(writer);
+}
+
+void json_stream_init(json_stream_t *stream) {
+  memset(stream, 0, sizeof(json_stream_t));
+  json_writer_init(&stream->text);
+}
+
+static int add_part(json_stream_t *stream, const char *data, size_t offset,
+                    size_t len) {
+  json_part_t *parts = NULL;
+  size_t capacity = 0;
+
+  if (stream->count == stream->capacity) {
+    capacity = stream->capacity == 0 ? 16 : stream->capacity * 2;
+    parts = (json_part_t *)mem_realloc(stream->parts,
+                                       capacity * sizeof(json_part_t));
+    if (parts == NULL) {
+      return -1;
+    }
+    stream->parts = parts;
+    stream->capacity = capacity;
+  }
+
+  stream->parts[stream->count].data = data;
+  stream->parts[stream->count].offset = offset;
+  stream->parts[stream->count].len = len;
+  stream->count++;
+  return 0;
+}
+
+/*
+* Make text appended since start readable, as part of the previous
+* literal part when that one ends right there
+*/
+static int add_text_part(json_stream_t *stream, size_t start) {
+  json_part_t *last = stream->count > 0 ? &stream->parts[stream->count - 1]
+                                        : NULL;
+
+  if (last != NULL && last->data == NULL &&
+      last->offset + last->len == start) {
+    last->len += stream->text.size - start;
+    return 0;
+  }
+  return add_part(stream, NULL, start, stream->text.size - start);
+}
+
+int json_stream_append(json_stream_t *stream, const char *text, size_t len) {
+  size_t start = stream->text.size;
+
+  if (json_writer_append(&stream->text, text, len) != 0) {
+    return -1;
+  }
+  return add_text_part(stream, start);
+}
+
+int json_stream_append_string(json_stream_t *stream, const char *value) {
+  size_t start = stream->text.size;
+
+  if (json_writer_append_string(&stream->text, value) != 0) {
+    return -1;
+  }
+  return add_text_part(stream, start);
+}
+
+int json_stream_append_number(json_stream_t *stream, double value) {
+  size_t start = stream->text.size;
+
+  if (json_writer_append_number(&stream->text, value) != 0) {
+    return -1;
+  }
+  return add_text_part(stream, start);
+}
+
+int json_stream_reference_string(json_stream_t *stream, const char *value,
+                                 size_t len) {
+  /* a string part is never empty data, its quotes are always written */
+  return add_part(stream, len > 0 ? value : "", 0, len);
+}
+
+/*
+* Escape what fits of the current string part into buffer[0, room); an
+* escape cut by the end of buffer is finished from pending
+* Return bytes written
+*/
+static size_t read_escaped(json_stream_t *stream, const json_part_t *part,
+                           char *buffer, size_t room) {
+  const unsigned char *start = (const unsigned char *)part->data;
+  const unsigned char *p = start + stream->pos;
+  const unsigned char *end = start + part->len;
+  const unsigned char *stop = NULL;
+  const unsigned char *run = NULL;
+  char escape[6];
+  size_t written = 0;
+  size_t len = 0;
+
+  while (written < room && p < end) {
+    stop = (size_t)(end - p) < room - written ? end : p + (room - written);
+    for (run = p; p < stop && !escaped[*p]; p++) {
+    }
+    memcpy(buffer + written, run, (size_t)(p - run));
+    written += (size_t)(p - run);
+    if (p == stop) {
+      continue;
+    }
+
+    len = escape_char(*p++, escape);
+    if (len > room - written) {
+      memcpy(stream->pending, escape, len);
+      stream->pending_len = len;
+      stream->pending_pos = room - written;
+      len = room - written;
+    }
+    memcpy(buffer + written, escape, len);
+    written += len;
+  }
+
+  stream->pos = (size_t)(p - start);
+  return written;
+}
+
+size_t json_stream_read(json_stream_t *stream, char *buffer, size_t size) {
+  const json_part_t *part = NULL;
+  size_t n = 0;
+  size_t take = 0;
+
+  while (n < size) {
+    if (stream->pending_pos < stream->pending_len) {
+      buffer[n++] = stream->pending[stream->pending_pos++];
+      continue;
+    }
+    if (stream->part == stream->count) {
+      break;
+    }
+
+    part = &stream->parts[stream->part];
+    if (part->data == NULL) {
+      take = part->len - stream->pos;
+      if (take > size - n) {
+        take = size - n;
+      }
+      memcpy(buffer + n, stream->text.data + part->offset + stream->pos,
+             take);
+      n += take;
+      stream->pos += take;
+      if (stream->pos == part->len) {
+        stream->part++;
+        stream->pos = 0;
+      }
+    } else if (!stream->quoted) {
+      buffer[n++] = '"';
+      stream->quoted = 1;
+    } else if (stream->pos < part->len) {
+      n += read_escaped(stream, part, buffer + n, size - n);
+    } else {
+      buffer[n++] = '"';
+      stream->quoted = 0;
+      stream->part++;
+      stream->pos = 0;
+    }
+  }
+
+  return n;
+}
+
+void json_stream_rewind(json_stream_t *stream) {
+  stream->part = 0;
+  stream->pos = 0;
+  stream->quoted = 0;
+  stream->pending_len = 0;
+  stream->pending_pos = 0;
+}
+
+size_t json_stream_length(const json_stream_t *stream) {
+  size_t total = 0;
+  size_t i;
+
+  for (i = 0; i < stream->count; i++) {
+    const json_part_t *part = &stream->parts[i];
+    total += part->data == NULL ? part->len
+                                : escaped_length(part->data, part->len) + 2;
+  }
+  return total;
+}
+
+char *json_stream_to_string(json_stream_t *stream) {
+  size_t len = json_stream_length(stream);
+  char *data = (char *)mem_malloc(len + 1);
+
+  if (data == NULL) {
+    return NULL;
+  }
+
+  json_stream_rewind(stream);
+  json_stream_read(stream, data, len);
+  data[len] = '\0';
+  json_stream_rewind(stream);
+  return data;
+}
+
+void json_stream_free(json_stream_t *stream) {
+  json_writer_free(&stream->text);
+  mem_free(stream->parts);
+  json_stream_init(stream);
+}
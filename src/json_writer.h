@@ -0,0 +1,137 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* Growable output buffer, data stays NUL-terminated
+* Output matches cJSON_PrintUnformatted for the same values, so bodies
+* built either way hash and compare equal
+*/
+typedef struct {
+  char *data;
+  size_t size;
+  size_t capacity;
+} json_writer_t;
+
+void json_writer_init(json_writer_t *writer);
+
+/*
+* Make room for extra more bytes
+* Return 0 if ok, -1 if out of memory
+*/
+int json_writer_reserve(json_writer_t *writer, size_t extra);
+
+/*
+* Return 0 if ok, -1 if out of memory
+*/
+int json_writer_append(json_writer_t *writer, const char *data, size_t len);
+
+/*
+* Append value as a quoted, escaped JSON string
+* Return 0 if ok, -1 if out of memory
+*/
+int json_writer_append_string(json_writer_t *writer, const char *value);
+
+/*
+* Same for value[0, len); a NUL inside is written as \u0000
+* Return 0 if ok, -1 if out of memory
+*/
+int json_writer_append_string_n(json_writer_t *writer, const char *value,
+                                size_t len);
+
+/*
+* Return 0 if ok, -1 if out of memory
+*/
+int json_writer_append_number(json_writer_t *writer, double value);
+
+/*
+* Hand the buffer to the caller and reset the writer
+*/
+char *json_writer_detach(json_writer_t *writer);
+
+void json_writer_free(json_writer_t *writer);
+
+/*
+* Piece of a json_stream_t: literal text at offset of the stream's text
+* when data is NULL, otherwise a caller's string escaped as it is read
+*/
+typedef struct {
+  const char *data;
+  size_t offset;
+  size_t len;
+} json_part_t;
+
+/*
+* JSON document produced on demand, for a body written while it is sent.
+* Keys, numbers and short values are copied into text; large strings are
+* only referenced and escaped as they are read, so the stream takes
+* memory for its parts, not for the document. Referenced strings must
+* outlive the stream
+*/
+typedef struct {
+  json_writer_t text;
+  json_part_t *parts;
+  size_t count;
+  size_t capacity;
+  /* read position: part, bytes of it done, opening quote written */
+  size_t part;
+  size_t pos;
+  int quoted;
+  /* rest of an escape cut off by the end of the last read */
+  char pending[6];
+  size_t pending_len;
+  size_t pending_pos;
+} json_stream_t;
+
+void json_stream_init(json_stream_t *stream);
+
+/*
+* Append literal text, an escaped copy of value, or a number
+* Return 0 if ok, -1 if out of memory
+*/
+int json_stream_append(json_stream_t *stream, const char *text, size_t len);
+
+int json_stream_append_string(json_stream_t *stream, const char *value);
+
+int json_stream_append_number(json_stream_t *stream, double value);
+
+/*
+* Append value[0, len) as a JSON string without copying it
+* Return 0 if ok, -1 if out of memory
+*/
+int json_stream_reference_string(json_stream_t *stream, const char *value,
+                                 size_t len);
+
+/*
+* Write the next bytes of the document to buffer
+* Return bytes written, less than size only at the end
+*/
+size_t json_stream_read(json_stream_t *stream, char *buffer, size_t size);
+
+/*
+* Start reading from the beginning again
+*/
+void json_stream_rewind(json_stream_t *stream);
+
+/*
+* Bytes of the whole document
+*/
+size_t json_stream_length(const json_stream_t *stream);
+
+/*
+* Whole document as one mem_malloc'd string, NULL if out of memory
+*/
+char *json_stream_to_string(json_stream_t *stream);
+
+void json_stream_free(json_stream_t *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JSON_WRITER_H */
@@ -2,6 +2,9 @@
 
 #include "../include/mistral.h"
 #include "http_client.h"
+#include "mistral_alloc.h"
+#include "mistral_arena.h"
+#include "mistral_context.h"
 #include "mistral_helpers.h"
 #include "mistral_utils.h"
 #include <cjson/cJSON.h>
@@ -16,6 +19,7 @@
 #define DEFAULT_MAX_RETRIES 3
 #define DEFAULT_RETRY_DELAY_MS 1000
 #define DEFAULT_TIMEOUT_SEC 60
+#define DEFAULT_CONNECT_TIMEOUT_MS 10000
 
 int execute_embeddings_http_request_with_retry(const mistral_config_t *config,
                                                const char *endpoint,
@@ -38,6 +42,10 @@ static int g_debug_enabled = 0;
 /*Init the Mistral lib include HTTP client*/
 int mistral_init(void) { return http_client_init(); }
 
+void mistral_set_buffer_retention(size_t max_bytes) {
+  http_set_buffer_retention(max_bytes);
+}
+
 /*Cleanup all Mistral resources*/
 void mistral_cleanup(void) { http_client_cleanup(); }
 
@@ -58,7 +66,7 @@ mistral_config_t *mistral_config_create(const char *api_key) {
     return NULL;
   }
 
-  config = (mistral_config_t *)malloc(sizeof(mistral_config_t));
+  config = (mistral_config_t *)mem_malloc(sizeof(mistral_config_t));
   if (config == NULL) {
     fprintf(stderr, "failed to allocate memory for config\n");
     return NULL;
@@ -66,18 +74,18 @@ mistral_config_t *mistral_config_create(const char *api_key) {
 
   memset(config, 0, sizeof(mistral_config_t));
 
-  config->api_key = strdup(api_key);
+  config->api_key = mem_strdup(api_key);
   if (config->api_key == NULL) {
     fprintf(stderr, "failed to duplicate API key\n");
-    free(config);
+    mem_free(config);
     return NULL;
   }
 
-  config->model = strdup(DEFAULT_MODEL);
+  config->model = mem_strdup(DEFAULT_MODEL);
   if (config->model == NULL) {
     fprintf(stderr, "failed to duplicate model name\n");
-    free(config->api_key);
-    free(config);
+    mem_free(config->api_key);
+    mem_free(config);
     return NULL;
   }
 
@@ -86,6 +94,7 @@ mistral_config_t *mistral_config_create(const char *api_key) {
   config->max_retries = DEFAULT_MAX_RETRIES;
   config->retry_delay_ms = DEFAULT_RETRY_DELAY_MS;
   config->timeout_sec = DEFAULT_TIMEOUT_SEC;
+  config->connect_timeout_ms = DEFAULT_CONNECT_TIMEOUT_MS;
   config->debug_mode = 0;
 
   return config;
@@ -94,12 +103,12 @@ mistral_config_t *mistral_config_create(const char *api_key) {
 void mistral_config_free(mistral_config_t *config) {
   if (config != NULL) {
     if (config->api_key != NULL) {
-      free(config->api_key);
+      mem_free(config->api_key);
     }
     if (config->model != NULL) {
-      free(config->model);
+      mem_free(config->model);
     }
-    free(config);
+    mem_free(config);
   }
 }
 
@@ -139,24 +148,30 @@ int mistral_config_validate(const mistral_config_t *config) {
     return -1;
   }
 
+  if (config->connect_timeout_ms < 0 || config->first_byte_timeout_ms < 0 ||
+      config->idle_timeout_ms < 0 || config->deadline_ms < 0) {
+    DEBUG_LOG("negative timeout");
+    return -1;
+  }
+
   return 0;
 }
 
 void mistral_api_error_free(mistral_api_error_t *error) {
   if (error != NULL) {
     if (error->message != NULL) {
-      free(error->message);
+      mem_free(error->message);
     }
     if (error->type != NULL) {
-      free(error->type);
+      mem_free(error->type);
     }
     if (error->param != NULL) {
-      free(error->param);
+      mem_free(error->param);
     }
     if (error->code != NULL) {
-      free(error->code);
+      mem_free(error->code);
     }
-    free(error);
+    mem_free(error);
   }
 }
 
@@ -172,8 +187,8 @@ int mistral_embeddings(const mistral_config_t *config,
       input_count == 0 || response == NULL) {
     fprintf(stderr, "invalid arguments to mistral_embeddings\n");
     if (response != NULL) {
-      memset(response, 0, sizeof(mistral_embeddings_response_t));
-      response->error_message = strdup("Invalid parameters");
+      embeddings_response_begin(config, response);
+      response->error_message = mem_strdup("Invalid parameters");
       if (response->error_message == NULL) {
         return -1;
       }
@@ -182,9 +197,9 @@ int mistral_embeddings(const mistral_config_t *config,
     return -1;
   }
 
-  memset(response, 0, sizeof(mistral_embeddings_response_t));
+  embeddings_response_begin(config, response);
 
-  if (validate_common_params(config, (mistral_response_t *)response) != 0) {
+  if (validate_embeddings_params(config, response) != 0) {
     return -1;
   }
 
@@ -204,7 +219,7 @@ int mistral_embeddings(const mistral_config_t *config,
 
   request_json = create_embeddings_json(config, embeddings, input_count);
   if (request_json == NULL) {
-    response->error_message = strdup("failed to create request JSON");
+    response->error_message = mem_strdup("failed to create request JSON");
     if (response->error_message == NULL) {
       return -1;
     }
@@ -218,7 +233,7 @@ int mistral_embeddings(const mistral_config_t *config,
       config, MISTRAL_BASE_API "/embeddings", request_json, response);
 
   if (request_json != NULL) {
-    free(request_json);
+    mem_free(request_json);
   }
 
   if (debug_was_enabled) {
@@ -242,7 +257,7 @@ int mistral_fim_completions(const mistral_config_t *config,
       fim->prompt == NULL || fim->suffix == NULL) {
     fprintf(stderr, "invalid arguments to mistral_fim_completions\n");
     if (response != NULL) {
-      memset(response, 0, sizeof(mistral_response_t));
+      response_begin(config, response);
       if (set_error_message(response, "Invalid parameters") != 0) {
         return -1;
       }
@@ -251,7 +266,7 @@ int mistral_fim_completions(const mistral_config_t *config,
     return -1;
   }
 
-  memset(response, 0, sizeof(mistral_response_t));
+  response_begin(config, response);
 
   if (validate_common_params(config, response) != 0) {
     return -1;
@@ -286,7 +301,7 @@ int mistral_fim_completions(const mistral_config_t *config,
       config, MISTRAL_BASE_API "/fim/completions", request_json, response);
 
   if (request_json != NULL) {
-    free(request_json);
+    mem_free(request_json);
   }
 
   if (debug_was_enabled) {
@@ -303,6 +318,9 @@ int mistral_chat_completions(const mistral_config_t *config,
                              const mistral_message_t *messages,
                              size_t message_count,
                              mistral_response_t *response) {
+  const mistral_message_t *fitted = messages;
+  size_t fitted_count = message_count;
+  char *summary = NULL;
   char *request_json = NULL;
   int ret = -1;
   int debug_was_enabled = 0;
@@ -311,7 +329,7 @@ int mistral_chat_completions(const mistral_config_t *config,
       message_count == 0 || response == NULL) {
     fprintf(stderr, "invalid arguments to mistral_chat_completions\n");
     if (response != NULL) {
-      memset(response, 0, sizeof(mistral_response_t));
+      response_begin(config, response);
       if (set_error_message(response, "Invalid parameters") != 0) {
         return -1;
       }
@@ -320,12 +338,19 @@ int mistral_chat_completions(const mistral_config_t *config,
     return -1;
   }
 
-  memset(response, 0, sizeof(mistral_response_t));
+  response_begin(config, response);
 
   if (validate_common_params(config, response) != 0) {
     return -1;
   }
 
+  /* trim before anything is serialized or sent */
+  if (config->context_policy != NULL &&
+      context_policy_fit(config->context_policy, messages, message_count,
+                         &fitted, &fitted_count, &summary, response) != 0) {
+    return -1;
+  }
+
   if (config->debug_mode) {
     mistral_set_debug(1);
     debug_was_enabled = 1;
@@ -340,7 +365,11 @@ int mistral_chat_completions(const mistral_config_t *config,
   DEBUG_LOG("Max retries: %d, Timeout: %d seconds", config->max_retries,
             config->timeout_sec);
 
-  request_json = create_chat_request_json(config, messages, message_count);
+  request_json = create_chat_request_json(config, fitted, fitted_count);
+  if (fitted != messages) {
+    mem_free((void *)fitted);
+    mem_free(summary);
+  }
   if (request_json == NULL) {
     if (set_error_message(response, "failed to create request JSON") != 0) {
       return -1;
@@ -355,7 +384,7 @@ int mistral_chat_completions(const mistral_config_t *config,
       config, MISTRAL_BASE_API "/chat/completions", request_json, response);
 
   if (request_json != NULL) {
-    free(request_json);
+    mem_free(request_json);
   }
 
   if (debug_was_enabled) {
@@ -368,77 +397,335 @@ int mistral_chat_completions(const mistral_config_t *config,
   return ret;
 }
 
-void mistral_response_free(mistral_response_t *response) {
-  if (response != NULL) {
-    if (response->id != NULL) {
-      free(response->id);
-      response->id = NULL;
-    }
-    if (response->model != NULL) {
-      free(response->model);
-      response->model = NULL;
-    }
-    if (response->content != NULL) {
-      free(response->content);
-      response->content = NULL;
+static int slice_valid(const char *data, size_t len) {
+  return data != NULL || len == 0;
+}
+
+static char *copy_slice(const char *data, size_t len) {
+  char *copy = (char *)mem_malloc(len + 1);
+
+  if (copy != NULL) {
+    if (len > 0) {
+      memcpy(copy, data, len);
     }
-    if (response->error_message != NULL) {
-      free(response->error_message);
-      response->error_message = NULL;
+    copy[len] = '\0';
+  }
+  return copy;
+}
+
+/*
+* The context policy counts and summarizes C strings, so it gets
+* terminated copies of the messages
+*/
+static int chat_with_copies(const mistral_config_t *config,
+                            const mistral_message_n_t *messages,
+                            size_t message_count,
+                            mistral_response_t *response) {
+  mistral_message_t *copies = NULL;
+  size_t i;
+  int ret = -1;
+
+  copies = (mistral_message_t *)mem_calloc(message_count,
+                                           sizeof(mistral_message_t));
+  for (i = 0; copies != NULL && i < message_count; i++) {
+    copies[i].role = copy_slice(messages[i].role, messages[i].role_len);
+    copies[i].content =
+        copy_slice(messages[i].content, messages[i].content_len);
+    if (copies[i].role == NULL || copies[i].content == NULL) {
+      break;
     }
-    if (response->api_error != NULL) {
-      mistral_api_error_free(response->api_error);
-      response->api_error = NULL;
+  }
+
+  if (copies != NULL && i == message_count) {
+    ret = mistral_chat_completions(config, copies, message_count, response);
+  } else {
+    response_begin(config, response);
+    if (set_error_message(response, "failed to copy messages") == 0) {
+      response->error_code = MISTRAL_ERR_MEM;
     }
-    response->prompt_tokens = 0;
-    response->completion_tokens = 0;
-    response->total_tokens = 0;
-    response->error_code = MISTRAL_OK;
-    response->http_code = 0;
   }
+
+  for (i = 0; copies != NULL && i < message_count; i++) {
+    mem_free(copies[i].role);
+    mem_free(copies[i].content);
+  }
+  mem_free(copies);
+  return ret;
 }
 
-void mistral_embeddings_response_free(mistral_embeddings_response_t *response) {
-  if (response != NULL) {
-    if (response->id != NULL) {
-      free(response->id);
-      response->id = NULL;
+int mistral_chat_completions_n(const mistral_config_t *config,
+                               const mistral_message_n_t *messages,
+                               size_t message_count,
+                               mistral_response_t *response) {
+  json_stream_t body;
+  size_t i;
+  int ret = -1;
+
+  for (i = 0; messages != NULL && i < message_count; i++) {
+    if (messages[i].role == NULL ||
+        !slice_valid(messages[i].content, messages[i].content_len)) {
+      break;
     }
-    if (response->model != NULL) {
-      free(response->model);
-      response->model = NULL;
+  }
+  if (config == NULL || config->api_key == NULL || messages == NULL ||
+      message_count == 0 || i < message_count || response == NULL) {
+    fprintf(stderr, "invalid arguments to mistral_chat_completions_n\n");
+    if (response != NULL) {
+      response_begin(config, response);
+      if (set_error_message(response, "Invalid parameters") == 0) {
+        response->error_code = MISTRAL_ERR_INVALID_PARAM;
+      }
     }
-    if (response->object != NULL) {
-      free(response->object);
-      response->object = NULL;
+    return -1;
+  }
+
+  if (config->context_policy != NULL) {
+    return chat_with_copies(config, messages, message_count, response);
+  }
+
+  response_begin(config, response);
+
+  if (validate_common_params(config, response) != 0) {
+    return -1;
+  }
+
+  json_stream_init(&body);
+  if (create_chat_request_stream(config, messages, message_count, &body) !=
+      0) {
+    json_stream_free(&body);
+    if (set_error_message(response, "failed to create request JSON") == 0) {
+      response->error_code = MISTRAL_ERR_MEM;
     }
-    if (response->error_message != NULL) {
-      free(response->error_message);
-      response->error_message = NULL;
+    return -1;
+  }
+
+  ret = execute_http_stream_with_retry(
+      config, MISTRAL_BASE_API "/chat/completions", &body, response);
+  json_stream_free(&body);
+
+  return ret;
+}
+
+int mistral_fim_completions_n(const mistral_config_t *config,
+                              const mistral_fim_n_t *fim,
+                              mistral_response_t *response) {
+  json_stream_t body;
+  int ret = -1;
+
+  if (config == NULL || config->api_key == NULL || fim == NULL ||
+      fim->prompt == NULL || !slice_valid(fim->suffix, fim->suffix_len) ||
+      response == NULL) {
+    fprintf(stderr, "invalid arguments to mistral_fim_completions_n\n");
+    if (response != NULL) {
+      response_begin(config, response);
+      if (set_error_message(response, "Invalid parameters") == 0) {
+        response->error_code = MISTRAL_ERR_INVALID_PARAM;
+      }
     }
-    if (response->api_error != NULL) {
-      mistral_api_error_free(response->api_error);
-      response->api_error = NULL;
+    return -1;
+  }
+
+  response_begin(config, response);
+
+  if (validate_common_params(config, response) != 0) {
+    return -1;
+  }
+
+  json_stream_init(&body);
+  if (create_fim_request_stream(config, fim->prompt, fim->prompt_len,
+                                fim->suffix != NULL ? fim->suffix : "",
+                                fim->suffix_len, &body) != 0) {
+    json_stream_free(&body);
+    if (set_error_message(response, "failed to create request JSON") == 0) {
+      response->error_code = MISTRAL_ERR_MEM;
+    }
+    return -1;
+  }
+
+  ret = execute_http_stream_with_retry(
+      config, MISTRAL_BASE_API "/fim/completions", &body, response);
+  json_stream_free(&body);
+
+  return ret;
+}
+
+int mistral_embeddings_n(const mistral_config_t *config,
+                         const mistral_embeddings_n_t *inputs,
+                         size_t input_count,
+                         mistral_embeddings_response_t *response) {
+  json_stream_t body;
+  size_t i;
+  int ret = -1;
+
+  for (i = 0; inputs != NULL && i < input_count; i++) {
+    if (!slice_valid(inputs[i].input, inputs[i].input_len)) {
+      break;
     }
-    if (response->data != NULL) {
-      size_t i = 0;
-      while (i < 1000 && (response->data[i].embending != NULL || i == 0)) {
-        if (response->data[i].embending != NULL) {
-          free(response->data[i].embending);
-        }
-        if (response->data[i].object != NULL) {
-          free(response->data[i].object);
-        }
-        i++;
+  }
+  if (config == NULL || config->api_key == NULL || inputs == NULL ||
+      input_count == 0 || i < input_count || response == NULL) {
+    fprintf(stderr, "invalid arguments to mistral_embeddings_n\n");
+    if (response != NULL) {
+      embeddings_response_begin(config, response);
+      response->error_message = mem_strdup("Invalid parameters");
+      if (response->error_message != NULL) {
+        response->error_code = MISTRAL_ERR_INVALID_PARAM;
       }
-      free(response->data);
-      response->data = NULL;
     }
-    if (response->usage != NULL) {
-      free(response->usage);
-      response->usage = NULL;
+    return -1;
+  }
+
+  embeddings_response_begin(config, response);
+
+  if (validate_embeddings_params(config, response) != 0) {
+    return -1;
+  }
+
+  json_stream_init(&body);
+  if (create_embeddings_stream(config, inputs, input_count, &body) != 0) {
+    json_stream_free(&body);
+    response->error_message = mem_strdup("failed to create request JSON");
+    response->error_code = MISTRAL_ERR_MEM;
+    return -1;
+  }
+
+  ret = execute_embeddings_stream_with_retry(
+      config, MISTRAL_BASE_API "/embeddings", &body, response);
+  json_stream_free(&body);
+
+  return ret;
+}
+
+/*
+* Parsed fields live in the response arena, anything set later on its own
+*/
+static void free_unless_owned(const mistral_response_arena_t *arena,
+                              void *ptr) {
+  if (!response_arena_owns(arena, ptr)) {
+    mem_free(ptr);
+  }
+}
+
+/*
+* Give a body parsed in place back to the receive path
+*/
+static void recycle_body(response_arena_t *arena) {
+  size_t capacity = 0;
+  char *body = NULL;
+
+  if (arena != NULL) {
+    body = response_arena_take_body(arena, &capacity);
+    http_recycle_buffer(body, capacity);
+  }
+}
+
+static void clear_response(mistral_response_t *response) {
+  free_unless_owned(response->arena, response->id);
+  free_unless_owned(response->arena, response->model);
+  free_unless_owned(response->arena, response->content);
+  response->id = NULL;
+  response->model = NULL;
+  response->content = NULL;
+  if (response->error_message != NULL) {
+    mem_free(response->error_message);
+    response->error_message = NULL;
+  }
+  if (response->api_error != NULL) {
+    mistral_api_error_free(response->api_error);
+    response->api_error = NULL;
+  }
+  recycle_body(response->arena);
+  response->prompt_tokens = 0;
+  response->completion_tokens = 0;
+  response->total_tokens = 0;
+  response->error_code = MISTRAL_OK;
+  response->http_code = 0;
+  response->cached = 0;
+  response->fallback_index = 0;
+}
+
+void mistral_response_free(mistral_response_t *response) {
+  if (response != NULL) {
+    clear_response(response);
+    response_arena_free(response->arena);
+    response->arena = NULL;
+  }
+}
+
+void mistral_response_reset(mistral_response_t *response) {
+  if (response != NULL) {
+    clear_response(response);
+    if (response->arena != NULL) {
+      response_arena_reset(response->arena);
+    }
+  }
+}
+
+mistral_string_view_t mistral_response_view(const mistral_response_t *response,
+                                            mistral_response_field_t field) {
+  mistral_string_view_t view = {NULL, 0};
+
+  if (response == NULL) {
+    return view;
+  }
+
+  switch (field) {
+  case MISTRAL_FIELD_ID:
+    view.data = response->id;
+    break;
+  case MISTRAL_FIELD_MODEL:
+    view.data = response->model;
+    break;
+  case MISTRAL_FIELD_CONTENT:
+    view.data = response->content;
+    break;
+  }
+
+  /* a field replaced after parsing has no recorded length */
+  if (view.data != NULL &&
+      response_arena_length(response->arena, view.data, &view.length) != 0) {
+    view.length = strlen(view.data);
+  }
+  return view;
+}
+
+/*
+* Everything parsed is in the arena, only the error fields are freed here
+*/
+static void clear_embeddings_response(
+    mistral_embeddings_response_t *response) {
+  response->id = NULL;
+  response->model = NULL;
+  response->object = NULL;
+  response->data = NULL;
+  response->usage = NULL;
+  if (response->error_message != NULL) {
+    mem_free(response->error_message);
+    response->error_message = NULL;
+  }
+  if (response->api_error != NULL) {
+    mistral_api_error_free(response->api_error);
+    response->api_error = NULL;
+  }
+  recycle_body(response->arena);
+  response->error_code = MISTRAL_OK;
+  response->http_code = 0;
+}
+
+void mistral_embeddings_response_free(mistral_embeddings_response_t *response) {
+  if (response != NULL) {
+    clear_embeddings_response(response);
+    response_arena_free(response->arena);
+    response->arena = NULL;
+  }
+}
+
+void mistral_embeddings_response_reset(
+    mistral_embeddings_response_t *response) {
+  if (response != NULL) {
+    clear_embeddings_response(response);
+    if (response->arena != NULL) {
+      response_arena_reset(response->arena);
     }
-    response->error_code = MISTRAL_OK;
-    response->http_code = 0;
   }
 }
@@ -0,0 +1,104 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mistral_alloc.h"
+#include <cjson/cJSON.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+* Set once before mistral_init, read without a lock afterwards
+*/
+static mistral_malloc_cb hook_malloc = NULL;
+static mistral_realloc_cb hook_realloc = NULL;
+static mistral_free_cb hook_free = NULL;
+static void *hook_data = NULL;
+
+void *mem_malloc(size_t size) {
+  if (hook_malloc == NULL) {
+    return malloc(size);
+  }
+  return hook_malloc(size, hook_data);
+}
+
+void *mem_calloc(size_t count, size_t size) {
+  void *ptr = NULL;
+
+  if (hook_malloc == NULL) {
+    return calloc(count, size);
+  }
+  if (size != 0 && count > SIZE_MAX / size) {
+    return NULL;
+  }
+
+  ptr = hook_malloc(count * size, hook_data);
+  if (ptr != NULL) {
+    memset(ptr, 0, count * size);
+  }
+  return ptr;
+}
+
+void *mem_realloc(void *ptr, size_t size) {
+  if (hook_realloc == NULL) {
+    return realloc(ptr, size);
+  }
+  return hook_realloc(ptr, size, hook_data);
+}
+
+char *mem_strdup(const char *value) {
+  size_t len = 0;
+  char *copy = NULL;
+
+  if (hook_malloc == NULL) {
+    return strdup(value);
+  }
+
+  len = strlen(value) + 1;
+  copy = (char *)hook_malloc(len, hook_data);
+  if (copy != NULL) {
+    memcpy(copy, value, len);
+  }
+  return copy;
+}
+
+void mem_free(void *ptr) {
+  if (hook_free == NULL) {
+    free(ptr);
+  } else if (ptr != NULL) {
+    hook_free(ptr, hook_data);
+  }
+}
+
+int mem_hooked(void) { return hook_malloc != NULL; }
+
+int mistral_set_allocator(mistral_malloc_cb malloc_cb,
+                          mistral_realloc_cb realloc_cb,
+                          mistral_free_cb free_cb, void *user_data) {
+  cJSON_Hooks hooks;
+
+  if ((malloc_cb == NULL) != (realloc_cb == NULL) ||
+      (malloc_cb == NULL) != (free_cb == NULL)) {
+    fprintf(stderr, "allocator needs malloc, realloc and free together\n");
+    return -1;
+  }
+
+  hook_malloc = malloc_cb;
+  hook_realloc = realloc_cb;
+  hook_free = free_cb;
+  hook_data = user_data;
+
+  /* cJSON has no context pointer, it goes through the wrappers instead */
+  if (malloc_cb == NULL) {
+    cJSON_InitHooks(NULL);
+  } else {
+    hooks.malloc_fn = mem_malloc;
+    hooks.free_fn = mem_free;
+    cJSON_InitHooks(&hooks);
+  }
+  return 0;
+}
+
+void *mistral_malloc(size_t size) { return mem_malloc(size); }
+
+void mistral_free(void *ptr) { mem_free(ptr); }
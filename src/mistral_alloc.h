@@ -0,0 +1,34 @@
+#ifndef MISTRAL_ALLOC_H
+#define MISTRAL_ALLOC_H
+
+#include "../include/mistral.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* Every allocation the library makes goes through these, so they reach
+* the hooks of mistral_set_allocator; plain libc without hooks
+*/
+void *mem_malloc(size_t size);
+
+void *mem_calloc(size_t count, size_t size);
+
+void *mem_realloc(void *ptr, size_t size);
+
+char *mem_strdup(const char *value);
+
+void mem_free(void *ptr);
+
+/*
+* Return 1 if mistral_set_allocator installed hooks
+*/
+int mem_hooked(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MISTRAL_ALLOC_H */
@@ -0,0 +1,301 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mistral_arena.h"
+#include "mistral_alloc.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_BLOCK_SIZE 256
+/* bytes an adopted arena may hold beyond twice its content */
+#define ADOPT_SLACK 4096
+/* id, model and content */
+#define ARENA_VIEW_SLOTS 3
+
+/* strictest alignment a parsed field needs */
+typedef union {
+  long l;
+  double d;
+  void *p;
+} arena_align_t;
+
+#define ARENA_ALIGN sizeof(arena_align_t)
+#define ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN)
+
+typedef struct arena_block {
+  struct arena_block *next;
+  size_t used;
+  size_t size;
+  arena_align_t data[];
+} arena_block_t;
+
+/*
+* blocks: newest first; the oldest one lives in the same allocation, right
+* after the header
+* body: adopted receive buffer of body_size bytes plus its NUL, in an
+* allocation of body_capacity bytes
+* views: lengths of strings that may hold NUL bytes
+*/
+struct mistral_response_arena {
+  arena_block_t *blocks;
+  char *body;
+  size_t body_size;
+  size_t body_capacity;
+  mistral_string_view_t views[ARENA_VIEW_SLOTS];
+  size_t view_count;
+};
+
+#define HEADER_SIZE ALIGN_UP(sizeof(struct mistral_response_arena))
+
+response_arena_t *response_arena_create(size_t first_block) {
+  response_arena_t *arena = NULL;
+  arena_block_t *block = NULL;
+
+  first_block = ALIGN_UP(first_block < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE
+                                                      : first_block);
+  arena = (response_arena_t *)mem_malloc(HEADER_SIZE + sizeof(arena_block_t) +
+                                     first_block);
+  if (arena == NULL) {
+    return NULL;
+  }
+
+  block = (arena_block_t *)((char *)arena + HEADER_SIZE);
+  block->next = NULL;
+  block->used = 0;
+  block->size = first_block;
+  arena->blocks = block;
+  arena->body = NULL;
+  arena->body_size = 0;
+  arena->body_capacity = 0;
+  arena->view_count = 0;
+  return arena;
+}
+
+void *response_arena_alloc(response_arena_t *arena, size_t size) {
+  arena_block_t *block = arena->blocks;
+  void *ptr = NULL;
+
+  size = ALIGN_UP(size == 0 ? 1 : size);
+  if (block->size - block->used < size) {
+    size_t block_size = block->size * 2;
+    if (block_size < size) {
+      block_size = size;
+    }
+    block = (arena_block_t *)mem_malloc(sizeof(arena_block_t) + block_size);
+    if (block == NULL) {
+      return NULL;
+    }
+    block->next = arena->blocks;
+    block->used = 0;
+    block->size = block_size;
+    arena->blocks = block;
+  }
+
+  ptr = (char *)block->data + block->used;
+  block->used += size;
+  return ptr;
+}
+
+char *response_arena_strdup(response_arena_t *arena, const char *value) {
+  size_t len = strlen(value) + 1;
+  char *copy = (char *)response_arena_alloc(arena, len);
+
+  if (copy != NULL) {
+    memcpy(copy, value, len);
+  }
+  return copy;
+}
+
+int response_arena_owns(const response_arena_t *arena, const void *ptr) {
+  const arena_block_t *block = NULL;
+  uintptr_t address = (uintptr_t)ptr;
+
+  if (arena == NULL || ptr == NULL) {
+    return 0;
+  }
+  if (arena->body != NULL && address >= (uintptr_t)arena->body &&
+      address <= (uintptr_t)arena->body + arena->body_size) {
+    return 1;
+  }
+
+  for (block = arena->blocks; block != NULL; block = block->next) {
+    uintptr_t start = (uintptr_t)block->data;
+    if (address >= start && address < start + block->size) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void response_arena_adopt(response_arena_t *arena, char *body, size_t size,
+                          size_t capacity) {
+  mem_free(arena->body);
+  arena->body = body;
+  arena->body_size = size;
+  arena->body_capacity = capacity;
+}
+
+char *response_arena_take_body(response_arena_t *arena, size_t *capacity) {
+  char *body = arena->body;
+
+  *capacity = arena->body_capacity;
+  arena->body = NULL;
+  arena->body_size = 0;
+  arena->body_capacity = 0;
+  return body;
+}
+
+int response_arena_set_length(response_arena_t *arena, const char *value,
+                              size_t length) {
+  if (arena->view_count == ARENA_VIEW_SLOTS) {
+    return -1;
+  }
+  arena->views[arena->view_count].data = value;
+  arena->views[arena->view_count].length = length;
+  arena->view_count++;
+  return 0;
+}
+
+int response_arena_length(const response_arena_t *arena, const char *value,
+                          size_t *length) {
+  size_t i;
+
+  for (i = 0; arena != NULL && i < arena->view_count; i++) {
+    if (arena->views[i].data == value) {
+      *length = arena->views[i].length;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+size_t response_arena_blocks(const response_arena_t *arena) {
+  const arena_block_t *block = NULL;
+  size_t count = 0;
+
+  for (block = arena != NULL ? arena->blocks : NULL; block != NULL;
+       block = block->next) {
+    count++;
+  }
+  return count;
+}
+
+void response_arena_reset(response_arena_t *arena) {
+  arena_block_t *block = NULL;
+  arena_block_t *first = NULL;
+  size_t total = 0;
+
+  mem_free(arena->body);
+  arena->body = NULL;
+  arena->body_size = 0;
+  arena->body_capacity = 0;
+  arena->view_count = 0;
+
+  /* the next response of this size fits one block without growing */
+  if (arena->blocks->next != NULL && arena->blocks->next->next != NULL) {
+    for (block = arena->blocks; block != NULL; block = block->next) {
+      total += block->size;
+    }
+    while (arena->blocks->next != NULL) {
+      block = arena->blocks;
+      arena->blocks = block->next;
+      mem_free(block);
+    }
+    first = (arena_block_t *)mem_malloc(sizeof(arena_block_t) + total);
+    if (first != NULL) {
+      first->next = arena->blocks;
+      first->size = total;
+      arena->blocks = first;
+    }
+  }
+
+  for (block = arena->blocks; block != NULL; block = block->next) {
+    block->used = 0;
+  }
+}
+
+void response_arena_free(response_arena_t *arena) {
+  arena_block_t *block = NULL;
+
+  if (arena == NULL) {
+    return;
+  }
+
+  mem_free(arena->body);
+  /* every block but the oldest was allocated on its own */
+  while (arena->blocks->next != NULL) {
+    block = arena->blocks;
+    arena->blocks = block->next;
+    mem_free(block);
+  }
+  mem_free(arena);
+}
+
+char *response_take_content(mistral_response_t *response) {
+  char *content = response->content;
+  size_t length = 0;
+
+  if (content != NULL && response_arena_owns(response->arena, content)) {
+    if (response_arena_length(response->arena, content, &length) != 0) {
+      length = strlen(content);
+    }
+    content = (char *)mem_malloc(length + 1);
+    if (content == NULL) {
+      return NULL;
+    }
+    memcpy(content, response->content, length + 1);
+  }
+  response->content = NULL;
+  return content;
+}
+
+response_arena_t *response_take_arena(mistral_response_t *response,
+                                      char **content) {
+  response_arena_t *arena = response->arena;
+  const arena_block_t *block = NULL;
+  char *id = NULL;
+  char *model = NULL;
+  size_t length = 0;
+  size_t footprint = 0;
+
+  if (response->content == NULL ||
+      !response_arena_owns(arena, response->content)) {
+    return NULL;
+  }
+  if (response_arena_length(arena, response->content, &length) != 0) {
+    length = strlen(response->content);
+  }
+  footprint = arena->body_capacity;
+  for (block = arena->blocks; block != NULL; block = block->next) {
+    footprint += block->size;
+  }
+  if (footprint > length * 2 + ADOPT_SLACK) {
+    return NULL;
+  }
+
+  if (response->id != NULL && response_arena_owns(arena, response->id)) {
+    id = mem_strdup(response->id);
+    if (id == NULL) {
+      return NULL;
+    }
+  }
+  if (response->model != NULL &&
+      response_arena_owns(arena, response->model)) {
+    model = mem_strdup(response->model);
+    if (model == NULL) {
+      mem_free(id);
+      return NULL;
+    }
+  }
+  if (id != NULL) {
+    response->id = id;
+  }
+  if (model != NULL) {
+    response->model = model;
+  }
+
+  *content = response->content;
+  response->content = NULL;
+  response->arena = NULL;
+  return arena;
+}
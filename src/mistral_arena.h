@@ -0,0 +1,98 @@
+#ifndef MISTRAL_ARENA_H
+#define MISTRAL_ARENA_H
+
+#include "../include/mistral.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* Bump allocator holding everything parsed into one response, released
+* with a single free. The first block shares the header's allocation.
+* Conversations keep their copied messages in one too
+*/
+typedef mistral_response_arena_t response_arena_t;
+
+/*
+* first_block: bytes expected, later blocks double as needed
+* Return NULL if out of memory
+*/
+response_arena_t *response_arena_create(size_t first_block);
+
+/*
+* Return size bytes aligned for any type, NULL if out of memory
+*/
+void *response_arena_alloc(response_arena_t *arena, size_t size);
+
+char *response_arena_strdup(response_arena_t *arena, const char *value);
+
+/*
+* Return 1 if ptr points into the arena, so it must not be freed alone
+*/
+int response_arena_owns(const response_arena_t *arena, const void *ptr);
+
+/*
+* Take ownership of a mem_malloc'd buffer of capacity bytes, like a
+* response body whose strings the response points into; owns() covers
+* body[0, size]
+*/
+void response_arena_adopt(response_arena_t *arena, char *body, size_t size,
+                          size_t capacity);
+
+/*
+* Give the adopted body back to the caller, for reuse as a receive buffer
+* Return NULL if there is none
+*/
+char *response_arena_take_body(response_arena_t *arena, size_t *capacity);
+
+/*
+* Record the length of a string that may hold NUL bytes, for id, model
+* and content
+* Return 0 if ok, -1 if all slots are used
+*/
+int response_arena_set_length(response_arena_t *arena, const char *value,
+                              size_t length);
+
+/*
+* Length recorded for value
+* Return 0 if found, -1 if none was recorded
+*/
+int response_arena_length(const response_arena_t *arena, const char *value,
+                          size_t *length);
+
+/*
+* Blocks handed out, for tests and benchmarks
+*/
+size_t response_arena_blocks(const response_arena_t *arena);
+
+/*
+* Forget everything allocated so the arena can hold the next response.
+* Grown blocks are merged into one as large as all of them together
+*/
+void response_arena_reset(response_arena_t *arena);
+
+void response_arena_free(response_arena_t *arena);
+
+/*
+* Detach response->content as a heap string the caller frees: moved when
+* it is already one, copied out of the arena otherwise
+* Return NULL if there is no content or out of memory
+*/
+char *response_take_content(mistral_response_t *response);
+
+/*
+* Detach the arena holding response->content, so the content is kept
+* without a copy; id and model move to the heap and content becomes NULL.
+* Refused when the arena is much larger than the content, like a reused
+* receive buffer of a bigger earlier reply
+* Return the arena with *content set, NULL to use response_take_content
+*/
+response_arena_t *response_take_arena(mistral_response_t *response,
+                                      char **content);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MISTRAL_ARENA_H */
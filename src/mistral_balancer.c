@@ -0,0 +1,319 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mistral_balancer.h"
+#include "mistral_alloc.h"
+#include "mistral_utils.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_BACKENDS 64
+#define MAX_BASE_URL_LEN 256
+#define MAX_API_KEY_LEN 400
+#define BASE_COOLDOWN_MS 1000.0
+#define MAX_COOLDOWN_MS 30000.0
+#define LATENCY_ALPHA 0.2
+
+struct pool_backend {
+  char *base_url;
+  char *api_key;
+  int weight;
+  int outstanding;
+  int consecutive_failures;
+  double cooldown_until;
+  double latency_ms;
+  unsigned long requests;
+  unsigned long failures;
+};
+
+struct mistral_backend_pool {
+  pthread_mutex_t lock;
+  mistral_balance_policy_t policy;
+  pool_backend_t *backends[MAX_BACKENDS];
+  int count;
+  uint64_t rng;
+};
+
+static uint64_t next_random(mistral_backend_pool_t *pool) {
+  /* xorshift64, only used to spread picks */
+  pool->rng ^= pool->rng << 13;
+  pool->rng ^= pool->rng >> 7;
+  pool->rng ^= pool->rng << 17;
+  return pool->rng;
+}
+
+static int is_available(const pool_backend_t *backend, double now) {
+  return backend->cooldown_until <= now;
+}
+
+/*
+* Lower is better: requests in flight per unit of weight. Idle backends tie,
+* so at low load the weighted random pick decides and traffic follows the
+* weights
+*/
+static double backend_score(const pool_backend_t *backend) {
+  return (double)backend->outstanding / (double)backend->weight;
+}
+
+static pool_backend_t *pick_weighted(mistral_backend_pool_t *pool,
+                                     double now, int total_weight) {
+  int target = (int)(next_random(pool) % (uint64_t)total_weight);
+  int i;
+
+  for (i = 0; i < pool->count; i++) {
+    if (!is_available(pool->backends[i], now)) {
+      continue;
+    }
+    target -= pool->backends[i]->weight;
+    if (target < 0) {
+      return pool->backends[i];
+    }
+  }
+  return NULL;
+}
+
+static pool_backend_t *pick_power_of_two(mistral_backend_pool_t *pool,
+                                         double now, int available,
+                                         int total_weight) {
+  pool_backend_t *first = pick_weighted(pool, now, total_weight);
+  pool_backend_t *second = NULL;
+  int tries = 0;
+
+  if (available == 1) {
+    return first;
+  }
+
+  do {
+    second = pick_weighted(pool, now, total_weight);
+  } while (second == first && ++tries < 4);
+
+  return backend_score(second) < backend_score(first) ? second : first;
+}
+
+static pool_backend_t *pick_least_outstanding(mistral_backend_pool_t *pool,
+                                              double now, int total_weight) {
+  pool_backend_t *best = pick_weighted(pool, now, total_weight);
+  int i;
+
+  for (i = 0; i < pool->count; i++) {
+    pool_backend_t *backend = pool->backends[i];
+    if (is_available(backend, now) &&
+        backend_score(backend) < backend_score(best)) {
+      best = backend;
+    }
+  }
+  return best;
+}
+
+mistral_backend_pool_t *
+mistral_backend_pool_create(mistral_balance_policy_t policy) {
+  mistral_backend_pool_t *pool = NULL;
+
+  if (policy != MISTRAL_BALANCE_P2C &&
+      policy != MISTRAL_BALANCE_LEAST_OUTSTANDING) {
+    fprintf(stderr, "invalid balance policy\n");
+    return NULL;
+  }
+
+  pool = (mistral_backend_pool_t *)mem_malloc(sizeof(mistral_backend_pool_t));
+  if (pool == NULL) {
+    fprintf(stderr, "failed to allocate memory for backend pool\n");
+    return NULL;
+  }
+
+  memset(pool, 0, sizeof(mistral_backend_pool_t));
+
+  if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+    fprintf(stderr, "failed to init backend pool mutex\n");
+    mem_free(pool);
+    return NULL;
+  }
+
+  pool->policy = policy;
+  pool->rng = hash_bytes(&pool, sizeof(pool), 0) ^ (uint64_t)monotonic_ms();
+  if (pool->rng == 0) {
+    pool->rng = 0x9e3779b97f4a7c15ULL;
+  }
+
+  return pool;
+}
+
+int mistral_backend_pool_add(mistral_backend_pool_t *pool,
+                             const char *base_url, const char *api_key,
+                             int weight) {
+  pool_backend_t *backend = NULL;
+  int index = -1;
+
+  if (pool == NULL || base_url == NULL || api_key == NULL || weight < 1 ||
+      strlen(base_url) == 0 || strlen(base_url) >= MAX_BASE_URL_LEN ||
+      strlen(api_key) == 0 || strlen(api_key) >= MAX_API_KEY_LEN) {
+    fprintf(stderr, "invalid backend parameters\n");
+    return -1;
+  }
+
+  backend = (pool_backend_t *)mem_calloc(1, sizeof(pool_backend_t));
+  if (backend == NULL) {
+    fprintf(stderr, "failed to allocate memory for backend\n");
+    return -1;
+  }
+
+  backend->base_url = mem_strdup(base_url);
+  backend->api_key = mem_strdup(api_key);
+  if (backend->base_url == NULL || backend->api_key == NULL) {
+    fprintf(stderr, "failed to duplicate backend parameters\n");
+    mem_free(backend->base_url);
+    mem_free(backend->api_key);
+    mem_free(backend);
+    return -1;
+  }
+  backend->weight = weight;
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->count < MAX_BACKENDS) {
+    index = pool->count;
+    pool->backends[pool->count++] = backend;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  if (index < 0) {
+    fprintf(stderr, "backend pool is full\n");
+    mem_free(backend->base_url);
+    mem_free(backend->api_key);
+    mem_free(backend);
+  }
+  return index;
+}
+
+int mistral_backend_pool_get_stats(mistral_backend_pool_t *pool, int index,
+                                   mistral_backend_stats_t *stats) {
+  pool_backend_t *backend = NULL;
+
+  if (pool == NULL || stats == NULL) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  if (index >= 0 && index < pool->count) {
+    backend = pool->backends[index];
+    stats->requests = backend->requests;
+    stats->failures = backend->failures;
+    stats->outstanding = backend->outstanding;
+    stats->healthy = is_available(backend, monotonic_ms());
+    stats->latency_ms = backend->latency_ms;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return backend != NULL ? 0 : -1;
+}
+
+void mistral_backend_pool_free(mistral_backend_pool_t *pool) {
+  int i;
+
+  if (pool != NULL) {
+    for (i = 0; i < pool->count; i++) {
+      mem_free(pool->backends[i]->base_url);
+      mem_free(pool->backends[i]->api_key);
+      mem_free(pool->backends[i]);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    mem_free(pool);
+  }
+}
+
+pool_backend_t *backend_pool_acquire(mistral_backend_pool_t *pool) {
+  pool_backend_t *backend = NULL;
+  double now = monotonic_ms();
+  int available = 0;
+  int total_weight = 0;
+  int i;
+
+  pthread_mutex_lock(&pool->lock);
+
+  for (i = 0; i < pool->count; i++) {
+    if (is_available(pool->backends[i], now)) {
+      available++;
+      total_weight += pool->backends[i]->weight;
+    }
+  }
+
+  if (available == 0) {
+    /* everything is cooling down, use whichever recovers first */
+    for (i = 0; i < pool->count; i++) {
+      if (backend == NULL ||
+          pool->backends[i]->cooldown_until < backend->cooldown_until) {
+        backend = pool->backends[i];
+      }
+    }
+  } else if (pool->policy == MISTRAL_BALANCE_LEAST_OUTSTANDING) {
+    backend = pick_least_outstanding(pool, now, total_weight);
+  } else {
+    backend = pick_power_of_two(pool, now, available, total_weight);
+  }
+
+  if (backend != NULL) {
+    backend->outstanding++;
+    backend->requests++;
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+  return backend;
+}
+
+const char *backend_base_url(const pool_backend_t *backend) {
+  return backend->base_url;
+}
+
+const char *backend_api_key(const pool_backend_t *backend) {
+  return backend->api_key;
+}
+
+void backend_pool_release(mistral_backend_pool_t *pool,
+                          pool_backend_t *backend, long http_code,
+                          double latency_ms) {
+  double cooldown = BASE_COOLDOWN_MS;
+  int i;
+
+  pthread_mutex_lock(&pool->lock);
+
+  backend->outstanding--;
+
+  /* 401 and 403 point at this backend's key, not at the request */
+  if (http_code == 0 || http_code == 401 || http_code == 403 ||
+      http_code == 429 || http_code >= 500) {
+    backend->failures++;
+    backend->consecutive_failures++;
+    for (i = 1; i < backend->consecutive_failures && cooldown < MAX_COOLDOWN_MS;
+         i++) {
+      cooldown *= 2.0;
+    }
+    if (cooldown > MAX_COOLDOWN_MS) {
+      cooldown = MAX_COOLDOWN_MS;
+    }
+    backend->cooldown_until = monotonic_ms() + cooldown;
+  } else if (http_code > 0) {
+    backend->consecutive_failures = 0;
+    backend->cooldown_until = 0.0;
+    if (backend->latency_ms == 0.0) {
+      backend->latency_ms = latency_ms;
+    } else {
+      backend->latency_ms += LATENCY_ALPHA * (latency_ms - backend->latency_ms);
+    }
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+}
+
+int backend_pool_available(mistral_backend_pool_t *pool) {
+  double now = monotonic_ms();
+  int available = 0;
+  int i;
+
+  pthread_mutex_lock(&pool->lock);
+  for (i = 0; i < pool->count && !available; i++) {
+    available = is_available(pool->backends[i], now);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return available;
+}
@@ -0,0 +1,40 @@
+#ifndef MISTRAL_BALANCER_H
+#define MISTRAL_BALANCER_H
+
+#include "../include/mistral.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pool_backend pool_backend_t;
+
+/*
+* Pick a backend for one attempt and count it as outstanding
+* Return backend to pass to backend_pool_release, NULL if the pool is empty
+*/
+pool_backend_t *backend_pool_acquire(mistral_backend_pool_t *pool);
+
+const char *backend_base_url(const pool_backend_t *backend);
+
+const char *backend_api_key(const pool_backend_t *backend);
+
+/*
+* Feed the outcome of the attempt
+* http_code: 0 if the transfer itself failed, -1 to only drop the
+* outstanding count (e.g. cancelled)
+*/
+void backend_pool_release(mistral_backend_pool_t *pool,
+                          pool_backend_t *backend, long http_code,
+                          double latency_ms);
+
+/*
+* Return 1 if some backend is not cooling down after a failure
+*/
+int backend_pool_available(mistral_backend_pool_t *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MISTRAL_BALANCER_H */
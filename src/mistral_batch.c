@@ -0,0 +1,162 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/mistral.h"
+#include "mistral_rate_limiter.h"
+#include "mistral_utils.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  const mistral_config_t *config;
+  const mistral_batch_item_t *items;
+  mistral_response_t *results;
+  const mistral_batch_options_t *options;
+  size_t count;
+  size_t next_index;
+  size_t completed;
+  size_t failed;
+  pthread_mutex_t lock;
+} batch_state_t;
+
+/*
+* Wait for the rate limiter, then send one item. config->deadline_ms spans
+* the wait and the call, config->cancel_token ends either
+* Return 0 if ok, -1 if the item failed
+*/
+static int batch_item(batch_state_t *state, size_t index) {
+  mistral_config_t call = *state->config;
+  mistral_response_t *result = &state->results[index];
+  double deadline = call.deadline_ms > 0
+                        ? monotonic_ms() + call.deadline_ms
+                        : 0.0;
+
+  if (state->options != NULL &&
+      rate_limiter_acquire_until(state->options->rate_limiter, deadline,
+                                 call.cancel_token) != 0) {
+    if (mistral_cancel_token_is_cancelled(call.cancel_token)) {
+      set_error_message(result, "request cancelled");
+      result->error_code = MISTRAL_ERR_CANCELLED;
+    } else {
+      set_error_message(result, "request timed out");
+      result->error_code = MISTRAL_ERR_TIMEOUT;
+    }
+    return -1;
+  }
+
+  if (deadline > 0.0) {
+    call.deadline_ms = (int)(deadline - monotonic_ms());
+    if (call.deadline_ms < 1) {
+      call.deadline_ms = 1;
+    }
+  }
+
+  return mistral_chat_completions(&call, state->items[index].messages,
+                                  state->items[index].message_count, result);
+}
+
+static void *batch_worker(void *arg) {
+  batch_state_t *state = (batch_state_t *)arg;
+
+  for (;;) {
+    size_t index = 0;
+    int ret = -1;
+
+    /* items not taken yet are failed by mistral_chat_completions_batch */
+    pthread_mutex_lock(&state->lock);
+    if (state->next_index >= state->count ||
+        mistral_cancel_token_is_cancelled(state->config->cancel_token)) {
+      pthread_mutex_unlock(&state->lock);
+      break;
+    }
+    index = state->next_index++;
+    pthread_mutex_unlock(&state->lock);
+
+    ret = batch_item(state, index);
+
+    pthread_mutex_lock(&state->lock);
+    state->completed++;
+    if (ret != 0) {
+      state->failed++;
+    }
+    if (state->options != NULL && state->options->on_progress != NULL) {
+      state->options->on_progress(state->completed, state->count, index,
+                                  &state->results[index],
+                                  state->options->user_data);
+    }
+    pthread_mutex_unlock(&state->lock);
+  }
+
+  return NULL;
+}
+
+int mistral_chat_completions_batch(const mistral_config_t *config,
+                                   const mistral_batch_item_t *conversations,
+                                   size_t count, int max_in_flight,
+                                   mistral_response_t *results,
+                                   const mistral_batch_options_t *options) {
+  batch_state_t state;
+  pthread_t threads[MISTRAL_BATCH_MAX_IN_FLIGHT];
+  size_t thread_count = 0;
+  size_t started = 0;
+  size_t i;
+
+  if (config == NULL || conversations == NULL || count == 0 ||
+      max_in_flight < 1 || results == NULL) {
+    fprintf(stderr, "invalid arguments to mistral_chat_completions_batch\n");
+    return -1;
+  }
+
+  /* with reuse_responses the last batch's results keep their arenas */
+  for (i = 0; i < count; i++) {
+    response_begin(config, &results[i]);
+  }
+  memset(&state, 0, sizeof(state));
+
+  state.config = config;
+  state.items = conversations;
+  state.results = results;
+  state.options = options;
+  state.count = count;
+
+  if (pthread_mutex_init(&state.lock, NULL) != 0) {
+    fprintf(stderr, "failed to init batch mutex\n");
+    return -1;
+  }
+
+  thread_count = (size_t)max_in_flight;
+  if (thread_count > MISTRAL_BATCH_MAX_IN_FLIGHT) {
+    thread_count = MISTRAL_BATCH_MAX_IN_FLIGHT;
+  }
+  if (thread_count > count) {
+    thread_count = count;
+  }
+
+  for (i = 0; i < thread_count; i++) {
+    if (pthread_create(&threads[i], NULL, batch_worker, &state) != 0) {
+      fprintf(stderr, "failed to start batch worker %zu\n", i);
+      break;
+    }
+    started++;
+  }
+
+  /* no worker thread, run the batch inline */
+  if (started == 0) {
+    batch_worker(&state);
+  }
+
+  for (i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  for (i = state.next_index; i < count; i++) {
+    set_error_message(&results[i], "request cancelled");
+    results[i].error_code = MISTRAL_ERR_CANCELLED;
+    state.failed++;
+  }
+
+  pthread_mutex_destroy(&state.lock);
+
+  return state.failed == 0 ? 0 : -1;
+}
@@ -0,0 +1,247 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mistral_breaker.h"
+#include "mistral_alloc.h"
+#include "mistral_utils.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_BREAKER_WINDOW 1024
+
+typedef struct circuit {
+  char *endpoint;
+  char *model;
+  mistral_circuit_state_t state;
+  unsigned char *outcomes;
+  int outcome_count;
+  int outcome_next;
+  int failures;
+  double opened_at_ms;
+  int probe_in_flight;
+  struct circuit *next;
+} circuit_t;
+
+struct mistral_circuit_breaker {
+  pthread_mutex_t lock;
+  circuit_t *circuits;
+  double failure_rate;
+  int window_size;
+  int open_ms;
+  int slow_call_ms;
+};
+
+static circuit_t *find_circuit(mistral_circuit_breaker_t *breaker,
+                               const char *endpoint, const char *model,
+                               int create) {
+  circuit_t *circuit = NULL;
+
+  for (circuit = breaker->circuits; circuit != NULL; circuit = circuit->next) {
+    if (strcmp(circuit->endpoint, endpoint) == 0 &&
+        strcmp(circuit->model, model) == 0) {
+      return circuit;
+    }
+  }
+
+  if (!create) {
+    return NULL;
+  }
+
+  circuit = (circuit_t *)mem_calloc(1, sizeof(circuit_t));
+  if (circuit == NULL) {
+    return NULL;
+  }
+
+  circuit->endpoint = mem_strdup(endpoint);
+  circuit->model = mem_strdup(model);
+  circuit->outcomes =
+      (unsigned char *)mem_calloc((size_t)breaker->window_size, 1);
+  if (circuit->endpoint == NULL || circuit->model == NULL ||
+      circuit->outcomes == NULL) {
+    mem_free(circuit->endpoint);
+    mem_free(circuit->model);
+    mem_free(circuit->outcomes);
+    mem_free(circuit);
+    return NULL;
+  }
+
+  circuit->next = breaker->circuits;
+  breaker->circuits = circuit;
+  return circuit;
+}
+
+static void reset_window(circuit_t *circuit) {
+  circuit->outcome_count = 0;
+  circuit->outcome_next = 0;
+  circuit->failures = 0;
+}
+
+static void open_circuit(circuit_t *circuit) {
+  circuit->state = MISTRAL_CIRCUIT_OPEN;
+  circuit->opened_at_ms = monotonic_ms();
+  circuit->probe_in_flight = 0;
+}
+
+mistral_circuit_breaker_t *mistral_circuit_breaker_create(double failure_rate,
+                                                          int window_size,
+                                                          int open_ms,
+                                                          int slow_call_ms) {
+  mistral_circuit_breaker_t *breaker = NULL;
+
+  if (failure_rate <= 0.0 || failure_rate > 1.0 || window_size < 1 ||
+      window_size > MAX_BREAKER_WINDOW || open_ms < 1 || slow_call_ms < 0) {
+    fprintf(stderr, "invalid circuit breaker parameters\n");
+    return NULL;
+  }
+
+  breaker = (mistral_circuit_breaker_t *)mem_malloc(
+      sizeof(mistral_circuit_breaker_t));
+  if (breaker == NULL) {
+    fprintf(stderr, "failed to allocate memory for circuit breaker\n");
+    return NULL;
+  }
+
+  memset(breaker, 0, sizeof(mistral_circuit_breaker_t));
+
+  if (pthread_mutex_init(&breaker->lock, NULL) != 0) {
+    fprintf(stderr, "failed to init circuit breaker mutex\n");
+    mem_free(breaker);
+    return NULL;
+  }
+
+  breaker->failure_rate = failure_rate;
+  breaker->window_size = window_size;
+  breaker->open_ms = open_ms;
+  breaker->slow_call_ms = slow_call_ms;
+
+  return breaker;
+}
+
+mistral_circuit_state_t
+mistral_circuit_breaker_get_state(mistral_circuit_breaker_t *breaker,
+                                  const char *endpoint, const char *model) {
+  mistral_circuit_state_t state = MISTRAL_CIRCUIT_CLOSED;
+  circuit_t *circuit = NULL;
+
+  if (breaker == NULL || endpoint == NULL || model == NULL) {
+    return MISTRAL_CIRCUIT_CLOSED;
+  }
+
+  pthread_mutex_lock(&breaker->lock);
+  circuit = find_circuit(breaker, endpoint, model, 0);
+  if (circuit != NULL) {
+    state = circuit->state;
+    if (state == MISTRAL_CIRCUIT_OPEN &&
+        monotonic_ms() - circuit->opened_at_ms >= breaker->open_ms) {
+      state = MISTRAL_CIRCUIT_HALF_OPEN;
+    }
+  }
+  pthread_mutex_unlock(&breaker->lock);
+
+  return state;
+}
+
+void mistral_circuit_breaker_free(mistral_circuit_breaker_t *breaker) {
+  circuit_t *circuit = NULL;
+
+  if (breaker != NULL) {
+    while (breaker->circuits != NULL) {
+      circuit = breaker->circuits;
+      breaker->circuits = circuit->next;
+      mem_free(circuit->endpoint);
+      mem_free(circuit->model);
+      mem_free(circuit->outcomes);
+      mem_free(circuit);
+    }
+    pthread_mutex_destroy(&breaker->lock);
+    mem_free(breaker);
+  }
+}
+
+int breaker_allow(mistral_circuit_breaker_t *breaker, const char *endpoint,
+                  const char *model, int *probe) {
+  circuit_t *circuit = NULL;
+  int allowed = 1;
+
+  *probe = 0;
+
+  pthread_mutex_lock(&breaker->lock);
+
+  circuit = find_circuit(breaker, endpoint, model, 1);
+  if (circuit != NULL) {
+    if (circuit->state == MISTRAL_CIRCUIT_OPEN &&
+        monotonic_ms() - circuit->opened_at_ms >= breaker->open_ms) {
+      circuit->state = MISTRAL_CIRCUIT_HALF_OPEN;
+    }
+
+    if (circuit->state == MISTRAL_CIRCUIT_OPEN) {
+      allowed = 0;
+    } else if (circuit->state == MISTRAL_CIRCUIT_HALF_OPEN) {
+      allowed = !circuit->probe_in_flight;
+      circuit->probe_in_flight = 1;
+      *probe = allowed;
+    }
+  }
+
+  pthread_mutex_unlock(&breaker->lock);
+  return allowed;
+}
+
+void breaker_record(mistral_circuit_breaker_t *breaker, const char *endpoint,
+                    const char *model, int probe, long http_code,
+                    double latency_ms) {
+  circuit_t *circuit = NULL;
+  int failed = http_code == 0 || http_code >= 500 ||
+               (breaker->slow_call_ms > 0 && latency_ms > breaker->slow_call_ms);
+
+  pthread_mutex_lock(&breaker->lock);
+
+  circuit = find_circuit(breaker, endpoint, model, 0);
+  if (circuit == NULL) {
+    pthread_mutex_unlock(&breaker->lock);
+    return;
+  }
+
+  /* an attempt sent before the circuit opened says nothing of now */
+  if (circuit->state == MISTRAL_CIRCUIT_HALF_OPEN && probe) {
+    if (failed) {
+      open_circuit(circuit);
+    } else {
+      circuit->state = MISTRAL_CIRCUIT_CLOSED;
+      reset_window(circuit);
+    }
+    circuit->probe_in_flight = 0;
+  } else if (circuit->state == MISTRAL_CIRCUIT_CLOSED) {
+    if (circuit->outcome_count == breaker->window_size) {
+      circuit->failures -= circuit->outcomes[circuit->outcome_next];
+    } else {
+      circuit->outcome_count++;
+    }
+    circuit->outcomes[circuit->outcome_next] = (unsigned char)failed;
+    circuit->failures += failed;
+    circuit->outcome_next = (circuit->outcome_next + 1) % breaker->window_size;
+
+    if (circuit->outcome_count == breaker->window_size &&
+        (double)circuit->failures >=
+            breaker->failure_rate * (double)breaker->window_size) {
+      open_circuit(circuit);
+      reset_window(circuit);
+    }
+  }
+
+  pthread_mutex_unlock(&breaker->lock);
+}
+
+void breaker_release(mistral_circuit_breaker_t *breaker, const char *endpoint,
+                     const char *model, int probe) {
+  circuit_t *circuit = NULL;
+
+  pthread_mutex_lock(&breaker->lock);
+  circuit = find_circuit(breaker, endpoint, model, 0);
+  if (circuit != NULL && circuit->state == MISTRAL_CIRCUIT_HALF_OPEN &&
+      probe) {
+    circuit->probe_in_flight = 0;
+  }
+  pthread_mutex_unlock(&breaker->lock);
+}
@@ -0,0 +1,40 @@
+#ifndef MISTRAL_BREAKER_H
+#define MISTRAL_BREAKER_H
+
+#include "../include/mistral.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* Return 1 if an attempt may be sent, 0 if the circuit is open
+* probe: set to 1 if the attempt is the half-open probe, 0 otherwise; pass
+* it on to breaker_record or breaker_release
+*/
+int breaker_allow(mistral_circuit_breaker_t *breaker, const char *endpoint,
+                  const char *model, int *probe);
+
+/*
+* Record the outcome of an attempt let through by breaker_allow
+* Only the probe moves a half-open circuit, other outcomes arriving then
+* are dropped
+* http_code: 0 if the transfer itself failed
+*/
+void breaker_record(mistral_circuit_breaker_t *breaker, const char *endpoint,
+                    const char *model, int probe, long http_code,
+                    double latency_ms);
+
+/*
+* Give back an attempt let through by breaker_allow that was never sent
+* or was cancelled, without counting it; frees the half-open probe if the
+* attempt was the probe
+*/
+void breaker_release(mistral_circuit_breaker_t *breaker, const char *endpoint,
+                     const char *model, int probe);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MISTRAL_BREAKER_H */
@@ -0,0 +1,610 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mistral_cache.h"
+#include "mistral_alloc.h"
+#include "mistral_utils.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CACHE_FILE_MAGIC "MCACHE1\n"
+#define CACHE_MIN_BUCKETS 64
+/* rewrite the backing file once it holds this many times the live bytes */
+#define CACHE_COMPACT_RATIO 2
+
+typedef struct cache_entry {
+  uint64_t hash;
+  char *key;
+  size_t key_len;
+  char *id;
+  char *model;
+  char *content;
+  int prompt_tokens;
+  int completion_tokens;
+  int total_tokens;
+  long long expires_at;
+  size_t bytes;
+  struct cache_entry *bucket_next;
+  struct cache_entry *lru_prev;
+  struct cache_entry *lru_next;
+} cache_entry_t;
+
+/* fixed-size part of a record in the backing file */
+typedef struct {
+  unsigned int key_len;
+  unsigned int id_len;
+  unsigned int model_len;
+  unsigned int content_len;
+  int prompt_tokens;
+  int completion_tokens;
+  int total_tokens;
+  long long expires_at;
+} cache_record_t;
+
+struct mistral_response_cache {
+  pthread_mutex_t lock;
+  cache_entry_t **buckets;
+  size_t bucket_count;
+  cache_entry_t *lru_head;
+  cache_entry_t *lru_tail;
+  size_t entries;
+  size_t bytes;
+  size_t max_bytes;
+  int ttl_sec;
+  FILE *backing;
+  char *backing_path;
+  /* bytes written to backing since it was last compacted */
+  size_t backing_bytes;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+};
+
+static char *build_key(const char *endpoint, const char *request_json,
+                       size_t *key_len) {
+  size_t endpoint_len = strlen(endpoint);
+  size_t json_len = strlen(request_json);
+  char *key = (char *)mem_malloc(endpoint_len + json_len + 2);
+
+  if (key == NULL) {
+    return NULL;
+  }
+
+  memcpy(key, endpoint, endpoint_len);
+  key[endpoint_len] = '\n';
+  memcpy(key + endpoint_len + 1, request_json, json_len + 1);
+  *key_len = endpoint_len + json_len + 1;
+  return key;
+}
+
+static char *dup_or_null(const char *value) {
+  return value != NULL ? mem_strdup(value) : NULL;
+}
+
+static void entry_free(cache_entry_t *entry) {
+  mem_free(entry->key);
+  mem_free(entry->id);
+  mem_free(entry->model);
+  mem_free(entry->content);
+  mem_free(entry);
+}
+
+static void lru_unlink(mistral_response_cache_t *cache, cache_entry_t *entry) {
+  if (entry->lru_prev != NULL) {
+    entry->lru_prev->lru_next = entry->lru_next;
+  } else {
+    cache->lru_head = entry->lru_next;
+  }
+  if (entry->lru_next != NULL) {
+    entry->lru_next->lru_prev = entry->lru_prev;
+  } else {
+    cache->lru_tail = entry->lru_prev;
+  }
+  entry->lru_prev = NULL;
+  entry->lru_next = NULL;
+}
+
+static void lru_push_front(mistral_response_cache_t *cache,
+                           cache_entry_t *entry) {
+  entry->lru_prev = NULL;
+  entry->lru_next = cache->lru_head;
+  if (cache->lru_head != NULL) {
+    cache->lru_head->lru_prev = entry;
+  }
+  cache->lru_head = entry;
+  if (cache->lru_tail == NULL) {
+    cache->lru_tail = entry;
+  }
+}
+
+static cache_entry_t *find_entry(mistral_response_cache_t *cache,
+                                 uint64_t hash, const char *key,
+                                 size_t key_len) {
+  cache_entry_t *entry = cache->buckets[hash & (cache->bucket_count - 1)];
+
+  while (entry != NULL) {
+    if (entry->hash == hash && entry->key_len == key_len &&
+        memcmp(entry->key, key, key_len) == 0) {
+      return entry;
+    }
+    entry = entry->bucket_next;
+  }
+  return NULL;
+}
+
+static void remove_entry(mistral_response_cache_t *cache,
+                         cache_entry_t *entry) {
+  cache_entry_t **link =
+      &cache->buckets[entry->hash & (cache->bucket_count - 1)];
+
+  while (*link != NULL) {
+    if (*link == entry) {
+      *link = entry->bucket_next;
+      break;
+    }
+    link = &(*link)->bucket_next;
+  }
+
+  lru_unlink(cache, entry);
+  cache->entries--;
+  cache->bytes -= entry->bytes;
+  entry_free(entry);
+}
+
+static void grow_buckets(mistral_response_cache_t *cache) {
+  size_t new_count = cache->bucket_count * 2;
+  cache_entry_t **buckets = NULL;
+  size_t i;
+
+  buckets = (cache_entry_t **)mem_calloc(new_count, sizeof(cache_entry_t *));
+  if (buckets == NULL) {
+    return;
+  }
+
+  for (i = 0; i < cache->bucket_count; i++) {
+    cache_entry_t *entry = cache->buckets[i];
+    while (entry != NULL) {
+      cache_entry_t *next = entry->bucket_next;
+      size_t slot = entry->hash & (new_count - 1);
+      entry->bucket_next = buckets[slot];
+      buckets[slot] = entry;
+      entry = next;
+    }
+  }
+
+  mem_free(cache->buckets);
+  cache->buckets = buckets;
+  cache->bucket_count = new_count;
+}
+
+/* takes ownership of entry, frees it if it can never fit */
+static void insert_entry(mistral_response_cache_t *cache,
+                         cache_entry_t *entry) {
+  cache_entry_t *old = NULL;
+  size_t slot = 0;
+
+  if (entry->bytes > cache->max_bytes) {
+    entry_free(entry);
+    return;
+  }
+
+  old = find_entry(cache, entry->hash, entry->key, entry->key_len);
+  if (old != NULL) {
+    remove_entry(cache, old);
+  }
+
+  while (cache->bytes + entry->bytes > cache->max_bytes &&
+         cache->lru_tail != NULL) {
+    remove_entry(cache, cache->lru_tail);
+    cache->evictions++;
+  }
+
+  if (cache->entries >= cache->bucket_count) {
+    grow_buckets(cache);
+  }
+
+  slot = entry->hash & (cache->bucket_count - 1);
+  entry->bucket_next = cache->buckets[slot];
+  cache->buckets[slot] = entry;
+  lru_push_front(cache, entry);
+  cache->entries++;
+  cache->bytes += entry->bytes;
+}
+
+static size_t entry_bytes(const cache_entry_t *entry) {
+  return sizeof(cache_entry_t) + entry->key_len + 1 +
+         (entry->id != NULL ? strlen(entry->id) + 1 : 0) +
+         (entry->model != NULL ? strlen(entry->model) + 1 : 0) +
+         (entry->content != NULL ? strlen(entry->content) + 1 : 0);
+}
+
+static int write_field(FILE *file, const char *value, unsigned int len) {
+  return len == 0 || fwrite(value, 1, len, file) == len ? 0 : -1;
+}
+
+/*
+* Write one record, the caller flushes
+* Return bytes written, 0 if error
+*/
+static size_t append_record(FILE *file, const cache_entry_t *entry) {
+  cache_record_t record;
+
+  memset(&record, 0, sizeof(record));
+  record.key_len = (unsigned int)entry->key_len;
+  record.id_len = entry->id != NULL ? (unsigned int)strlen(entry->id) : 0;
+  record.model_len =
+      entry->model != NULL ? (unsigned int)strlen(entry->model) : 0;
+  record.content_len =
+      entry->content != NULL ? (unsigned int)strlen(entry->content) : 0;
+  record.prompt_tokens = entry->prompt_tokens;
+  record.completion_tokens = entry->completion_tokens;
+  record.total_tokens = entry->total_tokens;
+  record.expires_at = entry->expires_at;
+
+  if (fwrite(&record, sizeof(record), 1, file) != 1 ||
+      write_field(file, entry->key, record.key_len) != 0 ||
+      write_field(file, entry->id, record.id_len) != 0 ||
+      write_field(file, entry->model, record.model_len) != 0 ||
+      write_field(file, entry->content, record.content_len) != 0) {
+    fprintf(stderr, "failed to write response cache record\n");
+    return 0;
+  }
+  return sizeof(record) + record.key_len + record.id_len + record.model_len +
+         record.content_len;
+}
+
+static char *read_field(FILE *file, unsigned int len) {
+  char *value = NULL;
+
+  if (len == 0) {
+    return NULL;
+  }
+
+  value = (char *)mem_malloc((size_t)len + 1);
+  if (value == NULL) {
+    return NULL;
+  }
+
+  if (fread(value, 1, len, file) != len) {
+    mem_free(value);
+    return NULL;
+  }
+  value[len] = '\0';
+  return value;
+}
+
+/*
+* Load the live entries of path, a missing or empty file holds none
+* Return 0 if ok, -1 if path is not a response cache file
+*/
+static int load_backing_file(mistral_response_cache_t *cache,
+                             const char *path) {
+  char magic[sizeof(CACHE_FILE_MAGIC) - 1];
+  cache_record_t record;
+  long long now = (long long)time(NULL);
+  FILE *file = fopen(path, "rb");
+  cache_entry_t *entry = NULL;
+  long size = 0;
+  size_t fields = 0;
+
+  if (file == NULL) {
+    return 0;
+  }
+  if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0 ||
+      fseek(file, 0, SEEK_SET) != 0) {
+    fprintf(stderr, "failed to read response cache file %s\n", path);
+    fclose(file);
+    return -1;
+  }
+  if (size == 0) {
+    fclose(file);
+    return 0;
+  }
+
+  if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+      memcmp(magic, CACHE_FILE_MAGIC, sizeof(magic)) != 0) {
+    fprintf(stderr, "ignoring invalid response cache file %s\n", path);
+    fclose(file);
+    return -1;
+  }
+
+  while (fread(&record, sizeof(record), 1, file) == 1) {
+    /* a corrupt length must not turn into a huge allocation */
+    fields = (size_t)record.key_len + record.id_len + record.model_len +
+             record.content_len;
+    if (record.key_len > cache->max_bytes || record.id_len > cache->max_bytes ||
+        record.model_len > cache->max_bytes ||
+        record.content_len > cache->max_bytes ||
+        fields > (size_t)(size - ftell(file))) {
+      fprintf(stderr, "ignoring corrupt response cache records in %s\n",
+              path);
+      break;
+    }
+
+    entry = (cache_entry_t *)mem_calloc(1, sizeof(cache_entry_t));
+    if (entry == NULL) {
+      break;
+    }
+
+    entry->key = read_field(file, record.key_len);
+    entry->id = read_field(file, record.id_len);
+    entry->model = read_field(file, record.model_len);
+    entry->content = read_field(file, record.content_len);
+    if (entry->key == NULL ||
+        (record.id_len > 0 && entry->id == NULL) ||
+        (record.model_len > 0 && entry->model == NULL) ||
+        (record.content_len > 0 && entry->content == NULL)) {
+      entry_free(entry);
+      break;
+    }
+
+    if (record.expires_at != 0 && record.expires_at <= now) {
+      entry_free(entry);
+      continue;
+    }
+
+    entry->key_len = record.key_len;
+    entry->hash = hash_bytes(entry->key, entry->key_len, 0);
+    entry->prompt_tokens = record.prompt_tokens;
+    entry->completion_tokens = record.completion_tokens;
+    entry->total_tokens = record.total_tokens;
+    entry->expires_at = record.expires_at;
+    entry->bytes = entry_bytes(entry);
+    insert_entry(cache, entry);
+  }
+
+  fclose(file);
+  return 0;
+}
+
+/*
+* Write the live entries, oldest first, to <path>.tmp and rename it over
+* the backing file, which then takes the appends. The old file is whole
+* until the rename, so a crash or a failed write loses nothing
+* Return 0 if ok, -1 if the old file was kept
+*/
+static int compact_backing_file(mistral_response_cache_t *cache) {
+  cache_entry_t *entry = NULL;
+  size_t path_len = strlen(cache->backing_path);
+  size_t written = sizeof(CACHE_FILE_MAGIC) - 1;
+  size_t bytes = 0;
+  char *tmp_path = NULL;
+  FILE *file = NULL;
+  int failed = 0;
+
+  tmp_path = (char *)mem_malloc(path_len + sizeof(".tmp"));
+  if (tmp_path == NULL) {
+    fprintf(stderr, "failed to allocate memory for response cache\n");
+    return -1;
+  }
+  memcpy(tmp_path, cache->backing_path, path_len);
+  memcpy(tmp_path + path_len, ".tmp", sizeof(".tmp"));
+
+  file = fopen(tmp_path, "wb");
+  if (file == NULL) {
+    fprintf(stderr, "failed to open response cache file %s\n", tmp_path);
+    mem_free(tmp_path);
+    cache->backing_bytes = cache->bytes;
+    return -1;
+  }
+
+  failed = fwrite(CACHE_FILE_MAGIC, 1, written, file) != written;
+  for (entry = cache->lru_tail; entry != NULL && !failed;
+       entry = entry->lru_prev) {
+    bytes = append_record(file, entry);
+    failed = bytes == 0;
+    written += bytes;
+  }
+
+  /* fclose does the one flush and reports a write that failed in it */
+  if (fclose(file) != 0 || failed ||
+      rename(tmp_path, cache->backing_path) != 0) {
+    fprintf(stderr, "failed to compact response cache file %s\n",
+            cache->backing_path);
+    remove(tmp_path);
+    mem_free(tmp_path);
+    /* try again once the file has grown as much again */
+    cache->backing_bytes = cache->bytes;
+    return -1;
+  }
+  mem_free(tmp_path);
+
+  if (cache->backing != NULL) {
+    fclose(cache->backing);
+  }
+  cache->backing = fopen(cache->backing_path, "ab");
+  cache->backing_bytes = written;
+  if (cache->backing == NULL) {
+    fprintf(stderr, "failed to open response cache file %s\n",
+            cache->backing_path);
+    return -1;
+  }
+  return 0;
+}
+
+mistral_response_cache_t *mistral_response_cache_create(
+    size_t max_bytes, int ttl_sec, const char *backing_file) {
+  mistral_response_cache_t *cache = NULL;
+
+  if (max_bytes == 0 || ttl_sec < 0) {
+    fprintf(stderr, "invalid response cache parameters\n");
+    return NULL;
+  }
+
+  cache =
+      (mistral_response_cache_t *)mem_malloc(sizeof(mistral_response_cache_t));
+  if (cache == NULL) {
+    fprintf(stderr, "failed to allocate memory for response cache\n");
+    return NULL;
+  }
+
+  memset(cache, 0, sizeof(mistral_response_cache_t));
+
+  cache->bucket_count = CACHE_MIN_BUCKETS;
+  cache->buckets = (cache_entry_t **)mem_calloc(cache->bucket_count,
+                                               sizeof(cache_entry_t *));
+  if (cache->buckets == NULL) {
+    fprintf(stderr, "failed to allocate memory for response cache\n");
+    mem_free(cache);
+    return NULL;
+  }
+
+  if (pthread_mutex_init(&cache->lock, NULL) != 0) {
+    fprintf(stderr, "failed to init response cache mutex\n");
+    mem_free(cache->buckets);
+    mem_free(cache);
+    return NULL;
+  }
+
+  cache->max_bytes = max_bytes;
+  cache->ttl_sec = ttl_sec;
+
+  if (backing_file != NULL) {
+    cache->backing_path = mem_strdup(backing_file);
+    if (cache->backing_path == NULL) {
+      fprintf(stderr, "failed to allocate memory for response cache\n");
+      pthread_mutex_destroy(&cache->lock);
+      mem_free(cache->buckets);
+      mem_free(cache);
+      return NULL;
+    }
+    /* never overwrite a file that is not a cache file, stay in memory */
+    if (load_backing_file(cache, backing_file) == 0) {
+      compact_backing_file(cache);
+    }
+  }
+
+  return cache;
+}
+
+void mistral_response_cache_get_stats(mistral_response_cache_t *cache,
+                                      mistral_response_cache_stats_t *stats) {
+  if (cache == NULL || stats == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  stats->hits = cache->hits;
+  stats->misses = cache->misses;
+  stats->evictions = cache->evictions;
+  stats->entries = cache->entries;
+  stats->bytes = cache->bytes;
+  pthread_mutex_unlock(&cache->lock);
+}
+
+void mistral_response_cache_free(mistral_response_cache_t *cache) {
+  if (cache != NULL) {
+    while (cache->lru_head != NULL) {
+      remove_entry(cache, cache->lru_head);
+    }
+    if (cache->backing != NULL) {
+      fclose(cache->backing);
+    }
+    mem_free(cache->backing_path);
+    mem_free(cache->buckets);
+    pthread_mutex_destroy(&cache->lock);
+    mem_free(cache);
+  }
+}
+
+int response_cache_lookup(mistral_response_cache_t *cache,
+                          const char *endpoint, const char *request_json,
+                          mistral_response_t *response) {
+  cache_entry_t *entry = NULL;
+  size_t key_len = 0;
+  char *key = build_key(endpoint, request_json, &key_len);
+  uint64_t hash = 0;
+  int ret = -1;
+
+  if (key == NULL) {
+    return -1;
+  }
+  hash = hash_bytes(key, key_len, 0);
+
+  pthread_mutex_lock(&cache->lock);
+
+  entry = find_entry(cache, hash, key, key_len);
+  if (entry != NULL && entry->expires_at != 0 &&
+      entry->expires_at <= (long long)time(NULL)) {
+    remove_entry(cache, entry);
+    entry = NULL;
+  }
+
+  if (entry != NULL) {
+    response->id = dup_or_null(entry->id);
+    response->model = dup_or_null(entry->model);
+    response->content = dup_or_null(entry->content);
+    if ((entry->id != NULL && response->id == NULL) ||
+        (entry->model != NULL && response->model == NULL) ||
+        (entry->content != NULL && response->content == NULL)) {
+      /* the caller's arena stays, it may be reused */
+      mistral_response_reset(response);
+    } else {
+      response->prompt_tokens = entry->prompt_tokens;
+      response->completion_tokens = entry->completion_tokens;
+      response->total_tokens = entry->total_tokens;
+      response->http_code = 200;
+      response->error_code = MISTRAL_OK;
+      response->cached = 1;
+      lru_unlink(cache, entry);
+      lru_push_front(cache, entry);
+      cache->hits++;
+      ret = 0;
+    }
+  } else {
+    cache->misses++;
+  }
+
+  pthread_mutex_unlock(&cache->lock);
+  mem_free(key);
+  return ret;
+}
+
+void response_cache_store(mistral_response_cache_t *cache,
+                          const char *endpoint, const char *request_json,
+                          const mistral_response_t *response) {
+  cache_entry_t *entry = NULL;
+
+  if (response->content == NULL) {
+    return;
+  }
+
+  entry = (cache_entry_t *)mem_calloc(1, sizeof(cache_entry_t));
+  if (entry == NULL) {
+    return;
+  }
+
+  entry->key = build_key(endpoint, request_json, &entry->key_len);
+  entry->id = dup_or_null(response->id);
+  entry->model = dup_or_null(response->model);
+  entry->content = mem_strdup(response->content);
+  if (entry->key == NULL || entry->content == NULL ||
+      (response->id != NULL && entry->id == NULL) ||
+      (response->model != NULL && entry->model == NULL)) {
+    entry_free(entry);
+    return;
+  }
+
+  entry->hash = hash_bytes(entry->key, entry->key_len, 0);
+  entry->prompt_tokens = response->prompt_tokens;
+  entry->completion_tokens = response->completion_tokens;
+  entry->total_tokens = response->total_tokens;
+  entry->expires_at =
+      cache->ttl_sec > 0 ? (long long)time(NULL) + cache->ttl_sec : 0;
+  entry->bytes = entry_bytes(entry);
+
+  pthread_mutex_lock(&cache->lock);
+  if (cache->backing != NULL && entry->bytes <= cache->max_bytes) {
+    cache->backing_bytes += append_record(cache->backing, entry);
+    fflush(cache->backing);
+  }
+  insert_entry(cache, entry);
+  /* overwrites and evictions only append, so the file outgrows the cache */
+  if (cache->backing != NULL &&
+      cache->backing_bytes > CACHE_COMPACT_RATIO * cache->bytes) {
+    compact_backing_file(cache);
+  }
+  pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,29 @@
+#ifndef MISTRAL_CACHE_H
+#define MISTRAL_CACHE_H
+
+#include "../include/mistral.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* Fill response from cache
+* Return 0 on hit, -1 on miss
+*/
+int response_cache_lookup(mistral_response_cache_t *cache,
+                          const char *endpoint, const char *request_json,
+                          mistral_response_t *response);
+
+/*
+* Store successful response under endpoint and request JSON
+*/
+void response_cache_store(mistral_response_cache_t *cache,
+                          const char *endpoint, const char *request_json,
+                          const mistral_response_t *response);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MISTRAL_CACHE_H */
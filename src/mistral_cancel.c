@@ -0,0 +1,142 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mistral_cancel.h"
+#include "mistral_alloc.h"
+#include "mistral_utils.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+* A self-pipe: cancel writes one byte, so poll on the read end wakes up
+* curl and retry sleeps without any polling interval
+*/
+struct mistral_cancel_token {
+  pthread_mutex_t lock;
+  int cancelled;
+  int pipe_fds[2];
+};
+
+mistral_cancel_token_t *mistral_cancel_token_create(void) {
+  mistral_cancel_token_t *token = NULL;
+
+  token = (mistral_cancel_token_t *)mem_malloc(sizeof(mistral_cancel_token_t));
+  if (token == NULL) {
+    fprintf(stderr, "failed to allocate memory for cancel token\n");
+    return NULL;
+  }
+
+  memset(token, 0, sizeof(mistral_cancel_token_t));
+
+  if (pipe(token->pipe_fds) != 0) {
+    fprintf(stderr, "failed to create cancel token pipe\n");
+    mem_free(token);
+    return NULL;
+  }
+
+  fcntl(token->pipe_fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(token->pipe_fds[1], F_SETFL, O_NONBLOCK);
+
+  if (pthread_mutex_init(&token->lock, NULL) != 0) {
+    fprintf(stderr, "failed to init cancel token mutex\n");
+    close(token->pipe_fds[0]);
+    close(token->pipe_fds[1]);
+    mem_free(token);
+    return NULL;
+  }
+
+  return token;
+}
+
+void mistral_cancel_token_cancel(mistral_cancel_token_t *token) {
+  if (token == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&token->lock);
+  if (!token->cancelled) {
+    token->cancelled = 1;
+    if (write(token->pipe_fds[1], "c", 1) != 1) {
+      fprintf(stderr, "failed to signal cancel token\n");
+    }
+  }
+  pthread_mutex_unlock(&token->lock);
+}
+
+int mistral_cancel_token_is_cancelled(mistral_cancel_token_t *token) {
+  int cancelled = 0;
+
+  if (token == NULL) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&token->lock);
+  cancelled = token->cancelled;
+  pthread_mutex_unlock(&token->lock);
+
+  return cancelled;
+}
+
+void mistral_cancel_token_reset(mistral_cancel_token_t *token) {
+  char drain[16];
+
+  if (token == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&token->lock);
+  while (read(token->pipe_fds[0], drain, sizeof(drain)) > 0) {
+  }
+  token->cancelled = 0;
+  pthread_mutex_unlock(&token->lock);
+}
+
+void mistral_cancel_token_free(mistral_cancel_token_t *token) {
+  if (token != NULL) {
+    close(token->pipe_fds[0]);
+    close(token->pipe_fds[1]);
+    pthread_mutex_destroy(&token->lock);
+    mem_free(token);
+  }
+}
+
+int cancel_token_check(void *token) {
+  return mistral_cancel_token_is_cancelled((mistral_cancel_token_t *)token);
+}
+
+int cancel_token_fd(mistral_cancel_token_t *token) {
+  return token->pipe_fds[0];
+}
+
+int cancel_token_sleep(mistral_cancel_token_t *token, int milliseconds) {
+  struct pollfd wait_fd;
+  double deadline = 0.0;
+  double remaining = 0.0;
+
+  if (token == NULL) {
+    sleep_ms(milliseconds);
+    return 0;
+  }
+
+  wait_fd.fd = token->pipe_fds[0];
+  wait_fd.events = POLLIN;
+  deadline = monotonic_ms() + milliseconds;
+
+  for (;;) {
+    if (mistral_cancel_token_is_cancelled(token)) {
+      return -1;
+    }
+
+    remaining = deadline - monotonic_ms();
+    if (remaining <= 0.0) {
+      return 0;
+    }
+
+    wait_fd.revents = 0;
+    poll(&wait_fd, 1, (int)remaining + 1);
+  }
+}
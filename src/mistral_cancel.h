@@ -0,0 +1,30 @@
+#ifndef MISTRAL_CANCEL_H
+#define MISTRAL_CANCEL_H
+
+#include "../include/mistral.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* is_cancelled callback for http_request_options_t, data is the token
+*/
+int cancel_token_check(void *token);
+
+/*
+* Descriptor that becomes readable once the token is cancelled
+*/
+int cancel_token_fd(mistral_cancel_token_t *token);
+
+/*
+* Sleep that returns early on cancellation, token may be NULL
+* Return 0 if the full time elapsed, -1 if cancelled
+*/
+int cancel_token_sleep(mistral_cancel_token_t *token, int milliseconds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MISTRAL_CANCEL_H */
@@ -0,0 +1,300 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mistral_coalescer.h"
+#include "mistral_alloc.h"
+#include "mistral_utils.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct flight {
+  uint64_t hash;
+  const char *url;
+  const char **headers;
+  const char *body;
+  int done;
+  int ret;
+  /* the leader's own token ended it, followers must not inherit that */
+  int cancelled;
+  int waiters;
+  http_response_t response;
+  pthread_cond_t cond;
+  struct flight *next;
+} flight_t;
+
+struct mistral_coalescer {
+  pthread_mutex_t lock;
+  flight_t *flights;
+  unsigned long requests;
+  unsigned long coalesced;
+};
+
+static uint64_t request_hash(const char *url, const char **headers,
+                             const char *body) {
+  uint64_t hash = hash_bytes(url, strlen(url) + 1, 0);
+  size_t i;
+
+  for (i = 0; headers != NULL && headers[i] != NULL; i++) {
+    hash = hash_bytes(headers[i], strlen(headers[i]) + 1, hash);
+  }
+  if (body != NULL) {
+    hash = hash_bytes(body, strlen(body), hash);
+  }
+  return hash;
+}
+
+static int same_request(const flight_t *flight, const char *url,
+                        const char **headers, const char *body) {
+  size_t i;
+
+  if (strcmp(flight->url, url) != 0) {
+    return 0;
+  }
+
+  if ((flight->body == NULL) != (body == NULL) ||
+      (body != NULL && strcmp(flight->body, body) != 0)) {
+    return 0;
+  }
+
+  if ((flight->headers == NULL) != (headers == NULL)) {
+    return 0;
+  }
+  for (i = 0; headers != NULL; i++) {
+    if (flight->headers[i] == NULL || headers[i] == NULL) {
+      return flight->headers[i] == headers[i];
+    }
+    if (strcmp(flight->headers[i], headers[i]) != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int copy_http_response(const http_response_t *src,
+                              http_response_t *dst) {
+  dst->data = NULL;
+  dst->size = src->size;
+  dst->capacity = src->data != NULL ? src->size + 1 : 0;
+  dst->http_code = src->http_code;
+
+  if (src->data != NULL) {
+    dst->data = (char *)mem_malloc(src->size + 1);
+    if (dst->data == NULL) {
+      dst->size = 0;
+      return -1;
+    }
+    memcpy(dst->data, src->data, src->size + 1);
+  }
+  return 0;
+}
+
+static void flight_free(flight_t *flight) {
+  http_response_free(&flight->response);
+  pthread_cond_destroy(&flight->cond);
+  mem_free(flight);
+}
+
+mistral_coalescer_t *mistral_coalescer_create(void) {
+  mistral_coalescer_t *coalescer = NULL;
+
+  coalescer = (mistral_coalescer_t *)mem_malloc(sizeof(mistral_coalescer_t));
+  if (coalescer == NULL) {
+    fprintf(stderr, "failed to allocate memory for coalescer\n");
+    return NULL;
+  }
+
+  memset(coalescer, 0, sizeof(mistral_coalescer_t));
+
+  if (pthread_mutex_init(&coalescer->lock, NULL) != 0) {
+    fprintf(stderr, "failed to init coalescer mutex\n");
+    mem_free(coalescer);
+    return NULL;
+  }
+
+  return coalescer;
+}
+
+void mistral_coalescer_get_stats(mistral_coalescer_t *coalescer,
+                                 mistral_coalescer_stats_t *stats) {
+  if (coalescer == NULL || stats == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&coalescer->lock);
+  stats->requests = coalescer->requests;
+  stats->coalesced = coalescer->coalesced;
+  pthread_mutex_unlock(&coalescer->lock);
+}
+
+void mistral_coalescer_free(mistral_coalescer_t *coalescer) {
+  if (coalescer != NULL) {
+    pthread_mutex_destroy(&coalescer->lock);
+    mem_free(coalescer);
+  }
+}
+
+/*
+* Wait for the leader until wait_end (monotonic ms, 0 for none) or the
+* follower's own cancellation
+* Return 0 once the flight is done, -1 if the wait ended first
+*/
+static int wait_for_flight(mistral_coalescer_t *coalescer, flight_t *flight,
+                           const http_request_options_t *options,
+                           double wait_end) {
+  while (!flight->done) {
+    if (cond_wait_until(&flight->cond, &coalescer->lock, wait_end,
+                        options != NULL ? options->is_cancelled : NULL,
+                        options != NULL ? options->cancel_data : NULL) != 0 &&
+        !flight->done) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int coalescer_run(mistral_coalescer_t *coalescer, const char *url,
+                  const char **headers, const char *body,
+                  const http_request_options_t *options,
+                  coalescer_send_cb send, void *send_data,
+                  http_response_t *response) {
+  flight_t *flight = NULL;
+  flight_t **link = NULL;
+  uint64_t hash = request_hash(url, headers, body);
+  double wait_end = options != NULL && options->timeout_ms > 0
+                        ? monotonic_ms() + options->timeout_ms
+                        : 0.0;
+  int ret = -1;
+
+  pthread_mutex_lock(&coalescer->lock);
+  coalescer->requests++;
+
+join:
+  for (flight = coalescer->flights; flight != NULL; flight = flight->next) {
+    if (flight->hash == hash && same_request(flight, url, headers, body)) {
+      break;
+    }
+  }
+
+  if (flight != NULL) {
+    coalescer->coalesced++;
+    flight->waiters++;
+    if (wait_for_flight(coalescer, flight, options, wait_end) != 0) {
+      /* the leader still owns an unfinished flight */
+      flight->waiters--;
+      pthread_mutex_unlock(&coalescer->lock);
+      response->coalesced = 1;
+      response->timed_out = options == NULL ||
+                            options->is_cancelled == NULL ||
+                            !options->is_cancelled(options->cancel_data);
+      if (response->timed_out) {
+        fprintf(stderr, "coalesced request timed out\n");
+      }
+      return -1;
+    }
+
+    /* the flight is unlinked, so this lookup joins another or leads */
+    if (flight->cancelled) {
+      flight->waiters--;
+      if (flight->waiters == 0) {
+        flight_free(flight);
+      }
+      goto join;
+    }
+
+    ret = flight->ret;
+    response->coalesced = 1;
+    if (ret == 0 && copy_http_response(&flight->response, response) != 0) {
+      fprintf(stderr, "failed to copy coalesced response\n");
+      ret = -1;
+    }
+    if (ret != 0) {
+      response->timed_out = flight->response.timed_out;
+    }
+
+    flight->waiters--;
+    if (flight->waiters == 0) {
+      flight_free(flight);
+    }
+    pthread_mutex_unlock(&coalescer->lock);
+    return ret;
+  }
+
+  flight = (flight_t *)mem_malloc(sizeof(flight_t));
+  if (flight == NULL || monotonic_cond_init(&flight->cond) != 0) {
+    pthread_mutex_unlock(&coalescer->lock);
+    mem_free(flight);
+    return send(send_data, response);
+  }
+
+  flight->hash = hash;
+  flight->url = url;
+  flight->headers = headers;
+  flight->body = body;
+  flight->done = 0;
+  flight->ret = -1;
+  flight->cancelled = 0;
+  flight->waiters = 0;
+  memset(&flight->response, 0, sizeof(http_response_t));
+  flight->next = coalescer->flights;
+  coalescer->flights = flight;
+  pthread_mutex_unlock(&coalescer->lock);
+
+  ret = send(send_data, response);
+
+  pthread_mutex_lock(&coalescer->lock);
+
+  for (link = &coalescer->flights; *link != NULL; link = &(*link)->next) {
+    if (*link == flight) {
+      *link = flight->next;
+      break;
+    }
+  }
+
+  /* no new waiter can join once the flight is unlinked */
+  flight->ret = ret;
+  flight->done = 1;
+  flight->cancelled = ret != 0 && options != NULL &&
+                      options->is_cancelled != NULL &&
+                      options->is_cancelled(options->cancel_data);
+  flight->response.timed_out = ret != 0 && response->timed_out;
+  if (flight->waiters > 0) {
+    if (ret == 0 && copy_http_response(response, &flight->response) != 0) {
+      flight->ret = -1;
+    }
+    pthread_cond_broadcast(&flight->cond);
+  } else {
+    flight_free(flight);
+  }
+
+  pthread_mutex_unlock(&coalescer->lock);
+  return ret;
+}
+
+typedef struct {
+  const char *url;
+  const char **headers;
+  const char *body;
+  const http_request_options_t *options;
+} direct_post_t;
+
+static int direct_post(void *data, http_response_t *response) {
+  direct_post_t *post = (direct_post_t *)data;
+
+  return http_post_ex(post->url, post->headers, post->body, post->options,
+                      response);
+}
+
+int coalescer_http_post(mistral_coalescer_t *coalescer, const char *url,
+                        const char **headers, const char *body,
+                        const http_request_options_t *options,
+                        http_response_t *response) {
+  direct_post_t post;
+
+  post.url = url;
+  post.headers = headers;
+  post.body = body;
+  post.options = options;
+  return coalescer_run(coalescer, url, headers, body, options, direct_post,
+                       &post, response);
+}
@@ -0,0 +1,45 @@
+#ifndef MISTRAL_COALESCER_H
+#define MISTRAL_COALESCER_H
+
+#include "../include/mistral.h"
+#include "http_client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* Sends the request for the leader of a flight, data is the caller's
+* Return 0 if ok, -1 if error
+*/
+typedef int (*coalescer_send_cb)(void *data, http_response_t *response);
+
+/*
+* Runs send unless an identical request is already in flight, then waits
+* for that one instead. url, headers and body only key the flight: send
+* may post somewhere else, e.g. to a backend it picks itself. A follower
+* waits under its own timeout and cancel callback, and runs send itself
+* if the leader was cancelled. A follower's response has coalesced set:
+* its outcome is the leader's and must not be counted again
+* Return 0 if ok, -1 if error
+*/
+int coalescer_run(mistral_coalescer_t *coalescer, const char *url,
+                  const char **headers, const char *body,
+                  const http_request_options_t *options,
+                  coalescer_send_cb send, void *send_data,
+                  http_response_t *response);
+
+/*
+* coalescer_run that sends with http_post_ex to url
+* Return 0 if ok, -1 if error
+*/
+int coalescer_http_post(mistral_coalescer_t *coalescer, const char *url,
+                        const char **headers, const char *body,
+                        const http_request_options_t *options,
+                        http_response_t *response);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MISTRAL_COALESCER_H */
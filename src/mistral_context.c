@@ -0,0 +1,331 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mistral_context.h"
+#include "mistral_alloc.h"
+#include "mistral_utils.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* direct mapped, a colliding message just gets counted again */
+#define COUNT_CACHE_SLOTS 4096
+#define BOS_TOKENS 1
+
+typedef struct {
+  uint64_t hash;
+  long tokens;
+} count_slot_t;
+
+struct mistral_context_policy {
+  pthread_mutex_t lock;
+  mistral_context_strategy_t strategy;
+  long max_prompt_tokens;
+  size_t max_recent_messages;
+  const mistral_tokenizer_t *tokenizer;
+  mistral_context_summarizer_t summarizer;
+  void *user_data;
+  count_slot_t *counts;
+};
+
+static int is_role(const mistral_message_t *message, const char *role) {
+  return strcmp(message->role, role) == 0;
+}
+
+static long count_text(const mistral_context_policy_t *policy,
+                       const char *role, const char *content) {
+  long tokens = 0;
+
+  if (policy->tokenizer != NULL) {
+    tokens = mistral_count_tokens(policy->tokenizer, content);
+    if (tokens < 0) {
+      return -1;
+    }
+  } else {
+    tokens = (long)((strlen(content) + 3) / 4);
+  }
+
+  /* </s> after replies, [INST] [/INST] or similar pairs otherwise */
+  return tokens + (strcmp(role, "assistant") == 0 ? 1 : 2);
+}
+
+long context_message_tokens(mistral_context_policy_t *policy,
+                            const mistral_message_t *message, int cache) {
+  count_slot_t *slot = NULL;
+  uint64_t hash = 0;
+  long tokens = 0;
+
+  if (message->role == NULL || message->content == NULL) {
+    return -1;
+  }
+  /* estimates cost no more than the hash */
+  if (!cache || policy->tokenizer == NULL) {
+    return count_text(policy, message->role, message->content);
+  }
+
+  hash = hash_bytes(message->role, strlen(message->role) + 1, 0);
+  hash = hash_bytes(message->content, strlen(message->content), hash);
+  if (hash == 0) {
+    hash = 1;
+  }
+  slot = &policy->counts[hash & (COUNT_CACHE_SLOTS - 1)];
+
+  pthread_mutex_lock(&policy->lock);
+  tokens = slot->hash == hash ? slot->tokens : -1;
+  pthread_mutex_unlock(&policy->lock);
+  if (tokens >= 0) {
+    return tokens;
+  }
+
+  tokens = count_text(policy, message->role, message->content);
+  if (tokens >= 0) {
+    pthread_mutex_lock(&policy->lock);
+    slot->hash = hash;
+    slot->tokens = tokens;
+    pthread_mutex_unlock(&policy->lock);
+  }
+  return tokens;
+}
+
+/*
+* Move tail forward to a user message so the kept suffix never opens with
+* a reply or tool result whose request was dropped
+*/
+static size_t align_tail(const mistral_message_t *messages, const long *tokens,
+                         size_t count, size_t tail, long *used) {
+  while (tail + 1 < count && !is_role(&messages[tail], "user")) {
+    *used -= tokens[tail];
+    tail++;
+  }
+  return tail;
+}
+
+int context_policy_plan(mistral_context_policy_t *policy,
+                        const mistral_message_t *messages, const long *tokens,
+                        size_t count, size_t summary_index,
+                        context_plan_t *plan) {
+  mistral_message_t summary;
+  size_t head = 0;
+  size_t tail = count;
+  size_t i;
+  long used = BOS_TOKENS;
+  long total = BOS_TOKENS;
+
+  memset(plan, 0, sizeof(context_plan_t));
+  plan->head = count;
+  plan->tail = count;
+
+  /* system prompts always stay, drop-middle also keeps the first exchange */
+  while (head < count && head != summary_index &&
+         is_role(&messages[head], "system")) {
+    head++;
+  }
+  if (policy->strategy == MISTRAL_CONTEXT_DROP_MIDDLE && head < count) {
+    head++;
+    while (head < count && !is_role(&messages[head], "user")) {
+      head++;
+    }
+  }
+
+  for (i = 0; i < count; i++) {
+    total += tokens[i];
+  }
+  if (total <= policy->max_prompt_tokens &&
+      (policy->max_recent_messages == 0 ||
+       count - head <= policy->max_recent_messages)) {
+    return 0;
+  }
+  if (head >= count) {
+    return -1;
+  }
+
+  for (i = 0; i < head; i++) {
+    used += tokens[i];
+  }
+  while (tail > head && used + tokens[tail - 1] <= policy->max_prompt_tokens &&
+         (policy->max_recent_messages == 0 ||
+          count - tail < policy->max_recent_messages)) {
+    used += tokens[--tail];
+  }
+  if (tail == count) {
+    return -1;
+  }
+  tail = align_tail(messages, tokens, count, tail, &used);
+
+  if (policy->strategy == MISTRAL_CONTEXT_SUMMARIZE &&
+      policy->summarizer != NULL && tail > head) {
+    plan->summary =
+        policy->summarizer(messages + head, tail - head, policy->user_data);
+  }
+  if (plan->summary != NULL) {
+    summary.role = "system";
+    summary.content = plan->summary;
+    plan->summary_tokens = context_message_tokens(policy, &summary, 0);
+    while (plan->summary_tokens >= 0 &&
+           used + plan->summary_tokens > policy->max_prompt_tokens &&
+           tail + 1 < count) {
+      used -= tokens[tail++];
+      tail = align_tail(messages, tokens, count, tail, &used);
+    }
+    if (plan->summary_tokens < 0 ||
+        used + plan->summary_tokens > policy->max_prompt_tokens) {
+      /* a summary that does not fit is dropped like the rest */
+      mem_free(plan->summary);
+      plan->summary = NULL;
+      plan->summary_tokens = 0;
+    }
+  }
+
+  plan->head = head;
+  plan->tail = tail;
+  return 0;
+}
+
+int context_policy_fit(mistral_context_policy_t *policy,
+                       const mistral_message_t *messages, size_t count,
+                       const mistral_message_t **fitted, size_t *fitted_count,
+                       char **summary, mistral_response_t *response) {
+  mistral_message_t *kept = NULL;
+  context_plan_t plan;
+  long *tokens = NULL;
+  size_t n = 0;
+  size_t i;
+
+  *fitted = messages;
+  *fitted_count = count;
+  *summary = NULL;
+
+  tokens = (long *)mem_malloc((count + 1) * sizeof(long));
+  if (tokens == NULL) {
+    goto oom;
+  }
+  for (i = 0; i < count; i++) {
+    tokens[i] = context_message_tokens(policy, &messages[i], 1);
+    if (tokens[i] < 0) {
+      mem_free(tokens);
+      if (set_error_message(response, "invalid message") == 0) {
+        response->error_code = MISTRAL_ERR_INVALID_PARAM;
+      }
+      return -1;
+    }
+  }
+
+  if (context_policy_plan(policy, messages, tokens, count, count, &plan) !=
+      0) {
+    mem_free(tokens);
+    if (set_error_message(response, "prompt exceeds context budget") == 0) {
+      response->error_code = MISTRAL_ERR_INVALID_PARAM;
+    }
+    return -1;
+  }
+  mem_free(tokens);
+
+  if (plan.tail == count && plan.head == count) {
+    return 0;
+  }
+
+  kept = (mistral_message_t *)mem_malloc((count + 1) *
+                                         sizeof(mistral_message_t));
+  if (kept == NULL) {
+    mem_free(plan.summary);
+    goto oom;
+  }
+  for (i = 0; i < plan.head; i++) {
+    kept[n++] = messages[i];
+  }
+  if (plan.summary != NULL) {
+    kept[n].role = "system";
+    kept[n].content = plan.summary;
+    n++;
+  }
+  for (i = plan.tail; i < count; i++) {
+    kept[n++] = messages[i];
+  }
+
+  *fitted = kept;
+  *fitted_count = n;
+  *summary = plan.summary;
+  return 0;
+
+oom:
+  if (set_error_message(response, "failed to allocate memory") == 0) {
+    response->error_code = MISTRAL_ERR_MEM;
+  }
+  return -1;
+}
+
+mistral_context_policy_t *
+mistral_context_policy_create(mistral_context_strategy_t strategy,
+                              long max_prompt_tokens,
+                              size_t max_recent_messages) {
+  mistral_context_policy_t *policy = NULL;
+
+  if (max_prompt_tokens <= BOS_TOKENS ||
+      (strategy != MISTRAL_CONTEXT_KEEP_RECENT &&
+       strategy != MISTRAL_CONTEXT_DROP_MIDDLE &&
+       strategy != MISTRAL_CONTEXT_SUMMARIZE)) {
+    fprintf(stderr, "invalid context policy parameters\n");
+    return NULL;
+  }
+
+  policy = (mistral_context_policy_t *)mem_calloc(1, sizeof(*policy));
+  if (policy == NULL) {
+    fprintf(stderr, "failed to allocate memory for context policy\n");
+    return NULL;
+  }
+
+  policy->counts =
+      (count_slot_t *)mem_calloc(COUNT_CACHE_SLOTS, sizeof(count_slot_t));
+  if (policy->counts == NULL) {
+    fprintf(stderr, "failed to allocate memory for context policy\n");
+    mem_free(policy);
+    return NULL;
+  }
+
+  if (pthread_mutex_init(&policy->lock, NULL) != 0) {
+    fprintf(stderr, "failed to initialize context policy lock\n");
+    mem_free(policy->counts);
+    mem_free(policy);
+    return NULL;
+  }
+
+  policy->strategy = strategy;
+  policy->max_prompt_tokens = max_prompt_tokens;
+  policy->max_recent_messages = max_recent_messages;
+  return policy;
+}
+
+int mistral_context_policy_set_tokenizer(mistral_context_policy_t *policy,
+                                         const mistral_tokenizer_t *tokenizer) {
+  if (policy == NULL) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&policy->lock);
+  policy->tokenizer = tokenizer;
+  /* cached counts were made with the old one */
+  memset(policy->counts, 0, COUNT_CACHE_SLOTS * sizeof(count_slot_t));
+  pthread_mutex_unlock(&policy->lock);
+  return 0;
+}
+
+int mistral_context_policy_set_summarizer(
+    mistral_context_policy_t *policy, mistral_context_summarizer_t summarizer,
+    void *user_data) {
+  if (policy == NULL) {
+    return -1;
+  }
+
+  policy->summarizer = summarizer;
+  policy->user_data = user_data;
+  return 0;
+}
+
+void mistral_context_policy_free(mistral_context_policy_t *policy) {
+  if (policy != NULL) {
+    pthread_mutex_destroy(&policy->lock);
+    mem_free(policy->counts);
+    mem_free(policy);
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef MISTRAL_CONTEXT_H
+#define MISTRAL_CONTEXT_H
+
+#include "../include/mistral.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* What a prompt keeps: messages [0, head), then summary as a system
+* message if not NULL, then [tail, count). head == tail == count when
+* everything fits. summary is malloc'd, the caller frees it
+*/
+typedef struct {
+  size_t head;
+  size_t tail;
+  char *summary;
+  long summary_tokens;
+} context_plan_t;
+
+/*
+* Prompt tokens of one message including its template markers: exact with
+* the policy's tokenizer, bytes / 4 otherwise. cache: look the count up by
+* content hash, for messages the library does not own
+* Return -1 if error
+*/
+long context_message_tokens(mistral_context_policy_t *policy,
+                            const mistral_message_t *message, int cache);
+
+/*
+* Plan the prompt from per-message token counts, calling the summarizer
+* for the dropped range when the strategy asks for one. Leading system
+* messages are pinned up to summary_index, an earlier summary that is
+* folded into the next one instead (count if there is none)
+* Return 0 if ok, -1 if the pinned messages and the newest one alone
+* exceed the budget
+*/
+int context_policy_plan(mistral_context_policy_t *policy,
+                        const mistral_message_t *messages, const long *tokens,
+                        size_t count, size_t summary_index,
+                        context_plan_t *plan);
+
+/*
+* Messages of a caller's array that fit the policy, as borrowed pointers
+* plus the summary. *fitted is messages itself when all fit, otherwise a
+* malloc'd array to free along with *summary
+* Return 0 if ok, -1 if error (set on response)
+*/
+int context_policy_fit(mistral_context_policy_t *policy,
+                       const mistral_message_t *messages, size_t count,
+                       const mistral_message_t **fitted, size_t *fitted_count,
+                       char **summary, mistral_response_t *response);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MISTRAL_CONTEXT_H */
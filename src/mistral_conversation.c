@@ -0,0 +1,442 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/mistral.h"
+#include "json_writer.h"
+#include "mistral_alloc.h"
+#include "mistral_arena.h"
+#include "mistral_context.h"
+#include "mistral_helpers.h"
+#include "mistral_utils.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE 8192
+#define MIN_MESSAGES 16
+
+/*
+* owned: content is on the heap and belongs to the conversation
+* storage: arena of the reply the content lives in, adopted from its
+* response
+* tokens: prompt cost under counted_by, -1 until a context policy asks
+* json_offset: where the message's fragment starts in messages_json
+*/
+typedef struct {
+  int owned;
+  response_arena_t *storage;
+  long tokens;
+  size_t json_offset;
+} conversation_entry_t;
+
+/*
+* messages_json holds the escaped, comma-joined message objects of the
+* whole history, so a request only copies it between a prefix and suffix,
+* or joins two slices of it when a context policy drops the middle
+*/
+struct mistral_conversation {
+  response_arena_t *arena;
+  mistral_message_t *messages;
+  conversation_entry_t *entries;
+  size_t count;
+  size_t capacity;
+  json_writer_t messages_json;
+  const mistral_context_policy_t *counted_by;
+  size_t summary_index;
+};
+
+static int write_fragment(json_writer_t *writer, int comma, const char *role,
+                          const char *content) {
+  size_t rollback = writer->size;
+
+  if ((comma && json_writer_append(writer, ",", 1) != 0) ||
+      json_writer_append(writer, "{\"role\":", 8) != 0 ||
+      json_writer_append_string(writer, role) != 0 ||
+      json_writer_append(writer, ",\"content\":", 11) != 0 ||
+      json_writer_append_string(writer, content) != 0 ||
+      json_writer_append(writer, "}", 1) != 0) {
+    writer->size = rollback;
+    if (writer->data != NULL) {
+      writer->data[rollback] = '\0';
+    }
+    return -1;
+  }
+  return 0;
+}
+
+static int append_fragment(mistral_conversation_t *conversation, size_t index,
+                           const char *role, const char *content) {
+  conversation->entries[index].json_offset = conversation->messages_json.size;
+  return write_fragment(&conversation->messages_json, index > 0, role,
+                        content);
+}
+
+/*
+* Store a message whose strings already live in the arena or, with owned
+* set, on the heap and now belong to the conversation, like storage does
+*/
+static int push_message(mistral_conversation_t *conversation, char *role,
+                        char *content, int owned, response_arena_t *storage) {
+  size_t index = conversation->count;
+
+  if (conversation->count == conversation->capacity) {
+    size_t capacity = conversation->capacity == 0 ? MIN_MESSAGES
+                                                  : conversation->capacity * 2;
+    mistral_message_t *messages = (mistral_message_t *)mem_realloc(
+        conversation->messages, capacity * sizeof(mistral_message_t));
+    conversation_entry_t *entries = NULL;
+    if (messages == NULL) {
+      return -1;
+    }
+    conversation->messages = messages;
+    entries = (conversation_entry_t *)mem_realloc(
+        conversation->entries, capacity * sizeof(conversation_entry_t));
+    if (entries == NULL) {
+      return -1;
+    }
+    conversation->entries = entries;
+    conversation->capacity = capacity;
+  }
+
+  if (append_fragment(conversation, index, role, content) != 0) {
+    return -1;
+  }
+
+  conversation->messages[index].role = role;
+  conversation->messages[index].content = content;
+  conversation->entries[index].owned = owned;
+  conversation->entries[index].storage = storage;
+  conversation->entries[index].tokens = -1;
+  conversation->count++;
+  return 0;
+}
+
+static void release_message(mistral_conversation_t *conversation,
+                            size_t index) {
+  if (conversation->entries[index].owned) {
+    mem_free(conversation->messages[index].content);
+  }
+  response_arena_free(conversation->entries[index].storage);
+}
+
+/*
+* Replace messages [head, tail) with a system message holding summary,
+* which the conversation takes over. The new history JSON reuses the
+* kept fragments, nothing changes if it cannot be built
+*/
+static int compact(mistral_conversation_t *conversation, size_t head,
+                   size_t tail, char *summary, long summary_tokens) {
+  const json_writer_t *old = &conversation->messages_json;
+  size_t prefix = conversation->entries[head].json_offset;
+  size_t suffix = conversation->entries[tail].json_offset;
+  size_t moved = conversation->count - tail;
+  size_t summary_offset = 0;
+  size_t shift_to = 0;
+  char *role = response_arena_strdup(conversation->arena, "system");
+  json_writer_t writer;
+  size_t i;
+
+  json_writer_init(&writer);
+  if (role == NULL ||
+      json_writer_reserve(&writer, old->size - suffix + prefix +
+                                       strlen(summary) * 6 + 64) != 0 ||
+      json_writer_append(&writer, old->data, prefix) != 0) {
+    json_writer_free(&writer);
+    return -1;
+  }
+  summary_offset = writer.size;
+  if (write_fragment(&writer, head > 0, role, summary) != 0) {
+    json_writer_free(&writer);
+    return -1;
+  }
+  shift_to = writer.size;
+  if (json_writer_append(&writer, old->data + suffix, old->size - suffix) !=
+      0) {
+    json_writer_free(&writer);
+    return -1;
+  }
+
+  for (i = head; i < tail; i++) {
+    release_message(conversation, i);
+  }
+  memmove(&conversation->messages[head + 1], &conversation->messages[tail],
+          moved * sizeof(mistral_message_t));
+  memmove(&conversation->entries[head + 1], &conversation->entries[tail],
+          moved * sizeof(conversation_entry_t));
+  for (i = head + 1; i < head + 1 + moved; i++) {
+    conversation->entries[i].json_offset =
+        conversation->entries[i].json_offset - suffix + shift_to;
+  }
+  conversation->messages[head].role = role;
+  conversation->messages[head].content = summary;
+  conversation->entries[head].owned = 1;
+  conversation->entries[head].storage = NULL;
+  conversation->entries[head].tokens = summary_tokens;
+  conversation->entries[head].json_offset = summary_offset;
+  conversation->count = head + 1 + moved;
+  conversation->summary_index = head;
+
+  json_writer_free(&conversation->messages_json);
+  conversation->messages_json = writer;
+  return 0;
+}
+
+/*
+* Counts only messages added since the last call, then plans the prompt;
+* a summary is folded into the history so later turns reuse it
+* Return 0 if ok, -1 if error (set on response)
+*/
+static int fit_context(mistral_context_policy_t *policy,
+                       mistral_conversation_t *conversation,
+                       context_plan_t *plan, mistral_response_t *response) {
+  long *tokens = NULL;
+  size_t i;
+
+  if (conversation->counted_by != policy) {
+    for (i = 0; i < conversation->count; i++) {
+      conversation->entries[i].tokens = -1;
+    }
+    conversation->counted_by = policy;
+  }
+
+  tokens = (long *)mem_malloc(conversation->count * sizeof(long));
+  if (tokens == NULL) {
+    goto oom;
+  }
+  for (i = 0; i < conversation->count; i++) {
+    if (conversation->entries[i].tokens < 0) {
+      conversation->entries[i].tokens =
+          context_message_tokens(policy, &conversation->messages[i], 0);
+    }
+    tokens[i] = conversation->entries[i].tokens;
+    if (tokens[i] < 0) {
+      mem_free(tokens);
+      goto oom;
+    }
+  }
+
+  if (context_policy_plan(policy, conversation->messages, tokens,
+                          conversation->count, conversation->summary_index,
+                          plan) != 0) {
+    mem_free(tokens);
+    if (set_error_message(response, "prompt exceeds context budget") == 0) {
+      response->error_code = MISTRAL_ERR_INVALID_PARAM;
+    }
+    return -1;
+  }
+  mem_free(tokens);
+
+  if (plan->summary != NULL) {
+    if (compact(conversation, plan->head, plan->tail, plan->summary,
+                plan->summary_tokens) != 0) {
+      mem_free(plan->summary);
+      goto oom;
+    }
+    /* the history now is the plan */
+    plan->summary = NULL;
+    plan->head = conversation->count;
+    plan->tail = conversation->count;
+  }
+  return 0;
+
+oom:
+  if (set_error_message(response, "failed to allocate memory") == 0) {
+    response->error_code = MISTRAL_ERR_MEM;
+  }
+  return -1;
+}
+
+/*
+* Request for messages [0, head) and [tail, count) of the history
+*/
+static char *conversation_request_json(const mistral_config_t *config,
+                                       const mistral_conversation_t *conversation,
+                                       size_t head, size_t tail) {
+  const json_writer_t *history = &conversation->messages_json;
+  size_t prefix = history->size;
+  size_t suffix = history->size;
+  json_writer_t writer;
+
+  if (tail < conversation->count) {
+    prefix = conversation->entries[head].json_offset;
+    /* the tail fragment opens with a comma, unneeded with no prefix */
+    suffix = conversation->entries[tail].json_offset + (head == 0 ? 1 : 0);
+  }
+
+  json_writer_init(&writer);
+
+  /* same key order as create_chat_request_json; model stays first */
+  if (json_writer_reserve(&writer, conversation->messages_json.size +
+                                       strlen(config->model) * 6 + 128) != 0 ||
+      json_writer_append(&writer, "{\"model\":", 9) != 0 ||
+      json_writer_append_string(&writer, config->model) != 0 ||
+      json_writer_append(&writer, ",\"messages\":[", 13) != 0 ||
+      json_writer_append(&writer, history->data, prefix) != 0 ||
+      json_writer_append(&writer, history->data + suffix,
+                         history->size - suffix) != 0 ||
+      json_writer_append(&writer, "],\"temperature\":", 16) != 0 ||
+      json_writer_append_number(&writer, config->temperature) != 0 ||
+      json_writer_append(&writer, ",\"max_tokens\":", 14) != 0 ||
+      json_writer_append_number(&writer, config->max_tokens) != 0 ||
+      json_writer_append(&writer, "}", 1) != 0) {
+    json_writer_free(&writer);
+    return NULL;
+  }
+
+  return json_writer_detach(&writer);
+}
+
+mistral_conversation_t *mistral_conversation_create(void) {
+  mistral_conversation_t *conversation = NULL;
+
+  conversation =
+      (mistral_conversation_t *)mem_malloc(sizeof(mistral_conversation_t));
+  if (conversation == NULL) {
+    fprintf(stderr, "failed to allocate memory for conversation\n");
+    return NULL;
+  }
+
+  memset(conversation, 0, sizeof(mistral_conversation_t));
+  conversation->arena = response_arena_create(ARENA_BLOCK_SIZE);
+  if (conversation->arena == NULL) {
+    fprintf(stderr, "failed to allocate memory for conversation\n");
+    mem_free(conversation);
+    return NULL;
+  }
+  json_writer_init(&conversation->messages_json);
+  conversation->summary_index = SIZE_MAX;
+
+  return conversation;
+}
+
+int mistral_conversation_append(mistral_conversation_t *conversation,
+                                const char *role, const char *content) {
+  char *role_copy = NULL;
+  char *content_copy = NULL;
+
+  if (conversation == NULL || role == NULL || content == NULL) {
+    fprintf(stderr, "invalid arguments to mistral_conversation_append\n");
+    return -1;
+  }
+
+  role_copy = response_arena_strdup(conversation->arena, role);
+  content_copy = role_copy != NULL
+                     ? response_arena_strdup(conversation->arena, content)
+                     : NULL;
+  if (content_copy == NULL ||
+      push_message(conversation, role_copy, content_copy, 0, NULL) != 0) {
+    fprintf(stderr, "failed to append conversation message\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+size_t mistral_conversation_count(const mistral_conversation_t *conversation) {
+  return conversation != NULL ? conversation->count : 0;
+}
+
+int mistral_conversation_get(const mistral_conversation_t *conversation,
+                             size_t index, mistral_message_t *message) {
+  if (conversation == NULL || message == NULL ||
+      index >= conversation->count) {
+    return -1;
+  }
+
+  *message = conversation->messages[index];
+  return 0;
+}
+
+int mistral_conversation_chat(const mistral_config_t *config,
+                              mistral_conversation_t *conversation,
+                              mistral_response_t *response) {
+  context_plan_t plan;
+  char *request_json = NULL;
+  response_arena_t *storage = NULL;
+  char *role = NULL;
+  char *content = NULL;
+  int ret = -1;
+
+  if (conversation == NULL || conversation->count == 0 || response == NULL) {
+    fprintf(stderr, "invalid arguments to mistral_conversation_chat\n");
+    if (response != NULL) {
+      response_begin(config, response);
+      if (set_error_message(response, "Invalid parameters") == 0) {
+        response->error_code = MISTRAL_ERR_INVALID_PARAM;
+      }
+    }
+    return -1;
+  }
+
+  response_begin(config, response);
+
+  if (validate_common_params(config, response) != 0) {
+    return -1;
+  }
+
+  plan.head = conversation->count;
+  plan.tail = conversation->count;
+  if (config->context_policy != NULL &&
+      fit_context(config->context_policy, conversation, &plan,
+                  response) != 0) {
+    return -1;
+  }
+
+  request_json =
+      conversation_request_json(config, conversation, plan.head, plan.tail);
+  if (request_json == NULL) {
+    if (set_error_message(response, "failed to create request JSON") == 0) {
+      response->error_code = MISTRAL_ERR_MEM;
+    }
+    return -1;
+  }
+
+  ret = execute_http_request_with_retry(
+      config, MISTRAL_BASE_API "/chat/completions", request_json, response);
+  mem_free(request_json);
+
+  if (ret != 0) {
+    return ret;
+  }
+
+  /*
+  * the reply moves into the history, with the arena it was parsed into
+  * when that holds little else; only its JSON escape is new
+  */
+  role = response_arena_strdup(conversation->arena, "assistant");
+  if (role != NULL) {
+    storage = response_take_arena(response, &content);
+    if (storage == NULL) {
+      content = response_take_content(response);
+    }
+  }
+  if (role == NULL || content == NULL ||
+      push_message(conversation, role, content, storage == NULL,
+                   storage) != 0) {
+    fprintf(stderr, "failed to append reply to conversation\n");
+    /* the content is still freed with the response */
+    if (storage != NULL) {
+      response->arena = storage;
+    }
+    response->content = content;
+    response->error_code = MISTRAL_ERR_MEM;
+    return -1;
+  }
+
+  return 0;
+}
+
+void mistral_conversation_free(mistral_conversation_t *conversation) {
+  size_t i;
+
+  if (conversation != NULL) {
+    for (i = 0; i < conversation->count; i++) {
+      release_message(conversation, i);
+    }
+    response_arena_free(conversation->arena);
+    mem_free(conversation->messages);
+    mem_free(conversation->entries);
+    json_writer_free(&conversation->messages_json);
+    mem_free(conversation);
+  }
+}
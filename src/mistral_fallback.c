@@ -0,0 +1,165 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mistral_fallback.h"
+#include "json_view.h"
+#include "mistral_alloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_FALLBACK_MODELS 16
+#define MODEL_PREFIX "{\"model\":\""
+
+struct mistral_fallback_policy {
+  mistral_fallback_model_t entries[MAX_FALLBACK_MODELS];
+  size_t count;
+};
+
+mistral_fallback_policy_t *
+mistral_fallback_policy_create(const mistral_fallback_model_t *chain,
+                               size_t count) {
+  mistral_fallback_policy_t *policy = NULL;
+  size_t i;
+
+  if (chain == NULL || count == 0 || count > MAX_FALLBACK_MODELS) {
+    fprintf(stderr, "invalid fallback chain\n");
+    return NULL;
+  }
+
+  for (i = 0; i < count; i++) {
+    if (chain[i].max_retries < 0 || chain[i].max_retries > 10 ||
+        (i > 0 && chain[i].model == NULL) ||
+        (chain[i].model != NULL && strlen(chain[i].model) == 0)) {
+      fprintf(stderr, "invalid fallback entry %zu\n", i);
+      return NULL;
+    }
+  }
+
+  policy = (mistral_fallback_policy_t *)mem_malloc(
+      sizeof(mistral_fallback_policy_t));
+  if (policy == NULL) {
+    fprintf(stderr, "failed to allocate memory for fallback policy\n");
+    return NULL;
+  }
+
+  memset(policy, 0, sizeof(mistral_fallback_policy_t));
+
+  for (i = 0; i < count; i++) {
+    policy->entries[i] = chain[i];
+    if (chain[i].model != NULL) {
+      policy->entries[i].model = mem_strdup(chain[i].model);
+      if (policy->entries[i].model == NULL) {
+        fprintf(stderr, "failed to duplicate fallback model\n");
+        policy->count = i;
+        mistral_fallback_policy_free(policy);
+        return NULL;
+      }
+    }
+  }
+  policy->count = count;
+
+  return policy;
+}
+
+void mistral_fallback_policy_free(mistral_fallback_policy_t *policy) {
+  size_t i;
+
+  if (policy != NULL) {
+    for (i = 0; i < policy->count; i++) {
+      mem_free((char *)policy->entries[i].model);
+    }
+    mem_free(policy);
+  }
+}
+
+size_t fallback_policy_count(const mistral_fallback_policy_t *policy) {
+  return policy->count;
+}
+
+const mistral_fallback_model_t *
+fallback_policy_entry(const mistral_fallback_policy_t *policy, size_t index) {
+  return &policy->entries[index];
+}
+
+int fallback_triggered(const mistral_fallback_model_t *entry,
+                       mistral_error_code_t error_code) {
+  switch (error_code) {
+  case MISTRAL_ERR_RATE_LIMIT:
+    return (entry->triggers & MISTRAL_FALLBACK_ON_RATE_LIMIT) != 0;
+  case MISTRAL_ERR_SERVER:
+    return (entry->triggers & MISTRAL_FALLBACK_ON_SERVER_ERROR) != 0;
+  case MISTRAL_ERR_TIMEOUT:
+    return (entry->triggers & MISTRAL_FALLBACK_ON_TIMEOUT) != 0;
+  case MISTRAL_ERR_NETWORK:
+    return (entry->triggers & MISTRAL_FALLBACK_ON_NETWORK) != 0;
+  case MISTRAL_ERR_CIRCUIT_OPEN:
+    return (entry->triggers & MISTRAL_FALLBACK_ON_CIRCUIT_OPEN) != 0;
+  default:
+    return 0;
+  }
+}
+
+char *fallback_request_json(const char *request_json, const char *model) {
+  size_t prefix_len = strlen(MODEL_PREFIX);
+  const char *end = request_json + strlen(request_json);
+  const char *keys[1] = {"model"};
+  const char *value = NULL;
+  const char *value_end = NULL;
+  size_t escaped_len = 0;
+  size_t head_len = 0;
+  size_t rest_len = 0;
+  char *json = NULL;
+  char *out = NULL;
+  const char *p = NULL;
+
+  /* the request builders add "model" first, so that spot is tried before
+   * a pass over the whole body */
+  if (strncmp(request_json, MODEL_PREFIX, prefix_len) == 0) {
+    value = request_json + prefix_len - 1;
+    for (value_end = value + 1; *value_end != '\0'; value_end++) {
+      if (*value_end == '\\' && value_end[1] != '\0') {
+        value_end++;
+      } else if (*value_end == '"') {
+        break;
+      }
+    }
+    if (*value_end != '"') {
+      return NULL;
+    }
+    value_end++;
+  } else {
+    if (json_view_members(request_json, end, keys, &value, 1) != 0 ||
+        value == NULL || *value != '"') {
+      return NULL;
+    }
+    value_end = json_view_skip(value, end);
+  }
+
+  for (p = model; *p != '\0'; p++) {
+    if ((unsigned char)*p < 0x20) {
+      return NULL;
+    }
+    escaped_len += (*p == '"' || *p == '\\') ? 2 : 1;
+  }
+
+  head_len = (size_t)(value - request_json);
+  rest_len = (size_t)(end - value_end);
+  json = (char *)mem_malloc(head_len + escaped_len + rest_len + 3);
+  if (json == NULL) {
+    return NULL;
+  }
+
+  memcpy(json, request_json, head_len);
+  out = json + head_len;
+  *out++ = '"';
+  for (p = model; *p != '\0'; p++) {
+    if (*p == '"' || *p == '\\') {
+      *out++ = '\\';
+    }
+    *out++ = *p;
+  }
+  *out++ = '"';
+  memcpy(out, value_end, rest_len + 1);
+
+  return json;
+}
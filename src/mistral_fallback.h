@@ -0,0 +1,34 @@
+#ifndef MISTRAL_FALLBACK_H
+#define MISTRAL_FALLBACK_H
+
+#include "../include/mistral.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+size_t fallback_policy_count(const mistral_fallback_policy_t *policy);
+
+/*
+* Entry at index, model is NULL for config->model
+*/
+const mistral_fallback_model_t *
+fallback_policy_entry(const mistral_fallback_policy_t *policy, size_t index);
+
+/*
+* Return 1 if a call that ended with error_code should move past entry
+*/
+int fallback_triggered(const mistral_fallback_model_t *entry,
+                       mistral_error_code_t error_code);
+
+/*
+* Copy of request_json with the top-level "model" string replaced
+* Return NULL if there is no such string, the JSON is malformed or on OOM
+*/
+char *fallback_request_json(const char *request_json, const char *model);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MISTRAL_FALLBACK_H */
@@ -0,0 +1,393 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/mistral.h"
+#include "mistral_alloc.h"
+#include "mistral_utils.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+* One worker per session. Updates replace the pending request and cancel
+* the one in flight; the worker sends the pending one once the cursor has
+* rested for debounce_ms, and only delivers a reply if no update came
+* while it ran. prediction is the last delivered completion, kept to
+* answer updates that only type its next characters. deliver_lock is
+* taken before lock and held from the generation check through the
+* callback, so an update never returns while a stale reply is delivered
+*/
+struct mistral_fim_session {
+  pthread_mutex_t deliver_lock;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t worker;
+  const mistral_config_t *config;
+  const mistral_tokenizer_t *tokenizer;
+  long max_prompt_tokens;
+  int debounce_ms;
+  mistral_fim_session_cb callback;
+  void *user_data;
+  mistral_cancel_token_t *token;
+  int busy;
+  int stopping;
+  unsigned long generation;
+  /* newest update not sent yet */
+  int pending;
+  char *prefix;
+  char *suffix;
+  size_t cursor;
+  double updated_ms;
+  /* reused completion waiting for delivery */
+  char *reuse;
+  size_t reuse_cursor;
+  /* what the last delivered completion was predicted for */
+  char *predicted_prefix;
+  char *predicted_suffix;
+  char *prediction;
+  size_t predicted_cursor;
+  mistral_fim_session_stats_t stats;
+};
+
+static char *copy_range(const char *data, size_t len) {
+  char *copy = (char *)mem_malloc(len + 1);
+
+  if (copy != NULL) {
+    memcpy(copy, data, len);
+    copy[len] = '\0';
+  }
+  return copy;
+}
+
+static void forget_prediction(mistral_fim_session_t *session) {
+  mem_free(session->predicted_prefix);
+  mem_free(session->predicted_suffix);
+  mem_free(session->prediction);
+  session->predicted_prefix = NULL;
+  session->predicted_suffix = NULL;
+  session->prediction = NULL;
+}
+
+/*
+* Characters of the prediction typed since it was made, or -1 if the new
+* window is not the predicted one plus those characters. The window may
+* have slid forward, so only the overlapping tails are compared
+*/
+static long typed_ahead(const mistral_fim_session_t *session,
+                        const char *prefix, const char *suffix,
+                        size_t cursor) {
+  size_t typed = 0;
+  size_t prefix_len = strlen(prefix);
+  size_t old_len = 0;
+  size_t overlap = 0;
+
+  if (session->prediction == NULL || cursor < session->predicted_cursor ||
+      strcmp(suffix, session->predicted_suffix) != 0) {
+    return -1;
+  }
+
+  typed = cursor - session->predicted_cursor;
+  if (typed >= strlen(session->prediction) || typed > prefix_len ||
+      memcmp(prefix + prefix_len - typed, session->prediction, typed) != 0) {
+    return -1;
+  }
+
+  prefix_len -= typed;
+  old_len = strlen(session->predicted_prefix);
+  overlap = prefix_len < old_len ? prefix_len : old_len;
+  if (memcmp(prefix + prefix_len - overlap,
+             session->predicted_prefix + old_len - overlap, overlap) != 0) {
+    return -1;
+  }
+  return (long)typed;
+}
+
+static void *session_worker(void *arg) {
+  mistral_fim_session_t *session = (mistral_fim_session_t *)arg;
+  mistral_response_t response;
+  mistral_config_t call;
+  mistral_fim_t fim;
+  unsigned long generation = 0;
+  size_t cursor = 0;
+  char *reuse = NULL;
+  char *prediction = NULL;
+  double rest_until = 0.0;
+  int deliver = 0;
+  int ret = 0;
+
+  pthread_mutex_lock(&session->lock);
+  while (!session->stopping) {
+    if (session->reuse != NULL) {
+      pthread_mutex_unlock(&session->lock);
+      pthread_mutex_lock(&session->deliver_lock);
+      pthread_mutex_lock(&session->lock);
+      /* a newer update may have replaced or dropped it meanwhile */
+      reuse = session->stopping ? NULL : session->reuse;
+      cursor = session->reuse_cursor;
+      if (reuse != NULL) {
+        session->reuse = NULL;
+        session->stats.delivered++;
+      }
+      pthread_mutex_unlock(&session->lock);
+      if (reuse != NULL) {
+        session->callback(reuse, cursor, session->user_data);
+        mem_free(reuse);
+      }
+      pthread_mutex_unlock(&session->deliver_lock);
+      pthread_mutex_lock(&session->lock);
+      continue;
+    }
+
+    if (!session->pending) {
+      pthread_cond_wait(&session->cond, &session->lock);
+      continue;
+    }
+    rest_until = session->updated_ms + session->debounce_ms;
+    if (monotonic_ms() < rest_until) {
+      /* monotonic, so a wall clock jump neither stretches nor skips it */
+      cond_wait_until(&session->cond, &session->lock, rest_until, NULL, NULL);
+      continue;
+    }
+
+    fim.prompt = session->prefix;
+    fim.suffix = session->suffix;
+    cursor = session->cursor;
+    generation = session->generation;
+    session->prefix = NULL;
+    session->suffix = NULL;
+    session->pending = 0;
+    session->busy = 1;
+    session->stats.requests++;
+    mistral_cancel_token_reset(session->token);
+    pthread_mutex_unlock(&session->lock);
+
+    /* freed after every request, so there is no memory to reuse */
+    call = *session->config;
+    call.cancel_token = session->token;
+    call.reuse_responses = 0;
+    memset(&response, 0, sizeof(response));
+    ret = mistral_fim_completions(&call, &fim, &response);
+
+    /* the reply is delivered from here, update() edits the kept copy */
+    prediction = ret == 0 ? mem_strdup(response.content) : NULL;
+
+    pthread_mutex_lock(&session->deliver_lock);
+    pthread_mutex_lock(&session->lock);
+    session->busy = 0;
+    deliver = 0;
+    if (ret == 0 && generation == session->generation && !session->stopping) {
+      forget_prediction(session);
+      if (prediction != NULL) {
+        session->predicted_prefix = fim.prompt;
+        session->predicted_suffix = fim.suffix;
+        session->prediction = prediction;
+        session->predicted_cursor = cursor;
+        fim.prompt = NULL;
+        fim.suffix = NULL;
+        prediction = NULL;
+      }
+      session->stats.delivered++;
+      deliver = 1;
+    } else if (ret == 0 || response.error_code == MISTRAL_ERR_CANCELLED) {
+      session->stats.cancelled++;
+    } else {
+      session->stats.failed++;
+    }
+    pthread_mutex_unlock(&session->lock);
+
+    if (deliver) {
+      session->callback(response.content, cursor, session->user_data);
+    }
+    pthread_mutex_unlock(&session->deliver_lock);
+    mem_free(prediction);
+    mem_free(fim.prompt);
+    mem_free(fim.suffix);
+    mistral_response_free(&response);
+    pthread_mutex_lock(&session->lock);
+  }
+  pthread_mutex_unlock(&session->lock);
+
+  return NULL;
+}
+
+mistral_fim_session_t *
+mistral_fim_session_create(const mistral_config_t *config, int debounce_ms,
+                           long max_prompt_tokens,
+                           const mistral_tokenizer_t *tokenizer,
+                           mistral_fim_session_cb callback, void *user_data) {
+  mistral_fim_session_t *session = NULL;
+
+  if (config == NULL || debounce_ms < 0 || max_prompt_tokens <= 0 ||
+      callback == NULL) {
+    fprintf(stderr, "invalid arguments to mistral_fim_session_create\n");
+    return NULL;
+  }
+
+  session = (mistral_fim_session_t *)mem_calloc(1, sizeof(*session));
+  if (session == NULL) {
+    fprintf(stderr, "failed to allocate memory for FIM session\n");
+    return NULL;
+  }
+
+  session->config = config;
+  session->tokenizer = tokenizer;
+  session->max_prompt_tokens = max_prompt_tokens;
+  session->debounce_ms = debounce_ms;
+  session->callback = callback;
+  session->user_data = user_data;
+
+  session->token = mistral_cancel_token_create();
+  if (session->token == NULL) {
+    mem_free(session);
+    return NULL;
+  }
+
+  if (pthread_mutex_init(&session->deliver_lock, NULL) != 0) {
+    fprintf(stderr, "failed to initialize FIM session lock\n");
+    mistral_cancel_token_free(session->token);
+    mem_free(session);
+    return NULL;
+  }
+  if (pthread_mutex_init(&session->lock, NULL) != 0) {
+    fprintf(stderr, "failed to initialize FIM session lock\n");
+    pthread_mutex_destroy(&session->deliver_lock);
+    mistral_cancel_token_free(session->token);
+    mem_free(session);
+    return NULL;
+  }
+  if (monotonic_cond_init(&session->cond) != 0) {
+    fprintf(stderr, "failed to initialize FIM session condition\n");
+    pthread_mutex_destroy(&session->lock);
+    pthread_mutex_destroy(&session->deliver_lock);
+    mistral_cancel_token_free(session->token);
+    mem_free(session);
+    return NULL;
+  }
+  if (pthread_create(&session->worker, NULL, session_worker, session) != 0) {
+    fprintf(stderr, "failed to start FIM session worker\n");
+    pthread_cond_destroy(&session->cond);
+    pthread_mutex_destroy(&session->lock);
+    pthread_mutex_destroy(&session->deliver_lock);
+    mistral_cancel_token_free(session->token);
+    mem_free(session);
+    return NULL;
+  }
+
+  return session;
+}
+
+int mistral_fim_session_update(mistral_fim_session_t *session,
+                               const char *buffer, size_t length,
+                               size_t cursor) {
+  mistral_fim_window_t window;
+  char *prefix = NULL;
+  char *suffix = NULL;
+  long typed = 0;
+
+  if (session == NULL ||
+      mistral_fim_select_window(buffer, length, cursor,
+                                session->max_prompt_tokens, session->tokenizer,
+                                &window) != 0) {
+    fprintf(stderr, "invalid arguments to mistral_fim_session_update\n");
+    return -1;
+  }
+
+  /* only the window is copied, the editor may change buffer right away */
+  prefix = copy_range(buffer + window.prefix_start,
+                      cursor - window.prefix_start);
+  suffix = copy_range(buffer + cursor, window.suffix_end - cursor);
+  if (prefix == NULL || suffix == NULL) {
+    fprintf(stderr, "failed to copy FIM window\n");
+    mem_free(prefix);
+    mem_free(suffix);
+    return -1;
+  }
+
+  pthread_mutex_lock(&session->deliver_lock);
+  pthread_mutex_lock(&session->lock);
+  session->generation++;
+  session->stats.updates++;
+  if (session->busy) {
+    mistral_cancel_token_cancel(session->token);
+  }
+
+  typed = typed_ahead(session, prefix, suffix, cursor);
+  if (typed >= 0) {
+    /* the rest of the prediction still applies, no request needed */
+    char *rest = copy_range(session->prediction + typed,
+                            strlen(session->prediction) - (size_t)typed);
+    if (rest != NULL) {
+      mem_free(session->reuse);
+      session->reuse = rest;
+      session->reuse_cursor = cursor;
+      mem_free(session->predicted_prefix);
+      session->predicted_prefix = prefix;
+      session->predicted_cursor = cursor;
+      memmove(session->prediction, session->prediction + typed,
+              strlen(session->prediction) - (size_t)typed + 1);
+      mem_free(suffix);
+      mem_free(session->prefix);
+      mem_free(session->suffix);
+      session->prefix = NULL;
+      session->suffix = NULL;
+      session->pending = 0;
+      session->stats.reused++;
+      pthread_cond_signal(&session->cond);
+      pthread_mutex_unlock(&session->lock);
+      pthread_mutex_unlock(&session->deliver_lock);
+      return 0;
+    }
+  }
+
+  if (session->pending) {
+    session->stats.debounced++;
+  }
+  mem_free(session->prefix);
+  mem_free(session->suffix);
+  mem_free(session->reuse);
+  session->reuse = NULL;
+  session->prefix = prefix;
+  session->suffix = suffix;
+  session->cursor = cursor;
+  session->pending = 1;
+  session->updated_ms = monotonic_ms();
+  pthread_cond_signal(&session->cond);
+  pthread_mutex_unlock(&session->lock);
+  pthread_mutex_unlock(&session->deliver_lock);
+
+  return 0;
+}
+
+void mistral_fim_session_get_stats(mistral_fim_session_t *session,
+                                   mistral_fim_session_stats_t *stats) {
+  if (session == NULL || stats == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&session->lock);
+  *stats = session->stats;
+  pthread_mutex_unlock(&session->lock);
+}
+
+void mistral_fim_session_free(mistral_fim_session_t *session) {
+  if (session == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&session->lock);
+  session->stopping = 1;
+  mistral_cancel_token_cancel(session->token);
+  pthread_cond_signal(&session->cond);
+  pthread_mutex_unlock(&session->lock);
+  pthread_join(session->worker, NULL);
+
+  mem_free(session->prefix);
+  mem_free(session->suffix);
+  mem_free(session->reuse);
+  forget_prediction(session);
+  mistral_cancel_token_free(session->token);
+  pthread_cond_destroy(&session->cond);
+  pthread_mutex_destroy(&session->lock);
+  pthread_mutex_destroy(&session->deliver_lock);
+  mem_free(session);
+}
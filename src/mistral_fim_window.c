@@ -0,0 +1,289 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/mistral.h"
+#include "mistral_alloc.h"
+#include "mistral_helpers.h"
+#include "mistral_tokenizer.h"
+#include "mistral_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the text before the cursor gets this share of the budget first */
+#define PREFIX_SHARE_NUM 3
+#define PREFIX_SHARE_DEN 4
+/* give up a block boundary that would waste more of the window than this */
+#define BOUNDARY_SLACK_DEN 4
+
+typedef struct {
+  const char *buffer;
+  size_t length;
+  const mistral_tokenizer_t *tokenizer;
+} window_source_t;
+
+static long count_range(const window_source_t *source, size_t start,
+                        size_t end) {
+  if (source->tokenizer != NULL) {
+    return tokenizer_count_range(source->tokenizer, source->buffer + start,
+                                 end - start);
+  }
+  return (long)((end - start + 3) / 4);
+}
+
+static int is_blank_line(const char *p, const char *end) {
+  for (; p < end && *p != '\n'; p++) {
+    if (*p != ' ' && *p != '\t' && *p != '\r') {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+* A line at column 0 that opens something, like a function, type or
+* top-level statement, rather than closing one
+*/
+static int opens_block(const char *line, const char *end) {
+  return line < end && *line != ' ' && *line != '\t' && *line != '\r' &&
+         *line != '\n' && *line != '}' && *line != ')' && *line != ']';
+}
+
+static size_t line_start(const char *buffer, size_t pos) {
+  while (pos > 0 && buffer[pos - 1] != '\n') {
+    pos--;
+  }
+  return pos;
+}
+
+static size_t line_end(const char *buffer, size_t length, size_t pos) {
+  const char *newline = memchr(buffer + pos, '\n', length - pos);
+  return newline != NULL ? (size_t)(newline - buffer) + 1 : length;
+}
+
+static int is_continuation(const char *buffer, size_t pos) {
+  return ((unsigned char)buffer[pos] & 0xc0) == 0x80;
+}
+
+/*
+* Part of one line too long for the budget, like minified code: the bytes
+* nearest the cursor, [*from, cursor) or [cursor, *to), on character
+* boundaries, shrunk until their exact count fits
+* Return tokens used, -1 if error
+*/
+static long cut_line(const window_source_t *source, size_t cursor,
+                     size_t line_bytes, long budget, int before,
+                     size_t *edge) {
+  size_t bytes = (size_t)budget * 4;
+  long tokens = 0;
+
+  if (bytes > line_bytes) {
+    bytes = line_bytes;
+  }
+  for (;;) {
+    size_t pos = before ? cursor - bytes : cursor + bytes;
+    if (before) {
+      while (pos < cursor && is_continuation(source->buffer, pos)) {
+        pos++;
+      }
+    } else {
+      while (pos > cursor && pos < source->length &&
+             is_continuation(source->buffer, pos)) {
+        pos--;
+      }
+    }
+    tokens = before ? count_range(source, pos, cursor)
+                    : count_range(source, cursor, pos);
+    if (tokens < 0 || tokens <= budget || pos == cursor) {
+      *edge = pos;
+      return tokens;
+    }
+    bytes /= 2;
+  }
+}
+
+/*
+* Grow the prefix from the cursor back one line at a time, within budget.
+* Ends at the outermost block opening reached if that keeps most of the
+* window, at a line start otherwise
+* Return tokens used, -1 if error
+*/
+static long scan_prefix(const window_source_t *source, size_t cursor,
+                        long budget, size_t *start) {
+  size_t pos = cursor;
+  size_t boundary = cursor;
+  long used = 0;
+  long boundary_used = 0;
+
+  while (pos > 0) {
+    size_t from = line_start(source->buffer, pos - 1);
+    long tokens = count_range(source, from, pos);
+
+    if (tokens < 0) {
+      return -1;
+    }
+    if (used + tokens > budget) {
+      if (pos == cursor) {
+        used = cut_line(source, cursor, cursor - from, budget, 1, &pos);
+      }
+      break;
+    }
+
+    used += tokens;
+    pos = from;
+    if (opens_block(source->buffer + pos, source->buffer + cursor) ||
+        (pos > 0 && is_blank_line(source->buffer + line_start(source->buffer,
+                                                               pos - 1),
+                                  source->buffer + pos))) {
+      boundary = pos;
+      boundary_used = used;
+    }
+  }
+
+  if (pos > 0 && boundary != cursor &&
+      used - boundary_used <= used / BOUNDARY_SLACK_DEN) {
+    pos = boundary;
+    used = boundary_used;
+  }
+  *start = pos;
+  return used;
+}
+
+/*
+* Grow the suffix from the cursor forward one line at a time, within
+* budget. Ends before the last block opening or blank line reached if
+* that keeps most of the window
+* Return tokens used, -1 if error
+*/
+static long scan_suffix(const window_source_t *source, size_t cursor,
+                        long budget, size_t *end) {
+  size_t pos = cursor;
+  size_t boundary = cursor;
+  long used = 0;
+  long boundary_used = 0;
+
+  while (pos < source->length) {
+    size_t to = line_end(source->buffer, source->length, pos);
+    long tokens = 0;
+
+    if (pos > cursor &&
+        (opens_block(source->buffer + pos, source->buffer + to) ||
+         is_blank_line(source->buffer + pos, source->buffer + to))) {
+      boundary = pos;
+      boundary_used = used;
+    }
+
+    tokens = count_range(source, pos, to);
+    if (tokens < 0) {
+      return -1;
+    }
+    if (used + tokens > budget) {
+      if (pos == cursor) {
+        used = cut_line(source, cursor, to - cursor, budget, 0, &pos);
+      }
+      break;
+    }
+
+    used += tokens;
+    pos = to;
+  }
+
+  if (pos < source->length && boundary != cursor &&
+      used - boundary_used <= used / BOUNDARY_SLACK_DEN) {
+    pos = boundary;
+    used = boundary_used;
+  }
+  *end = pos;
+  return used;
+}
+
+int mistral_fim_select_window(const char *buffer, size_t length, size_t cursor,
+                              long max_prompt_tokens,
+                              const mistral_tokenizer_t *tokenizer,
+                              mistral_fim_window_t *window) {
+  window_source_t source;
+  long prefix_budget = 0;
+  long prefix_used = 0;
+  long suffix_used = 0;
+
+  if ((buffer == NULL && length > 0) || cursor > length ||
+      max_prompt_tokens <= 0 || window == NULL) {
+    fprintf(stderr, "invalid arguments to mistral_fim_select_window\n");
+    return -1;
+  }
+
+  source.buffer = buffer;
+  source.length = length;
+  source.tokenizer = tokenizer;
+  memset(window, 0, sizeof(mistral_fim_window_t));
+
+  /* whatever one side leaves unused goes to the other */
+  prefix_budget = max_prompt_tokens * PREFIX_SHARE_NUM / PREFIX_SHARE_DEN;
+  suffix_used = scan_suffix(&source, cursor, max_prompt_tokens - prefix_budget,
+                            &window->suffix_end);
+  if (suffix_used < 0) {
+    return -1;
+  }
+  prefix_used = scan_prefix(&source, cursor, max_prompt_tokens - suffix_used,
+                            &window->prefix_start);
+  if (prefix_used < 0) {
+    return -1;
+  }
+  if (window->prefix_start == 0 && window->suffix_end < length) {
+    suffix_used = scan_suffix(&source, cursor, max_prompt_tokens - prefix_used,
+                              &window->suffix_end);
+    if (suffix_used < 0) {
+      return -1;
+    }
+  }
+
+  window->prefix_tokens = prefix_used;
+  window->suffix_tokens = suffix_used;
+  return 0;
+}
+
+int mistral_fim_completions_window(const mistral_config_t *config,
+                                   const char *buffer, size_t length,
+                                   size_t cursor, long max_prompt_tokens,
+                                   const mistral_tokenizer_t *tokenizer,
+                                   mistral_response_t *response) {
+  mistral_fim_window_t window;
+  json_stream_t body;
+  int ret = -1;
+
+  if (config == NULL || config->api_key == NULL || response == NULL ||
+      mistral_fim_select_window(buffer, length, cursor, max_prompt_tokens,
+                                tokenizer, &window) != 0) {
+    fprintf(stderr, "invalid arguments to mistral_fim_completions_window\n");
+    if (response != NULL) {
+      response_begin(config, response);
+      if (set_error_message(response, "Invalid parameters") == 0) {
+        response->error_code = MISTRAL_ERR_INVALID_PARAM;
+      }
+    }
+    return -1;
+  }
+
+  response_begin(config, response);
+
+  if (validate_common_params(config, response) != 0) {
+    return -1;
+  }
+
+  /* the slices are escaped straight from the caller's buffer */
+  json_stream_init(&body);
+  if (create_fim_request_stream(
+          config, buffer + window.prefix_start, cursor - window.prefix_start,
+          buffer + cursor, window.suffix_end - cursor, &body) != 0) {
+    json_stream_free(&body);
+    if (set_error_message(response, "failed to create request JSON") == 0) {
+      response->error_code = MISTRAL_ERR_MEM;
+    }
+    return -1;
+  }
+
+  ret = execute_http_stream_with_retry(
+      config, MISTRAL_BASE_API "/fim/completions", &body, response);
+  json_stream_free(&body);
+
+  return ret;
+}
@@ -0,0 +1,162 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mistral_hedge.h"
+#include "mistral_alloc.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HEDGE_SAMPLE_WINDOW 128
+/* samples needed before a learned delay is trusted */
+#define HEDGE_MIN_SAMPLES 20
+
+struct mistral_hedge_policy {
+  pthread_mutex_t lock;
+  int fixed_after_ms;
+  double percentile;
+  double budget;
+  double samples[HEDGE_SAMPLE_WINDOW];
+  size_t sample_count;
+  size_t sample_next;
+  double learned_after_ms;
+  int samples_dirty;
+  unsigned long requests;
+  unsigned long hedges;
+  unsigned long hedge_wins;
+  unsigned long reserved;
+};
+
+static int compare_doubles(const void *a, const void *b) {
+  double lhs = *(const double *)a;
+  double rhs = *(const double *)b;
+  return (lhs > rhs) - (lhs < rhs);
+}
+
+static double learned_delay(mistral_hedge_policy_t *policy) {
+  double sorted[HEDGE_SAMPLE_WINDOW];
+  size_t rank = 0;
+
+  if (policy->sample_count < HEDGE_MIN_SAMPLES) {
+    return 0.0;
+  }
+
+  if (policy->samples_dirty) {
+    memcpy(sorted, policy->samples, policy->sample_count * sizeof(double));
+    qsort(sorted, policy->sample_count, sizeof(double), compare_doubles);
+
+    rank = (size_t)(policy->percentile / 100.0 * (double)policy->sample_count);
+    if (rank >= policy->sample_count) {
+      rank = policy->sample_count - 1;
+    }
+    policy->learned_after_ms = sorted[rank];
+    policy->samples_dirty = 0;
+  }
+
+  return policy->learned_after_ms;
+}
+
+mistral_hedge_policy_t *mistral_hedge_policy_create(int hedge_after_ms,
+                                                    double percentile,
+                                                    double budget_percent) {
+  mistral_hedge_policy_t *policy = NULL;
+
+  if (hedge_after_ms < 0 || percentile <= 0.0 || percentile >= 100.0 ||
+      budget_percent <= 0.0 || budget_percent > 100.0) {
+    fprintf(stderr, "invalid hedge policy parameters\n");
+    return NULL;
+  }
+
+  policy = (mistral_hedge_policy_t *)mem_malloc(sizeof(mistral_hedge_policy_t));
+  if (policy == NULL) {
+    fprintf(stderr, "failed to allocate memory for hedge policy\n");
+    return NULL;
+  }
+
+  memset(policy, 0, sizeof(mistral_hedge_policy_t));
+
+  if (pthread_mutex_init(&policy->lock, NULL) != 0) {
+    fprintf(stderr, "failed to init hedge policy mutex\n");
+    mem_free(policy);
+    return NULL;
+  }
+
+  policy->fixed_after_ms = hedge_after_ms;
+  policy->percentile = percentile;
+  policy->budget = budget_percent / 100.0;
+
+  return policy;
+}
+
+void mistral_hedge_policy_get_stats(mistral_hedge_policy_t *policy,
+                                    mistral_hedge_stats_t *stats) {
+  if (policy == NULL || stats == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&policy->lock);
+  stats->requests = policy->requests;
+  stats->hedges = policy->hedges;
+  stats->hedge_wins = policy->hedge_wins;
+  stats->hedge_after_ms = policy->fixed_after_ms > 0
+                              ? (double)policy->fixed_after_ms
+                              : learned_delay(policy);
+  pthread_mutex_unlock(&policy->lock);
+}
+
+void mistral_hedge_policy_free(mistral_hedge_policy_t *policy) {
+  if (policy != NULL) {
+    pthread_mutex_destroy(&policy->lock);
+    mem_free(policy);
+  }
+}
+
+int hedge_begin(mistral_hedge_policy_t *policy) {
+  int after_ms = 0;
+
+  pthread_mutex_lock(&policy->lock);
+
+  policy->requests++;
+
+  /* a possible hedge holds budget until hedge_end knows if it was sent */
+  if ((double)(policy->hedges + policy->reserved + 1) <=
+      policy->budget * (double)policy->requests) {
+    after_ms = policy->fixed_after_ms > 0 ? policy->fixed_after_ms
+                                          : (int)(learned_delay(policy) + 0.5);
+    if (after_ms > 0) {
+      policy->reserved++;
+    }
+  }
+
+  pthread_mutex_unlock(&policy->lock);
+  return after_ms;
+}
+
+void hedge_end(mistral_hedge_policy_t *policy, int hedge_after_ms,
+               const http_response_t *response) {
+  pthread_mutex_lock(&policy->lock);
+
+  if (hedge_after_ms > 0) {
+    policy->reserved--;
+  }
+
+  if (response->hedged) {
+    policy->hedges++;
+    if (response->hedge_won) {
+      policy->hedge_wins++;
+    }
+  }
+
+  /* a winning hedge was sent hedge_after_ms into the request */
+  if (response->ttfb_ms > 0.0) {
+    policy->samples[policy->sample_next] =
+        response->ttfb_ms + (response->hedge_won ? hedge_after_ms : 0);
+    policy->sample_next = (policy->sample_next + 1) % HEDGE_SAMPLE_WINDOW;
+    if (policy->sample_count < HEDGE_SAMPLE_WINDOW) {
+      policy->sample_count++;
+    }
+    policy->samples_dirty = 1;
+  }
+
+  pthread_mutex_unlock(&policy->lock);
+}
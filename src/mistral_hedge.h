@@ -0,0 +1,28 @@
+#ifndef MISTRAL_HEDGE_H
+#define MISTRAL_HEDGE_H
+
+#include "../include/mistral.h"
+#include "http_client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* Decide whether the next request may be hedged
+* Return delay in ms to pass as hedge_after_ms, 0 if hedging is not allowed
+*/
+int hedge_begin(mistral_hedge_policy_t *policy);
+
+/*
+* Account a finished request started with hedge_begin
+* hedge_after_ms: value hedge_begin returned
+*/
+void hedge_end(mistral_hedge_policy_t *policy, int hedge_after_ms,
+               const http_response_t *response);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MISTRAL_HEDGE_H */
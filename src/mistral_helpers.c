@@ -2,6 +2,20 @@
 
 #include "mistral_helpers.h"
 #include "http_client.h"
+#include "json_view.h"
+#include "json_writer.h"
+#include "mistral_alloc.h"
+#include "mistral_arena.h"
+#include "mistral_balancer.h"
+#include "mistral_breaker.h"
+#include "mistral_cache.h"
+#include "mistral_cancel.h"
+#include "mistral_coalescer.h"
+#include "mistral_fallback.h"
+#include "mistral_hedge.h"
+#include "mistral_limiter.h"
+#include "mistral_router.h"
+#include "mistral_transfer.h"
 #include "mistral_utils.h"
 #include <cjson/cJSON.h>
 #include <stdio.h>
@@ -10,6 +24,20 @@
 #include <time.h>
 
 #define DEBUG_LOG(...) ((void)0)
+/* alignment padding of the few fields parsed into a response arena */
+#define ARENA_SLACK 256
+
+/*
+* The arena a reused response kept, emptied, or a new one
+*/
+static response_arena_t *parse_arena(response_arena_t *arena,
+                                     size_t first_block) {
+  if (arena != NULL) {
+    response_arena_reset(arena);
+    return arena;
+  }
+  return response_arena_create(first_block);
+}
 
 mistral_api_error_t *parse_api_error(cJSON *error_obj) {
   mistral_api_error_t *api_error = NULL;
@@ -19,7 +47,7 @@ mistral_api_error_t *parse_api_error(cJSON *error_obj) {
     return NULL;
   }
 
-  api_error = (mistral_api_error_t *)malloc(sizeof(mistral_api_error_t));
+  api_error = (mistral_api_error_t *)mem_malloc(sizeof(mistral_api_error_t));
   if (api_error == NULL) {
     return NULL;
   }
@@ -28,7 +56,7 @@ mistral_api_error_t *parse_api_error(cJSON *error_obj) {
 
   item = cJSON_GetObjectItemCaseSensitive(error_obj, "message");
   if (item != NULL && cJSON_IsString(item)) {
-    api_error->message = strdup(item->valuestring);
+    api_error->message = mem_strdup(item->valuestring);
     if (api_error->message == NULL) {
       mistral_api_error_free(api_error);
       return NULL;
@@ -37,7 +65,7 @@ mistral_api_error_t *parse_api_error(cJSON *error_obj) {
 
   item = cJSON_GetObjectItemCaseSensitive(error_obj, "type");
   if (item != NULL && cJSON_IsString(item)) {
-    api_error->type = strdup(item->valuestring);
+    api_error->type = mem_strdup(item->valuestring);
     if (api_error->type == NULL) {
       mistral_api_error_free(api_error);
       return NULL;
@@ -46,7 +74,7 @@ mistral_api_error_t *parse_api_error(cJSON *error_obj) {
 
   item = cJSON_GetObjectItemCaseSensitive(error_obj, "param");
   if (item != NULL && cJSON_IsString(item)) {
-    api_error->param = strdup(item->valuestring);
+    api_error->param = mem_strdup(item->valuestring);
     if (api_error->param == NULL) {
       mistral_api_error_free(api_error);
       return NULL;
@@ -56,7 +84,7 @@ mistral_api_error_t *parse_api_error(cJSON *error_obj) {
   item = cJSON_GetObjectItemCaseSensitive(error_obj, "code");
   if (item != NULL) {
     if (cJSON_IsString(item)) {
-      api_error->code = strdup(item->valuestring);
+      api_error->code = mem_strdup(item->valuestring);
       if (api_error->code == NULL) {
         mistral_api_error_free(api_error);
         return NULL;
@@ -64,7 +92,7 @@ mistral_api_error_t *parse_api_error(cJSON *error_obj) {
     } else if (cJSON_IsNumber(item)) {
       char code_buf[32];
       snprintf(code_buf, sizeof(code_buf), "%d", item->valueint);
-      api_error->code = strdup(code_buf);
+      api_error->code = mem_strdup(code_buf);
       if (api_error->code == NULL) {
         mistral_api_error_free(api_error);
         return NULL;
@@ -163,6 +191,33 @@ error:
   return NULL;
 }
 
+int create_embeddings_stream(const mistral_config_t *config,
+                             const mistral_embeddings_n_t *inputs,
+                             size_t input_count, json_stream_t *body) {
+  size_t i;
+
+  if (json_stream_append(body, "{\"model\":", 9) != 0 ||
+      json_stream_append_string(body, config->model) != 0 ||
+      json_stream_append(body, ",\"input\":[", 10) != 0) {
+    goto error;
+  }
+  for (i = 0; i < input_count; i++) {
+    if ((i > 0 && json_stream_append(body, ",", 1) != 0) ||
+        json_stream_reference_string(body, inputs[i].input,
+                                     inputs[i].input_len) != 0) {
+      goto error;
+    }
+  }
+  if (json_stream_append(body, "]}", 2) != 0) {
+    goto error;
+  }
+  return 0;
+
+error:
+  fprintf(stderr, "failed to create embeddings request JSON\n");
+  return -1;
+}
+
 char *create_fim_request_json(const mistral_config_t *config,
                               const mistral_fim_t *fim) {
   cJSON *root = NULL;
@@ -216,6 +271,28 @@ error:
   return NULL;
 }
 
+int create_fim_request_stream(const mistral_config_t *config,
+                              const char *prompt, size_t prompt_len,
+                              const char *suffix, size_t suffix_len,
+                              json_stream_t *body) {
+  /* same key order as create_fim_request_json */
+  if (json_stream_append(body, "{\"model\":", 9) != 0 ||
+      json_stream_append_string(body, config->model) != 0 ||
+      json_stream_append(body, ",\"prompt\":", 10) != 0 ||
+      json_stream_reference_string(body, prompt, prompt_len) != 0 ||
+      json_stream_append(body, ",\"suffix\":", 10) != 0 ||
+      json_stream_reference_string(body, suffix, suffix_len) != 0 ||
+      json_stream_append(body, ",\"temperature\":", 15) != 0 ||
+      json_stream_append_number(body, config->temperature) != 0 ||
+      json_stream_append(body, ",\"max_tokens\":", 14) != 0 ||
+      json_stream_append_number(body, config->max_tokens) != 0 ||
+      json_stream_append(body, "}", 1) != 0) {
+    fprintf(stderr, "failed to create FIM request JSON\n");
+    return -1;
+  }
+  return 0;
+}
+
 char *create_chat_request_json(const mistral_config_t *config,
                                const mistral_message_t *messages,
                                size_t message_count) {
@@ -295,19 +372,77 @@ error:
   return NULL;
 }
 
+int create_chat_request_stream(const mistral_config_t *config,
+                                const mistral_message_n_t *messages,
+                                size_t message_count, json_stream_t *body) {
+  size_t i;
+
+  /* same key order as create_chat_request_json */
+  if (json_stream_append(body, "{\"model\":", 9) != 0 ||
+      json_stream_append_string(body, config->model) != 0 ||
+      json_stream_append(body, ",\"messages\":[", 13) != 0) {
+    goto error;
+  }
+  for (i = 0; i < message_count; i++) {
+    if ((i > 0 && json_stream_append(body, ",", 1) != 0) ||
+        json_stream_append(body, "{\"role\":", 8) != 0 ||
+        json_stream_reference_string(body, messages[i].role,
+                                     messages[i].role_len) != 0 ||
+        json_stream_append(body, ",\"content\":", 11) != 0 ||
+        json_stream_reference_string(body, messages[i].content,
+                                     messages[i].content_len) != 0 ||
+        json_stream_append(body, "}", 1) != 0) {
+      goto error;
+    }
+  }
+  if (json_stream_append(body, "],\"temperature\":", 16) != 0 ||
+      json_stream_append_number(body, config->temperature) != 0 ||
+      json_stream_append(body, ",\"max_tokens\":", 14) != 0 ||
+      json_stream_append_number(body, config->max_tokens) != 0 ||
+      json_stream_append(body, "}", 1) != 0) {
+    goto error;
+  }
+  return 0;
+
+error:
+  fprintf(stderr, "failed to create chat request JSON\n");
+  return -1;
+}
+
+/*
+* Bytes the parsed vectors take, so the arena needs no second block for
+* them; a floats array is a fraction of its text
+*/
+static size_t embeddings_arena_size(const cJSON *root) {
+  const cJSON *data = cJSON_GetObjectItemCaseSensitive(root, "data");
+  const cJSON *item = NULL;
+  size_t size = ARENA_SLACK + sizeof(usage_info_t);
+
+  cJSON_ArrayForEach(item, data) {
+    const cJSON *embedding =
+        cJSON_GetObjectItemCaseSensitive(item, "embedding");
+    size += sizeof(embedding_response_data) + ARENA_SLACK / 8 +
+            (size_t)cJSON_GetArraySize(embedding) * sizeof(float);
+  }
+  return size + sizeof(embedding_response_data);
+}
+
 int parse_embenddings(const char *json_data, long http_code,
                       mistral_embeddings_response_t *response) {
   cJSON *root = NULL;
   cJSON *data = NULL;
   cJSON *usage = NULL;
   cJSON *item = NULL;
+  response_arena_t *arena = NULL;
 
+  arena = response->arena;
   memset(response, 0, sizeof(mistral_embeddings_response_t));
+  response->arena = arena;
   response->http_code = http_code;
 
   root = cJSON_Parse(json_data);
   if (root == NULL) {
-    response->error_message = strdup("failed to parse JSON response");
+    response->error_message = mem_strdup("failed to parse JSON response");
     if (response->error_message == NULL) {
       response->error_code = MISTRAL_ERR_MEM;
       return -1;
@@ -321,10 +456,10 @@ int parse_embenddings(const char *json_data, long http_code,
     response->api_error = parse_api_error(item);
 
     if (response->api_error != NULL && response->api_error->message != NULL) {
-      response->error_message = strdup(response->api_error->message);
+      response->error_message = mem_strdup(response->api_error->message);
       ;
     } else {
-      response->error_message = strdup("unknown API error");
+      response->error_message = mem_strdup("unknown API error");
     }
 
     response->error_code = determine_error_code(
@@ -344,35 +479,45 @@ int parse_embenddings(const char *json_data, long http_code,
       strncat(msg, "no error details provided", sizeof(msg) - strlen(msg) - 1);
     }
 
-    response->error_message = strdup(msg);
+    response->error_message = mem_strdup(msg);
     response->error_code = determine_error_code(http_code, NULL);
 
     cJSON_Delete(root);
     return -1;
   }
 
+  response->arena = parse_arena(response->arena, embeddings_arena_size(root));
+  if (response->arena == NULL) {
+    response->error_message = mem_strdup("failed to allocate response arena");
+    response->error_code = MISTRAL_ERR_MEM;
+    cJSON_Delete(root);
+    return -1;
+  }
+
   item = cJSON_GetObjectItemCaseSensitive(root, "id");
   if (item != NULL && cJSON_IsString(item)) {
-    response->id = strdup(item->valuestring);
+    response->id = response_arena_strdup(response->arena, item->valuestring);
   }
 
   item = cJSON_GetObjectItemCaseSensitive(root, "model");
   if (item != NULL && cJSON_IsString(item)) {
-    response->model = strdup(item->valuestring);
+    response->model = response_arena_strdup(response->arena, item->valuestring);
   }
 
   item = cJSON_GetObjectItemCaseSensitive(root, "object");
   if (item != NULL && cJSON_IsString(item)) {
-    response->object = strdup(item->valuestring);
+    response->object =
+        response_arena_strdup(response->arena, item->valuestring);
   }
 
   data = cJSON_GetObjectItemCaseSensitive(root, "data");
   if (data != NULL && cJSON_IsArray(data) && cJSON_GetArraySize(data) > 0) {
     size_t data_size = cJSON_GetArraySize(data);
-    response->data = malloc((data_size + 1) * sizeof(embedding_response_data));
+    response->data = response_arena_alloc(
+        response->arena, (data_size + 1) * sizeof(embedding_response_data));
     if (response->data == NULL) {
       response->error_message =
-          strdup("failed to allocate memory for embeddings data");
+          mem_strdup("failed to allocate memory for embeddings data");
       response->error_code = MISTRAL_ERR_MEM;
       cJSON_Delete(root);
       return -1;
@@ -390,7 +535,7 @@ int parse_embenddings(const char *json_data, long http_code,
 
       if (!cJSON_IsArray(embedding_array) || !cJSON_IsNumber(index)) {
         response->error_message =
-            strdup("invalid embedding format in response");
+            mem_strdup("invalid embedding format in response");
         response->error_code = MISTRAL_ERR_PARSE;
         cJSON_Delete(root);
         return -1;
@@ -398,23 +543,25 @@ int parse_embenddings(const char *json_data, long http_code,
 
       size_t embedding_size = cJSON_GetArraySize(embedding_array);
 
-      response->data[embedding_index].embending =
-          malloc(embedding_size * sizeof(float));
+      response->data[embedding_index].embending = response_arena_alloc(
+          response->arena, embedding_size * sizeof(float));
       if (response->data[embedding_index].embending == NULL) {
         response->error_message =
-            strdup("failed to allocate memory for embedding");
+            mem_strdup("failed to allocate memory for embedding");
         response->error_code = MISTRAL_ERR_MEM;
         cJSON_Delete(root);
         return -1;
       }
 
       response->data[embedding_index].index = index->valueint;
+      response->data[embedding_index].dimensions = (int)embedding_size;
 
       if (object != NULL && cJSON_IsString(object)) {
-        response->data[embedding_index].object = strdup(object->valuestring);
+        response->data[embedding_index].object =
+            response_arena_strdup(response->arena, object->valuestring);
         if (response->data[embedding_index].object == NULL) {
           response->error_message =
-              strdup("failed to allocate memory for object string");
+              mem_strdup("failed to allocate memory for object string");
           response->error_code = MISTRAL_ERR_MEM;
           cJSON_Delete(root);
           return -1;
@@ -428,7 +575,7 @@ int parse_embenddings(const char *json_data, long http_code,
               (float)cJSON_GetNumberValue(value);
         } else {
           response->error_message =
-              strdup("invalid embedding value in response");
+              mem_strdup("invalid embedding value in response");
           response->error_code = MISTRAL_ERR_PARSE;
           cJSON_Delete(root);
           return -1;
@@ -440,10 +587,11 @@ int parse_embenddings(const char *json_data, long http_code,
 
   usage = cJSON_GetObjectItemCaseSensitive(root, "usage");
   if (usage != NULL && cJSON_IsObject(usage)) {
-    response->usage = malloc(sizeof(usage_info_t));
+    response->usage =
+        response_arena_alloc(response->arena, sizeof(usage_info_t));
     if (response->usage == NULL) {
       response->error_message =
-          strdup("failed to allocate memory for usage info");
+          mem_strdup("failed to allocate memory for usage info");
       response->error_code = MISTRAL_ERR_MEM;
       cJSON_Delete(root);
       return -1;
@@ -477,8 +625,9 @@ int parse_embenddings(const char *json_data, long http_code,
   }
 
   if (response->data == NULL) {
-    response->error_message = strdup("no data in successful response");
+    response->error_message = mem_strdup("no data in successful response");
     response->error_code = MISTRAL_ERR_PARSE;
+    cJSON_Delete(root);
     return -1;
   }
 
@@ -495,13 +644,16 @@ int parse_response(const char *json_data, long http_code,
   cJSON *content = NULL;
   cJSON *usage = NULL;
   cJSON *item = NULL;
+  response_arena_t *arena = NULL;
 
+  arena = response->arena;
   memset(response, 0, sizeof(mistral_response_t));
+  response->arena = arena;
   response->http_code = http_code;
 
   root = cJSON_Parse(json_data);
   if (root == NULL) {
-    response->error_message = strdup("failed to parse JSON response");
+    response->error_message = mem_strdup("failed to parse JSON response");
     if (response->error_message == NULL) {
       response->error_code = MISTRAL_ERR_MEM;
       return -1;
@@ -515,9 +667,9 @@ int parse_response(const char *json_data, long http_code,
     response->api_error = parse_api_error(item);
 
     if (response->api_error != NULL && response->api_error->message != NULL) {
-      response->error_message = strdup(response->api_error->message);
+      response->error_message = mem_strdup(response->api_error->message);
     } else {
-      response->error_message = strdup("unknown API error");
+      response->error_message = mem_strdup("unknown API error");
     }
 
     response->error_code = determine_error_code(
@@ -538,21 +690,31 @@ int parse_response(const char *json_data, long http_code,
       strncat(msg, "no error details provided", sizeof(msg) - strlen(msg) - 1);
     }
 
-    response->error_message = strdup(msg);
+    response->error_message = mem_strdup(msg);
     response->error_code = determine_error_code(http_code, NULL);
 
     cJSON_Delete(root);
     return -1;
   }
 
+  /* unescaped strings never outgrow the body, one block holds them all */
+  response->arena =
+      parse_arena(response->arena, strlen(json_data) + ARENA_SLACK);
+  if (response->arena == NULL) {
+    response->error_message = mem_strdup("failed to allocate response arena");
+    response->error_code = MISTRAL_ERR_MEM;
+    cJSON_Delete(root);
+    return -1;
+  }
+
   item = cJSON_GetObjectItemCaseSensitive(root, "id");
   if (item != NULL && cJSON_IsString(item)) {
-    response->id = strdup(item->valuestring);
+    response->id = response_arena_strdup(response->arena, item->valuestring);
   }
 
   item = cJSON_GetObjectItemCaseSensitive(root, "model");
   if (item != NULL && cJSON_IsString(item)) {
-    response->model = strdup(item->valuestring);
+    response->model = response_arena_strdup(response->arena, item->valuestring);
   }
 
   choices = cJSON_GetObjectItemCaseSensitive(root, "choices");
@@ -564,7 +726,8 @@ int parse_response(const char *json_data, long http_code,
       if (message != NULL) {
         content = cJSON_GetObjectItemCaseSensitive(message, "content");
         if (content != NULL && cJSON_IsString(content)) {
-          response->content = strdup(content->valuestring);
+          response->content =
+              response_arena_strdup(response->arena, content->valuestring);
         }
       }
     }
@@ -591,7 +754,7 @@ int parse_response(const char *json_data, long http_code,
   cJSON_Delete(root);
 
   if (response->content == NULL) {
-    response->error_message = strdup("no content in successful response");
+    response->error_message = mem_strdup("no content in successful response");
     response->error_code = MISTRAL_ERR_PARSE;
     return -1;
   }
@@ -600,16 +763,427 @@ int parse_response(const char *json_data, long http_code,
   return 0;
 }
 
-int execute_http_request_with_retry(const mistral_config_t *config,
+/*
+* value at its opening quote if it is a string
+*/
+static char *view_string(const char *value) {
+  return value != NULL && *value == '"' ? (char *)value : NULL;
+}
+
+static int view_int(const char *usage, const char *end, const char *key) {
+  const char *value = json_view_member(usage, end, key);
+  return value != NULL ? (int)strtol(value, NULL, 10) : 0;
+}
+
+int parse_response_view(char **body, size_t size, size_t capacity,
+                        mistral_response_t *response) {
+  static const char *keys[] = {"error", "choices", "id", "model", "usage"};
+  const char *values[5];
+  char *data = *body;
+  const char *end = data + size;
+  const char *message = NULL;
+  const char *usage = NULL;
+  char *id = NULL;
+  char *model = NULL;
+  char *content = NULL;
+  response_arena_t *arena = NULL;
+
+  /* anything but a well formed reply goes to the full parser */
+  if (json_view_members(data, end, keys, values, 5) != 0 ||
+      values[0] != NULL) {
+    return 1;
+  }
+  message = json_view_member(json_view_first(values[1], end), end, "message");
+  content = view_string(json_view_member(message, end, "content"));
+  if (content == NULL) {
+    return 1;
+  }
+  id = view_string(values[2]);
+  model = view_string(values[3]);
+  usage = values[4];
+
+  arena = response->arena;
+  memset(response, 0, sizeof(mistral_response_t));
+  response->arena = parse_arena(arena, 0);
+  response->http_code = 200;
+
+  if (response->arena == NULL) {
+    response->error_message = mem_strdup("failed to allocate response arena");
+    response->error_code = MISTRAL_ERR_MEM;
+    return -1;
+  }
+
+  /* numbers first, unescaping rewrites the text behind them */
+  if (usage != NULL) {
+    response->prompt_tokens = view_int(usage, end, "prompt_tokens");
+    response->completion_tokens = view_int(usage, end, "completion_tokens");
+    response->total_tokens = view_int(usage, end, "total_tokens");
+  }
+
+  response->content = content + 1;
+  response_arena_set_length(response->arena, response->content,
+                            json_view_unescape(content));
+  if (id != NULL) {
+    response->id = id + 1;
+    response_arena_set_length(response->arena, response->id,
+                              json_view_unescape(id));
+  }
+  if (model != NULL) {
+    response->model = model + 1;
+    response_arena_set_length(response->arena, response->model,
+                              json_view_unescape(model));
+  }
+
+  response_arena_adopt(response->arena, data, size, capacity);
+  *body = NULL;
+  response->error_code = MISTRAL_OK;
+  return 0;
+}
+
+/*
+* Part of endpoint below MISTRAL_BASE_API when a backend pool should route
+* it, NULL otherwise
+*/
+static const char *pool_path(const mistral_config_t *config,
+                             const char *endpoint) {
+  size_t base_len = strlen(MISTRAL_BASE_API);
+
+  if (config->backend_pool == NULL ||
+      strncmp(endpoint, MISTRAL_BASE_API, base_len) != 0) {
+    return NULL;
+  }
+  return endpoint + base_len;
+}
+
+/*
+* Bytes of the values a stream holds before escaping, close enough to the
+* body size to pick how to send it
+*/
+static size_t stream_value_bytes(const json_stream_t *body) {
+  size_t total = body->text.size;
+  size_t i;
+
+  for (i = 0; i < body->count; i++) {
+    if (body->parts[i].data != NULL) {
+      total += body->parts[i].len;
+    }
+  }
+  return total;
+}
+
+/*
+* Nonzero if the body is large enough for config->compress_request_bytes
+*/
+static int compress_body(const mistral_config_t *config,
+                         const char *request_json,
+                         const json_stream_t *stream) {
+  size_t bytes = 0;
+
+  if (config->compress_request_bytes == 0) {
+    return 0;
+  }
+  bytes = stream != NULL ? stream_value_bytes(stream) : strlen(request_json);
+  return bytes >= config->compress_request_bytes;
+}
+
+static long read_request(char *buffer, size_t size, void *source) {
+  return (long)json_stream_read((json_stream_t *)source, buffer, size);
+}
+
+static int rewind_request(void *source) {
+  json_stream_rewind((json_stream_t *)source);
+  return 0;
+}
+
+typedef struct {
+  const mistral_config_t *config;
+  const char *path;
+  const char *url;
+  const char **headers;
+  const char *request_json;
+  json_stream_t *stream;
+  const http_request_options_t *options;
+  int hedge;
+} upstream_t;
+
+/*
+* Sends one attempt, to the backend picked from the pool if there is one,
+* and reports the outcome to that backend and the hedge policy. The
+* coalescer calls it for the leader only, so a follower never picks or
+* loads a backend, nor counts toward the hedge budget
+* Return 0 if ok, -1 if error
+*/
+static int send_upstream(void *data, http_response_t *http_resp) {
+  upstream_t *upstream = (upstream_t *)data;
+  const mistral_config_t *config = upstream->config;
+  http_request_options_t options = *upstream->options;
+  http_body_stream_t body;
+  pool_backend_t *backend = NULL;
+  const char *url = upstream->url;
+  const char **headers = upstream->headers;
+  const char *backend_headers[3];
+  char backend_url[512];
+  char backend_auth[512];
+  double started = monotonic_ms();
+  long outcome = 0;
+  int ret = -1;
+
+  if (upstream->hedge) {
+    options.hedge_after_ms = hedge_begin(config->hedge_policy);
+  }
+
+  if (upstream->path != NULL) {
+    backend = backend_pool_acquire(config->backend_pool);
+  }
+  if (backend != NULL) {
+    /* lengths are bounded by mistral_backend_pool_add */
+    snprintf(backend_url, sizeof(backend_url), "%s%s",
+             backend_base_url(backend), upstream->path);
+    snprintf(backend_auth, sizeof(backend_auth), "authorization: Bearer %s",
+             backend_api_key(backend));
+    backend_headers[0] = headers[0];
+    backend_headers[1] = backend_auth;
+    backend_headers[2] = NULL;
+    url = backend_url;
+    headers = backend_headers;
+  }
+
+  if (upstream->stream != NULL) {
+    body.read = read_request;
+    body.rewind = rewind_request;
+    body.source = upstream->stream;
+    ret = http_post_stream(url, headers, &body, &options, http_resp);
+  } else {
+    ret = http_post_ex(url, headers, upstream->request_json, &options,
+                       http_resp);
+  }
+
+  if (backend != NULL) {
+    /* a cancelled attempt says nothing about the backend */
+    outcome = mistral_cancel_token_is_cancelled(config->cancel_token)
+                  ? -1
+                  : (ret == 0 ? http_resp->http_code : 0);
+    backend_pool_release(config->backend_pool, backend, outcome,
+                         monotonic_ms() - started);
+  }
+
+  if (upstream->hedge) {
+    hedge_end(config->hedge_policy, options.hedge_after_ms, http_resp);
+  }
+  return ret;
+}
+
+/*
+* Single HTTP attempt, reported to the adaptive limiter and the circuit
+* breaker. With a backend pool the attempt goes to the picked backend's
+* URL with its key, limiter and breaker still see the logical endpoint.
+* Identical requests are only coalesced or hedged when the answer does not
+* depend on sampling. Coalescing keys on the logical endpoint, so calls
+* that would go to different backends still share one send.
+* A stream body, sent instead of request_json, is never coalesced or
+* hedged: both need the whole body up front. Neither is a compressed one,
+* which is deflated as it is sent.
+* The attempt never runs past deadline (monotonic ms, 0 for none)
+* Return 0 if ok, -1 if the attempt failed, -2 if it ended on the client
+* side: in the limiter queue or at deadline
+*/
+static int send_http_request(const mistral_config_t *config,
+                             const char *endpoint, const char **headers,
+                             const char *request_json, json_stream_t *stream,
+                             int deterministic, int probe, double deadline,
+                             http_response_t *http_resp) {
+  http_request_options_t options;
+  upstream_t upstream;
+  limiter_endpoint_t *slot = NULL;
+  int gzip = compress_body(config, request_json, stream);
+  double started = 0.0;
+  long outcome = 0;
+  int deadline_cut = 0;
+  int ret = -1;
+
+  /* a queue wait counts against the deadline like the transfer does */
+  if (config->limiter != NULL &&
+      limiter_acquire(config->limiter, endpoint, deadline,
+                      config->cancel_token, &slot) != 0) {
+    DEBUG_LOG("limiter wait ended by the deadline or a cancel");
+    if (config->circuit_breaker != NULL) {
+      breaker_release(config->circuit_breaker, endpoint, config->model, probe);
+    }
+    http_resp->timed_out =
+        !mistral_cancel_token_is_cancelled(config->cancel_token);
+    return -2;
+  }
+
+  memset(&options, 0, sizeof(options));
+  options.gzip_body = gzip;
+
+  if (config->cancel_token != NULL) {
+    options.is_cancelled = cancel_token_check;
+    options.cancel_data = config->cancel_token;
+    options.cancel_fd = cancel_token_fd(config->cancel_token);
+  }
+
+  started = monotonic_ms();
+
+  options.connect_timeout_ms = config->connect_timeout_ms;
+  options.timeout_ms = config->timeout_sec * 1000;
+  options.first_byte_timeout_ms = config->first_byte_timeout_ms;
+  options.idle_timeout_ms = config->idle_timeout_ms;
+  if (deadline > 0.0 && deadline - started < options.timeout_ms) {
+    options.timeout_ms =
+        deadline - started > 1.0 ? (int)(deadline - started) : 1;
+    deadline_cut = 1;
+  }
+  if (options.connect_timeout_ms > options.timeout_ms) {
+    options.connect_timeout_ms = options.timeout_ms;
+  }
+
+  upstream.config = config;
+  upstream.path = pool_path(config, endpoint);
+  upstream.url = endpoint;
+  upstream.headers = headers;
+  upstream.request_json = request_json;
+  upstream.stream = stream;
+  upstream.options = &options;
+  upstream.hedge =
+      config->hedge_policy != NULL && deterministic && stream == NULL && !gzip;
+  if (stream == NULL && config->coalescer != NULL && deterministic) {
+    ret = coalescer_run(config->coalescer, endpoint, headers, request_json,
+                        &options, send_upstream, &upstream, http_resp);
+  } else {
+    ret = send_upstream(&upstream, http_resp);
+  }
+
+  if (ret == 0) {
+    transfer_record(endpoint, http_resp, gzip);
+  }
+
+  /*
+  * a cancelled attempt says nothing about the endpoint, and a coalesced
+  * one was already counted by the caller that sent it
+  */
+  outcome = mistral_cancel_token_is_cancelled(config->cancel_token) ||
+                    http_resp->coalesced
+                ? -1
+                : (ret == 0 ? http_resp->http_code : 0);
+
+  if (slot != NULL) {
+    limiter_release(config->limiter, slot, outcome, monotonic_ms() - started);
+  }
+
+  if (config->circuit_breaker != NULL && outcome < 0) {
+    breaker_release(config->circuit_breaker, endpoint, config->model, probe);
+  } else if (config->circuit_breaker != NULL) {
+    breaker_record(config->circuit_breaker, endpoint, config->model, probe,
+                   outcome, monotonic_ms() - started);
+  }
+
+  /* the call ran out of time, the backend may have answered in time */
+  if (ret != 0 && deadline_cut && http_resp->timed_out &&
+      monotonic_ms() - started >= options.timeout_ms) {
+    return -2;
+  }
+  return ret;
+}
+
+/*
+* Checked right before every attempt; takes the half-open probe if that
+* is what lets the attempt through, so nothing may come between this and
+* send_http_request, which gets probe
+*/
+static int circuit_is_open(const mistral_config_t *config,
+                           const char *endpoint, int *probe) {
+  *probe = 0;
+  return config->circuit_breaker != NULL &&
+         !breaker_allow(config->circuit_breaker, endpoint, config->model,
+                        probe);
+}
+
+/*
+* Nonzero if the circuit is open now, without taking a probe. Ends a
+* retry loop before a backoff sleep that could not lead to an attempt
+*/
+static int circuit_rejects(const mistral_config_t *config,
+                           const char *endpoint) {
+  return config->circuit_breaker != NULL &&
+         mistral_circuit_breaker_get_state(config->circuit_breaker, endpoint,
+                                           config->model) ==
+             MISTRAL_CIRCUIT_OPEN;
+}
+
+/*
+* A failed backend cools down in the pool, so the next attempt can go to
+* another one right away instead of sleeping
+*/
+static int retry_elsewhere(const mistral_config_t *config,
+                           const char *endpoint) {
+  return pool_path(config, endpoint) != NULL &&
+         backend_pool_available(config->backend_pool);
+}
+
+/*
+* 401 and 403 refuse one backend's key, not the request, so the attempt
+* is worth repeating when another backend is ready
+*/
+static int key_refused_elsewhere(const mistral_config_t *config,
+                                 const char *endpoint, long http_code) {
+  return (http_code == 401 || http_code == 403) &&
+         retry_elsewhere(config, endpoint);
+}
+
+/*
+* Nonzero if delay_ms still fits before the call deadline, which is 0 when
+* config->deadline_ms is unset
+*/
+static int deadline_allows(double deadline, int delay_ms) {
+  return deadline <= 0.0 || monotonic_ms() + delay_ms < deadline;
+}
+
+static double call_deadline(const mistral_config_t *config) {
+  return config->deadline_ms > 0 ? monotonic_ms() + config->deadline_ms : 0.0;
+}
+
+/*
+* Feed config->model_router with one attempt on config->model, unless
+* http_resp is a copy of another caller's attempt
+*/
+static void route_feedback(const mistral_config_t *config,
+                           const http_response_t *http_resp, int ok,
+                           double started, const mistral_response_t *response) {
+  if (config->model_router != NULL && !http_resp->coalesced) {
+    router_record(config->model_router, config->model, ok,
+                  monotonic_ms() - started, ok ? response->prompt_tokens : 0,
+                  ok ? response->completion_tokens : 0);
+  }
+}
+
+/*
+* stream: body to send instead of request_json, which is then NULL and
+* the response cache is skipped
+*/
+static int execute_model_with_retry(const mistral_config_t *config,
                                     const char *endpoint,
                                     const char *request_json,
+                                    json_stream_t *stream, double deadline,
                                     mistral_response_t *response) {
   http_response_t http_resp = {0};
   char auth_header[512];
   const char *headers[3];
   int ret = -1;
   int attempt = 0;
+  int probe = 0;
   int retry_delay = config->retry_delay_ms;
+  double attempt_started = 0.0;
+  int use_cache = config->response_cache != NULL && config->cacheable &&
+                  stream == NULL;
+  int parsed = 0;
+  int sent = 0;
+
+  if (use_cache && response_cache_lookup(config->response_cache, endpoint,
+                                         request_json, response) == 0) {
+    DEBUG_LOG("response served from cache");
+    return 0;
+  }
 
   int written = snprintf(auth_header, sizeof(auth_header),
                          "authorization: Bearer %s", config->api_key);
@@ -627,10 +1201,28 @@ int execute_http_request_with_retry(const mistral_config_t *config,
   headers[2] = NULL;
 
   for (attempt = 0; attempt <= config->max_retries; attempt++) {
-    if (attempt > 0) {
+    if (mistral_cancel_token_is_cancelled(config->cancel_token)) {
+      goto cancelled;
+    }
+
+    if (!deadline_allows(deadline, 0)) {
+      goto timed_out;
+    }
+
+    if (attempt > 0 && circuit_rejects(config, endpoint)) {
+      goto circuit_open;
+    }
+
+    if (attempt > 0 && !retry_elsewhere(config, endpoint)) {
       DEBUG_LOG("retry attempt %d/%d after %d ms delay", attempt,
                 config->max_retries, retry_delay);
-      sleep_ms(retry_delay);
+      /* a backoff that outlasts the deadline cannot lead to a success */
+      if (!deadline_allows(deadline, retry_delay)) {
+        goto timed_out;
+      }
+      if (cancel_token_sleep(config->cancel_token, retry_delay) != 0) {
+        goto cancelled;
+      }
 
       retry_delay *= 2;
       if (retry_delay > 30000) {
@@ -638,18 +1230,39 @@ int execute_http_request_with_retry(const mistral_config_t *config,
       }
     }
 
+    if (circuit_is_open(config, endpoint, &probe)) {
+      goto circuit_open;
+    }
+
     DEBUG_LOG("Sending HTTP POST request attempt %d", attempt + 1);
 
     http_response_free(&http_resp);
     memset(&http_resp, 0, sizeof(http_resp));
 
-    if (http_post(endpoint, headers, request_json, &http_resp) != 0) {
+    attempt_started = monotonic_ms();
+    sent = send_http_request(config, endpoint, headers, request_json, stream,
+                             config->temperature == 0.0, probe, deadline,
+                             &http_resp);
+    if (sent != 0) {
       DEBUG_LOG("HTTP request failed");
 
+      if (mistral_cancel_token_is_cancelled(config->cancel_token)) {
+        goto cancelled;
+      }
+
+      /* limiter and deadline exits are client back-pressure */
+      if (sent == -1) {
+        route_feedback(config, &http_resp, 0, attempt_started, response);
+      }
+
       if (attempt < config->max_retries) {
         continue;
       }
 
+      if (http_resp.timed_out) {
+        goto timed_out;
+      }
+
       if (set_error_message(response, "HTTP request failed") != 0) {
         return -1;
       }
@@ -663,16 +1276,31 @@ int execute_http_request_with_retry(const mistral_config_t *config,
     if (http_resp.http_code == 200) {
       DEBUG_LOG("request successful");
 
-      if (parse_response(http_resp.data, http_resp.http_code, response) != 0) {
+      parsed = config->response_views
+                   ? parse_response_view(&http_resp.data, http_resp.size,
+                                         http_resp.capacity, response)
+                   : 1;
+      if (parsed == 1) {
+        parsed = parse_response(http_resp.data, http_resp.http_code, response);
+      }
+      if (parsed != 0) {
         DEBUG_LOG("failed to parse response");
         goto cleanup;
       }
 
+      route_feedback(config, &http_resp, 1, attempt_started, response);
+
+      if (use_cache) {
+        response_cache_store(config->response_cache, endpoint, request_json,
+                             response);
+      }
+
       ret = 0;
       goto cleanup;
 
     } else if (http_resp.http_code == 429) {
       DEBUG_LOG("rate limit hit (429), will retry");
+      route_feedback(config, &http_resp, 0, attempt_started, response);
 
       parse_response(http_resp.data, http_resp.http_code, response);
 
@@ -682,8 +1310,7 @@ int execute_http_request_with_retry(const mistral_config_t *config,
       }
 
       if (attempt < config->max_retries) {
-        mistral_response_free(response);
-        memset(response, 0, sizeof(mistral_response_t));
+        mistral_response_reset(response);
         continue;
       }
 
@@ -697,19 +1324,19 @@ int execute_http_request_with_retry(const mistral_config_t *config,
 
     } else if (http_resp.http_code >= 500 && http_resp.http_code < 600) {
       DEBUG_LOG("server error (%ld), will retry", http_resp.http_code);
+      route_feedback(config, &http_resp, 0, attempt_started, response);
 
       parse_response(http_resp.data, http_resp.http_code, response);
 
       if (attempt < config->max_retries) {
-        mistral_response_free(response);
-        memset(response, 0, sizeof(mistral_response_t));
+        mistral_response_reset(response);
         continue;
       }
 
       if (response->error_message == NULL) {
         char msg[128];
         snprintf(msg, sizeof(msg), "server error: %ld", http_resp.http_code);
-        char *error_msg = strdup(msg);
+        char *error_msg = mem_strdup(msg);
         if (error_msg == NULL) {
           response->error_code = MISTRAL_ERR_MEM;
           return -1;
@@ -719,12 +1346,17 @@ int execute_http_request_with_retry(const mistral_config_t *config,
       response->error_code = MISTRAL_ERR_SERVER;
       goto cleanup;
 
+    } else if (attempt < config->max_retries &&
+               key_refused_elsewhere(config, endpoint, http_resp.http_code)) {
+      DEBUG_LOG("key refused (%ld), trying another backend",
+                http_resp.http_code);
+      continue;
+
     } else {
       DEBUG_LOG("Non-retryable error: %ld", http_resp.http_code);
 
       if (attempt > 0) {
-        mistral_response_free(response);
-        memset(response, 0, sizeof(mistral_response_t));
+        mistral_response_reset(response);
       }
 
       if (parse_response(http_resp.data, http_resp.http_code, response) != 0) {
@@ -733,7 +1365,7 @@ int execute_http_request_with_retry(const mistral_config_t *config,
         if (response->error_message == NULL) {
           char msg[128];
           snprintf(msg, sizeof(msg), "HTTP error: %ld", http_resp.http_code);
-          char *error_msg = strdup(msg);
+          char *error_msg = mem_strdup(msg);
           if (error_msg == NULL) {
             response->error_code = MISTRAL_ERR_MEM;
             return -1;
@@ -754,28 +1386,177 @@ int execute_http_request_with_retry(const mistral_config_t *config,
     }
     response->error_code = MISTRAL_ERR_NETWORK;
   }
+  goto cleanup;
+
+timed_out:
+  DEBUG_LOG("request timed out");
+  mistral_response_reset(response);
+  if (set_error_message(response, "request timed out") == 0) {
+    response->error_code = MISTRAL_ERR_TIMEOUT;
+  }
+  goto cleanup;
+
+cancelled:
+  DEBUG_LOG("request cancelled");
+  mistral_response_reset(response);
+  if (set_error_message(response, "request cancelled") == 0) {
+    response->error_code = MISTRAL_ERR_CANCELLED;
+  }
+  goto cleanup;
+
+circuit_open:
+  DEBUG_LOG("circuit open, failing fast");
+  mistral_response_reset(response);
+  if (set_error_message(response, "circuit open") == 0) {
+    response->error_code = MISTRAL_ERR_CIRCUIT_OPEN;
+  }
 
 cleanup:
   http_response_free(&http_resp);
   return ret;
 }
 
-int execute_embeddings_http_request_with_retry(const mistral_config_t *config,
-                                               const char *endpoint,
-                                               const char *request_json,
-                                               mistral_embeddings_response_t *response) {
+/*
+* Walk config->fallback_policy: every model gets its own retry budget and
+* the same request with only "model" replaced, all under one deadline
+*/
+static int execute_fallback_chain(const mistral_config_t *config,
+                                  const char *endpoint,
+                                  const char *request_json, double deadline,
+                                  mistral_response_t *response) {
+  const mistral_fallback_policy_t *policy = config->fallback_policy;
+  size_t count = fallback_policy_count(policy);
+  mistral_config_t model_config = *config;
+  char *model_json = NULL;
+  int ret = -1;
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    const mistral_fallback_model_t *entry = fallback_policy_entry(policy, i);
+    const char *json = request_json;
+
+    model_config.model = entry->model != NULL ? (char *)entry->model
+                                              : config->model;
+    model_config.max_retries = entry->max_retries;
+
+    if (strcmp(model_config.model, config->model) != 0) {
+      model_json = fallback_request_json(request_json, model_config.model);
+      if (model_json == NULL) {
+        mistral_response_reset(response);
+        if (set_error_message(response, "failed to build fallback request") ==
+            0) {
+          response->error_code = MISTRAL_ERR_MEM;
+        }
+        return -1;
+      }
+      json = model_json;
+    }
+
+    if (i > 0) {
+      DEBUG_LOG("falling back to model %s", model_config.model);
+      mistral_response_reset(response);
+    }
+
+    ret = execute_model_with_retry(&model_config, endpoint, json, NULL,
+                                   deadline, response);
+    mem_free(model_json);
+    model_json = NULL;
+
+    if (ret == 0) {
+      response->fallback_index = (int)i;
+      if (response->model == NULL) {
+        response->model = mem_strdup(model_config.model);
+      }
+      return 0;
+    }
+
+    if (!fallback_triggered(entry, response->error_code) ||
+        !deadline_allows(deadline, 0)) {
+      break;
+    }
+  }
+
+  return ret;
+}
+
+/*
+* Point a copy of config and of the request at the model the router picks
+* Return 0 if rerouted, -1 to send the request unchanged
+*/
+static int route_request(const mistral_config_t *config,
+                         const char *request_json, mistral_config_t *routed,
+                         char **routed_json) {
+  mistral_route_decision_t decision;
+
+  if (mistral_model_router_select(config->model_router,
+                                  config->latency_target_ms,
+                                  config->min_quality_tier, config->max_tokens,
+                                  &decision) != 0 ||
+      strcmp(decision.model, config->model) == 0) {
+    return -1;
+  }
+
+  *routed_json = fallback_request_json(request_json, decision.model);
+  if (*routed_json == NULL) {
+    return -1;
+  }
+
+  DEBUG_LOG("routed to model %s, predicted %.0f ms", decision.model,
+            decision.predicted_ms);
+  *routed = *config;
+  routed->model = (char *)decision.model;
+  return 0;
+}
+
+int execute_http_request_with_retry(const mistral_config_t *config,
+                                    const char *endpoint,
+                                    const char *request_json,
+                                    mistral_response_t *response) {
+  double deadline = call_deadline(config);
+  mistral_config_t routed_config;
+  char *routed_json = NULL;
+  int ret = -1;
+
+  if (config->model_router != NULL &&
+      route_request(config, request_json, &routed_config, &routed_json) == 0) {
+    config = &routed_config;
+    request_json = routed_json;
+  }
+
+  if (config->fallback_policy != NULL) {
+    ret = execute_fallback_chain(config, endpoint, request_json, deadline,
+                                 response);
+  } else {
+    ret = execute_model_with_retry(config, endpoint, request_json, NULL,
+                                   deadline, response);
+  }
+
+  mem_free(routed_json);
+  return ret;
+}
+
+/*
+* stream: body to send instead of request_json, which is then NULL
+*/
+static int execute_embeddings_with_retry(const mistral_config_t *config,
+                                         const char *endpoint,
+                                         const char *request_json,
+                                         json_stream_t *stream,
+                                         mistral_embeddings_response_t *response) {
   http_response_t http_resp = {0};
   char auth_header[512];
   const char *headers[3];
   int ret = -1;
   int attempt = 0;
+  int probe = 0;
   int retry_delay = config->retry_delay_ms;
+  double deadline = call_deadline(config);
 
   int written = snprintf(auth_header, sizeof(auth_header),
                          "authorization: Bearer %s", config->api_key);
   if (written >= (int)sizeof(auth_header)) {
     fprintf(stderr, "authorization header too long\n");
-    response->error_message = strdup("authorization header too long");
+    response->error_message = mem_strdup("authorization header too long");
     if (response->error_message == NULL) {
       return -1;
     }
@@ -788,10 +1569,28 @@ int execute_embeddings_http_request_with_retry(const mistral_config_t *config,
   headers[2] = NULL;
 
   for (attempt = 0; attempt <= config->max_retries; attempt++) {
-    if (attempt > 0) {
+    if (mistral_cancel_token_is_cancelled(config->cancel_token)) {
+      goto cancelled;
+    }
+
+    if (!deadline_allows(deadline, 0)) {
+      goto timed_out;
+    }
+
+    if (attempt > 0 && circuit_rejects(config, endpoint)) {
+      goto circuit_open;
+    }
+
+    if (attempt > 0 && !retry_elsewhere(config, endpoint)) {
       DEBUG_LOG("retry attempt %d/%d after %d ms delay", attempt,
                 config->max_retries, retry_delay);
-      sleep_ms(retry_delay);
+      /* a backoff that outlasts the deadline cannot lead to a success */
+      if (!deadline_allows(deadline, retry_delay)) {
+        goto timed_out;
+      }
+      if (cancel_token_sleep(config->cancel_token, retry_delay) != 0) {
+        goto cancelled;
+      }
 
       retry_delay *= 2;
       if (retry_delay > 30000) {
@@ -799,19 +1598,32 @@ int execute_embeddings_http_request_with_retry(const mistral_config_t *config,
       }
     }
 
+    if (circuit_is_open(config, endpoint, &probe)) {
+      goto circuit_open;
+    }
+
     DEBUG_LOG("Sending HTTP POST request attempt %d", attempt + 1);
 
     http_response_free(&http_resp);
     memset(&http_resp, 0, sizeof(http_resp));
 
-    if (http_post(endpoint, headers, request_json, &http_resp) != 0) {
+    if (send_http_request(config, endpoint, headers, request_json, stream, 1,
+                          probe, deadline, &http_resp) != 0) {
       DEBUG_LOG("HTTP request failed");
 
+      if (mistral_cancel_token_is_cancelled(config->cancel_token)) {
+        goto cancelled;
+      }
+
       if (attempt < config->max_retries) {
         continue;
       }
 
-      response->error_message = strdup("HTTP request failed");
+      if (http_resp.timed_out) {
+        goto timed_out;
+      }
+
+      response->error_message = mem_strdup("HTTP request failed");
       if (response->error_message == NULL) {
         return -1;
       }
@@ -844,18 +1656,12 @@ int execute_embeddings_http_request_with_retry(const mistral_config_t *config,
       }
 
       if (attempt < config->max_retries) {
-        if (response->error_message != NULL) {
-          free(response->error_message);
-        }
-        if (response->api_error != NULL) {
-          mistral_api_error_free(response->api_error);
-        }
-        memset(response, 0, sizeof(mistral_embeddings_response_t));
+        mistral_embeddings_response_reset(response);
         continue;
       }
 
       if (response->error_message == NULL) {
-        response->error_message = strdup("rate limit exceeded");
+        response->error_message = mem_strdup("rate limit exceeded");
         if (response->error_message == NULL) {
           return -1;
         }
@@ -869,20 +1675,14 @@ int execute_embeddings_http_request_with_retry(const mistral_config_t *config,
       parse_embenddings(http_resp.data, http_resp.http_code, response);
 
       if (attempt < config->max_retries) {
-        if (response->error_message != NULL) {
-          free(response->error_message);
-        }
-        if (response->api_error != NULL) {
-          mistral_api_error_free(response->api_error);
-        }
-        memset(response, 0, sizeof(mistral_embeddings_response_t));
+        mistral_embeddings_response_reset(response);
         continue;
       }
 
       if (response->error_message == NULL) {
         char msg[128];
         snprintf(msg, sizeof(msg), "server error: %ld", http_resp.http_code);
-        response->error_message = strdup(msg);
+        response->error_message = mem_strdup(msg);
         if (response->error_message == NULL) {
           return -1;
         }
@@ -890,17 +1690,17 @@ int execute_embeddings_http_request_with_retry(const mistral_config_t *config,
       response->error_code = MISTRAL_ERR_SERVER;
       goto cleanup;
 
+    } else if (attempt < config->max_retries &&
+               key_refused_elsewhere(config, endpoint, http_resp.http_code)) {
+      DEBUG_LOG("key refused (%ld), trying another backend",
+                http_resp.http_code);
+      continue;
+
     } else {
       DEBUG_LOG("Non-retryable error: %ld", http_resp.http_code);
 
       if (attempt > 0) {
-        if (response->error_message != NULL) {
-          free(response->error_message);
-        }
-        if (response->api_error != NULL) {
-          mistral_api_error_free(response->api_error);
-        }
-        memset(response, 0, sizeof(mistral_embeddings_response_t));
+        mistral_embeddings_response_reset(response);
       }
 
       if (parse_embenddings(http_resp.data, http_resp.http_code, response) != 0) {
@@ -909,7 +1709,7 @@ int execute_embeddings_http_request_with_retry(const mistral_config_t *config,
         if (response->error_message == NULL) {
           char msg[128];
           snprintf(msg, sizeof(msg), "HTTP error: %ld", http_resp.http_code);
-          response->error_message = strdup(msg);
+          response->error_message = mem_strdup(msg);
           if (response->error_message == NULL) {
             return -1;
           }
@@ -923,14 +1723,104 @@ int execute_embeddings_http_request_with_retry(const mistral_config_t *config,
 
   DEBUG_LOG("exhausted all retry attempts");
   if (response->error_message == NULL) {
-    response->error_message = strdup("all retry attempts failed");
+    response->error_message = mem_strdup("all retry attempts failed");
     if (response->error_message == NULL) {
       return ret;
     }
     response->error_code = MISTRAL_ERR_NETWORK;
   }
+  goto cleanup;
+
+timed_out:
+  DEBUG_LOG("request timed out");
+  mistral_embeddings_response_reset(response);
+  response->error_message = mem_strdup("request timed out");
+  response->error_code = MISTRAL_ERR_TIMEOUT;
+  goto cleanup;
+
+cancelled:
+  DEBUG_LOG("request cancelled");
+  mistral_embeddings_response_reset(response);
+  response->error_message = mem_strdup("request cancelled");
+  response->error_code = MISTRAL_ERR_CANCELLED;
+  goto cleanup;
+
+circuit_open:
+  DEBUG_LOG("circuit open, failing fast");
+  mistral_embeddings_response_reset(response);
+  response->error_message = mem_strdup("circuit open");
+  response->error_code = MISTRAL_ERR_CIRCUIT_OPEN;
 
 cleanup:
   http_response_free(&http_resp);
   return ret;
 }
+
+int execute_embeddings_http_request_with_retry(const mistral_config_t *config,
+                                               const char *endpoint,
+                                               const char *request_json,
+                                               mistral_embeddings_response_t *response) {
+  return execute_embeddings_with_retry(config, endpoint, request_json, NULL,
+                                       response);
+}
+
+/*
+* Nonzero if body should be sent as it is read. Small bodies, and any
+* feature that needs the whole body as text, get it built in memory
+*/
+static int send_as_stream(const mistral_config_t *config,
+                          const json_stream_t *body) {
+  return config->stream_request_bytes > 0 &&
+         stream_value_bytes(body) >= config->stream_request_bytes &&
+         config->model_router == NULL && config->fallback_policy == NULL &&
+         config->coalescer == NULL &&
+         (config->response_cache == NULL || !config->cacheable);
+}
+
+int execute_http_stream_with_retry(const mistral_config_t *config,
+                                   const char *endpoint, json_stream_t *body,
+                                   mistral_response_t *response) {
+  char *request_json = NULL;
+  int ret = -1;
+
+  if (send_as_stream(config, body)) {
+    return execute_model_with_retry(config, endpoint, NULL, body,
+                                    call_deadline(config), response);
+  }
+
+  request_json = json_stream_to_string(body);
+  if (request_json == NULL) {
+    if (set_error_message(response, "failed to create request JSON") == 0) {
+      response->error_code = MISTRAL_ERR_MEM;
+    }
+    return -1;
+  }
+  ret = execute_http_request_with_retry(config, endpoint, request_json,
+                                        response);
+  mem_free(request_json);
+  return ret;
+}
+
+int execute_embeddings_stream_with_retry(const mistral_config_t *config,
+                                         const char *endpoint,
+                                         json_stream_t *body,
+                                         mistral_embeddings_response_t *response) {
+  char *request_json = NULL;
+  int ret = -1;
+
+  if (send_as_stream(config, body)) {
+    return execute_embeddings_with_retry(config, endpoint, NULL, body,
+                                         response);
+  }
+
+  request_json = json_stream_to_string(body);
+  if (request_json == NULL) {
+    response->error_message = mem_strdup("failed to create request JSON");
+    response->error_code = MISTRAL_ERR_MEM;
+    return -1;
+  }
+  ret = execute_embeddings_with_retry(config, endpoint, request_json, NULL,
+                                      response);
+  mem_free(request_json);
+  return ret;
+}
@@ -2,6 +2,7 @@
 #define MISTRAL_HELPERS_H
 
 #include "../include/mistral.h"
+#include "json_writer.h"
 #include <cjson/cJSON.h>
 
 #ifdef __cplusplus
@@ -16,13 +17,47 @@ mistral_error_code_t determine_error_code(long http_code,
 char *create_fim_request_json(const mistral_config_t *config,
                              const mistral_fim_t *fim);
 
+/*
+* FIM request from prompt[0, prompt_len) and suffix[0, suffix_len) on
+* body, which only references them; the document is byte-identical to
+* create_fim_request_json
+* Return 0 if ok, -1 if out of memory
+*/
+int create_fim_request_stream(const mistral_config_t *config,
+                              const char *prompt, size_t prompt_len,
+                              const char *suffix, size_t suffix_len,
+                              json_stream_t *body);
+
 char *create_chat_request_json(const mistral_config_t *config,
                               const mistral_message_t *messages,
                               size_t message_count);
 
+/*
+* Same document as create_chat_request_json on body, referencing the
+* slices
+* Return 0 if ok, -1 if out of memory
+*/
+int create_chat_request_stream(const mistral_config_t *config,
+                                const mistral_message_n_t *messages,
+                                size_t message_count, json_stream_t *body);
+
+/*
+* response: zeroed, or with the arena of a reused response, which is
+* filled again instead of allocating a new one
+*/
 int parse_response(const char *json_data, long http_code,
                     mistral_response_t *response);
 
+/*
+* Parse a 200 chat or FIM body of size bytes in place, in an allocation of
+* capacity bytes. On success the response takes *body (set to NULL) and
+* its strings point into it
+* Return 0 if ok, -1 if error (set on response), 1 if the body needs
+* parse_response, *body is then unchanged
+*/
+int parse_response_view(char **body, size_t size, size_t capacity,
+                        mistral_response_t *response);
+
 int execute_http_request_with_retry(const mistral_config_t *config,
                                     const char *endpoint,
                                     const char *request_json,
@@ -33,10 +68,35 @@ int execute_embeddings_http_request_with_retry(const mistral_config_t *config,
                                                const char *request_json,
                                                mistral_embeddings_response_t *response);
 
+/*
+* Send a request written on body, streamed as it is read once it reaches
+* config->stream_request_bytes, built in memory first otherwise or when
+* the router, fallback, coalescer or response cache need its text
+*/
+int execute_http_stream_with_retry(const mistral_config_t *config,
+                                   const char *endpoint, json_stream_t *body,
+                                   mistral_response_t *response);
+
+int execute_embeddings_stream_with_retry(const mistral_config_t *config,
+                                         const char *endpoint,
+                                         json_stream_t *body,
+                                         mistral_embeddings_response_t *response);
+
 char *create_embeddings_json(const mistral_config_t *config,
                              const mistral_embeddings_t *embeddings,
                              size_t input_count);
 
+/*
+* Same document as create_embeddings_json on body, referencing the slices
+* Return 0 if ok, -1 if out of memory
+*/
+int create_embeddings_stream(const mistral_config_t *config,
+                             const mistral_embeddings_n_t *inputs,
+                             size_t input_count, json_stream_t *body);
+
+/*
+* response: zeroed, or with the arena of a reused response
+*/
 int parse_embenddings(const char *json_data, long http_code,
                       mistral_embeddings_response_t *response);
 
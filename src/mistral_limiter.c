@@ -0,0 +1,219 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mistral_limiter.h"
+#include "mistral_alloc.h"
+#include "mistral_cancel.h"
+#include "mistral_utils.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* latency may grow this much over baseline before growth stops */
+#define LATENCY_TOLERANCE 1.5
+#define BASELINE_ALPHA 0.05
+#define RECENT_ALPHA 0.3
+#define DECREASE_FACTOR 0.5
+
+struct limiter_endpoint {
+  char *endpoint;
+  double limit;
+  int in_flight;
+  double baseline_ms;
+  double recent_ms;
+  double last_decrease_ms;
+  unsigned long increases;
+  unsigned long decreases;
+  struct limiter_endpoint *next;
+};
+
+struct mistral_adaptive_limiter {
+  pthread_mutex_t lock;
+  pthread_cond_t released;
+  limiter_endpoint_t *endpoints;
+  double initial_limit;
+  double min_limit;
+  double max_limit;
+};
+
+static limiter_endpoint_t *find_endpoint(mistral_adaptive_limiter_t *limiter,
+                                         const char *endpoint, int create) {
+  limiter_endpoint_t *slot = NULL;
+
+  for (slot = limiter->endpoints; slot != NULL; slot = slot->next) {
+    if (strcmp(slot->endpoint, endpoint) == 0) {
+      return slot;
+    }
+  }
+
+  if (!create) {
+    return NULL;
+  }
+
+  slot = (limiter_endpoint_t *)mem_calloc(1, sizeof(limiter_endpoint_t));
+  if (slot == NULL) {
+    return NULL;
+  }
+
+  slot->endpoint = mem_strdup(endpoint);
+  if (slot->endpoint == NULL) {
+    mem_free(slot);
+    return NULL;
+  }
+
+  slot->limit = limiter->initial_limit;
+  slot->next = limiter->endpoints;
+  limiter->endpoints = slot;
+  return slot;
+}
+
+mistral_adaptive_limiter_t *mistral_adaptive_limiter_create(int initial_limit,
+                                                            int min_limit,
+                                                            int max_limit) {
+  mistral_adaptive_limiter_t *limiter = NULL;
+
+  if (min_limit < 1 || max_limit < min_limit || initial_limit < min_limit ||
+      initial_limit > max_limit) {
+    fprintf(stderr, "invalid adaptive limiter parameters\n");
+    return NULL;
+  }
+
+  limiter = (mistral_adaptive_limiter_t *)mem_malloc(
+      sizeof(mistral_adaptive_limiter_t));
+  if (limiter == NULL) {
+    fprintf(stderr, "failed to allocate memory for adaptive limiter\n");
+    return NULL;
+  }
+
+  memset(limiter, 0, sizeof(mistral_adaptive_limiter_t));
+
+  if (pthread_mutex_init(&limiter->lock, NULL) != 0) {
+    fprintf(stderr, "failed to init adaptive limiter mutex\n");
+    mem_free(limiter);
+    return NULL;
+  }
+
+  if (monotonic_cond_init(&limiter->released) != 0) {
+    fprintf(stderr, "failed to init adaptive limiter condition\n");
+    pthread_mutex_destroy(&limiter->lock);
+    mem_free(limiter);
+    return NULL;
+  }
+
+  limiter->initial_limit = initial_limit;
+  limiter->min_limit = min_limit;
+  limiter->max_limit = max_limit;
+
+  return limiter;
+}
+
+int mistral_adaptive_limiter_get_stats(mistral_adaptive_limiter_t *limiter,
+                                       const char *endpoint,
+                                       mistral_adaptive_limiter_stats_t *stats) {
+  limiter_endpoint_t *slot = NULL;
+
+  if (limiter == NULL || endpoint == NULL || stats == NULL) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&limiter->lock);
+  slot = find_endpoint(limiter, endpoint, 0);
+  if (slot != NULL) {
+    stats->limit = slot->limit;
+    stats->in_flight = slot->in_flight;
+    stats->increases = slot->increases;
+    stats->decreases = slot->decreases;
+    stats->baseline_latency_ms = slot->baseline_ms;
+  }
+  pthread_mutex_unlock(&limiter->lock);
+
+  return slot != NULL ? 0 : -1;
+}
+
+void mistral_adaptive_limiter_free(mistral_adaptive_limiter_t *limiter) {
+  limiter_endpoint_t *slot = NULL;
+
+  if (limiter != NULL) {
+    while (limiter->endpoints != NULL) {
+      slot = limiter->endpoints;
+      limiter->endpoints = slot->next;
+      mem_free(slot->endpoint);
+      mem_free(slot);
+    }
+    pthread_cond_destroy(&limiter->released);
+    pthread_mutex_destroy(&limiter->lock);
+    mem_free(limiter);
+  }
+}
+
+int limiter_acquire(mistral_adaptive_limiter_t *limiter, const char *endpoint,
+                    double deadline, mistral_cancel_token_t *token,
+                    limiter_endpoint_t **slot) {
+  int ret = 0;
+
+  pthread_mutex_lock(&limiter->lock);
+
+  *slot = find_endpoint(limiter, endpoint, 1);
+  if (*slot != NULL) {
+    while (ret == 0 && (double)(*slot)->in_flight + 1.0 > (*slot)->limit) {
+      ret = cond_wait_until(&limiter->released, &limiter->lock, deadline,
+                            token != NULL ? cancel_token_check : NULL, token);
+    }
+    if (ret == 0) {
+      (*slot)->in_flight++;
+    } else {
+      *slot = NULL;
+    }
+  }
+
+  pthread_mutex_unlock(&limiter->lock);
+  return ret;
+}
+
+void limiter_release(mistral_adaptive_limiter_t *limiter,
+                     limiter_endpoint_t *slot, long http_code,
+                     double latency_ms) {
+  double now = monotonic_ms();
+  double window_ms = 0.0;
+
+  pthread_mutex_lock(&limiter->lock);
+
+  slot->in_flight--;
+
+  if (http_code < 0) {
+    /* nothing learned, but a waiter can take the slot */
+  } else if (http_code == 0 || http_code == 429 || http_code >= 500) {
+    /* one cut per round trip, so a burst of failures from the same
+     * window does not collapse the limit */
+    window_ms = slot->recent_ms > 0.0 ? slot->recent_ms : latency_ms;
+    if (now - slot->last_decrease_ms > window_ms &&
+        slot->limit > limiter->min_limit) {
+      slot->limit *= DECREASE_FACTOR;
+      if (slot->limit < limiter->min_limit) {
+        slot->limit = limiter->min_limit;
+      }
+      slot->last_decrease_ms = now;
+      slot->decreases++;
+    }
+  } else {
+    if (slot->baseline_ms == 0.0) {
+      slot->baseline_ms = latency_ms;
+      slot->recent_ms = latency_ms;
+    } else {
+      slot->baseline_ms += BASELINE_ALPHA * (latency_ms - slot->baseline_ms);
+      slot->recent_ms += RECENT_ALPHA * (latency_ms - slot->recent_ms);
+    }
+
+    if (slot->recent_ms <= slot->baseline_ms * LATENCY_TOLERANCE &&
+        slot->limit < limiter->max_limit) {
+      slot->limit += 1.0 / slot->limit;
+      if (slot->limit > limiter->max_limit) {
+        slot->limit = limiter->max_limit;
+      }
+      slot->increases++;
+    }
+  }
+
+  pthread_cond_broadcast(&limiter->released);
+  pthread_mutex_unlock(&limiter->lock);
+}
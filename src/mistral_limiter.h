@@ -0,0 +1,36 @@
+#ifndef MISTRAL_LIMITER_H
+#define MISTRAL_LIMITER_H
+
+#include "../include/mistral.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct limiter_endpoint limiter_endpoint_t;
+
+/*
+* Block until the endpoint has a free slot, deadline (monotonic ms, 0 for
+* none) passes or token (may be NULL) is cancelled. slot is set to pass to
+* limiter_release, NULL if out of memory, in which case the attempt goes
+* unlimited
+* Return 0 if ok, -1 if the deadline passed or the token was cancelled
+*/
+int limiter_acquire(mistral_adaptive_limiter_t *limiter, const char *endpoint,
+                    double deadline, mistral_cancel_token_t *token,
+                    limiter_endpoint_t **slot);
+
+/*
+* Give the slot back and feed the outcome of the attempt
+* http_code: 0 if the transfer itself failed, -1 to only give the slot
+* back (e.g. cancelled)
+*/
+void limiter_release(mistral_adaptive_limiter_t *limiter,
+                     limiter_endpoint_t *slot, long http_code,
+                     double latency_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MISTRAL_LIMITER_H */
@@ -0,0 +1,103 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mistral_rate_limiter.h"
+#include "../include/mistral.h"
+#include "mistral_alloc.h"
+#include "mistral_cancel.h"
+#include "mistral_utils.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct mistral_rate_limiter {
+  pthread_mutex_t lock;
+  double rate_per_ms;
+  double capacity;
+  double tokens;
+  double last_refill_ms;
+};
+
+mistral_rate_limiter_t *mistral_rate_limiter_create(double requests_per_sec,
+                                                    int burst) {
+  mistral_rate_limiter_t *limiter = NULL;
+
+  if (requests_per_sec <= 0.0 || burst < 1) {
+    fprintf(stderr, "invalid rate limiter parameters\n");
+    return NULL;
+  }
+
+  limiter =
+      (mistral_rate_limiter_t *)mem_malloc(sizeof(mistral_rate_limiter_t));
+  if (limiter == NULL) {
+    fprintf(stderr, "failed to allocate memory for rate limiter\n");
+    return NULL;
+  }
+
+  memset(limiter, 0, sizeof(mistral_rate_limiter_t));
+
+  if (pthread_mutex_init(&limiter->lock, NULL) != 0) {
+    fprintf(stderr, "failed to init rate limiter mutex\n");
+    mem_free(limiter);
+    return NULL;
+  }
+
+  limiter->rate_per_ms = requests_per_sec / 1000.0;
+  limiter->capacity = (double)burst;
+  limiter->tokens = (double)burst;
+  limiter->last_refill_ms = monotonic_ms();
+
+  return limiter;
+}
+
+void mistral_rate_limiter_acquire(mistral_rate_limiter_t *limiter) {
+  rate_limiter_acquire_until(limiter, 0.0, NULL);
+}
+
+int rate_limiter_acquire_until(mistral_rate_limiter_t *limiter,
+                               double deadline,
+                               mistral_cancel_token_t *token) {
+  if (limiter == NULL) {
+    return 0;
+  }
+
+  for (;;) {
+    double now = 0.0;
+    int wait_ms = 0;
+
+    pthread_mutex_lock(&limiter->lock);
+
+    now = monotonic_ms();
+    limiter->tokens += (now - limiter->last_refill_ms) * limiter->rate_per_ms;
+    if (limiter->tokens > limiter->capacity) {
+      limiter->tokens = limiter->capacity;
+    }
+    limiter->last_refill_ms = now;
+
+    if (limiter->tokens >= 1.0) {
+      limiter->tokens -= 1.0;
+      pthread_mutex_unlock(&limiter->lock);
+      return 0;
+    }
+
+    wait_ms = (int)((1.0 - limiter->tokens) / limiter->rate_per_ms) + 1;
+
+    pthread_mutex_unlock(&limiter->lock);
+
+    /* the refill is known, so a wait past the deadline is not started */
+    if (deadline > 0.0 && now + wait_ms >= deadline) {
+      return -1;
+    }
+
+    if (cancel_token_sleep(token, wait_ms) != 0) {
+      return -1;
+    }
+  }
+}
+
+void mistral_rate_limiter_free(mistral_rate_limiter_t *limiter) {
+  if (limiter != NULL) {
+    pthread_mutex_destroy(&limiter->lock);
+    mem_free(limiter);
+  }
+}
@@ -0,0 +1,24 @@
+#ifndef MISTRAL_RATE_LIMITER_H
+#define MISTRAL_RATE_LIMITER_H
+
+#include "../include/mistral.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* Take a token, waiting at most until deadline (monotonic ms, 0 for none)
+* token: ends the wait once cancelled, may be NULL
+* Return 0 if ok, -1 if no token frees up before the deadline or the wait
+* was cancelled
+*/
+int rate_limiter_acquire_until(mistral_rate_limiter_t *limiter,
+                               double deadline,
+                               mistral_cancel_token_t *token);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MISTRAL_RATE_LIMITER_H */
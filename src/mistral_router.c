@@ -0,0 +1,266 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mistral_router.h"
+#include "mistral_alloc.h"
+#include "mistral_utils.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_ROUTED_MODELS 32
+#define ESTIMATE_ALPHA 0.2
+/* estimates older than this get one request to refresh them */
+#define STALE_MS 60000.0
+#define MAX_ERROR_RATE 0.9
+#define FAILING_MS 1e9
+
+typedef struct {
+  char *model;
+  double price_per_mtok;
+  int quality_tier;
+  unsigned long samples;
+  double latency_ms;
+  double tokens_per_sec;
+  double error_rate;
+  double prompt_tokens;
+  double completion_tokens;
+  double last_sample_ms;
+} routed_model_t;
+
+struct mistral_model_router {
+  pthread_mutex_t lock;
+  routed_model_t models[MAX_ROUTED_MODELS];
+  int count;
+};
+
+static routed_model_t *find_model(mistral_model_router_t *router,
+                                  const char *model) {
+  int i;
+
+  for (i = 0; i < router->count; i++) {
+    if (strcmp(router->models[i].model, model) == 0) {
+      return &router->models[i];
+    }
+  }
+  return NULL;
+}
+
+static double update_average(double average, double sample) {
+  return average + ESTIMATE_ALPHA * (sample - average);
+}
+
+/*
+* Expected wall time for a reply of max_tokens at most: recent throughput
+* over the usual reply length, stretched by the retries the error rate
+* implies. 0 while the model has no estimate, so unmeasured models get tried
+*/
+static double predict_latency(const routed_model_t *entry, int max_tokens,
+                              double now) {
+  double tokens = entry->completion_tokens;
+  double error_rate = entry->error_rate;
+
+  if (now - entry->last_sample_ms > STALE_MS) {
+    return 0.0;
+  }
+  if (entry->tokens_per_sec <= 0.0) {
+    /* only failures so far */
+    return entry->error_rate > 0.0 ? FAILING_MS : 0.0;
+  }
+
+  if (max_tokens > 0 && tokens > max_tokens) {
+    tokens = max_tokens;
+  }
+  if (error_rate > MAX_ERROR_RATE) {
+    error_rate = MAX_ERROR_RATE;
+  }
+  return tokens * 1000.0 / entry->tokens_per_sec / (1.0 - error_rate);
+}
+
+mistral_model_router_t *mistral_model_router_create(void) {
+  mistral_model_router_t *router = NULL;
+
+  router = (mistral_model_router_t *)mem_malloc(sizeof(mistral_model_router_t));
+  if (router == NULL) {
+    fprintf(stderr, "failed to allocate memory for model router\n");
+    return NULL;
+  }
+
+  memset(router, 0, sizeof(mistral_model_router_t));
+
+  if (pthread_mutex_init(&router->lock, NULL) != 0) {
+    fprintf(stderr, "failed to init model router mutex\n");
+    mem_free(router);
+    return NULL;
+  }
+
+  return router;
+}
+
+int mistral_model_router_add(mistral_model_router_t *router,
+                             const char *model, double price_per_mtok,
+                             int quality_tier) {
+  char *name = NULL;
+  int ret = -1;
+
+  if (router == NULL || model == NULL || strlen(model) == 0 ||
+      price_per_mtok < 0.0) {
+    fprintf(stderr, "invalid router model parameters\n");
+    return -1;
+  }
+
+  name = mem_strdup(model);
+  if (name == NULL) {
+    fprintf(stderr, "failed to duplicate router model\n");
+    return -1;
+  }
+
+  pthread_mutex_lock(&router->lock);
+  if (router->count < MAX_ROUTED_MODELS && find_model(router, model) == NULL) {
+    routed_model_t *entry = &router->models[router->count++];
+    memset(entry, 0, sizeof(routed_model_t));
+    entry->model = name;
+    entry->price_per_mtok = price_per_mtok;
+    entry->quality_tier = quality_tier;
+    name = NULL;
+    ret = 0;
+  }
+  pthread_mutex_unlock(&router->lock);
+
+  if (ret != 0) {
+    fprintf(stderr, "router is full or model already added\n");
+    mem_free(name);
+  }
+  return ret;
+}
+
+int mistral_model_router_select(mistral_model_router_t *router,
+                                int latency_target_ms, int min_quality_tier,
+                                int max_tokens,
+                                mistral_route_decision_t *decision) {
+  routed_model_t *cheapest = NULL;
+  routed_model_t *fastest = NULL;
+  double cheapest_ms = 0.0;
+  double fastest_ms = 0.0;
+  double now = monotonic_ms();
+  int i;
+
+  if (router == NULL || decision == NULL) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&router->lock);
+
+  /* one pass: cheapest model meeting the target, fastest as fallback */
+  for (i = 0; i < router->count; i++) {
+    routed_model_t *entry = &router->models[i];
+    double predicted = 0.0;
+
+    if (entry->quality_tier < min_quality_tier) {
+      continue;
+    }
+
+    predicted = predict_latency(entry, max_tokens, now);
+    if ((latency_target_ms <= 0 || predicted <= latency_target_ms) &&
+        (cheapest == NULL ||
+         entry->price_per_mtok < cheapest->price_per_mtok)) {
+      cheapest = entry;
+      cheapest_ms = predicted;
+    }
+    if (fastest == NULL || predicted < fastest_ms) {
+      fastest = entry;
+      fastest_ms = predicted;
+    }
+  }
+
+  if (cheapest != NULL) {
+    decision->met_target = 1;
+  } else {
+    cheapest = fastest;
+    cheapest_ms = fastest_ms;
+    decision->met_target = 0;
+  }
+
+  if (cheapest != NULL) {
+    decision->model = cheapest->model;
+    decision->predicted_ms = cheapest_ms;
+    decision->estimated_cost =
+        cheapest->price_per_mtok *
+        (cheapest->prompt_tokens + cheapest->completion_tokens) / 1000000.0;
+  }
+
+  pthread_mutex_unlock(&router->lock);
+
+  return cheapest != NULL ? 0 : -1;
+}
+
+int mistral_model_router_get_stats(mistral_model_router_t *router,
+                                   const char *model,
+                                   mistral_model_route_stats_t *stats) {
+  routed_model_t *entry = NULL;
+
+  if (router == NULL || model == NULL || stats == NULL) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&router->lock);
+  entry = find_model(router, model);
+  if (entry != NULL) {
+    stats->samples = entry->samples;
+    stats->latency_ms = entry->latency_ms;
+    stats->tokens_per_sec = entry->tokens_per_sec;
+    stats->error_rate = entry->error_rate;
+    stats->completion_tokens = entry->completion_tokens;
+  }
+  pthread_mutex_unlock(&router->lock);
+
+  return entry != NULL ? 0 : -1;
+}
+
+void mistral_model_router_free(mistral_model_router_t *router) {
+  int i;
+
+  if (router != NULL) {
+    for (i = 0; i < router->count; i++) {
+      mem_free(router->models[i].model);
+    }
+    pthread_mutex_destroy(&router->lock);
+    mem_free(router);
+  }
+}
+
+void router_record(mistral_model_router_t *router, const char *model, int ok,
+                   double latency_ms, int prompt_tokens,
+                   int completion_tokens) {
+  routed_model_t *entry = NULL;
+
+  pthread_mutex_lock(&router->lock);
+
+  entry = find_model(router, model);
+  if (entry != NULL) {
+    entry->error_rate = update_average(entry->error_rate, ok ? 0.0 : 1.0);
+    entry->last_sample_ms = monotonic_ms();
+
+    if (ok && latency_ms > 0.0) {
+      double tokens_per_sec = completion_tokens * 1000.0 / latency_ms;
+
+      if (entry->samples == 0 || entry->tokens_per_sec <= 0.0) {
+        entry->latency_ms = latency_ms;
+        entry->tokens_per_sec = tokens_per_sec;
+        entry->prompt_tokens = prompt_tokens;
+        entry->completion_tokens = completion_tokens;
+      } else {
+        entry->latency_ms = update_average(entry->latency_ms, latency_ms);
+        entry->tokens_per_sec =
+            update_average(entry->tokens_per_sec, tokens_per_sec);
+        entry->prompt_tokens =
+            update_average(entry->prompt_tokens, prompt_tokens);
+        entry->completion_tokens =
+            update_average(entry->completion_tokens, completion_tokens);
+      }
+      entry->samples++;
+    }
+  }
+
+  pthread_mutex_unlock(&router->lock);
+}
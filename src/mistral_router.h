@@ -0,0 +1,22 @@
+#ifndef MISTRAL_ROUTER_H
+#define MISTRAL_ROUTER_H
+
+#include "../include/mistral.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* Feed the outcome of one attempt on model
+* ok: 0 for 429, 5xx or a failed transfer, tokens are then ignored
+*/
+void router_record(mistral_model_router_t *router, const char *model, int ok,
+                   double latency_ms, int prompt_tokens,
+                   int completion_tokens);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MISTRAL_ROUTER_H */
@@ -0,0 +1,408 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/mistral.h"
+#include "mistral_alloc.h"
+#include "mistral_utils.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* weight of the newest sample in latency averages */
+#define LATENCY_EWMA_ALPHA 0.1
+
+typedef struct {
+  uint64_t context_hash;
+  float *vector;
+  int dimensions;
+  char *query;
+  char *id;
+  char *model;
+  char *content;
+  int prompt_tokens;
+  int completion_tokens;
+  int total_tokens;
+  unsigned long last_used;
+} semantic_entry_t;
+
+struct mistral_semantic_cache {
+  pthread_mutex_t lock;
+  const mistral_config_t *embed_config;
+  double threshold;
+  semantic_entry_t *entries;
+  size_t entry_count;
+  size_t max_entries;
+  unsigned long clock;
+  mistral_semantic_audit_cb audit;
+  void *audit_user_data;
+  unsigned long lookups;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long embedding_failures;
+  double avg_chat_ms;
+  double avg_embedding_ms;
+  double saved_ms;
+};
+
+static void entry_clear(semantic_entry_t *entry) {
+  mem_free(entry->vector);
+  mem_free(entry->query);
+  mem_free(entry->id);
+  mem_free(entry->model);
+  mem_free(entry->content);
+  memset(entry, 0, sizeof(semantic_entry_t));
+}
+
+static double update_average(double average, double sample) {
+  if (average == 0.0) {
+    return sample;
+  }
+  return average + LATENCY_EWMA_ALPHA * (sample - average);
+}
+
+/*
+* model, the sampling settings that shape the reply, and every message
+* except the last user message
+*/
+static uint64_t context_hash(const mistral_config_t *config,
+                             const mistral_message_t *messages,
+                             size_t message_count, size_t query_index) {
+  uint64_t hash = hash_bytes(config->model, strlen(config->model) + 1, 0);
+  size_t i;
+
+  hash = hash_bytes(&config->temperature, sizeof(config->temperature), hash);
+  hash = hash_bytes(&config->max_tokens, sizeof(config->max_tokens), hash);
+
+  for (i = 0; i < message_count; i++) {
+    if (i == query_index) {
+      continue;
+    }
+    hash = hash_bytes(messages[i].role, strlen(messages[i].role) + 1, hash);
+    hash = hash_bytes(messages[i].content, strlen(messages[i].content) + 1,
+                      hash);
+  }
+  return hash;
+}
+
+/* embed text and scale the vector to unit length */
+static float *embed_normalized(const mistral_config_t *embed_config,
+                               const char *text, int *dimensions) {
+  mistral_embeddings_t input;
+  mistral_embeddings_response_t response;
+  float *vector = NULL;
+  double norm = 0.0;
+  int i;
+
+  memset(&response, 0, sizeof(response));
+  input.input = (char *)text;
+
+  if (mistral_embeddings(embed_config, &input, 1, &response) != 0 ||
+      response.data == NULL || response.data[0].embending == NULL ||
+      response.data[0].dimensions <= 0) {
+    mistral_embeddings_response_free(&response);
+    return NULL;
+  }
+
+  /* the parsed vector lives in the response arena, the entry owns a copy */
+  *dimensions = response.data[0].dimensions;
+  vector = (float *)mem_malloc((size_t)*dimensions * sizeof(float));
+  if (vector != NULL) {
+    memcpy(vector, response.data[0].embending,
+           (size_t)*dimensions * sizeof(float));
+  }
+  mistral_embeddings_response_free(&response);
+  if (vector == NULL) {
+    return NULL;
+  }
+
+  for (i = 0; i < *dimensions; i++) {
+    norm += (double)vector[i] * vector[i];
+  }
+  if (norm > 0.0) {
+    norm = sqrt(norm);
+    for (i = 0; i < *dimensions; i++) {
+      vector[i] = (float)(vector[i] / norm);
+    }
+  }
+
+  return vector;
+}
+
+static double dot_product(const float *a, const float *b, int dimensions) {
+  double sum = 0.0;
+  int i;
+
+  for (i = 0; i < dimensions; i++) {
+    sum += (double)a[i] * b[i];
+  }
+  return sum;
+}
+
+static int copy_entry_to_response(const mistral_config_t *config,
+                                  const semantic_entry_t *entry,
+                                  mistral_response_t *response) {
+  response_begin(config, response);
+
+  response->content = mem_strdup(entry->content);
+  if (response->content == NULL) {
+    set_error_message(response, "failed to copy cached response");
+    response->error_code = MISTRAL_ERR_MEM;
+    return -1;
+  }
+  if (entry->id != NULL) {
+    response->id = mem_strdup(entry->id);
+  }
+  if (entry->model != NULL) {
+    response->model = mem_strdup(entry->model);
+  }
+
+  response->prompt_tokens = entry->prompt_tokens;
+  response->completion_tokens = entry->completion_tokens;
+  response->total_tokens = entry->total_tokens;
+  response->http_code = 200;
+  response->error_code = MISTRAL_OK;
+  response->cached = 1;
+  return 0;
+}
+
+static void store_entry(mistral_semantic_cache_t *cache, uint64_t hash,
+                        float *vector, int dimensions, const char *query,
+                        const mistral_response_t *response) {
+  semantic_entry_t *slot = NULL;
+  size_t i;
+
+  if (cache->entry_count < cache->max_entries) {
+    slot = &cache->entries[cache->entry_count++];
+  } else {
+    slot = &cache->entries[0];
+    for (i = 1; i < cache->entry_count; i++) {
+      if (cache->entries[i].last_used < slot->last_used) {
+        slot = &cache->entries[i];
+      }
+    }
+    entry_clear(slot);
+  }
+
+  slot->context_hash = hash;
+  slot->vector = vector;
+  slot->dimensions = dimensions;
+  slot->query = mem_strdup(query);
+  slot->content = mem_strdup(response->content);
+  slot->id = response->id != NULL ? mem_strdup(response->id) : NULL;
+  slot->model = response->model != NULL ? mem_strdup(response->model) : NULL;
+  slot->prompt_tokens = response->prompt_tokens;
+  slot->completion_tokens = response->completion_tokens;
+  slot->total_tokens = response->total_tokens;
+  slot->last_used = ++cache->clock;
+
+  if (slot->query == NULL || slot->content == NULL) {
+    entry_clear(slot);
+    cache->entry_count--;
+    if (slot != &cache->entries[cache->entry_count]) {
+      *slot = cache->entries[cache->entry_count];
+      memset(&cache->entries[cache->entry_count], 0, sizeof(semantic_entry_t));
+    }
+  }
+}
+
+mistral_semantic_cache_t *mistral_semantic_cache_create(
+    const mistral_config_t *embed_config, double threshold,
+    size_t max_entries) {
+  mistral_semantic_cache_t *cache = NULL;
+
+  if (embed_config == NULL || threshold <= 0.0 || threshold > 1.0 ||
+      max_entries == 0) {
+    fprintf(stderr, "invalid semantic cache parameters\n");
+    return NULL;
+  }
+
+  cache =
+      (mistral_semantic_cache_t *)mem_malloc(sizeof(mistral_semantic_cache_t));
+  if (cache == NULL) {
+    fprintf(stderr, "failed to allocate memory for semantic cache\n");
+    return NULL;
+  }
+
+  memset(cache, 0, sizeof(mistral_semantic_cache_t));
+
+  cache->entries =
+      (semantic_entry_t *)mem_calloc(max_entries, sizeof(semantic_entry_t));
+  if (cache->entries == NULL) {
+    fprintf(stderr, "failed to allocate memory for semantic cache entries\n");
+    mem_free(cache);
+    return NULL;
+  }
+
+  if (pthread_mutex_init(&cache->lock, NULL) != 0) {
+    fprintf(stderr, "failed to init semantic cache mutex\n");
+    mem_free(cache->entries);
+    mem_free(cache);
+    return NULL;
+  }
+
+  cache->embed_config = embed_config;
+  cache->threshold = threshold;
+  cache->max_entries = max_entries;
+
+  return cache;
+}
+
+void mistral_semantic_cache_set_audit(mistral_semantic_cache_t *cache,
+                                      mistral_semantic_audit_cb audit,
+                                      void *user_data) {
+  if (cache == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  cache->audit = audit;
+  cache->audit_user_data = user_data;
+  pthread_mutex_unlock(&cache->lock);
+}
+
+int mistral_semantic_chat_completions(mistral_semantic_cache_t *cache,
+                                      const mistral_config_t *config,
+                                      const mistral_message_t *messages,
+                                      size_t message_count,
+                                      mistral_response_t *response) {
+  const char *query = NULL;
+  size_t query_index = 0;
+  uint64_t hash = 0;
+  float *vector = NULL;
+  int dimensions = 0;
+  double started = 0.0;
+  double embedding_ms = 0.0;
+  semantic_entry_t *best = NULL;
+  double best_similarity = 0.0;
+  mistral_semantic_audit_cb audit = NULL;
+  void *audit_user_data = NULL;
+  char *matched_query = NULL;
+  size_t i;
+  int ret = -1;
+
+  if (cache == NULL || config == NULL || config->model == NULL ||
+      messages == NULL || message_count == 0) {
+    return mistral_chat_completions(config, messages, message_count, response);
+  }
+
+  for (i = message_count; i > 0; i--) {
+    if (messages[i - 1].role != NULL && messages[i - 1].content != NULL &&
+        strcmp(messages[i - 1].role, "user") == 0) {
+      query = messages[i - 1].content;
+      query_index = i - 1;
+      break;
+    }
+  }
+
+  for (i = 0; i < message_count; i++) {
+    if (messages[i].role == NULL || messages[i].content == NULL) {
+      query = NULL;
+    }
+  }
+
+  if (query == NULL) {
+    return mistral_chat_completions(config, messages, message_count, response);
+  }
+
+  hash = context_hash(config, messages, message_count, query_index);
+
+  started = monotonic_ms();
+  vector = embed_normalized(cache->embed_config, query, &dimensions);
+  embedding_ms = monotonic_ms() - started;
+
+  pthread_mutex_lock(&cache->lock);
+  cache->lookups++;
+
+  if (vector == NULL) {
+    cache->embedding_failures++;
+    pthread_mutex_unlock(&cache->lock);
+    return mistral_chat_completions(config, messages, message_count, response);
+  }
+
+  cache->avg_embedding_ms = update_average(cache->avg_embedding_ms,
+                                           embedding_ms);
+
+  for (i = 0; i < cache->entry_count; i++) {
+    semantic_entry_t *entry = &cache->entries[i];
+    double similarity = 0.0;
+
+    if (entry->context_hash != hash || entry->dimensions != dimensions) {
+      continue;
+    }
+
+    similarity = dot_product(entry->vector, vector, dimensions);
+    if (similarity >= cache->threshold && similarity > best_similarity) {
+      best = entry;
+      best_similarity = similarity;
+    }
+  }
+
+  if (best != NULL && copy_entry_to_response(config, best, response) == 0) {
+    best->last_used = ++cache->clock;
+    cache->hits++;
+    if (cache->avg_chat_ms > embedding_ms) {
+      cache->saved_ms += cache->avg_chat_ms - embedding_ms;
+    }
+    /* the entry may be replaced once the lock is dropped */
+    audit = cache->audit;
+    audit_user_data = cache->audit_user_data;
+    matched_query = audit != NULL ? mem_strdup(best->query) : NULL;
+    pthread_mutex_unlock(&cache->lock);
+    mem_free(vector);
+    if (matched_query != NULL) {
+      audit(query, matched_query, best_similarity, audit_user_data);
+      mem_free(matched_query);
+    }
+    return 0;
+  }
+
+  cache->misses++;
+  pthread_mutex_unlock(&cache->lock);
+
+  started = monotonic_ms();
+  ret = mistral_chat_completions(config, messages, message_count, response);
+
+  pthread_mutex_lock(&cache->lock);
+  if (ret == 0 && response->content != NULL) {
+    cache->avg_chat_ms =
+        update_average(cache->avg_chat_ms, monotonic_ms() - started);
+    store_entry(cache, hash, vector, dimensions, query, response);
+    vector = NULL;
+  }
+  pthread_mutex_unlock(&cache->lock);
+
+  mem_free(vector);
+  return ret;
+}
+
+void mistral_semantic_cache_get_stats(mistral_semantic_cache_t *cache,
+                                      mistral_semantic_cache_stats_t *stats) {
+  if (cache == NULL || stats == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  stats->lookups = cache->lookups;
+  stats->hits = cache->hits;
+  stats->misses = cache->misses;
+  stats->embedding_failures = cache->embedding_failures;
+  stats->entries = cache->entry_count;
+  stats->avg_chat_ms = cache->avg_chat_ms;
+  stats->avg_embedding_ms = cache->avg_embedding_ms;
+  stats->saved_ms = cache->saved_ms;
+  pthread_mutex_unlock(&cache->lock);
+}
+
+void mistral_semantic_cache_free(mistral_semantic_cache_t *cache) {
+  size_t i;
+
+  if (cache != NULL) {
+    for (i = 0; i < cache->entry_count; i++) {
+      entry_clear(&cache->entries[i]);
+    }
+    mem_free(cache->entries);
+    pthread_mutex_destroy(&cache->lock);
+    mem_free(cache);
+  }
+}
@@ -0,0 +1,1081 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mistral_tokenizer.h"
+#include "mistral_alloc.h"
+#include "mistral_utils.h"
+#include <cjson/cJSON.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_RANK UINT32_MAX
+#define STACK_PARTS 128
+#define PIECE_CACHE_SIZE 8192
+#define SHORT_PIECE 16
+#define PAIR_COUNT 0x10000
+#define SWAR_HIGH 0x8080808080808080ULL
+#define SWAR_ONES 0x0101010101010101ULL
+
+typedef struct {
+  uint32_t offset;
+  uint32_t len;
+  uint32_t rank;
+} token_slot_t;
+
+/*
+* Tekken vocabulary: byte strings to BPE ranks in an open addressing table,
+* token bytes packed in one pool. Two byte tokens, the start of every
+* merge, are also indexed directly by their bytes
+*/
+struct mistral_tokenizer {
+  token_slot_t *slots;
+  size_t mask;
+  unsigned char *bytes;
+  uint32_t *pair_ranks;
+  size_t token_count;
+  uint32_t serial;
+  int has_system_prompt;
+  unsigned char classes[256];
+};
+
+/*
+* Counts of recent short pieces, one table per thread. Text repeats its
+* words, and a hit skips the lookup in megabytes of slots and bytes and
+* any merging. Entries name their tokenizer by serial, so one loaded
+* later at a freed tokenizer's address never matches
+*/
+typedef struct {
+  uint64_t key[2];
+  uint32_t serial;
+  uint16_t len;
+  uint16_t count;
+} piece_entry_t;
+
+static pthread_once_t piece_once = PTHREAD_ONCE_INIT;
+static pthread_key_t piece_key;
+static int piece_key_ok = 0;
+/* from SHORT_PIECE - len: len bytes of ones, then zeros */
+static const unsigned char key_masks[2 * SHORT_PIECE] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+static pthread_mutex_t serial_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t last_serial = 0;
+
+/* character classes of the Tekken pre-tokenizer pattern */
+enum {
+  CLASS_UPPER = 1,     /* \p{Lu}, only in [\p{Lu}\p{Lt}\p{Lm}\p{Lo}\p{M}] */
+  CLASS_LOWER = 2,     /* \p{Ll}, only in [\p{Ll}\p{Lm}\p{Lo}\p{M}] */
+  CLASS_LETTER = 3,    /* uncased letters, in both sets */
+  CLASS_NUMBER = 4,
+  CLASS_SPACE = 8,
+  CLASS_NEWLINE = 16 | 8,
+  CLASS_OTHER = 32,
+  CLASS_MARK = 32 | 3, /* \p{M}: in both letter sets, yet not \p{L} */
+  CLASS_WIDE = 64      /* lead byte of a multibyte character */
+};
+
+static unsigned char classify_byte(unsigned char c) {
+  if (c >= 'a' && c <= 'z') {
+    return CLASS_LOWER;
+  }
+  if (c >= 'A' && c <= 'Z') {
+    return CLASS_UPPER;
+  }
+  if (c >= '0' && c <= '9') {
+    return CLASS_NUMBER;
+  }
+  if (c == '\r' || c == '\n') {
+    return CLASS_NEWLINE;
+  }
+  if (c == ' ' || c == '\t' || c == '\v' || c == '\f') {
+    return CLASS_SPACE;
+  }
+  if (c >= 0x80) {
+    return CLASS_WIDE;
+  }
+  return CLASS_OTHER;
+}
+
+typedef struct {
+  uint32_t first;
+  uint32_t last;
+  unsigned char cls;
+} char_range_t;
+
+/*
+* Non-ASCII code points that are not uncased letters: cased letters of the
+* Latin, Greek, Cyrillic and fullwidth blocks, \p{N}, \s, and the
+* punctuation and symbols of the common blocks. Sorted
+*/
+static const char_range_t char_ranges[] = {
+    {0x0080, 0x0084, CLASS_OTHER},    {0x0085, 0x0085, CLASS_SPACE},
+    {0x0086, 0x009f, CLASS_OTHER},    {0x00a0, 0x00a0, CLASS_SPACE},
+    {0x00a1, 0x00a9, CLASS_OTHER},    {0x00ab, 0x00b1, CLASS_OTHER},
+    {0x00b2, 0x00b3, CLASS_NUMBER},   {0x00b4, 0x00b4, CLASS_OTHER},
+    {0x00b5, 0x00b5, CLASS_LOWER},    {0x00b6, 0x00b8, CLASS_OTHER},
+    {0x00b9, 0x00b9, CLASS_NUMBER},   {0x00bb, 0x00bb, CLASS_OTHER},
+    {0x00bc, 0x00be, CLASS_NUMBER},   {0x00bf, 0x00bf, CLASS_OTHER},
+    {0x00c0, 0x00d6, CLASS_UPPER},    {0x00d7, 0x00d7, CLASS_OTHER},
+    {0x00d8, 0x00de, CLASS_UPPER},    {0x00df, 0x00f6, CLASS_LOWER},
+    {0x00f7, 0x00f7, CLASS_OTHER},    {0x00f8, 0x00ff, CLASS_LOWER},
+    {0x01c4, 0x01c5, CLASS_UPPER},    {0x01c6, 0x01c6, CLASS_LOWER},
+    {0x01c7, 0x01c8, CLASS_UPPER},    {0x01c9, 0x01c9, CLASS_LOWER},
+    {0x01ca, 0x01cb, CLASS_UPPER},    {0x01cc, 0x01cc, CLASS_LOWER},
+    {0x01dd, 0x01dd, CLASS_LOWER},    {0x01f0, 0x01f0, CLASS_LOWER},
+    {0x01f1, 0x01f2, CLASS_UPPER},    {0x01f3, 0x01f3, CLASS_LOWER},
+    {0x01f6, 0x01f7, CLASS_UPPER},    {0x0234, 0x0239, CLASS_LOWER},
+    {0x023a, 0x023b, CLASS_UPPER},    {0x023c, 0x023c, CLASS_LOWER},
+    {0x023d, 0x023e, CLASS_UPPER},    {0x023f, 0x0240, CLASS_LOWER},
+    {0x0241, 0x0241, CLASS_UPPER},    {0x0242, 0x0242, CLASS_LOWER},
+    {0x0243, 0x0246, CLASS_UPPER},    {0x0247, 0x0247, CLASS_LOWER},
+    {0x0300, 0x036f, CLASS_MARK},     {0x0375, 0x0375, CLASS_OTHER},
+    {0x037b, 0x037d, CLASS_LOWER},    {0x037e, 0x037e, CLASS_OTHER},
+    {0x037f, 0x037f, CLASS_UPPER},    {0x0384, 0x0385, CLASS_OTHER},
+    {0x0386, 0x0386, CLASS_UPPER},    {0x0387, 0x0387, CLASS_OTHER},
+    {0x0388, 0x038f, CLASS_UPPER},    {0x0390, 0x0390, CLASS_LOWER},
+    {0x0391, 0x03ab, CLASS_UPPER},    {0x03ac, 0x03ce, CLASS_LOWER},
+    {0x03cf, 0x03cf, CLASS_UPPER},    {0x03d0, 0x03d1, CLASS_LOWER},
+    {0x03d2, 0x03d4, CLASS_UPPER},    {0x03d5, 0x03d7, CLASS_LOWER},
+    {0x03f0, 0x03f3, CLASS_LOWER},    {0x03f4, 0x03f4, CLASS_UPPER},
+    {0x03f5, 0x03f5, CLASS_LOWER},    {0x03f6, 0x03f6, CLASS_OTHER},
+    {0x03f7, 0x03f7, CLASS_UPPER},    {0x03f8, 0x03f8, CLASS_LOWER},
+    {0x03f9, 0x03fa, CLASS_UPPER},    {0x03fb, 0x03fc, CLASS_LOWER},
+    {0x03fd, 0x03ff, CLASS_UPPER},    {0x0400, 0x042f, CLASS_UPPER},
+    {0x0430, 0x045f, CLASS_LOWER},    {0x0482, 0x0482, CLASS_OTHER},
+    {0x0483, 0x0489, CLASS_MARK},     {0x0531, 0x0556, CLASS_UPPER},
+    {0x055a, 0x055f, CLASS_OTHER},    {0x0560, 0x0588, CLASS_LOWER},
+    {0x0589, 0x058a, CLASS_OTHER},    {0x058d, 0x058f, CLASS_OTHER},
+    {0x0591, 0x05bd, CLASS_MARK},     {0x05be, 0x05be, CLASS_OTHER},
+    {0x05bf, 0x05bf, CLASS_MARK},     {0x05c0, 0x05c0, CLASS_OTHER},
+    {0x05c1, 0x05c2, CLASS_MARK},     {0x05c3, 0x05c3, CLASS_OTHER},
+    {0x05c4, 0x05c5, CLASS_MARK},     {0x05c6, 0x05c6, CLASS_OTHER},
+    {0x05c7, 0x05c7, CLASS_MARK},     {0x05f3, 0x05f4, CLASS_OTHER},
+    {0x0600, 0x060f, CLASS_OTHER},    {0x0610, 0x061a, CLASS_MARK},
+    {0x061b, 0x061f, CLASS_OTHER},    {0x064b, 0x065f, CLASS_MARK},
+    {0x0660, 0x0669, CLASS_NUMBER},   {0x066a, 0x066d, CLASS_OTHER},
+    {0x0670, 0x0670, CLASS_MARK},     {0x06d4, 0x06d4, CLASS_OTHER},
+    {0x06d6, 0x06dc, CLASS_MARK},     {0x06dd, 0x06de, CLASS_OTHER},
+    {0x06df, 0x06e4, CLASS_MARK},     {0x06e7, 0x06e8, CLASS_MARK},
+    {0x06e9, 0x06e9, CLASS_OTHER},    {0x06ea, 0x06ed, CLASS_MARK},
+    {0x06f0, 0x06f9, CLASS_NUMBER},   {0x06fd, 0x06fe, CLASS_OTHER},
+    {0x0900, 0x0903, CLASS_MARK},     {0x093a, 0x093c, CLASS_MARK},
+    {0x093e, 0x094f, CLASS_MARK},     {0x0951, 0x0957, CLASS_MARK},
+    {0x0962, 0x0963, CLASS_MARK},     {0x0964, 0x0965, CLASS_OTHER},
+    {0x0966, 0x096f, CLASS_NUMBER},   {0x0970, 0x0970, CLASS_OTHER},
+    {0x0e31, 0x0e31, CLASS_MARK},     {0x0e34, 0x0e3a, CLASS_MARK},
+    {0x0e3f, 0x0e3f, CLASS_OTHER},    {0x0e47, 0x0e4e, CLASS_MARK},
+    {0x0e4f, 0x0e4f, CLASS_OTHER},    {0x0e50, 0x0e59, CLASS_NUMBER},
+    {0x0e5a, 0x0e5b, CLASS_OTHER},    {0x1680, 0x1680, CLASS_SPACE},
+    {0x1ab0, 0x1aff, CLASS_MARK},     {0x1dc0, 0x1dff, CLASS_MARK},
+    {0x1e96, 0x1e9d, CLASS_LOWER},    {0x1e9e, 0x1e9e, CLASS_UPPER},
+    {0x1e9f, 0x1e9f, CLASS_LOWER},    {0x2000, 0x200a, CLASS_SPACE},
+    {0x200b, 0x2027, CLASS_OTHER},    {0x2028, 0x2029, CLASS_SPACE},
+    {0x202a, 0x202e, CLASS_OTHER},    {0x202f, 0x202f, CLASS_SPACE},
+    {0x2030, 0x205e, CLASS_OTHER},    {0x205f, 0x205f, CLASS_SPACE},
+    {0x2060, 0x206f, CLASS_OTHER},    {0x2070, 0x2070, CLASS_NUMBER},
+    {0x2074, 0x2079, CLASS_NUMBER},   {0x207a, 0x207e, CLASS_OTHER},
+    {0x2080, 0x2089, CLASS_NUMBER},   {0x208a, 0x208e, CLASS_OTHER},
+    {0x20a0, 0x20cf, CLASS_OTHER},    {0x20d0, 0x20ff, CLASS_MARK},
+    {0x2100, 0x2101, CLASS_OTHER},    {0x2102, 0x2102, CLASS_UPPER},
+    {0x2103, 0x2106, CLASS_OTHER},    {0x2107, 0x2107, CLASS_UPPER},
+    {0x2108, 0x2109, CLASS_OTHER},    {0x210a, 0x210a, CLASS_LOWER},
+    {0x210b, 0x210d, CLASS_UPPER},    {0x210e, 0x210f, CLASS_LOWER},
+    {0x2110, 0x2112, CLASS_UPPER},    {0x2113, 0x2113, CLASS_LOWER},
+    {0x2114, 0x2114, CLASS_OTHER},    {0x2115, 0x2115, CLASS_UPPER},
+    {0x2116, 0x2118, CLASS_OTHER},    {0x2119, 0x211d, CLASS_UPPER},
+    {0x211e, 0x2123, CLASS_OTHER},    {0x2124, 0x2124, CLASS_UPPER},
+    {0x2125, 0x2125, CLASS_OTHER},    {0x2126, 0x2126, CLASS_UPPER},
+    {0x2127, 0x2127, CLASS_OTHER},    {0x2128, 0x2128, CLASS_UPPER},
+    {0x2129, 0x2129, CLASS_OTHER},    {0x212a, 0x212d, CLASS_UPPER},
+    {0x212e, 0x212e, CLASS_OTHER},    {0x212f, 0x212f, CLASS_LOWER},
+    {0x2130, 0x2133, CLASS_UPPER},    {0x2134, 0x2134, CLASS_LOWER},
+    {0x2139, 0x2139, CLASS_LOWER},    {0x213a, 0x213b, CLASS_OTHER},
+    {0x213c, 0x213d, CLASS_LOWER},    {0x213e, 0x213f, CLASS_UPPER},
+    {0x2140, 0x2144, CLASS_OTHER},    {0x2145, 0x2145, CLASS_UPPER},
+    {0x2146, 0x2149, CLASS_LOWER},    {0x214a, 0x214d, CLASS_OTHER},
+    {0x214e, 0x214e, CLASS_LOWER},    {0x214f, 0x214f, CLASS_OTHER},
+    {0x2150, 0x2182, CLASS_NUMBER},   {0x2185, 0x2189, CLASS_NUMBER},
+    {0x218a, 0x245f, CLASS_OTHER},    {0x2460, 0x249b, CLASS_NUMBER},
+    {0x249c, 0x24e9, CLASS_OTHER},    {0x24ea, 0x24ff, CLASS_NUMBER},
+    {0x2500, 0x2775, CLASS_OTHER},    {0x2776, 0x2793, CLASS_NUMBER},
+    {0x2794, 0x2bff, CLASS_OTHER},    {0x2e00, 0x2e2e, CLASS_OTHER},
+    {0x2e30, 0x2fff, CLASS_OTHER},    {0x3000, 0x3000, CLASS_SPACE},
+    {0x3001, 0x3004, CLASS_OTHER},    {0x3007, 0x3007, CLASS_NUMBER},
+    {0x3008, 0x3020, CLASS_OTHER},    {0x3021, 0x3029, CLASS_NUMBER},
+    {0x302a, 0x302f, CLASS_MARK},     {0x3030, 0x3030, CLASS_OTHER},
+    {0x3036, 0x3037, CLASS_OTHER},    {0x3038, 0x303a, CLASS_NUMBER},
+    {0x303d, 0x303f, CLASS_OTHER},    {0x3099, 0x309a, CLASS_MARK},
+    {0x309b, 0x309c, CLASS_OTHER},    {0x30a0, 0x30a0, CLASS_OTHER},
+    {0x30fb, 0x30fb, CLASS_OTHER},    {0x31c0, 0x31ef, CLASS_OTHER},
+    {0x3200, 0x321f, CLASS_OTHER},    {0x3220, 0x3229, CLASS_NUMBER},
+    {0x322a, 0x3247, CLASS_OTHER},    {0x3248, 0x324f, CLASS_NUMBER},
+    {0x3250, 0x3250, CLASS_OTHER},    {0x3251, 0x325f, CLASS_NUMBER},
+    {0x3260, 0x327f, CLASS_OTHER},    {0x3280, 0x3289, CLASS_NUMBER},
+    {0x328a, 0x32b0, CLASS_OTHER},    {0x32b1, 0x32bf, CLASS_NUMBER},
+    {0x32c0, 0x33ff, CLASS_OTHER},    {0x4dc0, 0x4dff, CLASS_OTHER},
+    {0xa490, 0xa4c6, CLASS_OTHER},    {0xe000, 0xf8ff, CLASS_OTHER},
+    {0xfb29, 0xfb29, CLASS_OTHER},    {0xfd3e, 0xfd3f, CLASS_OTHER},
+    {0xfe00, 0xfe0f, CLASS_MARK},     {0xfe10, 0xfe19, CLASS_OTHER},
+    {0xfe20, 0xfe2f, CLASS_MARK},     {0xfe30, 0xfe6f, CLASS_OTHER},
+    {0xfeff, 0xfeff, CLASS_OTHER},    {0xff01, 0xff0f, CLASS_OTHER},
+    {0xff10, 0xff19, CLASS_NUMBER},   {0xff1a, 0xff20, CLASS_OTHER},
+    {0xff21, 0xff3a, CLASS_UPPER},    {0xff3b, 0xff40, CLASS_OTHER},
+    {0xff41, 0xff5a, CLASS_LOWER},    {0xff5b, 0xff65, CLASS_OTHER},
+    {0xffe0, 0xffff, CLASS_OTHER},    {0x1d7ce, 0x1d7ff, CLASS_NUMBER},
+    {0x1f000, 0x1f0ff, CLASS_OTHER},  {0x1f100, 0x1f10c, CLASS_NUMBER},
+    {0x1f10d, 0x1fbef, CLASS_OTHER},  {0x1fbf0, 0x1fbf9, CLASS_NUMBER},
+    {0xe0000, 0xe007f, CLASS_OTHER},  {0xe0100, 0xe01ef, CLASS_MARK},
+    {0xf0000, 0x10ffff, CLASS_OTHER}};
+
+#define CHAR_RANGES (sizeof(char_ranges) / sizeof(char_ranges[0]))
+#define BMP_SIZE 0x10000
+
+/* classes of the Basic Multilingual Plane, filled once from char_ranges */
+static unsigned char bmp_classes[BMP_SIZE];
+static pthread_once_t bmp_once = PTHREAD_ONCE_INIT;
+
+/*
+* Most of Latin Extended, archaic Greek and Cyrillic past U+045F put each
+* capital right before its lowercase letter; upper: parity of the capitals
+*/
+static void set_case_pairs(uint32_t first, uint32_t last, uint32_t upper) {
+  uint32_t c;
+
+  for (c = first; c <= last; c++) {
+    bmp_classes[c] = (c & 1) == upper ? CLASS_UPPER : CLASS_LOWER;
+  }
+}
+
+static void build_bmp_classes(void) {
+  size_t i;
+  uint32_t c;
+
+  memset(bmp_classes, CLASS_LETTER, sizeof(bmp_classes));
+  for (c = 0; c < 0x80; c++) {
+    bmp_classes[c] = classify_byte((unsigned char)c);
+  }
+  set_case_pairs(0x0100, 0x0137, 0);
+  set_case_pairs(0x0139, 0x0148, 1);
+  set_case_pairs(0x014a, 0x0177, 0);
+  set_case_pairs(0x0179, 0x017e, 1);
+  bmp_classes[0x0138] = CLASS_LOWER;
+  bmp_classes[0x0149] = CLASS_LOWER;
+  bmp_classes[0x0178] = CLASS_UPPER;
+  bmp_classes[0x017f] = CLASS_LOWER;
+  set_case_pairs(0x01cd, 0x01dc, 1);
+  set_case_pairs(0x01de, 0x01ef, 0);
+  set_case_pairs(0x01f4, 0x01f5, 0);
+  set_case_pairs(0x01f8, 0x0233, 0);
+  set_case_pairs(0x0248, 0x024f, 0);
+  set_case_pairs(0x0370, 0x0373, 0);
+  set_case_pairs(0x0376, 0x0377, 0);
+  set_case_pairs(0x03d8, 0x03ef, 0);
+  set_case_pairs(0x0460, 0x0481, 0);
+  set_case_pairs(0x048a, 0x04bf, 0);
+  set_case_pairs(0x04c1, 0x04ce, 1);
+  set_case_pairs(0x04d0, 0x052f, 0);
+  bmp_classes[0x04c0] = CLASS_UPPER;
+  bmp_classes[0x04cf] = CLASS_LOWER;
+  set_case_pairs(0x1e00, 0x1e95, 0);
+  set_case_pairs(0x1ea0, 0x1eff, 0);
+  set_case_pairs(0x2183, 0x2184, 1);
+  for (i = 0; i < CHAR_RANGES && char_ranges[i].first < BMP_SIZE; i++) {
+    for (c = char_ranges[i].first; c <= char_ranges[i].last; c++) {
+      bmp_classes[c] = char_ranges[i].cls;
+    }
+  }
+}
+
+/*
+* Class of the multibyte character at p, its length in *len. A byte that
+* starts no valid UTF-8 sequence counts alone, as punctuation
+*/
+static int wide_class(const unsigned char *p, const unsigned char *end,
+                      size_t *len) {
+  uint32_t c = 0;
+  size_t need = 0;
+  size_t lo = 0;
+  size_t hi = CHAR_RANGES;
+  size_t i;
+
+  if (*p >= 0xc2 && *p < 0xe0) {
+    need = 2;
+    c = *p & 0x1f;
+  } else if (*p >= 0xe0 && *p < 0xf0) {
+    need = 3;
+    c = *p & 0x0f;
+  } else if (*p >= 0xf0 && *p < 0xf5) {
+    need = 4;
+    c = *p & 0x07;
+  }
+  if (need == 0 || (size_t)(end - p) < need) {
+    *len = 1;
+    return CLASS_OTHER;
+  }
+  for (i = 1; i < need; i++) {
+    if ((p[i] & 0xc0) != 0x80) {
+      *len = 1;
+      return CLASS_OTHER;
+    }
+    c = (c << 6) | (p[i] & 0x3f);
+  }
+
+  *len = need;
+  if (c < BMP_SIZE) {
+    return bmp_classes[c];
+  }
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (char_ranges[mid].last < c) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < CHAR_RANGES && char_ranges[lo].first <= c ? char_ranges[lo].cls
+                                                         : CLASS_LETTER;
+}
+
+/*
+* Class of the character at p, its length in *len
+*/
+static int char_class(const unsigned char *classes, const unsigned char *p,
+                      const unsigned char *end, size_t *len) {
+  if (classes[*p] != CLASS_WIDE) {
+    *len = 1;
+    return classes[*p];
+  }
+  return wide_class(p, end, len);
+}
+
+/*
+* Bytes before the first one, in memory order, whose high bit is set in
+* flags; some must be. A byte loop would mispredict at every word's end
+*/
+static size_t first_flagged(uint64_t flags) {
+  static const uint16_t probe = 1;
+  unsigned char little = 0;
+
+  memcpy(&little, &probe, 1);
+  if (little) {
+    flags = ((flags & (~flags + 1)) - 1) >> 7;
+  } else {
+    flags |= flags >> 8;
+    flags |= flags >> 16;
+    flags = ~(flags | flags >> 32) >> 7;
+  }
+  return (size_t)(((flags & SWAR_ONES) * SWAR_ONES) >> 56);
+}
+
+/*
+* Skip a run of ASCII lowercase letters eight bytes at a time
+*/
+static const unsigned char *skip_lower_ascii(const unsigned char *p,
+                                             const unsigned char *end) {
+  uint64_t word = 0;
+  uint64_t at_least_a = 0;
+  uint64_t past_z = 0;
+  uint64_t other = 0;
+
+  while (end - p >= 8) {
+    memcpy(&word, p, sizeof(word));
+    /* no byte below 0x80 carries into its neighbour */
+    at_least_a = word + SWAR_ONES * (0x80 - 'a');
+    past_z = word + SWAR_ONES * (0x80 - 'z' - 1);
+    other = ~(at_least_a & ~past_z & ~word) & SWAR_HIGH;
+    if (other != 0) {
+      return p + first_flagged(other);
+    }
+    p += 8;
+  }
+  while (p < end && *p >= 'a' && *p <= 'z') {
+    p++;
+  }
+  return p;
+}
+
+/*
+* Skip a run of the byte c eight bytes at a time: indentation
+*/
+static const unsigned char *skip_byte(const unsigned char *p,
+                                      const unsigned char *end,
+                                      unsigned char c) {
+  uint64_t word = 0;
+  uint64_t other = 0;
+
+  while (end - p >= 8) {
+    memcpy(&word, p, sizeof(word));
+    word ^= SWAR_ONES * c;
+    other = (word | ((word & ~SWAR_HIGH) + ~SWAR_HIGH)) & SWAR_HIGH;
+    if (other != 0) {
+      return p + first_flagged(other);
+    }
+    p += 8;
+  }
+  while (p < end && *p == c) {
+    p++;
+  }
+  return p;
+}
+
+/*
+* Skip characters whose class shares a bit with mask
+*/
+static const unsigned char *skip_class(const unsigned char *classes,
+                                       const unsigned char *p,
+                                       const unsigned char *end, int mask) {
+  size_t len = 0;
+
+  if ((mask & CLASS_LOWER) && end - p >= 8) {
+    p = skip_lower_ascii(p, end);
+  }
+  while (p < end && (char_class(classes, p, end, &len) & mask)) {
+    p += len;
+  }
+  return p;
+}
+
+/*
+* One match of the Tekken pattern at p, tried in alternation order:
+* [^\r\n\p{L}\p{N}]?[\p{Lu}..]*[\p{Ll}..]+
+* | [^\r\n\p{L}\p{N}]?[\p{Lu}..]+[\p{Ll}..]*
+* | \p{N} | ?[^\s\p{L}\p{N}]+[\r\n/]* | \s*[\r\n]+ | \s+(?!\S) | \s+
+*/
+static const unsigned char *next_piece(const unsigned char *classes,
+                                       const unsigned char *p,
+                                       const unsigned char *end) {
+  const unsigned char *start = p;
+  const unsigned char *q = p;
+  const unsigned char *last = NULL;
+  const unsigned char *broken = NULL;
+  size_t first_len = 0;
+  size_t len = 0;
+  int first = char_class(classes, p, end, &first_len);
+  int cls = 0;
+
+  /* optional prefix for the two letter alternatives */
+  if ((first & (CLASS_LETTER | CLASS_NUMBER)) == 0 &&
+      first != CLASS_NEWLINE) {
+    q = p + first_len;
+  }
+  if (q < end && ((cls = char_class(classes, q, end, &len)) & CLASS_LETTER)) {
+    /* [\p{Lu}..]* runs on, then gives back letters until [\p{Ll}..]+
+     * matches: all of a lowercase run right after it, else its last
+     * uncased letter. An all capital run is the second alternative */
+    while (cls & CLASS_UPPER) {
+      q += len;
+      if ((cls & CLASS_LETTER) == CLASS_LETTER) {
+        last = q;
+      }
+      cls = q < end ? char_class(classes, q, end, &len) : 0;
+    }
+    if (cls & CLASS_LOWER) {
+      return skip_class(classes, q + len, end, CLASS_LOWER);
+    }
+    return last != NULL ? last : q;
+  }
+
+  if (first == CLASS_NUMBER) {
+    return p + first_len;
+  }
+
+  /* ?[^\s\p{L}\p{N}]+[\r\n/]* */
+  q = *p == ' ' ? p + 1 : p;
+  if (q < end && (char_class(classes, q, end, &len) & CLASS_OTHER)) {
+    do {
+      q += len;
+    } while (q < end && (char_class(classes, q, end, &len) & CLASS_OTHER));
+    while (q < end && (*q == '\r' || *q == '\n' || *q == '/')) {
+      q++;
+    }
+    return q;
+  }
+
+  if (first & CLASS_SPACE) {
+    /* last: start of the run's last character, broken: past its last
+     * line break */
+    for (q = p; q < end;) {
+      if (*q == ' ') {
+        q = skip_byte(q, end, ' ');
+        last = q - 1;
+        continue;
+      }
+      cls = char_class(classes, q, end, &len);
+      if (!(cls & CLASS_SPACE)) {
+        break;
+      }
+      last = q;
+      q += len;
+      if (cls == CLASS_NEWLINE) {
+        broken = q;
+      }
+    }
+    /* \s*[\r\n]+ ends after the last line break of the run */
+    if (broken != NULL) {
+      return broken;
+    }
+    /* \s+(?!\S) leaves the last space for the next word */
+    if (q < end && last > start) {
+      return last;
+    }
+    return q;
+  }
+
+  return p + first_len;
+}
+
+/*
+* Word at a time multiplicative hash; pieces are short, so this beats the
+* byte wise FNV used for cache keys
+*/
+static uint64_t slot_hash(const unsigned char *data, size_t len) {
+  uint64_t hash = (uint64_t)len * 0x9e3779b97f4a7c15ULL;
+  uint64_t word = 0;
+
+  while (len >= 8) {
+    memcpy(&word, data, sizeof(word));
+    hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+    data += 8;
+    len -= 8;
+  }
+  if (len > 0) {
+    word = 0;
+    memcpy(&word, data, len);
+    hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+  }
+  return hash ^ (hash >> 29);
+}
+
+/*
+* The first len <= SHORT_PIECE bytes at p as two zero padded words. Text
+* that runs on past the piece is read whole and masked
+*/
+static void load_key(uint64_t key[2], const unsigned char *p, size_t len,
+                     size_t readable) {
+  uint64_t mask[2];
+
+  if (readable < SHORT_PIECE) {
+    key[0] = 0;
+    key[1] = 0;
+    memcpy(key, p, len);
+    return;
+  }
+  memcpy(key, p, 2 * sizeof(uint64_t));
+  memcpy(mask, key_masks + SHORT_PIECE - len, sizeof(mask));
+  key[0] &= mask[0];
+  key[1] &= mask[1];
+}
+
+/* slot_hash of a short piece from its key */
+static uint64_t key_hash(const uint64_t key[2], size_t len) {
+  uint64_t hash = ((uint64_t)len * 0x9e3779b97f4a7c15ULL ^ key[0]) *
+                  0xff51afd7ed558ccdULL;
+
+  if (len > 8) {
+    hash = (hash ^ key[1]) * 0xff51afd7ed558ccdULL;
+  }
+  return hash ^ (hash >> 29);
+}
+
+/*
+* find_rank for a short piece, comparing words: the pool is padded so a
+* key's worth of bytes can be read at any token
+*/
+static uint32_t find_key_rank(const mistral_tokenizer_t *tokenizer,
+                              const uint64_t key[2], size_t len,
+                              uint64_t hash) {
+  size_t i = (size_t)hash & tokenizer->mask;
+  uint64_t token[2];
+
+  for (;; i = (i + 1) & tokenizer->mask) {
+    const token_slot_t *slot = &tokenizer->slots[i];
+    if (slot->len == 0) {
+      return NO_RANK;
+    }
+    if (slot->len == len) {
+      load_key(token, tokenizer->bytes + slot->offset, len, SHORT_PIECE);
+      if (token[0] == key[0] && token[1] == key[1]) {
+        return slot->rank;
+      }
+    }
+  }
+}
+
+/*
+* Rank of the len bytes at data, readable bytes of text from there
+*/
+static uint32_t find_rank(const mistral_tokenizer_t *tokenizer,
+                          const unsigned char *data, size_t len,
+                          size_t readable) {
+  uint64_t key[2];
+  size_t i = 0;
+
+  if (len <= SHORT_PIECE) {
+    load_key(key, data, len, readable);
+    return find_key_rank(tokenizer, key, len, key_hash(key, len));
+  }
+
+  i = (size_t)slot_hash(data, len) & tokenizer->mask;
+  for (;; i = (i + 1) & tokenizer->mask) {
+    const token_slot_t *slot = &tokenizer->slots[i];
+    if (slot->len == 0) {
+      return NO_RANK;
+    }
+    if (slot->len == len &&
+        memcmp(tokenizer->bytes + slot->offset, data, len) == 0) {
+      return slot->rank;
+    }
+  }
+}
+
+/*
+* Byte pair merge as in tiktoken: repeatedly join the adjacent pair with
+* the lowest rank. Every single byte is a token, so the count is exact
+*/
+static long count_piece(const mistral_tokenizer_t *tokenizer,
+                        const unsigned char *piece, size_t len,
+                        size_t readable) {
+  size_t stack_starts[STACK_PARTS + 1];
+  uint32_t stack_ranks[STACK_PARTS + 1];
+  size_t *starts = stack_starts;
+  uint32_t *ranks = stack_ranks;
+  size_t parts = len + 1;
+  size_t i;
+  long count = 0;
+
+  if (len == 1 || find_rank(tokenizer, piece, len, readable) != NO_RANK) {
+    return 1;
+  }
+
+  if (len > STACK_PARTS) {
+    starts = (size_t *)mem_malloc((len + 1) * sizeof(size_t));
+    ranks = (uint32_t *)mem_malloc((len + 1) * sizeof(uint32_t));
+    if (starts == NULL || ranks == NULL) {
+      mem_free(starts);
+      mem_free(ranks);
+      return -1;
+    }
+  }
+
+  for (i = 0; i < parts; i++) {
+    starts[i] = i;
+  }
+  for (i = 0; i + 2 < parts; i++) {
+    ranks[i] = tokenizer->pair_ranks[piece[i] << 8 | piece[i + 1]];
+  }
+  ranks[parts - 2] = NO_RANK;
+  ranks[parts - 1] = NO_RANK;
+
+  for (;;) {
+    uint32_t best = NO_RANK;
+    size_t at = 0;
+
+    for (i = 0; i + 1 < parts; i++) {
+      if (ranks[i] < best) {
+        best = ranks[i];
+        at = i;
+      }
+    }
+    if (best == NO_RANK) {
+      break;
+    }
+
+    memmove(&starts[at + 1], &starts[at + 2],
+            (parts - at - 2) * sizeof(size_t));
+    memmove(&ranks[at + 1], &ranks[at + 2],
+            (parts - at - 2) * sizeof(uint32_t));
+    parts--;
+
+    if (at + 2 < parts) {
+      ranks[at] = find_rank(tokenizer, piece + starts[at],
+                            starts[at + 2] - starts[at], readable - starts[at]);
+    } else {
+      ranks[at] = NO_RANK;
+    }
+    if (at > 0) {
+      ranks[at - 1] =
+          find_rank(tokenizer, piece + starts[at - 1],
+                    starts[at + 1] - starts[at - 1], readable - starts[at - 1]);
+    }
+  }
+
+  count = (long)parts - 1;
+  if (starts != stack_starts) {
+    mem_free(starts);
+    mem_free(ranks);
+  }
+  return count;
+}
+
+static void make_piece_key(void) {
+  piece_key_ok = pthread_key_create(&piece_key, mem_free) == 0;
+}
+
+/*
+* This thread's piece count table, NULL when there is none to be had
+*/
+static piece_entry_t *piece_cache(void) {
+  piece_entry_t *cache = NULL;
+
+  pthread_once(&piece_once, make_piece_key);
+  if (!piece_key_ok) {
+    return NULL;
+  }
+
+  cache = (piece_entry_t *)pthread_getspecific(piece_key);
+  if (cache == NULL) {
+    cache = (piece_entry_t *)mem_calloc(PIECE_CACHE_SIZE, sizeof(*cache));
+    if (cache != NULL && pthread_setspecific(piece_key, cache) != 0) {
+      mem_free(cache);
+      cache = NULL;
+    }
+  }
+  return cache;
+}
+
+/*
+* Count of the piece from p to next: short ones through the thread's
+* table, then as a whole token, before any merging
+*/
+static long cached_count(const mistral_tokenizer_t *tokenizer,
+                         piece_entry_t *cache, const unsigned char *p,
+                         const unsigned char *next,
+                         const unsigned char *end) {
+  size_t len = (size_t)(next - p);
+  piece_entry_t *entry = NULL;
+  uint64_t key[2];
+  uint64_t hash = 0;
+  long count = 0;
+
+  if (len == 1) {
+    return 1;
+  }
+  if (len == 2) {
+    return tokenizer->pair_ranks[p[0] << 8 | p[1]] != NO_RANK ? 1 : 2;
+  }
+  if (len > SHORT_PIECE) {
+    return count_piece(tokenizer, p, len, (size_t)(end - p));
+  }
+
+  load_key(key, p, len, (size_t)(end - p));
+  hash = key_hash(key, len);
+  if (cache != NULL) {
+    entry = &cache[(hash >> 40) & (PIECE_CACHE_SIZE - 1)];
+    if (entry->serial == tokenizer->serial && entry->len == len &&
+        entry->key[0] == key[0] && entry->key[1] == key[1]) {
+      return entry->count;
+    }
+  }
+
+  if (find_key_rank(tokenizer, key, len, hash) != NO_RANK) {
+    count = 1;
+  } else {
+    count = count_piece(tokenizer, p, len, (size_t)(end - p));
+  }
+  if (entry != NULL && count > 0) {
+    entry->key[0] = key[0];
+    entry->key[1] = key[1];
+    entry->serial = tokenizer->serial;
+    entry->len = (uint16_t)len;
+    entry->count = (uint16_t)count;
+  }
+  return count;
+}
+
+static int base64_value(int c) {
+  if (c >= 'A' && c <= 'Z') {
+    return c - 'A';
+  }
+  if (c >= 'a' && c <= 'z') {
+    return c - 'a' + 26;
+  }
+  if (c >= '0' && c <= '9') {
+    return c - '0' + 52;
+  }
+  if (c == '+') {
+    return 62;
+  }
+  if (c == '/') {
+    return 63;
+  }
+  return -1;
+}
+
+/*
+* Decode base64 text into out, which has room for strlen(text) * 3 / 4
+* Return decoded length, -1 if text is not base64
+*/
+static long base64_decode(const char *text, unsigned char *out) {
+  unsigned int bits = 0;
+  int bit_count = 0;
+  long len = 0;
+
+  for (; *text != '\0' && *text != '='; text++) {
+    int value = base64_value((unsigned char)*text);
+    if (value < 0) {
+      return -1;
+    }
+    bits = (bits << 6) | (unsigned int)value;
+    bit_count += 6;
+    if (bit_count >= 8) {
+      bit_count -= 8;
+      out[len++] = (unsigned char)(bits >> bit_count);
+    }
+  }
+  return len;
+}
+
+static int insert_token(mistral_tokenizer_t *tokenizer, uint32_t offset,
+                        uint32_t len, uint32_t rank) {
+  const unsigned char *data = tokenizer->bytes + offset;
+  size_t i = (size_t)slot_hash(data, len) & tokenizer->mask;
+
+  for (;; i = (i + 1) & tokenizer->mask) {
+    token_slot_t *slot = &tokenizer->slots[i];
+    if (slot->len == 0) {
+      slot->offset = offset;
+      slot->len = len;
+      slot->rank = rank;
+      return 0;
+    }
+    if (slot->len == len &&
+        memcmp(tokenizer->bytes + slot->offset, data, len) == 0) {
+      return -1;
+    }
+  }
+}
+
+static char *read_file(const char *path) {
+  FILE *file = fopen(path, "rb");
+  char *data = NULL;
+  long size = 0;
+
+  if (file == NULL) {
+    return NULL;
+  }
+
+  if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) > 0 &&
+      fseek(file, 0, SEEK_SET) == 0) {
+    data = (char *)mem_malloc((size_t)size + 1);
+    if (data != NULL && fread(data, 1, (size_t)size, file) != (size_t)size) {
+      mem_free(data);
+      data = NULL;
+    }
+    if (data != NULL) {
+      data[size] = '\0';
+    }
+  }
+
+  fclose(file);
+  return data;
+}
+
+static int load_vocab(mistral_tokenizer_t *tokenizer, cJSON *root) {
+  cJSON *config = cJSON_GetObjectItemCaseSensitive(root, "config");
+  cJSON *vocab = cJSON_GetObjectItemCaseSensitive(root, "vocab");
+  cJSON *specials = cJSON_GetObjectItemCaseSensitive(root, "special_tokens");
+  cJSON *item = NULL;
+  cJSON *entry = NULL;
+  size_t limit = 0;
+  size_t pool_size = 0;
+  size_t capacity = 16;
+  uint32_t offset = 0;
+
+  if (!cJSON_IsArray(vocab)) {
+    return -1;
+  }
+
+  limit = (size_t)cJSON_GetArraySize(vocab);
+  /* the model only uses the first default_vocab_size ids, specials first */
+  if (config != NULL) {
+    cJSON *vocab_size =
+        cJSON_GetObjectItemCaseSensitive(config, "default_vocab_size");
+    cJSON *special_count =
+        cJSON_GetObjectItemCaseSensitive(config, "default_num_special_tokens");
+    if (cJSON_IsNumber(vocab_size) && cJSON_IsNumber(special_count) &&
+        vocab_size->valuedouble > special_count->valuedouble &&
+        vocab_size->valuedouble - special_count->valuedouble < (double)limit) {
+      limit = (size_t)(vocab_size->valuedouble - special_count->valuedouble);
+    }
+  }
+
+  cJSON_ArrayForEach(entry, specials) {
+    item = cJSON_GetObjectItemCaseSensitive(entry, "token_str");
+    if (cJSON_IsString(item) &&
+        strcmp(item->valuestring, "[SYSTEM_PROMPT]") == 0) {
+      tokenizer->has_system_prompt = 1;
+    }
+  }
+
+  cJSON_ArrayForEach(entry, vocab) {
+    item = cJSON_GetObjectItemCaseSensitive(entry, "token_bytes");
+    if (!cJSON_IsString(item)) {
+      return -1;
+    }
+    pool_size += strlen(item->valuestring) * 3 / 4 + 1;
+  }
+
+  while (capacity < limit * 2) {
+    capacity *= 2;
+  }
+
+  tokenizer->bytes =
+      (unsigned char *)mem_calloc(pool_size + SHORT_PIECE, 1);
+  tokenizer->slots = (token_slot_t *)mem_calloc(capacity, sizeof(token_slot_t));
+  tokenizer->pair_ranks =
+      (uint32_t *)mem_malloc(PAIR_COUNT * sizeof(uint32_t));
+  if (tokenizer->bytes == NULL || tokenizer->slots == NULL ||
+      tokenizer->pair_ranks == NULL) {
+    return -1;
+  }
+  tokenizer->mask = capacity - 1;
+  /* all ones is NO_RANK */
+  memset(tokenizer->pair_ranks, 0xff, PAIR_COUNT * sizeof(uint32_t));
+
+  cJSON_ArrayForEach(entry, vocab) {
+    cJSON *rank = cJSON_GetObjectItemCaseSensitive(entry, "rank");
+    long len = 0;
+
+    if (tokenizer->token_count == limit) {
+      break;
+    }
+
+    item = cJSON_GetObjectItemCaseSensitive(entry, "token_bytes");
+    len = base64_decode(item->valuestring, tokenizer->bytes + offset);
+    if (len <= 0 || !cJSON_IsNumber(rank) || rank->valuedouble < 0) {
+      return -1;
+    }
+    if (insert_token(tokenizer, offset, (uint32_t)len,
+                     (uint32_t)rank->valuedouble) == 0) {
+      tokenizer->token_count++;
+      if (len == 2) {
+        tokenizer->pair_ranks[tokenizer->bytes[offset] << 8 |
+                              tokenizer->bytes[offset + 1]] =
+            (uint32_t)rank->valuedouble;
+      }
+    }
+    offset += (uint32_t)len;
+  }
+
+  return 0;
+}
+
+mistral_tokenizer_t *mistral_tokenizer_load(const char *path) {
+  mistral_tokenizer_t *tokenizer = NULL;
+  cJSON *root = NULL;
+  char *data = NULL;
+
+  if (path == NULL) {
+    fprintf(stderr, "invalid tokenizer path\n");
+    return NULL;
+  }
+
+  data = read_file(path);
+  if (data == NULL) {
+    fprintf(stderr, "failed to read tokenizer file %s\n", path);
+    return NULL;
+  }
+
+  root = cJSON_Parse(data);
+  mem_free(data);
+  if (root == NULL) {
+    fprintf(stderr, "failed to parse tokenizer file %s\n", path);
+    return NULL;
+  }
+
+  pthread_once(&bmp_once, build_bmp_classes);
+  tokenizer = (mistral_tokenizer_t *)mem_calloc(1, sizeof(mistral_tokenizer_t));
+  if (tokenizer != NULL) {
+    int c;
+    for (c = 0; c < 256; c++) {
+      tokenizer->classes[c] = classify_byte((unsigned char)c);
+    }
+    pthread_mutex_lock(&serial_lock);
+    tokenizer->serial = ++last_serial;
+    pthread_mutex_unlock(&serial_lock);
+  }
+  if (tokenizer == NULL || load_vocab(tokenizer, root) != 0) {
+    fprintf(stderr, "invalid tokenizer vocabulary in %s\n", path);
+    mistral_tokenizer_free(tokenizer);
+    tokenizer = NULL;
+  }
+
+  cJSON_Delete(root);
+  return tokenizer;
+}
+
+void mistral_tokenizer_free(mistral_tokenizer_t *tokenizer) {
+  if (tokenizer != NULL) {
+    mem_free(tokenizer->slots);
+    mem_free(tokenizer->bytes);
+    mem_free(tokenizer->pair_ranks);
+    mem_free(tokenizer);
+  }
+}
+
+long tokenizer_count_range(const mistral_tokenizer_t *tokenizer,
+                           const char *text, size_t len) {
+  const unsigned char *p = (const unsigned char *)text;
+  const unsigned char *end = p + len;
+  piece_entry_t *cache = piece_cache();
+  long total = 0;
+
+  while (p < end) {
+    const unsigned char *next = next_piece(tokenizer->classes, p, end);
+    long count = cached_count(tokenizer, cache, p, next, end);
+    if (count < 0) {
+      return -1;
+    }
+    total += count;
+    p = next;
+  }
+
+  return total;
+}
+
+long mistral_count_tokens(const mistral_tokenizer_t *tokenizer,
+                          const char *text) {
+  if (tokenizer == NULL || text == NULL) {
+    return -1;
+  }
+
+  return tokenizer_count_range(tokenizer, text, strlen(text));
+}
+
+long mistral_count_chat_tokens(const mistral_tokenizer_t *tokenizer,
+                               const mistral_message_t *messages,
+                               size_t message_count) {
+  long total = 1; /* <s> */
+  long count = 0;
+  size_t i;
+
+  if (tokenizer == NULL || messages == NULL) {
+    return -1;
+  }
+
+  for (i = 0; i < message_count; i++) {
+    if (messages[i].role == NULL || messages[i].content == NULL) {
+      return -1;
+    }
+
+    count = mistral_count_tokens(tokenizer, messages[i].content);
+    if (count < 0) {
+      return -1;
+    }
+
+    if (strcmp(messages[i].role, "assistant") == 0) {
+      total += count + 1; /* </s> */
+    } else if (strcmp(messages[i].role, "system") == 0 &&
+               !tokenizer->has_system_prompt) {
+      /* older templates prepend it to the next user turn */
+      total += count + mistral_count_tokens(tokenizer, "\n\n");
+    } else {
+      /* [INST] [/INST], [SYSTEM_PROMPT] [/SYSTEM_PROMPT] or tool markers */
+      total += count + 2;
+    }
+  }
+
+  return total;
+}
@@ -0,0 +1,21 @@
+#ifndef MISTRAL_TOKENIZER_H
+#define MISTRAL_TOKENIZER_H
+
+#include "../include/mistral.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* Tokens in text[0, len), which need not be NUL-terminated
+* Return -1 if error
+*/
+long tokenizer_count_range(const mistral_tokenizer_t *tokenizer,
+                           const char *text, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MISTRAL_TOKENIZER_H */
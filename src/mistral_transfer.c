@@ -0,0 +1,69 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mistral_transfer.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *const endpoints[] = {"chat/completions", "fim/completions",
+                                        "embeddings"};
+#define ENDPOINT_COUNT (sizeof(endpoints) / sizeof(endpoints[0]))
+
+static pthread_mutex_t transfer_lock = PTHREAD_MUTEX_INITIALIZER;
+static mistral_transfer_stats_t transfer_stats[ENDPOINT_COUNT];
+
+/*
+* Index of name, a path below MISTRAL_BASE_API, -1 if not tracked
+*/
+static int endpoint_index(const char *name) {
+  size_t i;
+
+  for (i = 0; i < ENDPOINT_COUNT; i++) {
+    if (strcmp(name, endpoints[i]) == 0) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+void transfer_record(const char *endpoint, const http_response_t *http_resp,
+                     int compressed) {
+  mistral_transfer_stats_t *stats = NULL;
+  size_t base_len = strlen(MISTRAL_BASE_API "/");
+  int index = -1;
+
+  /* a coalesced request was served by another call's transfer */
+  if (http_resp->sent_bytes == 0 ||
+      strncmp(endpoint, MISTRAL_BASE_API "/", base_len) != 0) {
+    return;
+  }
+  index = endpoint_index(endpoint + base_len);
+  if (index < 0) {
+    return;
+  }
+
+  stats = &transfer_stats[index];
+  pthread_mutex_lock(&transfer_lock);
+  stats->requests++;
+  stats->compressed_requests += compressed ? 1 : 0;
+  stats->request_bytes += http_resp->sent_bytes;
+  stats->request_wire_bytes += http_resp->wire_sent_bytes;
+  stats->response_bytes += http_resp->size;
+  stats->response_wire_bytes += http_resp->wire_received_bytes;
+  pthread_mutex_unlock(&transfer_lock);
+}
+
+int mistral_get_transfer_stats(const char *endpoint,
+                               mistral_transfer_stats_t *stats) {
+  int index = endpoint != NULL ? endpoint_index(endpoint) : -1;
+
+  if (index < 0 || stats == NULL) {
+    fprintf(stderr, "invalid arguments to mistral_get_transfer_stats\n");
+    return -1;
+  }
+
+  pthread_mutex_lock(&transfer_lock);
+  *stats = transfer_stats[index];
+  pthread_mutex_unlock(&transfer_lock);
+  return 0;
+}
@@ -0,0 +1,22 @@
+#ifndef MISTRAL_TRANSFER_H
+#define MISTRAL_TRANSFER_H
+
+#include "../include/mistral.h"
+#include "http_client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* Add one completed attempt on endpoint (a full MISTRAL_BASE_API URL) to
+* its transfer counters
+*/
+void transfer_record(const char *endpoint, const http_response_t *http_resp,
+                     int compressed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MISTRAL_TRANSFER_H */
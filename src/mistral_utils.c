@@ -2,22 +2,94 @@
 
 #include "mistral_utils.h"
 #include "../include/mistral.h"
+#include "mistral_alloc.h"
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
-
-#ifdef _WIN32
-#include <windows.h>
-void sleep_ms(int milliseconds) { Sleep(milliseconds); }
-#else
 #include <unistd.h>
+
+/* how late a cancelled condition wait notices */
+#define CANCEL_POLL_MS 10
+
 void sleep_ms(int ms) {
   struct timespec ts;
   ts.tv_sec = ms / 1000;
   ts.tv_nsec = (ms % 1000) * 1000000;
   nanosleep(&ts, NULL);
 }
-#endif
+
+double monotonic_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+}
+
+void monotonic_timespec(double ms, struct timespec *ts) {
+  ts->tv_sec = (time_t)(ms / 1000.0);
+  ts->tv_nsec = (long)((ms - (double)ts->tv_sec * 1000.0) * 1000000.0);
+  if (ts->tv_nsec >= 1000000000L) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000L;
+  }
+}
+
+int monotonic_cond_init(pthread_cond_t *cond) {
+  pthread_condattr_t attr;
+  int ret = -1;
+
+  if (pthread_condattr_init(&attr) != 0) {
+    return -1;
+  }
+  if (pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0 &&
+      pthread_cond_init(cond, &attr) == 0) {
+    ret = 0;
+  }
+  pthread_condattr_destroy(&attr);
+  return ret;
+}
+
+int cond_wait_until(pthread_cond_t *cond, pthread_mutex_t *lock,
+                    double deadline, int (*is_cancelled)(void *),
+                    void *cancel_data) {
+  struct timespec until;
+  double wake = deadline;
+
+  if (is_cancelled != NULL) {
+    if (is_cancelled(cancel_data)) {
+      return -1;
+    }
+    /* cancelling does not signal cond, so look again every few ms */
+    wake = monotonic_ms() + CANCEL_POLL_MS;
+    if (deadline > 0.0 && deadline < wake) {
+      wake = deadline;
+    }
+  }
+
+  if (wake <= 0.0) {
+    pthread_cond_wait(cond, lock);
+    return 0;
+  }
+
+  monotonic_timespec(wake, &until);
+  if (pthread_cond_timedwait(cond, lock, &until) == ETIMEDOUT &&
+      deadline > 0.0 && monotonic_ms() >= deadline) {
+    return -1;
+  }
+  return 0;
+}
+
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  uint64_t hash = seed == 0 ? 14695981039346656037ULL : seed;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
 
 const char *mistral_error_string(mistral_error_code_t code) {
   switch (code) {
@@ -39,13 +111,17 @@ const char *mistral_error_string(mistral_error_code_t code) {
     return "timeout";
   case MISTRAL_ERR_MEM:
     return "memory allocation error";
+  case MISTRAL_ERR_CIRCUIT_OPEN:
+    return "circuit open";
+  case MISTRAL_ERR_CANCELLED:
+    return "cancelled";
   default:
     return "unknown error";
   }
 }
 
 int set_error_message(mistral_response_t *response, const char *message) {
-  char *msg = strdup(message);
+  char *msg = mem_strdup(message);
   if (msg == NULL) {
     response->error_code = MISTRAL_ERR_MEM;
     return -1;
@@ -54,12 +130,35 @@ int set_error_message(mistral_response_t *response, const char *message) {
   return 0;
 }
 
+void response_begin(const mistral_config_t *config,
+                    mistral_response_t *response) {
+  mistral_response_arena_t *arena = NULL;
+
+  if (config != NULL && config->reuse_responses) {
+    mistral_response_reset(response);
+    arena = response->arena;
+  }
+  memset(response, 0, sizeof(mistral_response_t));
+  response->arena = arena;
+}
+
+void embeddings_response_begin(const mistral_config_t *config,
+                               mistral_embeddings_response_t *response) {
+  mistral_response_arena_t *arena = NULL;
+
+  if (config != NULL && config->reuse_responses) {
+    mistral_embeddings_response_reset(response);
+    arena = response->arena;
+  }
+  memset(response, 0, sizeof(mistral_embeddings_response_t));
+  response->arena = arena;
+}
+
 int validate_common_params(const mistral_config_t *config,
                            mistral_response_t *response) {
   if (config == NULL || config->api_key == NULL || response == NULL) {
     fprintf(stderr, "invalid arguments: config, api_key or response is NULL\n");
     if (response != NULL) {
-      memset(response, 0, sizeof(mistral_response_t));
       if (set_error_message(response, "Invalid parameters") != 0) {
         return -1;
       }
@@ -78,3 +177,18 @@ int validate_common_params(const mistral_config_t *config,
 
   return 0;
 }
+
+int validate_embeddings_params(const mistral_config_t *config,
+                               mistral_embeddings_response_t *response) {
+  if (config == NULL || config->api_key == NULL ||
+      mistral_config_validate(config) != 0) {
+    fprintf(stderr, "invalid configuration\n");
+    response->error_message = mem_strdup("invalid configuration");
+    if (response->error_message != NULL) {
+      response->error_code = MISTRAL_ERR_INVALID_PARAM;
+    }
+    return -1;
+  }
+
+  return 0;
+}
@@ -2,6 +2,10 @@
 #define MISTRAL_UTILS_H
 
 #include "../include/mistral.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -9,11 +13,60 @@ extern "C" {
 
 void sleep_ms(int milliseconds);
 
+/*
+* Monotonic clock in milliseconds
+*/
+double monotonic_ms(void);
+
+/*
+* Absolute time for pthread_cond_timedwait on a monotonic_cond_init
+* condition, ms on the monotonic_ms clock
+*/
+void monotonic_timespec(double ms, struct timespec *ts);
+
+/*
+* Init a condition whose timed waits use the monotonic clock
+* Return 0 if ok, -1 if error
+*/
+int monotonic_cond_init(pthread_cond_t *cond);
+
+/*
+* One wait on a monotonic_cond_init condition, lock held. Ends on a signal,
+* at deadline (monotonic ms, 0 for none), or within a few ms of
+* is_cancelled turning true; is_cancelled may be NULL
+* Return 0 to recheck the awaited state, -1 if deadline passed or cancelled
+*/
+int cond_wait_until(pthread_cond_t *cond, pthread_mutex_t *lock,
+                    double deadline, int (*is_cancelled)(void *),
+                    void *cancel_data);
+
+/*
+* FNV-1a hash, pass 0 as seed to start, previous hash to continue
+*/
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed);
+
 int set_error_message(mistral_response_t *response, const char *message);
 
+/*
+* Clear a response at the start of a call: zeroed, or reset with its
+* memory kept when config->reuse_responses is set
+*/
+void response_begin(const mistral_config_t *config,
+                    mistral_response_t *response);
+
+void embeddings_response_begin(const mistral_config_t *config,
+                               mistral_embeddings_response_t *response);
+
+/*
+* Check config for a call whose response was started with response_begin
+* Return 0 if ok, -1 if invalid (set on response)
+*/
 int validate_common_params(const mistral_config_t *config,
                              mistral_response_t *response);
 
+int validate_embeddings_params(const mistral_config_t *config,
+                               mistral_embeddings_response_t *response);
+
 #ifdef __cplusplus
 }
 #endif
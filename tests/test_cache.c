@@ -0,0 +1,358 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/mistral.h"
+#include "../src/mistral_cache.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TEST_ENDPOINT "https://example.invalid/v1/chat/completions"
+#define TEST_CACHE_FILE "test_cache.bin"
+
+static void fill_response(mistral_response_t *response, const char *content) {
+  memset(response, 0, sizeof(mistral_response_t));
+  response->id = strdup("cmpl-1");
+  response->model = strdup("mistral-tiny");
+  response->content = strdup(content);
+  response->prompt_tokens = 10;
+  response->completion_tokens = 5;
+  response->total_tokens = 15;
+  response->http_code = 200;
+}
+
+int test_cache_hit_miss(void) {
+  printf("TEST - Response cache hit and miss\n");
+
+  mistral_response_cache_stats_t stats;
+  mistral_response_t stored;
+  mistral_response_t response = {0};
+  mistral_response_cache_t *cache =
+      mistral_response_cache_create(1 << 20, 0, NULL);
+  assert(cache != NULL);
+  printf("...init - ok\n");
+
+  assert(response_cache_lookup(cache, TEST_ENDPOINT, "{\"a\":1}", &response) !=
+         0);
+
+  fill_response(&stored, "cached answer");
+  response_cache_store(cache, TEST_ENDPOINT, "{\"a\":1}", &stored);
+  mistral_response_free(&stored);
+
+  assert(response_cache_lookup(cache, TEST_ENDPOINT, "{\"a\":2}", &response) !=
+         0);
+  assert(response_cache_lookup(cache, TEST_ENDPOINT, "{\"a\":1}", &response) ==
+         0);
+  assert(strcmp(response.content, "cached answer") == 0);
+  assert(strcmp(response.model, "mistral-tiny") == 0);
+  assert(response.prompt_tokens == 10);
+  assert(response.completion_tokens == 5);
+  assert(response.total_tokens == 15);
+  assert(response.cached == 1);
+  assert(response.error_code == MISTRAL_OK);
+  mistral_response_free(&response);
+  printf("...lookup - ok\n");
+
+  mistral_response_cache_get_stats(cache, &stats);
+  assert(stats.hits == 1);
+  assert(stats.misses == 2);
+  assert(stats.entries == 1);
+
+  mistral_response_cache_free(cache);
+  printf("...cleanup - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_cache_lru_eviction(void) {
+  printf("TEST - Response cache evicts least recently used\n");
+
+  mistral_response_cache_stats_t stats;
+  mistral_response_t stored;
+  mistral_response_t response = {0};
+  char content[512];
+  mistral_response_cache_t *cache = mistral_response_cache_create(2048, 0, NULL);
+  assert(cache != NULL);
+
+  memset(content, 'x', sizeof(content) - 1);
+  content[sizeof(content) - 1] = '\0';
+
+  fill_response(&stored, content);
+  response_cache_store(cache, TEST_ENDPOINT, "first", &stored);
+  response_cache_store(cache, TEST_ENDPOINT, "second", &stored);
+
+  /* touch first so second becomes the eviction candidate */
+  assert(response_cache_lookup(cache, TEST_ENDPOINT, "first", &response) == 0);
+  mistral_response_free(&response);
+
+  response_cache_store(cache, TEST_ENDPOINT, "third", &stored);
+  mistral_response_free(&stored);
+
+  mistral_response_cache_get_stats(cache, &stats);
+  assert(stats.bytes <= 2048);
+  assert(stats.evictions >= 1);
+
+  assert(response_cache_lookup(cache, TEST_ENDPOINT, "second", &response) != 0);
+  assert(response_cache_lookup(cache, TEST_ENDPOINT, "third", &response) == 0);
+  mistral_response_free(&response);
+  printf("...eviction - ok\n");
+
+  mistral_response_cache_free(cache);
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_cache_backing_file(void) {
+  printf("TEST - Response cache backing file\n");
+
+  mistral_response_t stored;
+  mistral_response_t response = {0};
+  mistral_response_cache_t *cache = NULL;
+
+  remove(TEST_CACHE_FILE);
+
+  cache = mistral_response_cache_create(1 << 20, 3600, TEST_CACHE_FILE);
+  assert(cache != NULL);
+  fill_response(&stored, "persisted");
+  response_cache_store(cache, TEST_ENDPOINT, "{\"p\":1}", &stored);
+  mistral_response_free(&stored);
+  mistral_response_cache_free(cache);
+  printf("...write - ok\n");
+
+  cache = mistral_response_cache_create(1 << 20, 3600, TEST_CACHE_FILE);
+  assert(cache != NULL);
+  assert(response_cache_lookup(cache, TEST_ENDPOINT, "{\"p\":1}", &response) ==
+         0);
+  assert(strcmp(response.content, "persisted") == 0);
+  assert(response.total_tokens == 15);
+  mistral_response_free(&response);
+  mistral_response_cache_free(cache);
+  printf("...reload - ok\n");
+
+  remove(TEST_CACHE_FILE);
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+static long file_size(const char *path) {
+  FILE *file = fopen(path, "rb");
+  long size = -1;
+
+  if (file != NULL) {
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fclose(file);
+  }
+  return size;
+}
+
+int test_cache_ttl_expiry(void) {
+  printf("TEST - Response cache TTL expiry\n");
+
+  struct timespec delay = {2, 100000000L};
+  mistral_response_cache_stats_t stats;
+  mistral_response_t stored;
+  mistral_response_t response = {0};
+  mistral_response_cache_t *cache =
+      mistral_response_cache_create(1 << 20, 1, NULL);
+  assert(cache != NULL);
+
+  fill_response(&stored, "short lived");
+  response_cache_store(cache, TEST_ENDPOINT, "{\"t\":1}", &stored);
+  mistral_response_free(&stored);
+  assert(response_cache_lookup(cache, TEST_ENDPOINT, "{\"t\":1}", &response) ==
+         0);
+  mistral_response_free(&response);
+  printf("...fresh hit - ok\n");
+
+  /* expiry is kept in whole seconds, wait past the next one */
+  nanosleep(&delay, NULL);
+  assert(response_cache_lookup(cache, TEST_ENDPOINT, "{\"t\":1}", &response) !=
+         0);
+  assert(response.content == NULL);
+  mistral_response_cache_get_stats(cache, &stats);
+  assert(stats.entries == 0 && stats.bytes == 0);
+  assert(stats.hits == 1 && stats.misses == 1);
+  printf("...expired miss - ok\n");
+
+  mistral_response_cache_free(cache);
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_cache_backing_compaction(void) {
+  printf("TEST - Response cache backing file compaction\n");
+
+  mistral_response_cache_stats_t stats;
+  mistral_response_t stored;
+  mistral_response_t response = {0};
+  mistral_response_cache_t *cache = NULL;
+  char content[512];
+  int i;
+
+  remove(TEST_CACHE_FILE);
+  memset(content, 'x', sizeof(content) - 1);
+  content[sizeof(content) - 1] = '\0';
+
+  cache = mistral_response_cache_create(1 << 20, 0, TEST_CACHE_FILE);
+  assert(cache != NULL);
+  fill_response(&stored, content);
+  /* without compaction every overwrite would stay in the file */
+  for (i = 0; i < 200; i++) {
+    response_cache_store(cache, TEST_ENDPOINT, "{\"c\":1}", &stored);
+  }
+  mistral_response_free(&stored);
+  mistral_response_cache_get_stats(cache, &stats);
+  assert(stats.entries == 1);
+  assert(file_size(TEST_CACHE_FILE) <= (long)(2 * stats.bytes + 1024));
+  mistral_response_cache_free(cache);
+  printf("...overwrites compacted - ok\n");
+
+  /* the compacted file was renamed into place and still loads */
+  assert(file_size(TEST_CACHE_FILE ".tmp") == -1);
+  cache = mistral_response_cache_create(1 << 20, 0, TEST_CACHE_FILE);
+  assert(cache != NULL);
+  assert(response_cache_lookup(cache, TEST_ENDPOINT, "{\"c\":1}", &response) ==
+         0);
+  assert(strcmp(response.content, content) == 0);
+  mistral_response_free(&response);
+  mistral_response_cache_free(cache);
+  printf("...renamed into place - ok\n");
+
+  remove(TEST_CACHE_FILE);
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_cache_corrupt_file(void) {
+  printf("TEST - Response cache corrupt backing file\n");
+
+  mistral_response_t stored;
+  mistral_response_t response = {0};
+  mistral_response_cache_t *cache = NULL;
+  unsigned char garbage[64];
+  FILE *file = NULL;
+
+  remove(TEST_CACHE_FILE);
+  cache = mistral_response_cache_create(1 << 20, 0, TEST_CACHE_FILE);
+  assert(cache != NULL);
+  fill_response(&stored, "kept");
+  response_cache_store(cache, TEST_ENDPOINT, "{\"k\":1}", &stored);
+  mistral_response_free(&stored);
+  mistral_response_cache_free(cache);
+
+  /* a record whose lengths claim about 4 GiB per field */
+  memset(garbage, 0xff, sizeof(garbage));
+  file = fopen(TEST_CACHE_FILE, "ab");
+  assert(file != NULL);
+  assert(fwrite(garbage, 1, sizeof(garbage), file) == sizeof(garbage));
+  fclose(file);
+
+  cache = mistral_response_cache_create(1 << 20, 0, TEST_CACHE_FILE);
+  assert(cache != NULL);
+  assert(response_cache_lookup(cache, TEST_ENDPOINT, "{\"k\":1}", &response) ==
+         0);
+  assert(strcmp(response.content, "kept") == 0);
+  mistral_response_free(&response);
+  mistral_response_cache_free(cache);
+  printf("...records before it loaded - ok\n");
+
+  /* loading rewrote the file without the corrupt tail */
+  cache = mistral_response_cache_create(1 << 20, 0, TEST_CACHE_FILE);
+  assert(cache != NULL);
+  assert(response_cache_lookup(cache, TEST_ENDPOINT, "{\"k\":1}", &response) ==
+         0);
+  mistral_response_free(&response);
+  mistral_response_cache_free(cache);
+  printf("...corrupt tail dropped - ok\n");
+
+  remove(TEST_CACHE_FILE);
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_cache_foreign_file(void) {
+  printf("TEST - Response cache foreign backing file\n");
+
+  const char text[] = "not a response cache\n";
+  mistral_response_t stored;
+  mistral_response_t response = {0};
+  mistral_response_cache_t *cache = NULL;
+  char read_back[sizeof(text)];
+  FILE *file = NULL;
+
+  file = fopen(TEST_CACHE_FILE, "wb");
+  assert(file != NULL);
+  assert(fwrite(text, 1, sizeof(text) - 1, file) == sizeof(text) - 1);
+  fclose(file);
+
+  /* the cache still works, in memory only */
+  cache = mistral_response_cache_create(1 << 20, 0, TEST_CACHE_FILE);
+  assert(cache != NULL);
+  fill_response(&stored, "memory");
+  response_cache_store(cache, TEST_ENDPOINT, "{\"f\":1}", &stored);
+  mistral_response_free(&stored);
+  assert(response_cache_lookup(cache, TEST_ENDPOINT, "{\"f\":1}", &response) ==
+         0);
+  mistral_response_free(&response);
+  mistral_response_cache_free(cache);
+  printf("...cache in memory - ok\n");
+
+  file = fopen(TEST_CACHE_FILE, "rb");
+  assert(file != NULL);
+  memset(read_back, 0, sizeof(read_back));
+  assert(fread(read_back, 1, sizeof(read_back), file) == sizeof(text) - 1);
+  fclose(file);
+  assert(strcmp(read_back, text) == 0);
+  printf("...file left as is - ok\n");
+
+  remove(TEST_CACHE_FILE);
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_cache_invalid_params(void) {
+  printf("TEST - Response cache invalid params\n");
+
+  assert(mistral_response_cache_create(0, 0, NULL) == NULL);
+  assert(mistral_response_cache_create(1024, -1, NULL) == NULL);
+  mistral_response_cache_free(NULL);
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int main(void) {
+  int failed = 0;
+
+  printf("===========================================\n");
+  printf("Response Cache Unit Tests\n");
+  printf("===========================================\n\n");
+
+  failed += test_cache_hit_miss();
+  failed += test_cache_lru_eviction();
+  failed += test_cache_backing_file();
+  failed += test_cache_ttl_expiry();
+  failed += test_cache_backing_compaction();
+  failed += test_cache_corrupt_file();
+  failed += test_cache_foreign_file();
+  failed += test_cache_invalid_params();
+
+  printf("\n===========================================\n");
+  if (failed == 0) {
+    printf("[+] All response cache tests passed!\n");
+  } else {
+    printf("[-] %d test(s) failed\n", failed);
+  }
+  printf("===========================================\n");
+
+  return failed;
+}
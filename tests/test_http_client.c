@@ -1,9 +1,13 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include "../src/http_client.h"
+#include "../src/http_gzip.h"
+#include "../src/json_writer.h"
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <zlib.h>
 
 int test_init_cleanup(void) {
   printf("TEST - HTTP client init/cleanup\n");
@@ -128,6 +132,173 @@ int test_null_ptr(void) {
   return 0;
 }
 
+int test_receive_buffer_reuse(void) {
+  printf("TEST - Receive buffer reuse\n");
+
+  const char *path = "/tmp/mistral_test_receive.json";
+  http_response_t response = {0};
+  char *first = NULL;
+  FILE *file = fopen(path, "w");
+  size_t i;
+
+  assert(file != NULL);
+  for (i = 0; i < 100000; i++) {
+    fputc('a' + (int)(i % 26), file);
+  }
+  fclose(file);
+  assert(http_client_init() == 0);
+  printf("...init - ok\n");
+
+  /* a local file comes through the same write callback, in many chunks */
+  if (http_post("file:///tmp/mistral_test_receive.json", NULL, NULL,
+                &response) != 0) {
+    printf("SKIPPED - file protocol unavailable\n");
+    http_client_cleanup();
+    remove(path);
+    return 0;
+  }
+  assert(response.size == 100000);
+  assert(response.capacity > response.size);
+  assert(response.data[99999] == 'a' + 99999 % 26);
+  assert(response.data[100000] == '\0');
+  first = response.data;
+  printf("...geometric growth - ok\n");
+
+  http_response_free(&response);
+  assert(http_post("file:///tmp/mistral_test_receive.json", NULL, NULL,
+                   &response) == 0);
+  assert(response.data == first);
+  assert(response.size == 100000);
+  printf("...reuse - ok\n");
+
+  http_set_buffer_retention(0);
+  http_response_free(&response);
+  http_set_buffer_retention(1024 * 1024);
+  http_client_cleanup();
+  remove(path);
+  printf("...cleanup - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+/*
+* Read stream to the end in pieces of step bytes and inflate it
+* Return the malloc'd text, its length in *length
+*/
+static char *read_inflated(const http_body_stream_t *stream, size_t step,
+                           size_t *length) {
+  size_t capacity = 1 << 20;
+  char *text = (char *)malloc(capacity);
+  char piece[4096];
+  z_stream z;
+  long n = 0;
+  int ret = Z_OK;
+
+  assert(text != NULL && step <= sizeof(piece));
+  memset(&z, 0, sizeof(z));
+  assert(inflateInit2(&z, 16 + 15) == Z_OK);
+  z.next_out = (Bytef *)text;
+  z.avail_out = (uInt)capacity;
+  while ((n = stream->read(piece, step, stream->source)) > 0) {
+    z.next_in = (Bytef *)piece;
+    z.avail_in = (uInt)n;
+    ret = inflate(&z, Z_NO_FLUSH);
+    assert(ret == Z_OK || ret == Z_STREAM_END);
+    assert(z.avail_in == 0);
+  }
+  assert(n == 0 && ret == Z_STREAM_END);
+  *length = capacity - z.avail_out;
+  inflateEnd(&z);
+  return text;
+}
+
+static long read_json(char *buffer, size_t size, void *source) {
+  return (long)json_stream_read((json_stream_t *)source, buffer, size);
+}
+
+static int rewind_json(void *source) {
+  json_stream_rewind((json_stream_t *)source);
+  return 0;
+}
+
+int test_gzip_body(void) {
+  printf("TEST - Gzip request body\n");
+
+  const size_t size = 40000;
+  char *body = (char *)malloc(size + 1);
+  char *text = NULL;
+  char *whole = NULL;
+  char piece[512];
+  gzip_body_t gz;
+  http_body_stream_t stream;
+  http_body_stream_t source;
+  json_stream_t json;
+  unsigned int seed = 1;
+  size_t length = 0;
+  size_t i;
+
+  /* little repetition, so the gzip data outgrows 16 KiB too */
+  assert(body != NULL);
+  for (i = 0; i < size; i++) {
+    seed = seed * 1103515245u + 12345u;
+    body[i] = (char)('a' + (seed >> 16) % 26);
+  }
+  body[size] = '\0';
+
+  assert(gzip_begin(&gz, body, NULL, &stream) == 0);
+  text = read_inflated(&stream, 100, &length);
+  assert(length == size && memcmp(text, body, size) == 0);
+  assert(gz.raw_bytes == size);
+  free(text);
+  printf("...string round trip - ok\n");
+
+  /* a redirect rewinds after part of the body went out */
+  assert(stream.rewind(stream.source) == 0);
+  assert(stream.read(piece, sizeof(piece), stream.source) > 0);
+  assert(stream.rewind(stream.source) == 0);
+  text = read_inflated(&stream, 4096, &length);
+  assert(length == size && memcmp(text, body, size) == 0);
+  assert(gz.raw_bytes == size);
+  free(text);
+  gzip_end(&gz);
+  printf("...string rewind - ok\n");
+
+  /* the stream source is filled 16 KiB at a time */
+  json_stream_init(&json);
+  assert(json_stream_append(&json, "{\"input\":", 9) == 0);
+  assert(json_stream_reference_string(&json, body, size) == 0);
+  assert(json_stream_append(&json, "}", 1) == 0);
+  whole = json_stream_to_string(&json);
+  assert(whole != NULL);
+  source.read = read_json;
+  source.rewind = rewind_json;
+  source.source = &json;
+  assert(gzip_begin(&gz, NULL, &source, &stream) == 0);
+  text = read_inflated(&stream, 777, &length);
+  assert(length == strlen(whole) && memcmp(text, whole, length) == 0);
+  assert(gz.raw_bytes == length);
+  free(text);
+  printf("...stream round trip - ok\n");
+
+  assert(stream.rewind(stream.source) == 0);
+  for (i = 0; i < 3; i++) {
+    assert(stream.read(piece, sizeof(piece), stream.source) > 0);
+  }
+  assert(stream.rewind(stream.source) == 0);
+  text = read_inflated(&stream, 1, &length);
+  assert(length == strlen(whole) && memcmp(text, whole, length) == 0);
+  free(text);
+  gzip_end(&gz);
+  printf("...stream rewind - ok\n");
+
+  free(whole);
+  json_stream_free(&json);
+  free(body);
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
 int main(void) {
   int failed = 0;
 
@@ -140,6 +311,8 @@ int main(void) {
   failed += test_response_free_empty();
   failed += test_response_free_with_data();
   failed += test_null_ptr();
+  failed += test_receive_buffer_reuse();
+  failed += test_gzip_body();
 
   printf("\n--- Real request ---\n");
   failed += test_real_http_request();
@@ -1,6 +1,19 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include "../include/mistral.h"
+#include "../src/http_client.h"
+#include "../src/mistral_alloc.h"
+#include "../src/mistral_arena.h"
+#include "../src/mistral_balancer.h"
+#include "../src/mistral_breaker.h"
+#include "../src/mistral_coalescer.h"
+#include "../src/mistral_context.h"
+#include "../src/mistral_fallback.h"
+#include "../src/mistral_hedge.h"
+#include "../src/mistral_helpers.h"
+#include "../src/mistral_limiter.h"
+#include "../src/mistral_utils.h"
+#include "test_server.h"
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -233,12 +246,15 @@ int test_chat_completions_invalid_params(void) {
 
   int result = mistral_chat_completions(NULL, messages, 1, &response);
   assert(result != 0);
+  mistral_response_free(&response);
 
   result = mistral_chat_completions(config, NULL, 1, &response);
   assert(result != 0);
+  mistral_response_free(&response);
 
   result = mistral_chat_completions(config, messages, 0, &response);
   assert(result != 0);
+  mistral_response_free(&response);
 
   result = mistral_chat_completions(config, messages, 1, NULL);
   assert(result != 0);
@@ -274,6 +290,3002 @@ int test_multiple_messages(void) {
   return 0;
 }
 
+static void count_progress(size_t completed, size_t total, size_t index,
+                           const mistral_response_t *result,
+                           void *user_data) {
+  size_t *calls = (size_t *)user_data;
+
+  assert(completed <= total);
+  assert(index < total);
+  assert(result != NULL);
+  (*calls)++;
+}
+
+int test_batch_invalid_params(void) {
+  printf("TEST - Batch with invalid params\n");
+
+  mistral_config_t *config = mistral_config_create("test");
+  mistral_message_t messages[] = {{.role = "user", .content = "test"}};
+  mistral_batch_item_t items[] = {{.messages = messages, .message_count = 1}};
+  mistral_response_t results[1];
+
+  printf("...init - ok\n");
+
+  assert(mistral_chat_completions_batch(NULL, items, 1, 1, results, NULL) != 0);
+  assert(mistral_chat_completions_batch(config, NULL, 1, 1, results, NULL) !=
+         0);
+  assert(mistral_chat_completions_batch(config, items, 0, 1, results, NULL) !=
+         0);
+  assert(mistral_chat_completions_batch(config, items, 1, 0, results, NULL) !=
+         0);
+  assert(mistral_chat_completions_batch(config, items, 1, 1, NULL, NULL) != 0);
+  printf("...rejected - ok\n");
+
+  /* more than MISTRAL_BATCH_MAX_IN_FLIGHT is capped, not rejected */
+  items[0].message_count = 0;
+  assert(mistral_chat_completions_batch(config, items, 1,
+                                        MISTRAL_BATCH_MAX_IN_FLIGHT + 1,
+                                        results, NULL) != 0);
+  assert(results[0].error_code == MISTRAL_ERR_INVALID_PARAM);
+  mistral_response_free(&results[0]);
+  printf("...max_in_flight capped - ok\n");
+
+  mistral_config_free(config);
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_batch_error_isolation(void) {
+  printf("TEST - Batch keeps results in input order\n");
+
+  mistral_config_t *config = mistral_config_create("test");
+  mistral_batch_item_t items[8];
+  mistral_response_t results[8];
+  mistral_batch_options_t options = {0};
+  size_t progress_calls = 0;
+  size_t i;
+
+  assert(config != NULL);
+
+  /* every item is invalid, so nothing goes to the network */
+  for (i = 0; i < 8; i++) {
+    items[i].messages = NULL;
+    items[i].message_count = i;
+  }
+
+  options.on_progress = count_progress;
+  options.user_data = &progress_calls;
+
+  printf("...init - ok\n");
+
+  assert(mistral_chat_completions_batch(config, items, 8, 3, results,
+                                        &options) != 0);
+  assert(progress_calls == 8);
+
+  for (i = 0; i < 8; i++) {
+    assert(results[i].error_code == MISTRAL_ERR_INVALID_PARAM);
+    assert(results[i].error_message != NULL);
+    mistral_response_free(&results[i]);
+  }
+
+  mistral_config_free(config);
+  printf("...cleanup - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_batch_reuse(void) {
+  printf("TEST - Batch with reused responses\n");
+
+  test_server_t server;
+  mistral_backend_pool_t *pool = NULL;
+  mistral_config_t *config = NULL;
+  mistral_cancel_token_t *token = mistral_cancel_token_create();
+  mistral_message_t message = {"user", "hello"};
+  mistral_batch_item_t items[4];
+  mistral_response_t results[4];
+  mistral_response_arena_t *arenas[4];
+  size_t i;
+
+  assert(token != NULL);
+  assert(test_server_start(&server) == 0);
+  config = test_server_config(&server, &pool);
+  assert(config != NULL);
+  config->reuse_responses = 1;
+  memset(results, 0, sizeof(results));
+  for (i = 0; i < 4; i++) {
+    items[i].messages = &message;
+    items[i].message_count = 1;
+  }
+
+  assert(mistral_chat_completions_batch(config, items, 4, 2, results, NULL) ==
+         0);
+  for (i = 0; i < 4; i++) {
+    assert(results[i].content != NULL && results[i].arena != NULL);
+    arenas[i] = results[i].arena;
+    mistral_response_reset(&results[i]);
+  }
+  printf("...first batch - ok\n");
+
+  /* the results of the last batch go back in and keep their arenas */
+  assert(mistral_chat_completions_batch(config, items, 4, 2, results, NULL) ==
+         0);
+  for (i = 0; i < 4; i++) {
+    assert(results[i].content != NULL && results[i].arena == arenas[i]);
+  }
+  assert(test_server_requests(&server) == 8);
+  printf("...arenas kept - ok\n");
+
+  /* items never started reuse them too, their messages are freed later */
+  mistral_cancel_token_cancel(token);
+  config->cancel_token = token;
+  assert(mistral_chat_completions_batch(config, items, 4, 2, results, NULL) !=
+         0);
+  for (i = 0; i < 4; i++) {
+    assert(results[i].error_code == MISTRAL_ERR_CANCELLED);
+    assert(results[i].content == NULL && results[i].arena == arenas[i]);
+  }
+  mistral_cancel_token_reset(token);
+  assert(mistral_chat_completions_batch(config, items, 4, 2, results, NULL) ==
+         0);
+  for (i = 0; i < 4; i++) {
+    assert(results[i].error_message == NULL && results[i].arena == arenas[i]);
+    mistral_response_free(&results[i]);
+  }
+  printf("...cancelled batch - ok\n");
+
+  mistral_cancel_token_free(token);
+  mistral_config_free(config);
+  mistral_backend_pool_free(pool);
+  test_server_stop(&server);
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_rate_limiter(void) {
+  printf("TEST - Rate limiter create/acquire\n");
+
+  assert(mistral_rate_limiter_create(0.0, 1) == NULL);
+  assert(mistral_rate_limiter_create(10.0, 0) == NULL);
+
+  mistral_rate_limiter_t *limiter = mistral_rate_limiter_create(1000.0, 2);
+  assert(limiter != NULL);
+  printf("...init - ok\n");
+
+  mistral_rate_limiter_acquire(limiter);
+  mistral_rate_limiter_acquire(limiter);
+  mistral_rate_limiter_acquire(limiter);
+  mistral_rate_limiter_acquire(NULL);
+  printf("...acquire - ok\n");
+
+  mistral_rate_limiter_free(limiter);
+  printf("...cleanup - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_coalescer_stats(void) {
+  printf("TEST - Coalescer create/stats\n");
+
+  mistral_coalescer_stats_t stats = {1, 1};
+  mistral_coalescer_t *coalescer = mistral_coalescer_create();
+  assert(coalescer != NULL);
+  printf("...init - ok\n");
+
+  mistral_coalescer_get_stats(coalescer, &stats);
+  assert(stats.requests == 0);
+  assert(stats.coalesced == 0);
+
+  mistral_config_t *config = mistral_config_create("test");
+  assert(config != NULL);
+  assert(config->coalescer == NULL);
+  config->coalescer = coalescer;
+  assert(mistral_config_validate(config) == 0);
+
+  mistral_config_free(config);
+  mistral_coalescer_free(coalescer);
+  mistral_coalescer_free(NULL);
+  printf("...cleanup - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+typedef struct {
+  mistral_coalescer_t *coalescer;
+  const char *url;
+  const char *body;
+  http_response_t response;
+  int ret;
+} coalesced_post_t;
+
+static void *coalesced_post(void *arg) {
+  coalesced_post_t *post = (coalesced_post_t *)arg;
+  const char *headers[] = {"Content-Type: application/json", NULL};
+
+  memset(&post->response, 0, sizeof(post->response));
+  post->ret = coalescer_http_post(post->coalescer, post->url, headers,
+                                  post->body, NULL, &post->response);
+  return NULL;
+}
+
+int test_coalescer_threads(void) {
+  printf("TEST - Coalescer with concurrent requests\n");
+
+  test_server_t server;
+  mistral_coalescer_t *coalescer = mistral_coalescer_create();
+  mistral_coalescer_stats_t stats;
+  coalesced_post_t posts[4];
+  pthread_t threads[4];
+  const char *distinct[4] = {"{\"n\":1}", "{\"n\":2}", "{\"n\":3}",
+                             "{\"n\":4}"};
+  char url[96];
+  int seen = 0;
+  int i;
+  assert(coalescer != NULL);
+  assert(test_server_start(&server) == 0);
+  snprintf(url, sizeof(url), "%s/chat/completions", server.url);
+  server.delay_ms = 200;
+
+  /* the followers join while the first request is still in flight */
+  for (i = 0; i < 4; i++) {
+    posts[i].coalescer = coalescer;
+    posts[i].url = url;
+    posts[i].body = "{\"same\":true}";
+    assert(pthread_create(&threads[i], NULL, coalesced_post, &posts[i]) == 0);
+    test_server_sleep_ms(20);
+  }
+  for (i = 0; i < 4; i++) {
+    pthread_join(threads[i], NULL);
+    assert(posts[i].ret == 0);
+    assert(posts[i].response.http_code == 200);
+    assert(strstr(posts[i].response.data, "\"reply 1\"") != NULL);
+    http_response_free(&posts[i].response);
+  }
+  assert(test_server_requests(&server) == 1);
+  mistral_coalescer_get_stats(coalescer, &stats);
+  assert(stats.requests == 4 && stats.coalesced == 3);
+  printf("...identical requests coalesced - ok\n");
+
+  for (i = 0; i < 4; i++) {
+    posts[i].body = distinct[i];
+    assert(pthread_create(&threads[i], NULL, coalesced_post, &posts[i]) == 0);
+  }
+  for (i = 0; i < 4; i++) {
+    char reply[16];
+    int n;
+    pthread_join(threads[i], NULL);
+    assert(posts[i].ret == 0);
+    for (n = 2; n <= 5; n++) {
+      snprintf(reply, sizeof(reply), "\"reply %d\"", n);
+      if (strstr(posts[i].response.data, reply) != NULL) {
+        seen |= 1 << n;
+      }
+    }
+    http_response_free(&posts[i].response);
+  }
+  assert(seen == (1 << 2 | 1 << 3 | 1 << 4 | 1 << 5));
+  assert(test_server_requests(&server) == 5);
+  mistral_coalescer_get_stats(coalescer, &stats);
+  assert(stats.requests == 8 && stats.coalesced == 3);
+  printf("...distinct requests sent apart - ok\n");
+
+  test_server_stop(&server);
+  mistral_coalescer_free(coalescer);
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+typedef struct {
+  const mistral_config_t *config;
+  mistral_response_t response;
+  int ret;
+} chat_call_t;
+
+static void *chat_in_thread(void *arg) {
+  chat_call_t *call = (chat_call_t *)arg;
+  mistral_message_t message = {"user", "hello"};
+
+  memset(&call->response, 0, sizeof(call->response));
+  call->ret = mistral_chat_completions(call->config, &message, 1,
+                                       &call->response);
+  return NULL;
+}
+
+int test_coalescer_outcomes(void) {
+  printf("TEST - Coalesced outcomes are counted once\n");
+
+  test_server_t server;
+  test_server_t other;
+  mistral_backend_pool_t *pool = NULL;
+  mistral_config_t *config = NULL;
+  mistral_coalescer_t *coalescer = mistral_coalescer_create();
+  mistral_circuit_breaker_t *breaker =
+      mistral_circuit_breaker_create(0.5, 4, 10000, 0);
+  mistral_hedge_policy_t *policy =
+      mistral_hedge_policy_create(5000, 95.0, 100.0);
+  mistral_hedge_stats_t stats;
+  chat_call_t calls[4];
+  pthread_t threads[4];
+  const char *endpoint = MISTRAL_BASE_API "/chat/completions";
+  int i;
+
+  assert(coalescer != NULL && breaker != NULL && policy != NULL);
+  assert(test_server_start(&server) == 0);
+  assert(test_server_start(&other) == 0);
+  config = test_server_config(&server, &pool);
+  assert(config != NULL);
+  assert(mistral_backend_pool_add(pool, other.url, "test", 1) == 1);
+  config->temperature = 0.0;
+  config->max_retries = 0;
+  config->coalescer = coalescer;
+  config->circuit_breaker = breaker;
+  config->hedge_policy = policy;
+  server.delay_ms = 200;
+  other.delay_ms = 200;
+
+  /* callers the pool would spread over two backends still share one send */
+  for (i = 0; i < 4; i++) {
+    calls[i].config = config;
+    assert(pthread_create(&threads[i], NULL, chat_in_thread, &calls[i]) == 0);
+    test_server_sleep_ms(20);
+  }
+  for (i = 0; i < 4; i++) {
+    pthread_join(threads[i], NULL);
+    assert(calls[i].ret == 0);
+    mistral_response_free(&calls[i].response);
+  }
+  assert(test_server_requests(&server) + test_server_requests(&other) == 1);
+  printf("...one send across backends - ok\n");
+
+  /* one upstream 503 shared by four callers is one failure, not four */
+  pthread_mutex_lock(&server.lock);
+  server.status = 503;
+  pthread_mutex_unlock(&server.lock);
+  pthread_mutex_lock(&other.lock);
+  other.status = 503;
+  pthread_mutex_unlock(&other.lock);
+  for (i = 0; i < 4; i++) {
+    assert(pthread_create(&threads[i], NULL, chat_in_thread, &calls[i]) == 0);
+    test_server_sleep_ms(20);
+  }
+  for (i = 0; i < 4; i++) {
+    pthread_join(threads[i], NULL);
+    assert(calls[i].ret != 0);
+    assert(calls[i].response.error_code == MISTRAL_ERR_SERVER);
+    mistral_response_free(&calls[i].response);
+  }
+  assert(test_server_requests(&server) + test_server_requests(&other) == 2);
+  assert(mistral_circuit_breaker_get_state(breaker, endpoint, config->model) ==
+         MISTRAL_CIRCUIT_CLOSED);
+  printf("...breaker saw one failure - ok\n");
+
+  /* the hedge budget grows with sends, not with callers */
+  mistral_hedge_policy_get_stats(policy, &stats);
+  assert(stats.requests == 2);
+  printf("...hedge policy saw two sends - ok\n");
+
+  mistral_config_free(config);
+  mistral_backend_pool_free(pool);
+  mistral_hedge_policy_free(policy);
+  mistral_circuit_breaker_free(breaker);
+  mistral_coalescer_free(coalescer);
+  test_server_stop(&other);
+  test_server_stop(&server);
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_semantic_cache_create(void) {
+  printf("TEST - Semantic cache create/stats\n");
+
+  mistral_config_t *config = mistral_config_create("test");
+  mistral_semantic_cache_stats_t stats;
+  assert(config != NULL);
+
+  assert(mistral_semantic_cache_create(NULL, 0.9, 16) == NULL);
+  assert(mistral_semantic_cache_create(config, 0.0, 16) == NULL);
+  assert(mistral_semantic_cache_create(config, 1.5, 16) == NULL);
+  assert(mistral_semantic_cache_create(config, 0.9, 0) == NULL);
+
+  mistral_semantic_cache_t *cache =
+      mistral_semantic_cache_create(config, 0.9, 16);
+  assert(cache != NULL);
+  printf("...init - ok\n");
+
+  memset(&stats, 0xff, sizeof(stats));
+  mistral_semantic_cache_get_stats(cache, &stats);
+  assert(stats.lookups == 0);
+  assert(stats.hits == 0);
+  assert(stats.entries == 0);
+  assert(stats.saved_ms == 0.0);
+
+  mistral_semantic_cache_free(cache);
+  mistral_config_free(config);
+  printf("...cleanup - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+typedef struct {
+  mistral_semantic_cache_t *cache;
+  unsigned long hits;
+  int calls;
+} audit_state_t;
+
+/* reads the stats, which takes the cache lock */
+static void audit_hit(const char *query, const char *matched_query,
+                      double similarity, void *user_data) {
+  audit_state_t *state = (audit_state_t *)user_data;
+  mistral_semantic_cache_stats_t stats;
+
+  assert(strcmp(query, matched_query) == 0);
+  assert(similarity > 0.99);
+  mistral_semantic_cache_get_stats(state->cache, &stats);
+  state->hits = stats.hits;
+  state->calls++;
+}
+
+int test_semantic_cache_hit(void) {
+  printf("TEST - Semantic cache hit\n");
+
+  test_server_t server;
+  mistral_backend_pool_t *pool = NULL;
+  mistral_config_t *config = NULL;
+  mistral_semantic_cache_t *cache = NULL;
+  mistral_semantic_cache_stats_t stats;
+  mistral_message_t message = {"user", "what is a mutex?"};
+  mistral_response_t response = {0};
+  audit_state_t audit = {0};
+  assert(test_server_start(&server) == 0);
+  config = test_server_config(&server, &pool);
+  assert(config != NULL);
+  cache = mistral_semantic_cache_create(config, 0.9, 16);
+  assert(cache != NULL);
+  audit.cache = cache;
+  mistral_semantic_cache_set_audit(cache, audit_hit, &audit);
+
+  /* the stored vector outlives the embeddings response it came from */
+  assert(mistral_semantic_chat_completions(cache, config, &message, 1,
+                                           &response) == 0);
+  assert(strcmp(response.content, "reply 2") == 0);
+  mistral_response_free(&response);
+  assert(mistral_semantic_chat_completions(cache, config, &message, 1,
+                                           &response) == 0);
+  assert(strcmp(response.content, "reply 2") == 0);
+  mistral_response_free(&response);
+  assert(test_server_requests(&server) == 3);
+
+  mistral_semantic_cache_get_stats(cache, &stats);
+  assert(stats.hits == 1 && stats.misses == 1 && stats.entries == 1);
+  printf("...hit from stored vector - ok\n");
+
+  assert(audit.calls == 1 && audit.hits == 1);
+  printf("...audit outside the lock - ok\n");
+
+  /* a reply capped at another length is not the same answer */
+  config->max_tokens = 16;
+  assert(mistral_semantic_chat_completions(cache, config, &message, 1,
+                                           &response) == 0);
+  mistral_response_free(&response);
+  config->temperature += 0.5;
+  assert(mistral_semantic_chat_completions(cache, config, &message, 1,
+                                           &response) == 0);
+  mistral_response_free(&response);
+  mistral_semantic_cache_get_stats(cache, &stats);
+  assert(stats.hits == 1 && stats.misses == 3 && stats.entries == 3);
+  assert(test_server_requests(&server) == 7);
+  printf("...sampling settings in the context - ok\n");
+
+  mistral_semantic_cache_free(cache);
+  mistral_config_free(config);
+  mistral_backend_pool_free(pool);
+  test_server_stop(&server);
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_adaptive_limiter_create(void) {
+  printf("TEST - Adaptive limiter create/stats\n");
+
+  mistral_adaptive_limiter_stats_t stats;
+
+  assert(mistral_adaptive_limiter_create(4, 0, 8) == NULL);
+  assert(mistral_adaptive_limiter_create(4, 8, 2) == NULL);
+  assert(mistral_adaptive_limiter_create(16, 1, 8) == NULL);
+
+  mistral_adaptive_limiter_t *limiter = mistral_adaptive_limiter_create(4, 1, 8);
+  assert(limiter != NULL);
+  printf("...init - ok\n");
+
+  assert(mistral_adaptive_limiter_get_stats(
+             limiter, MISTRAL_BASE_API "/chat/completions", &stats) != 0);
+  assert(mistral_adaptive_limiter_get_stats(NULL, "x", &stats) != 0);
+
+  mistral_adaptive_limiter_free(limiter);
+  mistral_adaptive_limiter_free(NULL);
+  printf("...cleanup - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+typedef struct {
+  mistral_adaptive_limiter_t *limiter;
+  limiter_endpoint_t *slot;
+  int acquired;
+} queued_acquire_t;
+
+static void *acquire_in_thread(void *arg) {
+  queued_acquire_t *queued = (queued_acquire_t *)arg;
+
+  assert(limiter_acquire(queued->limiter, "ep", 0.0, NULL, &queued->slot) ==
+         0);
+  queued->acquired = 1;
+  return NULL;
+}
+
+/* one attempt on "ep" with the given outcome */
+static void limiter_sample(mistral_adaptive_limiter_t *limiter,
+                           long http_code, double latency_ms) {
+  limiter_endpoint_t *slot = NULL;
+
+  assert(limiter_acquire(limiter, "ep", 0.0, NULL, &slot) == 0);
+  limiter_release(limiter, slot, http_code, latency_ms);
+}
+
+int test_adaptive_limiter_aimd(void) {
+  printf("TEST - Adaptive limiter AIMD and queueing\n");
+
+  mistral_adaptive_limiter_t *limiter = mistral_adaptive_limiter_create(2, 1, 4);
+  mistral_adaptive_limiter_stats_t stats;
+  limiter_endpoint_t *first = NULL;
+  limiter_endpoint_t *second = NULL;
+  limiter_endpoint_t *third = NULL;
+  queued_acquire_t queued = {0};
+  pthread_t thread;
+  int i;
+  assert(limiter != NULL);
+
+  assert(limiter_acquire(limiter, "ep", 0.0, NULL, &first) == 0);
+  assert(limiter_acquire(limiter, "ep", 0.0, NULL, &second) == 0);
+  assert(limiter_acquire(limiter, "ep", monotonic_ms() + 20.0, NULL,
+                         &third) != 0);
+  assert(mistral_adaptive_limiter_get_stats(limiter, "ep", &stats) == 0);
+  assert(stats.limit == 2.0 && stats.in_flight == 2);
+  printf("...limit caps in flight - ok\n");
+
+  /* additive: 1/limit per fast success, up to max_limit */
+  limiter_release(limiter, first, 200, 10.0);
+  limiter_release(limiter, second, 200, 10.0);
+  mistral_adaptive_limiter_get_stats(limiter, "ep", &stats);
+  assert(stats.limit > 2.89 && stats.limit < 2.91);
+  assert(stats.increases == 2 && stats.in_flight == 0);
+  assert(stats.baseline_latency_ms == 10.0);
+  for (i = 0; i < 20; i++) {
+    limiter_sample(limiter, 200, 10.0);
+  }
+  mistral_adaptive_limiter_get_stats(limiter, "ep", &stats);
+  assert(stats.limit == 4.0);
+  printf("...additive increase - ok\n");
+
+  /* recent latency well over baseline stops growth */
+  limiter_sample(limiter, 429, 10.0);
+  mistral_adaptive_limiter_get_stats(limiter, "ep", &stats);
+  assert(stats.limit == 2.0 && stats.decreases == 1);
+  i = (int)stats.increases;
+  limiter_sample(limiter, 200, 100.0);
+  mistral_adaptive_limiter_get_stats(limiter, "ep", &stats);
+  assert(stats.limit == 2.0 && stats.increases == (unsigned long)i);
+  printf("...latency blocks increase - ok\n");
+
+  /* multiplicative: one cut per round trip, never under min_limit */
+  limiter_sample(limiter, 503, 10.0);
+  mistral_adaptive_limiter_get_stats(limiter, "ep", &stats);
+  assert(stats.limit == 2.0 && stats.decreases == 1);
+  test_server_sleep_ms(60);
+  limiter_sample(limiter, 0, 10.0);
+  mistral_adaptive_limiter_get_stats(limiter, "ep", &stats);
+  assert(stats.limit == 1.0 && stats.decreases == 2);
+  test_server_sleep_ms(60);
+  limiter_sample(limiter, 503, 10.0);
+  mistral_adaptive_limiter_get_stats(limiter, "ep", &stats);
+  assert(stats.limit == 1.0 && stats.decreases == 2);
+  printf("...multiplicative decrease - ok\n");
+
+  /* a waiter is let in by the release of the only slot */
+  queued.limiter = limiter;
+  assert(limiter_acquire(limiter, "ep", 0.0, NULL, &first) == 0);
+  assert(pthread_create(&thread, NULL, acquire_in_thread, &queued) == 0);
+  test_server_sleep_ms(30);
+  mistral_adaptive_limiter_get_stats(limiter, "ep", &stats);
+  assert(stats.in_flight == 1);
+  limiter_release(limiter, first, 200, 10.0);
+  pthread_join(thread, NULL);
+  assert(queued.acquired == 1 && queued.slot != NULL);
+  mistral_adaptive_limiter_get_stats(limiter, "ep", &stats);
+  assert(stats.in_flight == 1);
+  limiter_release(limiter, queued.slot, 200, 10.0);
+  printf("...queued acquire - ok\n");
+
+  mistral_adaptive_limiter_free(limiter);
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_hedge_policy_create(void) {
+  printf("TEST - Hedge policy create/stats\n");
+
+  mistral_hedge_stats_t stats;
+
+  assert(mistral_hedge_policy_create(-1, 95.0, 5.0) == NULL);
+  assert(mistral_hedge_policy_create(0, 0.0, 5.0) == NULL);
+  assert(mistral_hedge_policy_create(0, 95.0, 0.0) == NULL);
+
+  mistral_hedge_policy_t *learned = mistral_hedge_policy_create(0, 95.0, 5.0);
+  mistral_hedge_policy_t *fixed = mistral_hedge_policy_create(250, 95.0, 5.0);
+  assert(learned != NULL);
+  assert(fixed != NULL);
+  printf("...init - ok\n");
+
+  mistral_hedge_policy_get_stats(learned, &stats);
+  assert(stats.requests == 0);
+  assert(stats.hedges == 0);
+  assert(stats.hedge_after_ms == 0.0);
+
+  mistral_hedge_policy_get_stats(fixed, &stats);
+  assert(stats.hedge_after_ms == 250.0);
+
+  mistral_hedge_policy_free(learned);
+  mistral_hedge_policy_free(fixed);
+  mistral_hedge_policy_free(NULL);
+  printf("...cleanup - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_hedge_budget_and_delay(void) {
+  printf("TEST - Hedge budget and learned delay\n");
+
+  mistral_hedge_policy_t *fixed = mistral_hedge_policy_create(100, 95.0, 10.0);
+  mistral_hedge_policy_t *learned = mistral_hedge_policy_create(0, 90.0, 50.0);
+  mistral_hedge_policy_t *tail = NULL;
+  mistral_hedge_stats_t stats;
+  http_response_t response = {0};
+  int after_ms = 0;
+  int i;
+  assert(fixed != NULL && learned != NULL);
+
+  /* 10%: the tenth request may hedge, its reservation blocks the next */
+  for (i = 1; i <= 9; i++) {
+    assert(hedge_begin(fixed) == 0);
+    hedge_end(fixed, 0, &response);
+  }
+  assert(hedge_begin(fixed) == 100);
+  assert(hedge_begin(fixed) == 0);
+  hedge_end(fixed, 0, &response);
+  response.hedged = 1;
+  response.hedge_won = 1;
+  hedge_end(fixed, 100, &response);
+  memset(&response, 0, sizeof(response));
+  for (i = 12; i <= 19; i++) {
+    assert(hedge_begin(fixed) == 0);
+    hedge_end(fixed, 0, &response);
+  }
+  assert(hedge_begin(fixed) == 100);
+  hedge_end(fixed, 100, &response);
+  assert(hedge_begin(fixed) == 100);
+  hedge_end(fixed, 100, &response);
+  mistral_hedge_policy_get_stats(fixed, &stats);
+  assert(stats.requests == 21);
+  assert(stats.hedges == 1 && stats.hedge_wins == 1);
+  assert(stats.hedge_after_ms == 100.0);
+  printf("...budget - ok\n");
+
+  /* no delay until enough first-byte samples are in */
+  for (i = 1; i <= 19; i++) {
+    assert(hedge_begin(learned) == 0);
+    response.ttfb_ms = 10.0 * i;
+    hedge_end(learned, 0, &response);
+  }
+  mistral_hedge_policy_get_stats(learned, &stats);
+  assert(stats.hedge_after_ms == 0.0);
+  response.ttfb_ms = 200.0;
+  hedge_end(learned, 0, &response);
+  mistral_hedge_policy_get_stats(learned, &stats);
+  assert(stats.hedge_after_ms == 190.0);
+  assert(hedge_begin(learned) == 190);
+  hedge_end(learned, 190, &response);
+  printf("...learned percentile - ok\n");
+
+  /* the window keeps the latest samples only */
+  response.ttfb_ms = 5.0;
+  for (i = 0; i < 128; i++) {
+    hedge_end(learned, 0, &response);
+  }
+  mistral_hedge_policy_get_stats(learned, &stats);
+  assert(stats.hedge_after_ms == 5.0);
+  printf("...sample window - ok\n");
+
+  /* a won hedge took hedge_after_ms plus its own first byte */
+  tail = mistral_hedge_policy_create(0, 50.0, 100.0);
+  assert(tail != NULL);
+  response.ttfb_ms = 10.0;
+  for (i = 0; i < 20; i++) {
+    assert(hedge_begin(tail) == 0);
+    hedge_end(tail, 0, &response);
+  }
+  response.hedged = 1;
+  response.hedge_won = 1;
+  for (i = 0; i < 21; i++) {
+    after_ms = hedge_begin(tail);
+    assert(after_ms >= 10);
+    hedge_end(tail, after_ms, &response);
+  }
+  mistral_hedge_policy_get_stats(tail, &stats);
+  assert(stats.hedge_wins == 21 && stats.hedge_after_ms >= 20.0);
+  printf("...won hedges timed from the first send - ok\n");
+
+  mistral_hedge_policy_free(tail);
+  mistral_hedge_policy_free(fixed);
+  mistral_hedge_policy_free(learned);
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_hedge_end_to_end(void) {
+  printf("TEST - Hedged request through the transfer\n");
+
+  test_server_t server;
+  mistral_backend_pool_t *pool = NULL;
+  mistral_config_t *config = NULL;
+  mistral_hedge_policy_t *policy = mistral_hedge_policy_create(0, 99.0, 100.0);
+  mistral_hedge_stats_t stats;
+  mistral_message_t message = {"user", "hello"};
+  mistral_response_t response = {0};
+  http_response_t primed = {0};
+  double started = 0.0;
+  double elapsed = 0.0;
+  int aborted = 0;
+  int waited = 0;
+  int i;
+
+  assert(policy != NULL);
+  assert(test_server_start(&server) == 0);
+  config = test_server_config(&server, &pool);
+  assert(config != NULL);
+  config->temperature = 0.0;
+  config->hedge_policy = policy;
+
+  /* learned delay of 40 ms, so the duplicate goes out 40 ms in */
+  primed.ttfb_ms = 40.0;
+  for (i = 0; i < 20; i++) {
+    assert(hedge_begin(policy) == 0);
+    hedge_end(policy, 0, &primed);
+  }
+  mistral_hedge_policy_get_stats(policy, &stats);
+  assert(stats.hedge_after_ms == 40.0);
+
+  /* the first send waits 400 ms, the hedge is answered right away */
+  pthread_mutex_lock(&server.lock);
+  server.delay_ms = 400;
+  server.slow_until = 1;
+  pthread_mutex_unlock(&server.lock);
+  started = monotonic_ms();
+  assert(mistral_chat_completions(config, &message, 1, &response) == 0);
+  elapsed = monotonic_ms() - started;
+  assert(strcmp(response.content, "reply 2") == 0);
+  assert(elapsed >= 40.0 && elapsed < 400.0);
+  mistral_response_free(&response);
+  mistral_hedge_policy_get_stats(policy, &stats);
+  assert(stats.hedges == 1 && stats.hedge_wins == 1);
+  printf("...hedge won - ok\n");
+
+  /* at the 99th percentile the new sample is the largest: 40 ms + ttfb */
+  assert(stats.hedge_after_ms > 40.0);
+  printf("...timed from the first send - ok\n");
+
+  /* the slow transfer was dropped, not waited for */
+  do {
+    test_server_sleep_ms(5);
+    pthread_mutex_lock(&server.lock);
+    aborted = server.aborted;
+    pthread_mutex_unlock(&server.lock);
+  } while (aborted == 0 && waited++ < 200);
+  assert(aborted == 1 && test_server_requests(&server) == 2);
+  printf("...losing transfer aborted - ok\n");
+
+  mistral_config_free(config);
+  mistral_backend_pool_free(pool);
+  mistral_hedge_policy_free(policy);
+  test_server_stop(&server);
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_circuit_breaker_create(void) {
+  printf("TEST - Circuit breaker create/state\n");
+
+  assert(mistral_circuit_breaker_create(0.0, 10, 1000, 0) == NULL);
+  assert(mistral_circuit_breaker_create(0.5, 0, 1000, 0) == NULL);
+  assert(mistral_circuit_breaker_create(0.5, 10, 0, 0) == NULL);
+  assert(mistral_circuit_breaker_create(0.5, 10, 1000, -1) == NULL);
+
+  mistral_circuit_breaker_t *breaker =
+      mistral_circuit_breaker_create(0.5, 10, 1000, 5000);
+  assert(breaker != NULL);
+  printf("...init - ok\n");
+
+  assert(mistral_circuit_breaker_get_state(
+             breaker, MISTRAL_BASE_API "/chat/completions",
+             "mistral-tiny") == MISTRAL_CIRCUIT_CLOSED);
+  assert(strcmp(mistral_error_string(MISTRAL_ERR_CIRCUIT_OPEN),
+                "circuit open") == 0);
+
+  mistral_circuit_breaker_free(breaker);
+  mistral_circuit_breaker_free(NULL);
+  printf("...cleanup - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_circuit_breaker_transitions(void) {
+  printf("TEST - Circuit breaker transitions\n");
+
+  mistral_circuit_breaker_t *breaker =
+      mistral_circuit_breaker_create(0.5, 4, 30, 100);
+  const char *endpoint = MISTRAL_BASE_API "/chat/completions";
+  int probe = 0;
+  int other = 0;
+  int i;
+  assert(breaker != NULL);
+
+  /* half the window failing opens the circuit, not less */
+  for (i = 0; i < 4; i++) {
+    assert(breaker_allow(breaker, endpoint, "m", &probe) == 1);
+    breaker_record(breaker, endpoint, "m", probe, i == 0 ? 503 : 200, 1.0);
+  }
+  assert(mistral_circuit_breaker_get_state(breaker, endpoint, "m") ==
+         MISTRAL_CIRCUIT_CLOSED);
+  assert(breaker_allow(breaker, endpoint, "m", &probe) == 1);
+  breaker_record(breaker, endpoint, "m", probe, 0, 1.0);
+  assert(mistral_circuit_breaker_get_state(breaker, endpoint, "m") ==
+         MISTRAL_CIRCUIT_CLOSED);
+  assert(breaker_allow(breaker, endpoint, "m", &probe) == 1);
+  breaker_record(breaker, endpoint, "m", probe, 200, 500.0);
+  assert(mistral_circuit_breaker_get_state(breaker, endpoint, "m") ==
+         MISTRAL_CIRCUIT_OPEN);
+  assert(breaker_allow(breaker, endpoint, "m", &probe) == 0);
+  assert(mistral_circuit_breaker_get_state(breaker, endpoint, "other") ==
+         MISTRAL_CIRCUIT_CLOSED);
+  printf("...closed to open - ok\n");
+
+  /* after open_ms a single probe goes out */
+  test_server_sleep_ms(40);
+  assert(mistral_circuit_breaker_get_state(breaker, endpoint, "m") ==
+         MISTRAL_CIRCUIT_HALF_OPEN);
+  assert(breaker_allow(breaker, endpoint, "m", &probe) == 1 && probe == 1);
+  assert(breaker_allow(breaker, endpoint, "m", &other) == 0 && other == 0);
+  breaker_release(breaker, endpoint, "m", probe);
+  assert(breaker_allow(breaker, endpoint, "m", &probe) == 1 && probe == 1);
+  printf("...half-open probe released - ok\n");
+
+  /* an attempt from before the circuit opened cannot end the probe */
+  breaker_release(breaker, endpoint, "m", 0);
+  breaker_record(breaker, endpoint, "m", 0, 200, 1.0);
+  assert(mistral_circuit_breaker_get_state(breaker, endpoint, "m") ==
+         MISTRAL_CIRCUIT_HALF_OPEN);
+  assert(breaker_allow(breaker, endpoint, "m", &other) == 0);
+  printf("...probe owned by its taker - ok\n");
+
+  /* a failed probe reopens, a good one closes with a fresh window */
+  breaker_record(breaker, endpoint, "m", probe, 502, 1.0);
+  assert(mistral_circuit_breaker_get_state(breaker, endpoint, "m") ==
+         MISTRAL_CIRCUIT_OPEN);
+  test_server_sleep_ms(40);
+  assert(breaker_allow(breaker, endpoint, "m", &probe) == 1);
+  breaker_record(breaker, endpoint, "m", probe, 200, 1.0);
+  assert(mistral_circuit_breaker_get_state(breaker, endpoint, "m") ==
+         MISTRAL_CIRCUIT_CLOSED);
+  /* the old failures are gone, a full new window is needed to reopen */
+  for (i = 0; i < 3; i++) {
+    assert(breaker_allow(breaker, endpoint, "m", &probe) == 1);
+    breaker_record(breaker, endpoint, "m", probe, 503, 1.0);
+  }
+  assert(mistral_circuit_breaker_get_state(breaker, endpoint, "m") ==
+         MISTRAL_CIRCUIT_CLOSED);
+  assert(breaker_allow(breaker, endpoint, "m", &probe) == 1);
+  breaker_record(breaker, endpoint, "m", probe, 503, 1.0);
+  assert(mistral_circuit_breaker_get_state(breaker, endpoint, "m") ==
+         MISTRAL_CIRCUIT_OPEN);
+  printf("...half-open to closed - ok\n");
+
+  mistral_circuit_breaker_free(breaker);
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+typedef struct {
+  mistral_circuit_breaker_t *breaker;
+  const char *model;
+} open_later_t;
+
+/* opens the circuit while the first attempt is still on the wire */
+static void *open_circuit_later(void *arg) {
+  open_later_t *later = (open_later_t *)arg;
+
+  test_server_sleep_ms(30);
+  breaker_record(later->breaker, MISTRAL_BASE_API "/chat/completions",
+                 later->model, 0, 503, 1.0);
+  return NULL;
+}
+
+int test_circuit_breaker_early_exit(void) {
+  printf("TEST - Circuit breaker early exit\n");
+
+  test_server_t server;
+  mistral_backend_pool_t *pool = NULL;
+  mistral_config_t *config = NULL;
+  mistral_message_t message = {"user", "hello"};
+  mistral_response_t response = {0};
+  open_later_t later;
+  pthread_t thread;
+  const char *endpoint = MISTRAL_BASE_API "/chat/completions";
+  assert(test_server_start(&server) == 0);
+  config = test_server_config(&server, &pool);
+  assert(config != NULL);
+  later.breaker = mistral_circuit_breaker_create(1.0, 1, 20, 0);
+  later.model = config->model;
+  assert(later.breaker != NULL);
+  config->circuit_breaker = later.breaker;
+
+  /*
+  * The circuit is half-open when the retry comes up, but the backoff
+  * outlasts the deadline: the call must end without taking the probe
+  */
+  server.status = 503;
+  server.delay_ms = 100;
+  config->max_retries = 1;
+  config->retry_delay_ms = 1000;
+  config->deadline_ms = 500;
+  assert(pthread_create(&thread, NULL, open_circuit_later, &later) == 0);
+  assert(mistral_chat_completions(config, &message, 1, &response) == -1);
+  pthread_join(thread, NULL);
+  assert(response.error_code == MISTRAL_ERR_TIMEOUT);
+  mistral_response_free(&response);
+  assert(mistral_circuit_breaker_get_state(later.breaker, endpoint,
+                                           config->model) ==
+         MISTRAL_CIRCUIT_HALF_OPEN);
+  printf("...deadline before backoff - ok\n");
+
+  /* the probe is still free, so the next call goes out and closes it */
+  pthread_mutex_lock(&server.lock);
+  server.status = 200;
+  server.delay_ms = 0;
+  pthread_mutex_unlock(&server.lock);
+  config->max_retries = 0;
+  assert(mistral_chat_completions(config, &message, 1, &response) == 0);
+  mistral_response_free(&response);
+  assert(mistral_circuit_breaker_get_state(later.breaker, endpoint,
+                                           config->model) ==
+         MISTRAL_CIRCUIT_CLOSED);
+  printf("...probe released - ok\n");
+
+  mistral_circuit_breaker_free(later.breaker);
+  mistral_config_free(config);
+  mistral_backend_pool_free(pool);
+  test_server_stop(&server);
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_cancel_token(void) {
+  printf("TEST - Cancel token\n");
+
+  mistral_config_t *config = mistral_config_create("test");
+  mistral_message_t messages[] = {{.role = "user", .content = "test"}};
+  mistral_response_t response = {0};
+  mistral_cancel_token_t *token = mistral_cancel_token_create();
+  assert(config != NULL);
+  assert(token != NULL);
+  printf("...init - ok\n");
+
+  assert(mistral_cancel_token_is_cancelled(token) == 0);
+  mistral_cancel_token_cancel(token);
+  mistral_cancel_token_cancel(token);
+  assert(mistral_cancel_token_is_cancelled(token) == 1);
+
+  /* a cancelled call returns before anything is sent */
+  config->cancel_token = token;
+  assert(mistral_chat_completions(config, messages, 1, &response) != 0);
+  assert(response.error_code == MISTRAL_ERR_CANCELLED);
+  mistral_response_free(&response);
+  printf("...cancelled call - ok\n");
+
+  mistral_cancel_token_reset(token);
+  assert(mistral_cancel_token_is_cancelled(token) == 0);
+  assert(mistral_cancel_token_is_cancelled(NULL) == 0);
+
+  mistral_cancel_token_free(token);
+  mistral_config_free(config);
+  printf("...cleanup - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+typedef struct {
+  mistral_config_t config;
+  mistral_response_t response;
+  double elapsed_ms;
+  int ret;
+} call_thread_t;
+
+static void *call_in_thread(void *arg) {
+  call_thread_t *call = (call_thread_t *)arg;
+  mistral_message_t message = {"user", "same question"};
+  double started = monotonic_ms();
+
+  memset(&call->response, 0, sizeof(call->response));
+  call->ret =
+      mistral_chat_completions(&call->config, &message, 1, &call->response);
+  call->elapsed_ms = monotonic_ms() - started;
+  return NULL;
+}
+
+/* cancels the token once the call under test is waiting */
+static void *cancel_later(void *arg) {
+  test_server_sleep_ms(400);
+  mistral_cancel_token_cancel((mistral_cancel_token_t *)arg);
+  return NULL;
+}
+
+int test_cancel_waits(void) {
+  printf("TEST - Cancel queued and coalesced waits\n");
+
+  test_server_t server;
+  mistral_backend_pool_t *pool = NULL;
+  mistral_config_t *config = NULL;
+  mistral_adaptive_limiter_t *limiter = NULL;
+  mistral_coalescer_t *coalescer = NULL;
+  limiter_endpoint_t *held = NULL;
+  mistral_adaptive_limiter_stats_t stats;
+  mistral_rate_limiter_t *rate = NULL;
+  mistral_message_t message = {"user", "hello"};
+  mistral_batch_item_t items[3] = {{&message, 1}, {&message, 1},
+                                   {&message, 1}};
+  mistral_batch_options_t options = {0};
+  mistral_response_t results[3];
+  double started = 0.0;
+  size_t i;
+  call_thread_t leader;
+  call_thread_t follower;
+  pthread_t leader_thread;
+  pthread_t follower_thread;
+  const char *endpoint = MISTRAL_BASE_API "/chat/completions";
+  assert(test_server_start(&server) == 0);
+  config = test_server_config(&server, &pool);
+  assert(config != NULL);
+  config->temperature = 0.0;
+  config->max_retries = 0;
+  leader.config = *config;
+  follower.config = *config;
+  leader.config.cancel_token = mistral_cancel_token_create();
+  follower.config.cancel_token = mistral_cancel_token_create();
+  assert(leader.config.cancel_token != NULL);
+  assert(follower.config.cancel_token != NULL);
+
+  /* the only limiter slot is taken, so the call queues until cancelled */
+  limiter = mistral_adaptive_limiter_create(1, 1, 1);
+  assert(limiter != NULL);
+  assert(limiter_acquire(limiter, endpoint, 0.0, NULL, &held) == 0);
+  leader.config.limiter = limiter;
+  assert(pthread_create(&leader_thread, NULL, call_in_thread, &leader) == 0);
+  test_server_sleep_ms(50);
+  mistral_cancel_token_cancel(leader.config.cancel_token);
+  pthread_join(leader_thread, NULL);
+  assert(leader.ret == -1);
+  assert(leader.response.error_code == MISTRAL_ERR_CANCELLED);
+  assert(leader.elapsed_ms < 1000.0);
+  assert(test_server_requests(&server) == 0);
+  mistral_response_free(&leader.response);
+  limiter_release(limiter, held, 200, 1.0);
+  leader.config.limiter = NULL;
+  mistral_cancel_token_reset(leader.config.cancel_token);
+  printf("...limiter wait cancelled - ok\n");
+
+  coalescer = mistral_coalescer_create();
+  assert(coalescer != NULL);
+  leader.config.coalescer = coalescer;
+  follower.config.coalescer = coalescer;
+  pthread_mutex_lock(&server.lock);
+  server.delay_ms = 300;
+  pthread_mutex_unlock(&server.lock);
+
+  /* a cancelled follower stops waiting, the leader is unaffected */
+  assert(pthread_create(&leader_thread, NULL, call_in_thread, &leader) == 0);
+  test_server_sleep_ms(50);
+  assert(pthread_create(&follower_thread, NULL, call_in_thread, &follower) ==
+         0);
+  test_server_sleep_ms(50);
+  mistral_cancel_token_cancel(follower.config.cancel_token);
+  pthread_join(follower_thread, NULL);
+  assert(follower.response.error_code == MISTRAL_ERR_CANCELLED);
+  assert(follower.elapsed_ms < 200.0);
+  pthread_join(leader_thread, NULL);
+  assert(leader.ret == 0);
+  assert(test_server_requests(&server) == 1);
+  mistral_response_free(&leader.response);
+  mistral_response_free(&follower.response);
+  mistral_cancel_token_reset(follower.config.cancel_token);
+  printf("...coalesced wait cancelled - ok\n");
+
+  /* a cancelled leader makes its follower send the request itself */
+  assert(pthread_create(&leader_thread, NULL, call_in_thread, &leader) == 0);
+  test_server_sleep_ms(50);
+  assert(pthread_create(&follower_thread, NULL, call_in_thread, &follower) ==
+         0);
+  test_server_sleep_ms(50);
+  mistral_cancel_token_cancel(leader.config.cancel_token);
+  pthread_join(leader_thread, NULL);
+  pthread_join(follower_thread, NULL);
+  assert(leader.response.error_code == MISTRAL_ERR_CANCELLED);
+  assert(follower.ret == 0);
+  assert(strcmp(follower.response.content, "reply 3") == 0);
+  assert(test_server_requests(&server) == 3);
+  mistral_response_free(&leader.response);
+  mistral_response_free(&follower.response);
+  printf("...follower outlives a cancelled leader - ok\n");
+
+  /* a transfer cancelled under the limiter is not taken as overload */
+  mistral_cancel_token_reset(leader.config.cancel_token);
+  leader.config.coalescer = NULL;
+  mistral_adaptive_limiter_free(limiter);
+  limiter = mistral_adaptive_limiter_create(2, 1, 4);
+  assert(limiter != NULL);
+  leader.config.limiter = limiter;
+  assert(pthread_create(&leader_thread, NULL, call_in_thread, &leader) == 0);
+  test_server_sleep_ms(50);
+  mistral_cancel_token_cancel(leader.config.cancel_token);
+  pthread_join(leader_thread, NULL);
+  assert(leader.response.error_code == MISTRAL_ERR_CANCELLED);
+  assert(mistral_adaptive_limiter_get_stats(limiter, endpoint, &stats) == 0);
+  assert(stats.limit == 2.0 && stats.in_flight == 0);
+  assert(stats.decreases == 0);
+  mistral_response_free(&leader.response);
+  printf("...cancelled transfer leaves the limit - ok\n");
+
+  /* the batch stops in the rate limiter wait and starts nothing after */
+  mistral_cancel_token_reset(leader.config.cancel_token);
+  leader.config.limiter = NULL;
+  rate = mistral_rate_limiter_create(0.5, 1);
+  assert(rate != NULL);
+  options.rate_limiter = rate;
+  started = monotonic_ms();
+  assert(pthread_create(&leader_thread, NULL, cancel_later,
+                        leader.config.cancel_token) == 0);
+  assert(mistral_chat_completions_batch(&leader.config, items, 3, 1, results,
+                                        &options) != 0);
+  pthread_join(leader_thread, NULL);
+  assert(monotonic_ms() - started < 1000.0);
+  assert(results[0].error_code == MISTRAL_OK);
+  assert(results[1].error_code == MISTRAL_ERR_CANCELLED);
+  assert(results[2].error_code == MISTRAL_ERR_CANCELLED);
+  assert(test_server_requests(&server) == 5);
+  for (i = 0; i < 3; i++) {
+    mistral_response_free(&results[i]);
+  }
+  mistral_rate_limiter_free(rate);
+  printf("...batch rate limit wait cancelled - ok\n");
+
+  mistral_coalescer_free(coalescer);
+  mistral_adaptive_limiter_free(limiter);
+  mistral_cancel_token_free(leader.config.cancel_token);
+  mistral_cancel_token_free(follower.config.cancel_token);
+  mistral_config_free(config);
+  mistral_backend_pool_free(pool);
+  test_server_stop(&server);
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_config_timeouts(void) {
+  printf("TEST - Config timeouts\n");
+
+  mistral_config_t *config = mistral_config_create("test");
+  assert(config != NULL);
+  printf("...init - ok\n");
+
+  assert(config->timeout_sec == 60);
+  assert(config->connect_timeout_ms == 10000);
+  assert(config->first_byte_timeout_ms == 0);
+  assert(config->idle_timeout_ms == 0);
+  assert(config->deadline_ms == 0);
+  assert(mistral_config_validate(config) == 0);
+  printf("...defaults - ok\n");
+
+  config->deadline_ms = 2000;
+  config->first_byte_timeout_ms = 500;
+  assert(mistral_config_validate(config) == 0);
+
+  config->idle_timeout_ms = -1;
+  assert(mistral_config_validate(config) != 0);
+  printf("...validate - ok\n");
+
+  mistral_config_free(config);
+  printf("...cleanup - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_timeouts_enforced(void) {
+  printf("TEST - Timeouts cut slow attempts short\n");
+
+  test_server_t server;
+  mistral_backend_pool_t *pool = NULL;
+  mistral_config_t *config = NULL;
+  mistral_message_t message = {"user", "hello"};
+  mistral_response_t response = {0};
+  double elapsed = 0.0;
+  double started = 0.0;
+  assert(test_server_start(&server) == 0);
+  config = test_server_config(&server, &pool);
+  assert(config != NULL);
+  config->max_retries = 0;
+
+  /* no body byte within first_byte_timeout_ms */
+  pthread_mutex_lock(&server.lock);
+  server.delay_ms = 600;
+  pthread_mutex_unlock(&server.lock);
+  config->first_byte_timeout_ms = 150;
+  started = monotonic_ms();
+  assert(mistral_chat_completions(config, &message, 1, &response) != 0);
+  elapsed = monotonic_ms() - started;
+  assert(response.error_code == MISTRAL_ERR_TIMEOUT);
+  assert(elapsed >= 140.0 && elapsed < 450.0);
+  mistral_response_free(&response);
+  config->first_byte_timeout_ms = 0;
+  printf("...first byte timeout - ok\n");
+
+  /* half the body arrives, then it stalls past idle_timeout_ms */
+  pthread_mutex_lock(&server.lock);
+  server.delay_ms = 0;
+  server.stall_ms = 600;
+  pthread_mutex_unlock(&server.lock);
+  config->idle_timeout_ms = 150;
+  started = monotonic_ms();
+  assert(mistral_chat_completions(config, &message, 1, &response) != 0);
+  elapsed = monotonic_ms() - started;
+  assert(response.error_code == MISTRAL_ERR_TIMEOUT);
+  assert(elapsed >= 140.0 && elapsed < 450.0);
+  mistral_response_free(&response);
+  config->idle_timeout_ms = 0;
+  printf("...idle timeout - ok\n");
+
+  /* attempt one ends at 600 ms, the call's deadline is 250 ms */
+  pthread_mutex_lock(&server.lock);
+  server.stall_ms = 0;
+  server.delay_ms = 600;
+  pthread_mutex_unlock(&server.lock);
+  config->deadline_ms = 250;
+  started = monotonic_ms();
+  assert(mistral_chat_completions(config, &message, 1, &response) != 0);
+  elapsed = monotonic_ms() - started;
+  assert(response.error_code == MISTRAL_ERR_TIMEOUT);
+  assert(elapsed >= 240.0 && elapsed < 450.0);
+  mistral_response_free(&response);
+  printf("...deadline on one attempt - ok\n");
+
+  /* every 503 takes 150 ms, the third attempt runs into the deadline */
+  pthread_mutex_lock(&server.lock);
+  server.status = 503;
+  server.delay_ms = 150;
+  server.requests = 0;
+  pthread_mutex_unlock(&server.lock);
+  config->max_retries = 5;
+  config->deadline_ms = 400;
+  started = monotonic_ms();
+  assert(mistral_chat_completions(config, &message, 1, &response) != 0);
+  elapsed = monotonic_ms() - started;
+  assert(response.error_code == MISTRAL_ERR_TIMEOUT);
+  assert(elapsed >= 390.0 && elapsed < 550.0);
+  assert(test_server_requests(&server) == 3);
+  mistral_response_free(&response);
+  printf("...deadline across retries - ok\n");
+
+  mistral_config_free(config);
+  mistral_backend_pool_free(pool);
+  test_server_stop(&server);
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_limiter_deadline(void) {
+  printf("TEST - Limiter waits bounded by the deadline\n");
+
+  test_server_t server;
+  mistral_backend_pool_t *pool = NULL;
+  mistral_config_t *config = NULL;
+  mistral_adaptive_limiter_t *limiter = NULL;
+  mistral_rate_limiter_t *rate = NULL;
+  limiter_endpoint_t *held = NULL;
+  limiter_endpoint_t *slot = NULL;
+  mistral_message_t message = {"user", "hello"};
+  mistral_batch_item_t items[2] = {{&message, 1}, {&message, 1}};
+  mistral_batch_options_t options = {0};
+  mistral_response_t response = {0};
+  mistral_response_t results[2];
+  const char *endpoint = MISTRAL_BASE_API "/chat/completions";
+  double started = 0.0;
+  assert(test_server_start(&server) == 0);
+  config = test_server_config(&server, &pool);
+  assert(config != NULL);
+  limiter = mistral_adaptive_limiter_create(1, 1, 1);
+  assert(limiter != NULL);
+
+  assert(limiter_acquire(limiter, endpoint, 0.0, NULL, &held) == 0);
+  assert(held != NULL);
+  started = monotonic_ms();
+  assert(limiter_acquire(limiter, endpoint, started + 50.0, NULL, &slot) != 0);
+  assert(slot == NULL);
+  assert(monotonic_ms() - started >= 45.0);
+  printf("...acquire times out - ok\n");
+
+  /* the queued call ends at its deadline without being sent */
+  config->limiter = limiter;
+  config->deadline_ms = 100;
+  started = monotonic_ms();
+  assert(mistral_chat_completions(config, &message, 1, &response) != 0);
+  assert(response.error_code == MISTRAL_ERR_TIMEOUT);
+  assert(monotonic_ms() - started < 1000.0);
+  assert(test_server_requests(&server) == 0);
+  mistral_response_free(&response);
+  limiter_release(limiter, held, 200, 1.0);
+  printf("...call times out in the queue - ok\n");
+
+  /* the second item would wait two seconds for a token */
+  config->limiter = NULL;
+  rate = mistral_rate_limiter_create(0.5, 1);
+  assert(rate != NULL);
+  options.rate_limiter = rate;
+  started = monotonic_ms();
+  assert(mistral_chat_completions_batch(config, items, 2, 1, results,
+                                        &options) != 0);
+  assert(monotonic_ms() - started < 1000.0);
+  assert(results[0].error_code == MISTRAL_OK);
+  assert(results[1].error_code == MISTRAL_ERR_TIMEOUT);
+  assert(test_server_requests(&server) == 1);
+  mistral_response_free(&results[0]);
+  mistral_response_free(&results[1]);
+  printf("...batch rate limit wait times out - ok\n");
+
+  mistral_rate_limiter_free(rate);
+  mistral_adaptive_limiter_free(limiter);
+  mistral_config_free(config);
+  mistral_backend_pool_free(pool);
+  test_server_stop(&server);
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_backend_pool_create(void) {
+  printf("TEST - Backend pool create\n");
+
+  mistral_backend_pool_t *pool =
+      mistral_backend_pool_create(MISTRAL_BALANCE_P2C);
+  mistral_backend_stats_t stats;
+  assert(pool != NULL);
+  printf("...init - ok\n");
+
+  assert(mistral_backend_pool_add(pool, MISTRAL_BASE_API, "key-a", 1) == 0);
+  assert(mistral_backend_pool_add(pool, MISTRAL_BASE_API, "key-b", 3) == 1);
+  assert(mistral_backend_pool_add(pool, MISTRAL_BASE_API, "key-c", 0) == -1);
+  assert(mistral_backend_pool_add(pool, NULL, "key-d", 1) == -1);
+  printf("...add - ok\n");
+
+  assert(mistral_backend_pool_get_stats(pool, 1, &stats) == 0);
+  assert(stats.requests == 0);
+  assert(stats.outstanding == 0);
+  assert(stats.healthy == 1);
+  assert(mistral_backend_pool_get_stats(pool, 2, &stats) == -1);
+  printf("...stats - ok\n");
+
+  mistral_backend_pool_free(pool);
+  printf("...cleanup - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+/* index of the backend in a pool of "http://a", "http://b", ... */
+static int backend_index(const pool_backend_t *backend) {
+  return backend_base_url(backend)[7] - 'a';
+}
+
+static mistral_backend_pool_t *balance_pool(mistral_balance_policy_t policy,
+                                            const int *weights, int count) {
+  mistral_backend_pool_t *pool = mistral_backend_pool_create(policy);
+  char url[16];
+  int i;
+
+  assert(pool != NULL);
+  for (i = 0; i < count; i++) {
+    snprintf(url, sizeof(url), "http://%c", 'a' + i);
+    assert(mistral_backend_pool_add(pool, url, "key", weights[i]) == i);
+  }
+  return pool;
+}
+
+int test_backend_pool_balance(void) {
+  printf("TEST - Backend pool balancing\n");
+
+  const int skewed[] = {1, 3};
+  const int even[] = {1, 1, 1};
+  mistral_backend_pool_t *pool = NULL;
+  mistral_backend_stats_t stats;
+  pool_backend_t *held[3];
+  pool_backend_t *backend = NULL;
+  int counts[3] = {0, 0, 0};
+  int i;
+
+  /* idle backends tie, so traffic follows the weights */
+  pool = balance_pool(MISTRAL_BALANCE_P2C, skewed, 2);
+  for (i = 0; i < 4000; i++) {
+    backend = backend_pool_acquire(pool);
+    counts[backend_index(backend)]++;
+    backend_pool_release(pool, backend, 200, 1.0);
+  }
+  assert(counts[1] > 2600 && counts[1] < 3400);
+  assert(mistral_backend_pool_get_stats(pool, 1, &stats) == 0);
+  assert(stats.requests == (unsigned long)counts[1]);
+  assert(stats.outstanding == 0 && stats.latency_ms == 1.0);
+  mistral_backend_pool_free(pool);
+  printf("...weights - ok\n");
+
+  /* of two picks, the one with fewer requests in flight wins */
+  pool = balance_pool(MISTRAL_BALANCE_P2C, even, 2);
+  held[0] = backend_pool_acquire(pool);
+  counts[0] = counts[1] = 0;
+  for (i = 0; i < 400; i++) {
+    backend = backend_pool_acquire(pool);
+    counts[backend == held[0] ? 0 : 1]++;
+    backend_pool_release(pool, backend, 200, 1.0);
+  }
+  assert(counts[1] > 320);
+  backend_pool_release(pool, held[0], 200, 1.0);
+  mistral_backend_pool_free(pool);
+  printf("...power of two choices - ok\n");
+
+  pool = balance_pool(MISTRAL_BALANCE_LEAST_OUTSTANDING, even, 3);
+  for (i = 0; i < 3; i++) {
+    held[i] = backend_pool_acquire(pool);
+  }
+  assert(held[0] != held[1] && held[1] != held[2] && held[0] != held[2]);
+  for (i = 0; i < 3; i++) {
+    backend_pool_release(pool, held[i], 200, 1.0);
+  }
+  mistral_backend_pool_free(pool);
+  pool = balance_pool(MISTRAL_BALANCE_LEAST_OUTSTANDING, skewed, 2);
+  counts[0] = counts[1] = 0;
+  for (i = 0; i < 3; i++) {
+    held[i] = backend_pool_acquire(pool);
+    counts[backend_index(held[i])]++;
+  }
+  assert(counts[0] == 1 && counts[1] == 2);
+  for (i = 0; i < 3; i++) {
+    backend_pool_release(pool, held[i], 200, 1.0);
+  }
+  mistral_backend_pool_free(pool);
+  printf("...least outstanding per weight - ok\n");
+
+  /* a failed backend cools down and is skipped while another is up */
+  pool = balance_pool(MISTRAL_BALANCE_P2C, even, 2);
+  backend = backend_pool_acquire(pool);
+  i = backend_index(backend);
+  backend_pool_release(pool, backend, 503, 1.0);
+  mistral_backend_pool_get_stats(pool, i, &stats);
+  assert(stats.healthy == 0 && stats.failures == 1);
+  assert(backend_pool_available(pool) == 1);
+  for (counts[0] = 0; counts[0] < 100; counts[0]++) {
+    backend = backend_pool_acquire(pool);
+    assert(backend_index(backend) != i);
+    backend_pool_release(pool, backend, -1, 1.0);
+  }
+  mistral_backend_pool_get_stats(pool, 1 - i, &stats);
+  assert(stats.healthy == 1 && stats.failures == 0);
+
+  /* with both down, the one that recovers first is used */
+  backend = backend_pool_acquire(pool);
+  backend_pool_release(pool, backend, 0, 1.0);
+  assert(backend_pool_available(pool) == 0);
+  backend = backend_pool_acquire(pool);
+  assert(backend_index(backend) == i);
+  backend_pool_release(pool, backend, 200, 1.0);
+  mistral_backend_pool_get_stats(pool, i, &stats);
+  assert(stats.healthy == 1 && backend_pool_available(pool) == 1);
+  mistral_backend_pool_free(pool);
+  printf("...cooldown - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_backend_pool_failover(void) {
+  printf("TEST - Backend pool failover on a refused key\n");
+
+  test_server_t refusing;
+  test_server_t serving;
+  mistral_backend_pool_t *pool = NULL;
+  mistral_config_t *config = NULL;
+  mistral_message_t message = {"user", "hello"};
+  mistral_response_t response = {0};
+  double started = 0.0;
+  int i;
+  assert(test_server_start(&refusing) == 0);
+  assert(test_server_start(&serving) == 0);
+  config = test_server_config(&serving, &pool);
+  assert(config != NULL);
+  assert(mistral_backend_pool_add(pool, refusing.url, "revoked", 1) == 1);
+  pthread_mutex_lock(&refusing.lock);
+  refusing.status = 401;
+  pthread_mutex_unlock(&refusing.lock);
+  config->max_retries = 1;
+  config->retry_delay_ms = 5000;
+
+  /* the refused attempt goes to the other backend without the backoff */
+  for (i = 0; i < 50 && test_server_requests(&refusing) == 0; i++) {
+    started = monotonic_ms();
+    assert(mistral_chat_completions(config, &message, 1, &response) == 0);
+    assert(monotonic_ms() - started < 1000.0);
+    mistral_response_free(&response);
+  }
+  assert(test_server_requests(&refusing) == 1);
+  assert(test_server_requests(&serving) == i);
+  printf("...401 retried on another backend - ok\n");
+
+  /* with no other backend ready the refusal is final */
+  pthread_mutex_lock(&serving.lock);
+  serving.status = 403;
+  pthread_mutex_unlock(&serving.lock);
+  assert(mistral_chat_completions(config, &message, 1, &response) != 0);
+  assert(response.error_code == MISTRAL_ERR_AUTH);
+  assert(test_server_requests(&refusing) == 1);
+  assert(test_server_requests(&serving) == i + 1);
+  mistral_response_free(&response);
+  printf("...403 without another backend - ok\n");
+
+  mistral_config_free(config);
+  mistral_backend_pool_free(pool);
+  test_server_stop(&refusing);
+  test_server_stop(&serving);
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_fallback_policy_create(void) {
+  printf("TEST - Fallback policy create\n");
+
+  mistral_fallback_model_t chain[] = {
+      {NULL, 1, MISTRAL_FALLBACK_ON_RATE_LIMIT | MISTRAL_FALLBACK_ON_SERVER_ERROR},
+      {"mistral-small-latest", 0, 0}};
+  mistral_fallback_model_t bad_chain[] = {{NULL, 1, 0}, {NULL, 1, 0}};
+  mistral_fallback_policy_t *policy = mistral_fallback_policy_create(chain, 2);
+  assert(policy != NULL);
+  printf("...init - ok\n");
+
+  assert(mistral_fallback_policy_create(NULL, 2) == NULL);
+  assert(mistral_fallback_policy_create(chain, 0) == NULL);
+  assert(mistral_fallback_policy_create(bad_chain, 2) == NULL);
+  chain[1].max_retries = -1;
+  assert(mistral_fallback_policy_create(chain, 2) == NULL);
+  printf("...invalid params - ok\n");
+
+  mistral_fallback_policy_free(policy);
+  printf("...cleanup - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+/* fallback_request_json(json, model) must equal expected, NULL for none */
+static void check_splice(const char *json, const char *model,
+                         const char *expected) {
+  char *spliced = fallback_request_json(json, model);
+
+  if (expected == NULL) {
+    assert(spliced == NULL);
+    return;
+  }
+  assert(spliced != NULL);
+  assert(strcmp(spliced, expected) == 0);
+  mem_free(spliced);
+}
+
+int test_fallback_splice(void) {
+  printf("TEST - Fallback triggers and model splicing\n");
+
+  mistral_fallback_model_t some = {
+      NULL, 0, MISTRAL_FALLBACK_ON_RATE_LIMIT | MISTRAL_FALLBACK_ON_TIMEOUT};
+  mistral_fallback_model_t all = {
+      NULL, 0,
+      MISTRAL_FALLBACK_ON_RATE_LIMIT | MISTRAL_FALLBACK_ON_SERVER_ERROR |
+          MISTRAL_FALLBACK_ON_TIMEOUT | MISTRAL_FALLBACK_ON_NETWORK |
+          MISTRAL_FALLBACK_ON_CIRCUIT_OPEN};
+
+  assert(fallback_triggered(&some, MISTRAL_ERR_RATE_LIMIT) == 1);
+  assert(fallback_triggered(&some, MISTRAL_ERR_TIMEOUT) == 1);
+  assert(fallback_triggered(&some, MISTRAL_ERR_SERVER) == 0);
+  assert(fallback_triggered(&some, MISTRAL_ERR_NETWORK) == 0);
+  assert(fallback_triggered(&some, MISTRAL_ERR_CIRCUIT_OPEN) == 0);
+  assert(fallback_triggered(&all, MISTRAL_ERR_SERVER) == 1);
+  assert(fallback_triggered(&all, MISTRAL_ERR_NETWORK) == 1);
+  assert(fallback_triggered(&all, MISTRAL_ERR_CIRCUIT_OPEN) == 1);
+  /* errors another model cannot fix never move down the chain */
+  assert(fallback_triggered(&all, MISTRAL_ERR_INVALID_PARAM) == 0);
+  assert(fallback_triggered(&all, MISTRAL_ERR_AUTH) == 0);
+  assert(fallback_triggered(&all, MISTRAL_ERR_PARSE) == 0);
+  assert(fallback_triggered(&all, MISTRAL_ERR_MEM) == 0);
+  assert(fallback_triggered(&all, MISTRAL_ERR_CANCELLED) == 0);
+  printf("...triggers - ok\n");
+
+  check_splice("{\"model\":\"a\",\"messages\":[]}", "mistral-small",
+               "{\"model\":\"mistral-small\",\"messages\":[]}");
+  check_splice("{\"model\":\"a\\\"b\",\"n\":1}", "q\"\\",
+               "{\"model\":\"q\\\"\\\\\",\"n\":1}");
+  printf("...leading model - ok\n");
+
+  /* only the top-level key is replaced, not one inside a message */
+  check_splice("{\"messages\":[{\"role\":\"user\",\"content\":"
+               "\"{\\\"model\\\":\\\"x\\\"}\"}], \"model\" : \"old\","
+               "\"temperature\":0}",
+               "new",
+               "{\"messages\":[{\"role\":\"user\",\"content\":"
+               "\"{\\\"model\\\":\\\"x\\\"}\"}], \"model\" : \"new\","
+               "\"temperature\":0}");
+  check_splice("{\"stream\":false,\"model\":\"old\"}", "new",
+               "{\"stream\":false,\"model\":\"new\"}");
+  printf("...model not first - ok\n");
+
+  check_splice("{\"messages\":[]}", "new", NULL);
+  check_splice("{\"n\":1,\"model\":7}", "new", NULL);
+  check_splice("{\"n\":1,\"model\":\"old\"", "new", NULL);
+  check_splice("{\"model\":\"old", "new", NULL);
+  check_splice("{\"model\":\"old\"}", "bad\nname", NULL);
+  printf("...rejected - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_model_router_select(void) {
+  printf("TEST - Model router select\n");
+
+  mistral_model_router_t *router = mistral_model_router_create();
+  mistral_route_decision_t decision;
+  mistral_model_route_stats_t stats;
+  assert(router != NULL);
+  printf("...init - ok\n");
+
+  assert(mistral_model_router_add(router, "mistral-small-latest", 0.2, 1) == 0);
+  assert(mistral_model_router_add(router, "mistral-large-latest", 2.0, 2) == 0);
+  assert(mistral_model_router_add(router, "mistral-large-latest", 2.0, 2) != 0);
+  assert(mistral_model_router_add(router, NULL, 1.0, 1) != 0);
+  printf("...add - ok\n");
+
+  /* unmeasured models count as meeting the target, so price decides */
+  assert(mistral_model_router_select(router, 500, 0, 1024, &decision) == 0);
+  assert(strcmp(decision.model, "mistral-small-latest") == 0);
+  assert(decision.met_target == 1);
+
+  assert(mistral_model_router_select(router, 500, 2, 1024, &decision) == 0);
+  assert(strcmp(decision.model, "mistral-large-latest") == 0);
+  assert(mistral_model_router_select(router, 500, 3, 1024, &decision) != 0);
+  printf("...select - ok\n");
+
+  assert(mistral_model_router_get_stats(router, "mistral-small-latest",
+                                        &stats) == 0);
+  assert(stats.samples == 0);
+  assert(mistral_model_router_get_stats(router, "unknown", &stats) != 0);
+
+  mistral_model_router_free(router);
+  printf("...cleanup - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_model_router_feedback(void) {
+  printf("TEST - Model router feedback skips client-side exits\n");
+
+  test_server_t server;
+  mistral_backend_pool_t *pool = NULL;
+  mistral_config_t *config = NULL;
+  mistral_model_router_t *router = mistral_model_router_create();
+  mistral_adaptive_limiter_t *limiter = mistral_adaptive_limiter_create(1, 1, 1);
+  mistral_model_route_stats_t stats;
+  limiter_endpoint_t *held = NULL;
+  mistral_message_t message = {"user", "hello"};
+  mistral_response_t response = {0};
+  const char *endpoint = MISTRAL_BASE_API "/chat/completions";
+  assert(router != NULL && limiter != NULL);
+  assert(mistral_model_router_add(router, "m", 1.0, 1) == 0);
+  assert(test_server_start(&server) == 0);
+  config = test_server_config(&server, &pool);
+  assert(config != NULL);
+  config->model_router = router;
+  config->max_retries = 0;
+
+  /* the only limiter slot is taken, the call never leaves the queue */
+  assert(limiter_acquire(limiter, endpoint, 0.0, NULL, &held) == 0);
+  config->limiter = limiter;
+  config->deadline_ms = 100;
+  assert(mistral_chat_completions(config, &message, 1, &response) != 0);
+  assert(response.error_code == MISTRAL_ERR_TIMEOUT);
+  mistral_response_free(&response);
+  limiter_release(limiter, held, 200, 1.0);
+  config->limiter = NULL;
+  assert(mistral_model_router_get_stats(router, "m", &stats) == 0);
+  assert(stats.error_rate == 0.0);
+  printf("...limiter exit ignored - ok\n");
+
+  /* the call's deadline ends the transfer before the server answers */
+  pthread_mutex_lock(&server.lock);
+  server.delay_ms = 400;
+  pthread_mutex_unlock(&server.lock);
+  assert(mistral_chat_completions(config, &message, 1, &response) != 0);
+  assert(response.error_code == MISTRAL_ERR_TIMEOUT);
+  mistral_response_free(&response);
+  assert(mistral_model_router_get_stats(router, "m", &stats) == 0);
+  assert(stats.error_rate == 0.0);
+  printf("...deadline exit ignored - ok\n");
+
+  /* a first-byte timeout is the model being slow */
+  config->deadline_ms = 0;
+  config->first_byte_timeout_ms = 100;
+  assert(mistral_chat_completions(config, &message, 1, &response) != 0);
+  assert(response.error_code == MISTRAL_ERR_TIMEOUT);
+  mistral_response_free(&response);
+  assert(mistral_model_router_get_stats(router, "m", &stats) == 0);
+  assert(stats.error_rate > 0.0);
+  printf("...network failure recorded - ok\n");
+
+  mistral_config_free(config);
+  mistral_backend_pool_free(pool);
+  mistral_adaptive_limiter_free(limiter);
+  mistral_model_router_free(router);
+  test_server_stop(&server);
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_conversation(void) {
+  printf("TEST - Conversation\n");
+
+  mistral_config_t *config = mistral_config_create("test");
+  mistral_conversation_t *conversation = mistral_conversation_create();
+  mistral_response_t response;
+  mistral_message_t message;
+  char text[32];
+  int i;
+  assert(config != NULL);
+  assert(conversation != NULL);
+  printf("...init - ok\n");
+
+  assert(mistral_conversation_chat(config, conversation, &response) != 0);
+  assert(response.error_code == MISTRAL_ERR_INVALID_PARAM);
+  mistral_response_free(&response);
+  printf("...empty conversation - ok\n");
+
+  assert(mistral_conversation_append(conversation, "system", "Be \"brief\"") == 0);
+  for (i = 0; i < 100; i++) {
+    snprintf(text, sizeof(text), "turn %d\n", i);
+    assert(mistral_conversation_append(conversation, "user", text) == 0);
+  }
+  assert(mistral_conversation_append(conversation, NULL, "x") != 0);
+  assert(mistral_conversation_count(conversation) == 101);
+  printf("...append - ok\n");
+
+  assert(mistral_conversation_get(conversation, 0, &message) == 0);
+  assert(strcmp(message.role, "system") == 0);
+  assert(strcmp(message.content, "Be \"brief\"") == 0);
+  assert(mistral_conversation_get(conversation, 100, &message) == 0);
+  assert(strcmp(message.content, "turn 99\n") == 0);
+  assert(mistral_conversation_get(conversation, 101, &message) != 0);
+  printf("...get - ok\n");
+
+  mistral_conversation_free(conversation);
+  mistral_config_free(config);
+  printf("...cleanup - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+/*
+* Write a vocabulary to a fresh temporary file, its name into path
+*/
+static void write_vocab(char *path, const char *vocab) {
+  int fd = -1;
+  FILE *file = NULL;
+
+  strcpy(path, "/tmp/mistral_tekken_XXXXXX");
+  fd = mkstemp(path);
+  assert(fd >= 0);
+  file = fdopen(fd, "w");
+  assert(file != NULL);
+  fputs(vocab, file);
+  fclose(file);
+}
+
+int test_tokenizer(void) {
+  printf("TEST - Tokenizer\n");
+
+  char path[32];
+  /* o plus the first byte of ， “ ” — or é: only é is part of a word */
+  const char *vocab =
+      "{\"config\": {\"default_vocab_size\": 15, "
+      "\"default_num_special_tokens\": 3},"
+      " \"special_tokens\": [{\"rank\": 0, \"token_str\": \"<unk>\"},"
+      " {\"rank\": 1, \"token_str\": \"<s>\"},"
+      " {\"rank\": 2, \"token_str\": \"[SYSTEM_PROMPT]\"}],"
+      " \"vocab\": [{\"rank\": 0, \"token_bytes\": \"aA==\"},"
+      " {\"rank\": 1, \"token_bytes\": \"ZQ==\"},"
+      " {\"rank\": 2, \"token_bytes\": \"bA==\"},"
+      " {\"rank\": 3, \"token_bytes\": \"bw==\"},"
+      " {\"rank\": 4, \"token_bytes\": \"IA==\"},"
+      " {\"rank\": 5, \"token_bytes\": \"aGU=\"},"
+      " {\"rank\": 6, \"token_bytes\": \"bGw=\"},"
+      " {\"rank\": 7, \"token_bytes\": \"aGVsbA==\"},"
+      " {\"rank\": 8, \"token_bytes\": \"aGVsbG8=\"},"
+      " {\"rank\": 9, \"token_bytes\": \"b+8=\"},"
+      " {\"rank\": 10, \"token_bytes\": \"b+I=\"},"
+      " {\"rank\": 11, \"token_bytes\": \"b8M=\"}]}";
+  /* single letters only: hello is five tokens */
+  const char *letters =
+      "{\"vocab\": [{\"rank\": 0, \"token_bytes\": \"aA==\"},"
+      " {\"rank\": 1, \"token_bytes\": \"ZQ==\"},"
+      " {\"rank\": 2, \"token_bytes\": \"bA==\"},"
+      " {\"rank\": 3, \"token_bytes\": \"bw==\"}]}";
+  mistral_message_t messages[] = {
+      {"system", "hello"}, {"user", "hello hello"}, {"assistant", "hello"}};
+  mistral_tokenizer_t *tokenizer = NULL;
+
+  write_vocab(path, vocab);
+  assert(mistral_tokenizer_load(NULL) == NULL);
+  assert(mistral_tokenizer_load("/nonexistent/tekken.json") == NULL);
+  tokenizer = mistral_tokenizer_load(path);
+  remove(path);
+  assert(tokenizer != NULL);
+  printf("...load - ok\n");
+
+  assert(mistral_count_tokens(tokenizer, "") == 0);
+  assert(mistral_count_tokens(tokenizer, "hello") == 1);
+  /* " hello" merges he, ll, hell, hello and keeps the space */
+  assert(mistral_count_tokens(tokenizer, "hello hello") == 3);
+  /* bytes missing from the vocabulary count one each */
+  assert(mistral_count_tokens(tokenizer, "Hi 42") == 5);
+  assert(mistral_count_tokens(tokenizer, NULL) == -1);
+  assert(mistral_count_tokens(NULL, "hello") == -1);
+  printf("...count tokens - ok\n");
+
+  /* a letter joins the word, so o and its first byte merge */
+  assert(mistral_count_tokens(tokenizer, "o\xc3\xa9") == 2);
+  /* punctuation starts a piece of its own: o, then its three bytes */
+  assert(mistral_count_tokens(tokenizer, "o\xef\xbc\x8c") == 4);
+  assert(mistral_count_tokens(tokenizer, "o\xe2\x80\x9c") == 4);
+  assert(mistral_count_tokens(tokenizer, "o\xe2\x80\x9d") == 4);
+  assert(mistral_count_tokens(tokenizer, "o\xe2\x80\x94") == 4);
+  /* and leads the next word: ，hello is three bytes and hello */
+  assert(mistral_count_tokens(tokenizer, "hello\xef\xbc\x8chello") == 5);
+  printf("...non-ASCII - ok\n");
+
+  assert(mistral_count_chat_tokens(tokenizer, messages, 3) == 11);
+  assert(mistral_count_chat_tokens(tokenizer, NULL, 3) == -1);
+  printf("...count chat tokens - ok\n");
+
+  /* counts remembered for the first vocabulary do not carry over */
+  mistral_tokenizer_free(tokenizer);
+  write_vocab(path, letters);
+  tokenizer = mistral_tokenizer_load(path);
+  remove(path);
+  assert(tokenizer != NULL);
+  assert(mistral_count_tokens(tokenizer, "hello") == 5);
+  printf("...reload - ok\n");
+
+  mistral_tokenizer_free(tokenizer);
+  mistral_tokenizer_free(NULL);
+  printf("...cleanup - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_context_policy(void) {
+  printf("TEST - Context policy\n");
+
+  mistral_config_t *config = mistral_config_create("test");
+  mistral_context_policy_t *policy = NULL;
+  mistral_conversation_t *conversation = mistral_conversation_create();
+  mistral_message_t messages[] = {
+      {"system", "Be brief"},
+      {"user", "A question that is far too long for a budget of eight tokens"}};
+  mistral_response_t response;
+  assert(config != NULL);
+  assert(conversation != NULL);
+
+  assert(mistral_context_policy_create(MISTRAL_CONTEXT_KEEP_RECENT, 0, 0) ==
+         NULL);
+  assert(mistral_context_policy_create((mistral_context_strategy_t)7, 100,
+                                       0) == NULL);
+  policy = mistral_context_policy_create(MISTRAL_CONTEXT_SUMMARIZE, 8, 4);
+  assert(policy != NULL);
+  assert(mistral_context_policy_set_tokenizer(NULL, NULL) != 0);
+  assert(mistral_context_policy_set_summarizer(policy, NULL, NULL) == 0);
+  printf("...create - ok\n");
+
+  /* rejected before any request is made */
+  config->context_policy = policy;
+  assert(mistral_chat_completions(config, messages, 2, &response) != 0);
+  assert(response.error_code == MISTRAL_ERR_INVALID_PARAM);
+  mistral_response_free(&response);
+
+  assert(mistral_conversation_append(conversation, messages[1].role,
+                                     messages[1].content) == 0);
+  assert(mistral_conversation_chat(config, conversation, &response) != 0);
+  assert(response.error_code == MISTRAL_ERR_INVALID_PARAM);
+  assert(mistral_conversation_count(conversation) == 1);
+  mistral_response_free(&response);
+  printf("...over budget - ok\n");
+
+  mistral_conversation_free(conversation);
+  mistral_context_policy_free(policy);
+  mistral_config_free(config);
+  printf("...cleanup - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+typedef struct {
+  size_t calls;
+  size_t count;
+  size_t length;
+  char first[16];
+} summarize_state_t;
+
+/* summary of length bytes, first keeps the start of the first message */
+static char *summarize(const mistral_message_t *messages, size_t count,
+                       void *user_data) {
+  summarize_state_t *state = (summarize_state_t *)user_data;
+  char *summary = (char *)malloc(state->length + 1);
+
+  assert(summary != NULL);
+  state->calls++;
+  state->count = count;
+  snprintf(state->first, sizeof(state->first), "%s", messages[0].content);
+  snprintf(summary, state->length + 1, "summary %zu", state->calls);
+  memset(summary + strlen(summary), '.', state->length - strlen(summary));
+  summary[state->length] = '\0';
+  return summary;
+}
+
+/* plan for messages of the given roles and token counts */
+static int plan_for(mistral_context_strategy_t strategy, long budget,
+                    size_t max_recent, const char *roles, const long *tokens,
+                    size_t summary_index, summarize_state_t *state,
+                    context_plan_t *plan) {
+  mistral_context_policy_t *policy =
+      mistral_context_policy_create(strategy, budget, max_recent);
+  mistral_message_t messages[8];
+  size_t count = strlen(roles);
+  size_t i;
+  int ret;
+
+  assert(policy != NULL && count <= 8);
+  for (i = 0; i < count; i++) {
+    messages[i].role = roles[i] == 's'   ? "system"
+                       : roles[i] == 'u' ? "user"
+                       : roles[i] == 'a' ? "assistant"
+                                         : "tool";
+    messages[i].content = messages[i].role;
+  }
+  if (state != NULL) {
+    mistral_context_policy_set_summarizer(policy, summarize, state);
+  }
+  ret = context_policy_plan(policy, messages, tokens, count,
+                            summary_index == 0 ? count : summary_index, plan);
+  mistral_context_policy_free(policy);
+  return ret;
+}
+
+int test_context_policy_plan(void) {
+  printf("TEST - Context policy plan\n");
+
+  const long tokens[] = {10, 20, 20, 20, 20, 20};
+  const long pinned[] = {10, 30, 20, 20, 20};
+  summarize_state_t state = {0, 0, 4, ""};
+  context_plan_t plan;
+
+  /* 1 BOS + 110 */
+  assert(plan_for(MISTRAL_CONTEXT_KEEP_RECENT, 111, 0, "suauau", tokens, 0,
+                  NULL, &plan) == 0);
+  assert(plan.head == 6 && plan.tail == 6 && plan.summary == NULL);
+  printf("...everything fits - ok\n");
+
+  /* the newest that fit start at a reply, which is dropped too */
+  assert(plan_for(MISTRAL_CONTEXT_KEEP_RECENT, 100, 0, "suauau", tokens, 0,
+                  NULL, &plan) == 0);
+  assert(plan.head == 1 && plan.tail == 3);
+  assert(plan_for(MISTRAL_CONTEXT_KEEP_RECENT, 100, 0, "suatau", tokens, 0,
+                  NULL, &plan) == 0);
+  assert(plan.head == 1 && plan.tail == 5);
+  printf("...keep recent, aligned to a user message - ok\n");
+
+  assert(plan_for(MISTRAL_CONTEXT_DROP_MIDDLE, 100, 0, "suauau", tokens, 0,
+                  NULL, &plan) == 0);
+  assert(plan.head == 3 && plan.tail == 5);
+  printf("...drop middle keeps the first exchange - ok\n");
+
+  assert(plan_for(MISTRAL_CONTEXT_SUMMARIZE, 100, 0, "suauau", tokens, 0,
+                  &state, &plan) == 0);
+  assert(plan.head == 1 && plan.tail == 3);
+  assert(state.calls == 1 && state.count == 2);
+  assert(strcmp(state.first, "user") == 0);
+  assert(plan.summary != NULL && plan.summary_tokens == 3);
+  free(plan.summary);
+
+  /* a 52 token summary only fits once two more messages go */
+  state.length = 200;
+  assert(plan_for(MISTRAL_CONTEXT_SUMMARIZE, 100, 0, "suauau", tokens, 0,
+                  &state, &plan) == 0);
+  assert(plan.head == 1 && plan.tail == 5);
+  assert(plan.summary != NULL && plan.summary_tokens == 52);
+  free(plan.summary);
+
+  /* one that never fits is dropped */
+  state.length = 400;
+  assert(plan_for(MISTRAL_CONTEXT_SUMMARIZE, 100, 0, "suauau", tokens, 0,
+                  &state, &plan) == 0);
+  assert(plan.head == 1 && plan.tail == 5 && plan.summary == NULL);
+  printf("...summarize - ok\n");
+
+  assert(plan_for(MISTRAL_CONTEXT_KEEP_RECENT, 1000, 2, "suauau", tokens, 0,
+                  NULL, &plan) == 0);
+  assert(plan.head == 1 && plan.tail == 5);
+  assert(plan_for(MISTRAL_CONTEXT_KEEP_RECENT, 1000, 5, "suauau", tokens, 0,
+                  NULL, &plan) == 0);
+  assert(plan.head == 6 && plan.tail == 6);
+  printf("...max recent messages - ok\n");
+
+  /* an earlier summary at index 1 is not pinned like a system prompt */
+  assert(plan_for(MISTRAL_CONTEXT_KEEP_RECENT, 70, 0, "ssuau", pinned, 1,
+                  NULL, &plan) == 0);
+  assert(plan.head == 1 && plan.tail == 4);
+  assert(plan_for(MISTRAL_CONTEXT_KEEP_RECENT, 70, 0, "ssuau", pinned, 0,
+                  NULL, &plan) == 0);
+  assert(plan.head == 2 && plan.tail == 4);
+  printf("...summary index - ok\n");
+
+  assert(plan_for(MISTRAL_CONTEXT_KEEP_RECENT, 20, 0, "su", tokens, 0, NULL,
+                  &plan) == -1);
+  assert(plan_for(MISTRAL_CONTEXT_KEEP_RECENT, 20, 0, "ss", tokens, 0, NULL,
+                  &plan) == -1);
+  printf("...over budget - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+/*
+* The messages array of the request in body must be exactly the
+* conversation's first count messages
+*/
+static void check_history_json(const char *body,
+                               const mistral_conversation_t *conversation,
+                               size_t count) {
+  const char *start = strstr(body, "\"messages\":[");
+  char expected[8192];
+  size_t used = 0;
+  mistral_message_t message;
+  size_t i;
+
+  assert(start != NULL);
+  start += 12;
+  for (i = 0; i < count; i++) {
+    assert(mistral_conversation_get(conversation, i, &message) == 0);
+    used += (size_t)snprintf(expected + used, sizeof(expected) - used,
+                             "%s{\"role\":\"%s\",\"content\":\"%s\"}",
+                             i > 0 ? "," : "", message.role, message.content);
+    assert(used < sizeof(expected));
+  }
+  assert(strncmp(start, expected, used) == 0);
+  assert(strncmp(start + used, "],", 2) == 0);
+}
+
+int test_conversation_compact(void) {
+  printf("TEST - Conversation compaction\n");
+
+  test_server_t server;
+  mistral_backend_pool_t *pool = NULL;
+  mistral_config_t *config = NULL;
+  mistral_context_policy_t *policy = NULL;
+  mistral_conversation_t *conversation = mistral_conversation_create();
+  mistral_response_t response = {0};
+  mistral_message_t message;
+  summarize_state_t state = {0, 0, 12, ""};
+  char content[64];
+  size_t count = 0;
+  int i;
+  assert(conversation != NULL);
+  assert(test_server_start(&server) == 0);
+  config = test_server_config(&server, &pool);
+  assert(config != NULL);
+  /* every turn below is 12 tokens, the summary 5 */
+  policy = mistral_context_policy_create(MISTRAL_CONTEXT_SUMMARIZE, 60, 0);
+  assert(policy != NULL);
+  mistral_context_policy_set_summarizer(policy, summarize, &state);
+  config->context_policy = policy;
+
+  assert(mistral_conversation_append(conversation, "system", "Be brief") ==
+         0);
+  for (i = 0; i < 7; i++) {
+    snprintf(content, sizeof(content), "turn %d padded to forty bytes ....",
+             i);
+    assert(mistral_conversation_append(conversation,
+                                       i % 2 == 0 ? "user" : "assistant",
+                                       content) == 0);
+  }
+  assert(mistral_conversation_chat(config, conversation, &response) == 0);
+  /* the reply's arena went to the conversation, id stays readable */
+  assert(response.arena == NULL && response.content == NULL);
+  assert(strcmp(response.id, "c-1") == 0);
+  mistral_response_free(&response);
+  assert(state.calls == 1);
+  count = mistral_conversation_count(conversation);
+  assert(count < 9);
+  assert(mistral_conversation_get(conversation, 1, &message) == 0);
+  assert(strcmp(message.role, "system") == 0);
+  assert(strncmp(message.content, "summary 1", 9) == 0);
+  assert(mistral_conversation_get(conversation, count - 1, &message) == 0);
+  assert(strcmp(message.content, "reply 1") == 0);
+  check_history_json(server.last_body, conversation, count - 1);
+  printf("...history replaced by summary - ok\n");
+
+  /* the moved fragments are found again at their rewritten offsets */
+  for (i = 0; i < 3; i++) {
+    snprintf(content, sizeof(content), "next %d padded to forty bytes ....",
+             i);
+    assert(mistral_conversation_append(conversation,
+                                       i % 2 == 0 ? "user" : "assistant",
+                                       content) == 0);
+  }
+  assert(mistral_conversation_chat(config, conversation, &response) == 0);
+  mistral_response_free(&response);
+  assert(state.calls == 2);
+  assert(strncmp(state.first, "summary 1", 9) == 0);
+  count = mistral_conversation_count(conversation);
+  assert(mistral_conversation_get(conversation, 1, &message) == 0);
+  assert(strncmp(message.content, "summary 2", 9) == 0);
+  check_history_json(server.last_body, conversation, count - 1);
+  printf("...second compaction folds the first - ok\n");
+
+  mistral_conversation_free(conversation);
+  mistral_context_policy_free(policy);
+  mistral_config_free(config);
+  mistral_backend_pool_free(pool);
+  test_server_stop(&server);
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_fim_window(void) {
+  printf("TEST - FIM window\n");
+
+  /* not NUL-terminated, like an mmap'd file */
+  const char source[] = "#include <stdio.h>\n"
+                        "\n"
+                        "static int add(int a, int b) {\n"
+                        "  return a + b;\n"
+                        "}\n"
+                        "\n"
+                        "int main(void) {\n"
+                        "  printf(\"%d\\n\", add(1, 2));\n"
+                        "  return 0;\n"
+                        "}\n";
+  size_t length = sizeof(source) - 1;
+  size_t cursor = (size_t)(strstr(source, "add(1") - source);
+  mistral_fim_window_t window;
+
+  assert(mistral_fim_select_window(source, length, cursor, 1000, NULL,
+                                   &window) == 0);
+  assert(window.prefix_start == 0);
+  assert(window.suffix_end == length);
+  printf("...whole file fits - ok\n");
+
+  assert(mistral_fim_select_window(source, length, cursor, 14, NULL,
+                                   &window) == 0);
+  assert(window.prefix_start > 0 && window.prefix_start <= cursor);
+  assert(source[window.prefix_start - 1] == '\n');
+  assert(window.suffix_end >= cursor && window.suffix_end <= length);
+  assert(window.prefix_tokens + window.suffix_tokens <= 14);
+  /* the prefix starts at main, not inside add */
+  assert(strncmp(source + window.prefix_start, "int main", 8) == 0);
+  printf("...budget - ok\n");
+
+  assert(mistral_fim_select_window(source, length, length + 1, 20, NULL,
+                                   &window) != 0);
+  assert(mistral_fim_select_window(source, length, cursor, 0, NULL,
+                                   &window) != 0);
+  assert(mistral_fim_select_window(NULL, 0, 0, 20, NULL, &window) == 0);
+  printf("...invalid params - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+static void fim_session_callback(const char *completion, size_t cursor,
+                                 void *user_data) {
+  (void)completion;
+  (void)cursor;
+  (*(int *)user_data)++;
+}
+
+int test_fim_session(void) {
+  printf("TEST - FIM session\n");
+
+  mistral_config_t *config = mistral_config_create("test");
+  mistral_fim_session_t *session = NULL;
+  mistral_fim_session_stats_t stats;
+  const char *buffer = "def add(a, b):\n    return \n";
+  int delivered = 0;
+  assert(config != NULL);
+
+  assert(mistral_fim_session_create(NULL, 100, 100, NULL,
+                                    fim_session_callback, &delivered) == NULL);
+  assert(mistral_fim_session_create(config, -1, 100, NULL,
+                                    fim_session_callback, &delivered) == NULL);
+  assert(mistral_fim_session_create(config, 100, 100, NULL, NULL, NULL) ==
+         NULL);
+  session = mistral_fim_session_create(config, 10000, 100, NULL,
+                                       fim_session_callback, &delivered);
+  assert(session != NULL);
+  printf("...create - ok\n");
+
+  /* both wait out the long debounce, the first is replaced */
+  assert(mistral_fim_session_update(session, buffer, strlen(buffer), 26) == 0);
+  assert(mistral_fim_session_update(session, buffer, strlen(buffer), 27) == 0);
+  assert(mistral_fim_session_update(session, buffer, strlen(buffer), 99) != 0);
+  mistral_fim_session_get_stats(session, &stats);
+  assert(stats.updates == 2);
+  assert(stats.debounced == 1);
+  assert(stats.requests == 0);
+  printf("...debounce - ok\n");
+
+  mistral_fim_session_free(session);
+  mistral_fim_session_free(NULL);
+  assert(delivered == 0);
+  mistral_config_free(config);
+  printf("...cleanup - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_fim_session_reuse(void) {
+  printf("TEST - FIM session with reused responses\n");
+
+  test_server_t server;
+  mistral_backend_pool_t *pool = NULL;
+  mistral_config_t *config = NULL;
+  mistral_fim_session_t *session = NULL;
+  mistral_message_t message = {"user", "hello"};
+  mistral_response_t response = {0};
+  const char *buffer = "def add(a, b):\n    return \n";
+  int delivered = 0;
+  int waited = 0;
+  assert(test_server_start(&server) == 0);
+  config = test_server_config(&server, &pool);
+  assert(config != NULL);
+  config->reuse_responses = 1;
+
+  /* the worker's response is on its stack and must not look reusable */
+  session = mistral_fim_session_create(config, 0, 100, NULL,
+                                       fim_session_callback, &delivered);
+  assert(session != NULL);
+  assert(mistral_fim_session_update(session, buffer, strlen(buffer), 26) == 0);
+  while (test_server_requests(&server) < 1 && waited++ < 200) {
+    test_server_sleep_ms(10);
+  }
+  mistral_fim_session_free(session);
+  assert(test_server_requests(&server) == 1);
+  printf("...session request - ok\n");
+
+  /* an invalid config keeps the arena of the previous reply */
+  assert(mistral_chat_completions(config, &message, 1, &response) == 0);
+  assert(response.arena != NULL);
+  config->temperature = 5.0;
+  assert(mistral_chat_completions(config, &message, 1, &response) != 0);
+  assert(response.error_code == MISTRAL_ERR_INVALID_PARAM);
+  assert(response.arena != NULL);
+  mistral_response_free(&response);
+  printf("...arena kept on invalid config - ok\n");
+
+  mistral_config_free(config);
+  mistral_backend_pool_free(pool);
+  test_server_stop(&server);
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+typedef struct {
+  pthread_mutex_t lock;
+  int delivered;
+  char completion[32];
+  size_t cursor;
+  int hold_ms;
+  double returned_ms;
+} fim_deliveries_t;
+
+static void record_delivery(const char *completion, size_t cursor,
+                            void *user_data) {
+  fim_deliveries_t *deliveries = (fim_deliveries_t *)user_data;
+  int hold_ms = 0;
+
+  pthread_mutex_lock(&deliveries->lock);
+  hold_ms = deliveries->hold_ms;
+  pthread_mutex_unlock(&deliveries->lock);
+  test_server_sleep_ms(hold_ms);
+  pthread_mutex_lock(&deliveries->lock);
+  deliveries->delivered++;
+  snprintf(deliveries->completion, sizeof(deliveries->completion), "%s",
+           completion);
+  deliveries->cursor = cursor;
+  deliveries->returned_ms = monotonic_ms();
+  pthread_mutex_unlock(&deliveries->lock);
+}
+
+/*
+* wait up to two seconds for the callback to have returned delivered times;
+* stats count a delivery before its callback runs, so they are not enough
+*/
+static void wait_delivered(fim_deliveries_t *deliveries, int delivered) {
+  int done = 0;
+  int waited = 0;
+
+  do {
+    test_server_sleep_ms(5);
+    pthread_mutex_lock(&deliveries->lock);
+    done = deliveries->delivered;
+    pthread_mutex_unlock(&deliveries->lock);
+  } while (done < delivered && waited++ < 400);
+  assert(done >= delivered);
+}
+
+int test_fim_session_delivery(void) {
+  printf("TEST - FIM session delivery\n");
+
+  test_server_t server;
+  mistral_backend_pool_t *pool = NULL;
+  mistral_config_t *config = NULL;
+  mistral_fim_session_t *session = NULL;
+  mistral_fim_session_stats_t stats;
+  fim_deliveries_t deliveries;
+  double update_returned = 0.0;
+  int waited = 0;
+  assert(test_server_start(&server) == 0);
+  config = test_server_config(&server, &pool);
+  assert(config != NULL);
+  memset(&deliveries, 0, sizeof(deliveries));
+  pthread_mutex_init(&deliveries.lock, NULL);
+  session = mistral_fim_session_create(config, 0, 100, NULL, record_delivery,
+                                       &deliveries);
+  assert(session != NULL);
+
+  assert(mistral_fim_session_update(session, "x = \n", 5, 4) == 0);
+  wait_delivered(&deliveries, 1);
+  assert(strcmp(deliveries.completion, "reply 1") == 0);
+  assert(deliveries.cursor == 4);
+
+  /* typing the start of the prediction is answered without a request */
+  assert(mistral_fim_session_update(session, "x = re\n", 7, 6) == 0);
+  wait_delivered(&deliveries, 2);
+  assert(strcmp(deliveries.completion, "ply 1") == 0);
+  assert(deliveries.cursor == 6);
+  mistral_fim_session_get_stats(session, &stats);
+  assert(stats.reused == 1 && stats.requests == 1);
+  assert(test_server_requests(&server) == 1);
+  printf("...typed ahead reuse - ok\n");
+
+  /* the outdated request is cancelled and its reply never delivered */
+  pthread_mutex_lock(&server.lock);
+  server.delay_ms = 300;
+  pthread_mutex_unlock(&server.lock);
+  assert(mistral_fim_session_update(session, "y = \n", 5, 4) == 0);
+  while (test_server_requests(&server) < 2 && waited++ < 400) {
+    test_server_sleep_ms(5);
+  }
+  assert(mistral_fim_session_update(session, "z = \n", 5, 4) == 0);
+  wait_delivered(&deliveries, 3);
+  mistral_fim_session_get_stats(session, &stats);
+  assert(stats.cancelled == 1 && stats.requests == 3);
+  assert(strcmp(deliveries.completion, "reply 3") == 0);
+  assert(deliveries.delivered == 3);
+  printf("...in-flight request cancelled - ok\n");
+
+  /* an update during a delivery waits for it, so none can follow it */
+  pthread_mutex_lock(&server.lock);
+  server.delay_ms = 0;
+  pthread_mutex_unlock(&server.lock);
+  pthread_mutex_lock(&deliveries.lock);
+  deliveries.hold_ms = 200;
+  pthread_mutex_unlock(&deliveries.lock);
+  assert(mistral_fim_session_update(session, "w = \n", 5, 4) == 0);
+  waited = 0;
+  while (test_server_requests(&server) < 4 && waited++ < 400) {
+    test_server_sleep_ms(5);
+  }
+  test_server_sleep_ms(50);
+  assert(mistral_fim_session_update(session, "v = \n", 5, 4) == 0);
+  update_returned = monotonic_ms();
+  pthread_mutex_lock(&deliveries.lock);
+  assert(deliveries.delivered == 4);
+  assert(deliveries.returned_ms <= update_returned);
+  deliveries.hold_ms = 0;
+  pthread_mutex_unlock(&deliveries.lock);
+  wait_delivered(&deliveries, 5);
+  assert(strcmp(deliveries.completion, "reply 5") == 0);
+  printf("...delivery serialized with updates - ok\n");
+
+  mistral_fim_session_free(session);
+  pthread_mutex_destroy(&deliveries.lock);
+  mistral_config_free(config);
+  mistral_backend_pool_free(pool);
+  test_server_stop(&server);
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_response_arena(void) {
+  printf("TEST - Response arena\n");
+
+  mistral_response_arena_t *arena = response_arena_create(16);
+  mistral_response_t response = {0};
+  mistral_embeddings_response_t embeddings = {0};
+  const size_t big = 4 << 20;
+  char *text = (char *)malloc(big + 1);
+  char *json = (char *)malloc(big + 128);
+  char *copies[8];
+  char *taken = NULL;
+  size_t i;
+  assert(arena != NULL && text != NULL && json != NULL);
+
+  /* each copy outgrows the block before it */
+  memset(text, 'a', big);
+  text[big] = '\0';
+  for (i = 0; i < 8; i++) {
+    copies[i] = response_arena_strdup(arena, text + big - (1u << (i + 12)));
+    assert(copies[i] != NULL);
+  }
+  assert(response_arena_blocks(arena) > 1);
+  for (i = 0; i < 8; i++) {
+    assert(strlen(copies[i]) == 1u << (i + 12));
+    assert(response_arena_owns(arena, copies[i]));
+  }
+  assert(!response_arena_owns(arena, text));
+  assert(((size_t)response_arena_alloc(arena, 3) & (sizeof(double) - 1)) == 0);
+  response_arena_free(arena);
+  printf("...growth - ok\n");
+
+  /* a multi megabyte reply still lands in the first block */
+  snprintf(json, big + 128,
+           "{\"id\":\"cmpl-1\",\"model\":\"m\",\"choices\":[{\"message\":"
+           "{\"content\":\"%s\"}}]}",
+           text);
+  assert(parse_response(json, 200, &response) == 0);
+  assert(strlen(response.content) == big);
+  assert(strcmp(response.id, "cmpl-1") == 0);
+  assert(response_arena_blocks(response.arena) == 1);
+  taken = response_take_content(&response);
+  assert(taken != NULL && response.content == NULL);
+  assert(!response_arena_owns(response.arena, taken));
+  assert(strlen(taken) == big);
+  free(taken);
+  mistral_response_free(&response);
+  assert(response.arena == NULL && response.id == NULL);
+  printf("...large content - ok\n");
+
+  /* a reply that fills its arena is adopted, not copied */
+  assert(parse_response("{\"id\":\"cmpl-2\",\"model\":\"m\",\"choices\":"
+                        "[{\"message\":{\"content\":\"kept\"}}]}",
+                        200, &response) == 0);
+  arena = response_take_arena(&response, &taken);
+  assert(arena != NULL && strcmp(taken, "kept") == 0);
+  assert(response_arena_owns(arena, taken));
+  assert(response.arena == NULL && response.content == NULL);
+  assert(!response_arena_owns(arena, response.id));
+  assert(strcmp(response.id, "cmpl-2") == 0);
+  mistral_response_free(&response);
+  assert(strcmp(taken, "kept") == 0);
+  response_arena_free(arena);
+
+  /* a short content in a big arena is left for response_take_content */
+  snprintf(json, big + 128,
+           "{\"id\":\"cmpl-3\",\"model\":\"%s\",\"choices\":[{\"message\":"
+           "{\"content\":\"short\"}}]}",
+           text);
+  assert(parse_response(json, 200, &response) == 0);
+  taken = NULL;
+  assert(response_take_arena(&response, &taken) == NULL && taken == NULL);
+  assert(response.arena != NULL && strcmp(response.content, "short") == 0);
+  mistral_response_free(&response);
+  printf("...take arena - ok\n");
+
+  assert(parse_embenddings(
+             "{\"object\":\"list\",\"data\":[{\"object\":\"embedding\","
+             "\"index\":0,\"embedding\":[0.5,-1]},{\"object\":\"embedding\","
+             "\"index\":1,\"embedding\":[2,0.25]}],\"usage\":"
+             "{\"prompt_tokens\":4,\"total_tokens\":4}}",
+             200, &embeddings) == 0);
+  assert(embeddings.data[1].embending[1] == 0.25f);
+  assert(embeddings.data[0].dimensions == 2);
+  assert(embeddings.usage->prompt_tokens == 4);
+  mistral_embeddings_response_free(&embeddings);
+  printf("...embeddings - ok\n");
+
+  free(text);
+  free(json);
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+typedef struct {
+  long live;
+  long calls;
+} alloc_counter_t;
+
+static void *counting_malloc(size_t size, void *user_data) {
+  alloc_counter_t *counter = (alloc_counter_t *)user_data;
+  void *ptr = malloc(size);
+  if (ptr != NULL) {
+    counter->live++;
+    counter->calls++;
+  }
+  return ptr;
+}
+
+static void *counting_realloc(void *ptr, size_t size, void *user_data) {
+  alloc_counter_t *counter = (alloc_counter_t *)user_data;
+  void *moved = realloc(ptr, size);
+  if (moved != NULL && ptr == NULL) {
+    counter->live++;
+  }
+  counter->calls++;
+  return moved;
+}
+
+static void counting_free(void *ptr, void *user_data) {
+  alloc_counter_t *counter = (alloc_counter_t *)user_data;
+  counter->live--;
+  free(ptr);
+}
+
+int test_allocator(void) {
+  printf("TEST - Custom allocator\n");
+
+  alloc_counter_t counter = {0, 0};
+  mistral_config_t *config = NULL;
+  mistral_conversation_t *conversation = NULL;
+  mistral_response_t response = {0};
+  mistral_message_t message = {"user", "hi"};
+  char *json = NULL;
+
+  assert(mistral_set_allocator(counting_malloc, NULL, counting_free,
+                               &counter) != 0);
+  assert(mistral_set_allocator(counting_malloc, counting_realloc,
+                               counting_free, &counter) == 0);
+  printf("...install - ok\n");
+
+  config = mistral_config_create("test");
+  assert(config != NULL);
+  json = create_chat_request_json(config, &message, 1);
+  assert(json != NULL);
+  mistral_free(json);
+  conversation = mistral_conversation_create();
+  assert(mistral_conversation_append(conversation, "user", "hi") == 0);
+  assert(parse_response("{\"choices\":[{\"message\":{\"content\":\"x\"}}]}",
+                        200, &response) == 0);
+  assert(counter.live > 0);
+  printf("...routed - ok\n");
+
+  mistral_response_free(&response);
+  mistral_conversation_free(conversation);
+  mistral_config_free(config);
+  assert(counter.live == 0);
+  assert(counter.calls > 0);
+  printf("...balanced - ok\n");
+
+  assert(mistral_set_allocator(NULL, NULL, NULL, NULL) == 0);
+  json = (char *)mistral_malloc(8);
+  assert(json != NULL);
+  mistral_free(json);
+  assert(counter.live == 0);
+  printf("...restore - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_response_views(void) {
+  printf("TEST - Response views\n");
+
+  const char *reply =
+      "{\"id\":\"cmpl-\\u00e9\",\"model\":\"m\",\"choices\":[{\"message\":"
+      "{\"tool_calls\":[{\"a\":[1,{\"b\":null}]}],\"content\":"
+      "\"a\\n\\\"b\\\" \\ud83d\\ude00 \\u0000z\"}}],"
+      "\"usage\":{\"prompt_tokens\":3,\"completion_tokens\":4,"
+      "\"total_tokens\":7}}";
+  const char *error = "{\"error\":{\"message\":\"bad\"}}";
+  mistral_response_t response = {0};
+  mistral_string_view_t view;
+  char *body = (char *)mistral_malloc(strlen(reply) + 1);
+  char *taken = NULL;
+  assert(body != NULL);
+
+  strcpy(body, reply);
+  assert(parse_response_view(&body, strlen(reply), strlen(reply) + 1,
+                             &response) == 0);
+  assert(body == NULL);
+  assert(strcmp(response.id, "cmpl-\xc3\xa9") == 0);
+  assert(strcmp(response.model, "m") == 0);
+  assert(response.total_tokens == 7 && response.completion_tokens == 4);
+  view = mistral_response_view(&response, MISTRAL_FIELD_CONTENT);
+  assert(view.length == 13);
+  assert(memcmp(view.data, "a\n\"b\" \xf0\x9f\x98\x80 \0z", 14) == 0);
+  view = mistral_response_view(&response, MISTRAL_FIELD_ID);
+  assert(view.length == 7);
+  printf("...in place - ok\n");
+
+  taken = response_take_content(&response);
+  assert(taken != NULL && taken[12] == 'z' && taken[13] == '\0');
+  free(taken);
+  view = mistral_response_view(&response, MISTRAL_FIELD_CONTENT);
+  assert(view.data == NULL && view.length == 0);
+  mistral_response_free(&response);
+  printf("...take content - ok\n");
+
+  body = (char *)mistral_malloc(strlen(error) + 1);
+  assert(body != NULL);
+  strcpy(body, error);
+  assert(parse_response_view(&body, strlen(error), strlen(error) + 1,
+                             &response) == 1);
+  assert(body != NULL && strcmp(body, error) == 0);
+  mistral_free(body);
+  printf("...fallback - ok\n");
+
+  memset(&response, 0, sizeof(response));
+  response.model = strdup("mistral-tiny");
+  view = mistral_response_view(&response, MISTRAL_FIELD_MODEL);
+  assert(view.length == 12);
+  mistral_response_free(&response);
+  printf("...plain response - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_response_reuse(void) {
+  printf("TEST - Response reuse\n");
+
+  const char *path = "/tmp/mistral_test_reply.json";
+  const char *reply =
+      "{\"id\":\"cmpl-1\",\"model\":\"m\",\"choices\":[{\"message\":"
+      "{\"content\":\"hello\"}}],\"usage\":{\"total_tokens\":3}}";
+  const char *vectors =
+      "{\"object\":\"list\",\"data\":[{\"object\":\"embedding\","
+      "\"index\":0,\"embedding\":[0.5,-1,2]}],\"usage\":"
+      "{\"prompt_tokens\":4,\"total_tokens\":4}}";
+  alloc_counter_t counter = {0, 0};
+  test_server_t failing;
+  test_server_t serving;
+  mistral_backend_pool_t *pool = NULL;
+  mistral_config_t *config = NULL;
+  mistral_message_t message = {"user", "hello"};
+  mistral_response_t response = {0};
+  mistral_embeddings_response_t embeddings = {0};
+  http_response_t http = {0};
+  mistral_response_arena_t *arena = NULL;
+  const float *matrix = NULL;
+  long warm = 0;
+  char *big = NULL;
+  FILE *file = fopen(path, "w");
+  size_t i;
+
+  assert(file != NULL);
+  fputs(reply, file);
+  fclose(file);
+  /* drop the spare receive buffer of earlier tests, it was not counted */
+  assert(http_client_init() == 0);
+  http_client_cleanup();
+  assert(http_client_init() == 0);
+  assert(mistral_set_allocator(counting_malloc, counting_realloc,
+                               counting_free, &counter) == 0);
+
+  /* receive, parse in place, reset: the body goes back to the receiver */
+  for (i = 0; i < 8; i++) {
+    if (http_post("file:///tmp/mistral_test_reply.json", NULL, NULL,
+                  &http) != 0) {
+      printf("SKIPPED - file protocol unavailable\n");
+      mistral_response_free(&response);
+      break;
+    }
+    assert(parse_response_view(&http.data, http.size, http.capacity,
+                               &response) == 0);
+    assert(strcmp(response.content, "hello") == 0);
+    assert(response.total_tokens == 3);
+    if (i == 0) {
+      arena = response.arena;
+    }
+    assert(response.arena == arena);
+    if (i == 1) {
+      warm = counter.calls;
+    }
+    mistral_response_reset(&response);
+    assert(response.content == NULL && response.arena == arena);
+  }
+  assert(i < 8 || counter.calls == warm);
+  printf("...steady state - ok\n");
+
+  /* a retried call keeps the arena the caller handed in */
+  mistral_response_free(&response);
+  assert(test_server_start(&failing) == 0);
+  assert(test_server_start(&serving) == 0);
+  config = test_server_config(&serving, &pool);
+  assert(config != NULL);
+  assert(mistral_backend_pool_add(pool, failing.url, "test", 1) == 1);
+  config->reuse_responses = 1;
+  config->max_retries = 1;
+  assert(mistral_chat_completions(config, &message, 1, &response) == 0);
+  arena = response.arena;
+  assert(arena != NULL);
+  /* grow the arena, a fresh one would start over with a single block */
+  big = (char *)malloc(16 * 1024 + 1);
+  assert(big != NULL);
+  memset(big, 'x', 16 * 1024);
+  big[16 * 1024] = '\0';
+  for (i = 0; i < 3; i++) {
+    assert(response_arena_strdup(arena, big) != NULL);
+  }
+  free(big);
+  big = NULL;
+  pthread_mutex_lock(&failing.lock);
+  failing.status = 503;
+  warm = failing.requests;
+  pthread_mutex_unlock(&failing.lock);
+  for (i = 0; i < 50 && test_server_requests(&failing) == warm; i++) {
+    assert(mistral_chat_completions(config, &message, 1, &response) == 0);
+    assert(response.arena == arena && response_arena_blocks(arena) == 2);
+  }
+  assert(test_server_requests(&failing) == warm + 1);
+  mistral_response_free(&response);
+  mistral_config_free(config);
+  mistral_backend_pool_free(pool);
+  test_server_stop(&failing);
+  test_server_stop(&serving);
+  printf("...arena kept across a retry - ok\n");
+
+  /* grown blocks are merged, the same strings then fit without growing */
+  mistral_response_free(&response);
+  big = (char *)malloc(64 * 1024 + 1);
+  assert(big != NULL);
+  memset(big, 'x', 64 * 1024);
+  big[64 * 1024] = '\0';
+  arena = response_arena_create(16);
+  assert(arena != NULL);
+  for (i = 0; i < 4; i++) {
+    assert(response_arena_strdup(arena, big + (7 - i) * 8 * 1024) != NULL);
+  }
+  assert(response_arena_blocks(arena) == 5);
+  response_arena_reset(arena);
+  assert(response_arena_blocks(arena) == 2);
+  for (i = 0; i < 4; i++) {
+    assert(response_arena_strdup(arena, big + (7 - i) * 8 * 1024) != NULL);
+  }
+  assert(response_arena_blocks(arena) == 2);
+  response_arena_free(arena);
+  free(big);
+  printf("...merged blocks - ok\n");
+
+  for (i = 0; i < 3; i++) {
+    assert(parse_embenddings(vectors, 200, &embeddings) == 0);
+    assert(embeddings.data[0].embending[2] == 2.0f);
+    if (i == 0) {
+      matrix = embeddings.data[0].embending;
+    }
+    assert(embeddings.data[0].embending == matrix);
+    mistral_embeddings_response_reset(&embeddings);
+    assert(embeddings.data == NULL && embeddings.arena != NULL);
+  }
+  mistral_embeddings_response_free(&embeddings);
+  assert(embeddings.arena == NULL);
+  printf("...embedding storage - ok\n");
+
+  http_client_cleanup();
+  assert(counter.live == 0);
+  assert(mistral_set_allocator(NULL, NULL, NULL, NULL) == 0);
+  remove(path);
+  printf("...cleanup - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_length_delimited(void) {
+  printf("TEST - Length-delimited inputs\n");
+
+  /* slices of one frame, none of them terminated */
+  const char frame[] = "useruser\"quoted\"\nassistanttext\001fin";
+  mistral_config_t *config = mistral_config_create("test");
+  mistral_message_n_t slices[2];
+  mistral_message_t copies[2] = {{"user", "user\"quoted\"\n"},
+                                 {"assistant", "text\001"}};
+  mistral_embeddings_n_t inputs[2];
+  mistral_embeddings_t strings[2] = {{"user"}, {"fin"}};
+  mistral_response_t response = {0};
+  mistral_embeddings_response_t embeddings = {0};
+  json_stream_t body;
+  char *expected = NULL;
+  char *json = NULL;
+  assert(config != NULL);
+
+  slices[0].role = frame;
+  slices[0].role_len = 4;
+  slices[0].content = frame + 4;
+  slices[0].content_len = 13;
+  slices[1].role = frame + 17;
+  slices[1].role_len = 9;
+  slices[1].content = frame + 26;
+  slices[1].content_len = 5;
+  expected = create_chat_request_json(config, copies, 2);
+  json_stream_init(&body);
+  assert(create_chat_request_stream(config, slices, 2, &body) == 0);
+  json = json_stream_to_string(&body);
+  json_stream_free(&body);
+  assert(expected != NULL && json != NULL);
+  assert(strcmp(json, expected) == 0);
+  mistral_free(expected);
+  mistral_free(json);
+  printf("...chat body - ok\n");
+
+  inputs[0].input = frame;
+  inputs[0].input_len = 4;
+  inputs[1].input = frame + 31;
+  inputs[1].input_len = 3;
+  expected = create_embeddings_json(config, strings, 2);
+  json_stream_init(&body);
+  assert(create_embeddings_stream(config, inputs, 2, &body) == 0);
+  json = json_stream_to_string(&body);
+  json_stream_free(&body);
+  assert(expected != NULL && json != NULL);
+  assert(strcmp(json, expected) == 0);
+  mistral_free(expected);
+  mistral_free(json);
+  printf("...embeddings body - ok\n");
+
+  slices[0].content = "a\0b";
+  slices[0].content_len = 3;
+  json_stream_init(&body);
+  assert(create_chat_request_stream(config, slices, 1, &body) == 0);
+  json = json_stream_to_string(&body);
+  json_stream_free(&body);
+  assert(json != NULL && strstr(json, "\"content\":\"a\\u0000b\"") != NULL);
+  mistral_free(json);
+  printf("...embedded NUL - ok\n");
+
+  slices[0].content = NULL;
+  assert(mistral_chat_completions_n(config, slices, 1, &response) == -1);
+  assert(response.error_code == MISTRAL_ERR_INVALID_PARAM);
+  mistral_response_free(&response);
+  assert(mistral_chat_completions_n(config, NULL, 1, &response) == -1);
+  mistral_response_free(&response);
+  assert(mistral_fim_completions_n(config, NULL, &response) == -1);
+  assert(response.error_code == MISTRAL_ERR_INVALID_PARAM);
+  mistral_response_free(&response);
+  inputs[1].input = NULL;
+  assert(mistral_embeddings_n(config, inputs, 2, &embeddings) == -1);
+  assert(embeddings.error_code == MISTRAL_ERR_INVALID_PARAM);
+  mistral_embeddings_response_free(&embeddings);
+  mistral_config_free(config);
+  printf("...invalid slices - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_json_stream(void) {
+  printf("TEST - JSON stream\n");
+
+  const char value[] = "tab\tquote\"ctl\001\037end\\";
+  json_stream_t stream;
+  char *whole = NULL;
+  char buffer[4096];
+  size_t length = 0;
+  size_t got = 0;
+  size_t step;
+
+  json_stream_init(&stream);
+  assert(json_stream_append(&stream, "{\"a\":", 5) == 0);
+  assert(json_stream_reference_string(&stream, value, sizeof(value) - 1) ==
+         0);
+  assert(json_stream_append(&stream, ",\"b\":", 5) == 0);
+  assert(json_stream_reference_string(&stream, "", 0) == 0);
+  assert(json_stream_append(&stream, ",\"c\":", 5) == 0);
+  assert(json_stream_append_number(&stream, 0.5) == 0);
+  assert(json_stream_append(&stream, "}", 1) == 0);
+
+  whole = json_stream_to_string(&stream);
+  assert(whole != NULL);
+  assert(strcmp(whole, "{\"a\":\"tab\\tquote\\\"ctl\\u0001\\u001fend\\\\\","
+                       "\"b\":\"\",\"c\":0.5}") == 0);
+  length = json_stream_length(&stream);
+  assert(length == strlen(whole));
+  printf("...whole document - ok\n");
+
+  /* every read size splits some escape */
+  for (step = 1; step <= 7; step++) {
+    size_t n = 0;
+    got = 0;
+    json_stream_rewind(&stream);
+    do {
+      n = json_stream_read(&stream, buffer + got, step);
+      got += n;
+    } while (n == step);
+    assert(got == length && memcmp(buffer, whole, length) == 0);
+  }
+  printf("...chunked reads - ok\n");
+
+  json_stream_rewind(&stream);
+  got = json_stream_read(&stream, buffer, 3);
+  json_stream_rewind(&stream);
+  got = json_stream_read(&stream, buffer, sizeof(buffer));
+  assert(got == length && memcmp(buffer, whole, length) == 0);
+  assert(json_stream_read(&stream, buffer, sizeof(buffer)) == 0);
+  printf("...rewind - ok\n");
+
+  mistral_free(whole);
+  json_stream_free(&stream);
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
+int test_transfer_stats(void) {
+  printf("TEST - Transfer stats\n");
+
+  mistral_config_t *config = mistral_config_create("test");
+  mistral_transfer_stats_t stats;
+  assert(config != NULL);
+  assert(config->compress_request_bytes == 0);
+  mistral_config_free(config);
+  printf("...compression off by default - ok\n");
+
+  assert(mistral_get_transfer_stats("chat/completions", &stats) == 0);
+  assert(mistral_get_transfer_stats("fim/completions", &stats) == 0);
+  assert(mistral_get_transfer_stats("embeddings", &stats) == 0);
+  assert(mistral_get_transfer_stats("models", &stats) == -1);
+  assert(mistral_get_transfer_stats(NULL, &stats) == -1);
+  assert(mistral_get_transfer_stats("embeddings", NULL) == -1);
+  printf("...endpoints - ok\n");
+
+  printf("TEST PASSED\n\n");
+  return 0;
+}
+
 int main(void) {
   int failed = 0;
 
@@ -291,6 +3303,51 @@ int main(void) {
   failed += test_response_with_free_data();
   failed += test_chat_completions_invalid_params();
   failed += test_multiple_messages();
+  failed += test_batch_invalid_params();
+  failed += test_batch_error_isolation();
+  failed += test_batch_reuse();
+  failed += test_rate_limiter();
+  failed += test_coalescer_stats();
+  failed += test_coalescer_threads();
+  failed += test_coalescer_outcomes();
+  failed += test_semantic_cache_create();
+  failed += test_semantic_cache_hit();
+  failed += test_adaptive_limiter_create();
+  failed += test_adaptive_limiter_aimd();
+  failed += test_hedge_policy_create();
+  failed += test_hedge_budget_and_delay();
+  failed += test_hedge_end_to_end();
+  failed += test_circuit_breaker_create();
+  failed += test_circuit_breaker_transitions();
+  failed += test_circuit_breaker_early_exit();
+  failed += test_cancel_token();
+  failed += test_cancel_waits();
+  failed += test_config_timeouts();
+  failed += test_timeouts_enforced();
+  failed += test_limiter_deadline();
+  failed += test_backend_pool_create();
+  failed += test_backend_pool_balance();
+  failed += test_backend_pool_failover();
+  failed += test_fallback_policy_create();
+  failed += test_fallback_splice();
+  failed += test_model_router_select();
+  failed += test_model_router_feedback();
+  failed += test_conversation();
+  failed += test_tokenizer();
+  failed += test_context_policy();
+  failed += test_context_policy_plan();
+  failed += test_conversation_compact();
+  failed += test_fim_window();
+  failed += test_fim_session();
+  failed += test_fim_session_reuse();
+  failed += test_fim_session_delivery();
+  failed += test_response_arena();
+  failed += test_allocator();
+  failed += test_response_views();
+  failed += test_response_reuse();
+  failed += test_length_delimited();
+  failed += test_json_stream();
+  failed += test_transfer_stats();
 
   printf("\n--- Network-dependent tests ---\n");
 
@@ -0,0 +1,311 @@
+#ifndef TEST_SERVER_H
+#define TEST_SERVER_H
+
+/*
+* Local HTTP server for tests that need the whole request path. Requests
+* reach it through a backend pool whose base URL is test_server_url.
+* Chat and FIM replies carry the request number as content, embeddings
+* get a three dimension vector of the input's length. status, the delays
+* and the counters may be changed between calls under lock
+*/
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t idle;
+  pthread_t thread;
+  int fd;
+  int port;
+  int active;
+  /* reply to every request with this status, after delay_ms */
+  int status;
+  int delay_ms;
+  /* if > 0, requests numbered after it do not wait delay_ms */
+  int slow_until;
+  /* if > 0, the reply stops for this long halfway through its body */
+  int stall_ms;
+  int requests;
+  /* requests whose client hung up before the reply was sent */
+  int aborted;
+  /* last request body, malloc'd */
+  char *last_body;
+  char url[64];
+} test_server_t;
+
+typedef struct {
+  test_server_t *server;
+  int fd;
+} test_connection_t;
+
+static void test_server_sleep_ms(int ms) {
+  struct timespec delay;
+
+  delay.tv_sec = ms / 1000;
+  delay.tv_nsec = (long)(ms % 1000) * 1000000L;
+  nanosleep(&delay, NULL);
+}
+
+/*
+* Read one request: headers into head, the body (plain or chunked) into a
+* malloc'd string
+* Return the body, NULL if the connection failed
+*/
+static char *test_server_read(int fd, char *head, size_t head_size) {
+  size_t used = 0;
+  size_t body_len = 0;
+  size_t length = 0;
+  size_t capacity = 0;
+  char *end = NULL;
+  char *body = NULL;
+  char *field = NULL;
+  int chunked = 0;
+  ssize_t n = 0;
+
+  while ((end = strstr(head, "\r\n\r\n")) == NULL) {
+    if (used + 1 >= head_size) {
+      return NULL;
+    }
+    n = recv(fd, head + used, head_size - used - 1, 0);
+    if (n <= 0) {
+      return NULL;
+    }
+    used += (size_t)n;
+    head[used] = '\0';
+  }
+
+  end += 4;
+  body_len = used - (size_t)(end - head);
+  for (field = strstr(head, "\r\n"); field != NULL && field + 2 < end;
+       field = strstr(field + 2, "\r\n")) {
+    if (strncasecmp(field + 2, "content-length:", 15) == 0) {
+      length = strtoul(field + 17, NULL, 10);
+    } else if (strncasecmp(field + 2, "transfer-encoding: chunked", 26) ==
+               0) {
+      chunked = 1;
+    }
+  }
+
+  /* a chunked body is read up to its last, empty chunk */
+  capacity = chunked ? 1 << 20 : length;
+  body = (char *)malloc(capacity + body_len + 1);
+  if (body == NULL) {
+    return NULL;
+  }
+  memcpy(body, end, body_len);
+  body[body_len] = '\0';
+  while (chunked ? body_len < 5 ||
+                        strcmp(body + body_len - 5, "0\r\n\r\n") != 0
+                 : body_len < length) {
+    n = recv(fd, body + body_len, capacity - body_len, 0);
+    if (n <= 0) {
+      free(body);
+      return NULL;
+    }
+    body_len += (size_t)n;
+    body[body_len] = '\0';
+  }
+
+  if (chunked) {
+    char *in = body;
+    char *out = body;
+    size_t size = 0;
+    while ((size = strtoul(in, &end, 16)) > 0) {
+      in = strstr(end, "\r\n") + 2;
+      memmove(out, in, size);
+      out += size;
+      in += size + 2;
+    }
+    *out = '\0';
+  }
+  return body;
+}
+
+static void *test_server_connection(void *arg) {
+  test_connection_t *connection = (test_connection_t *)arg;
+  test_server_t *server = connection->server;
+  char head[8192] = {0};
+  char reply[1024];
+  char response[1536];
+  char *body = test_server_read(connection->fd, head, sizeof(head));
+  int status = 0;
+  int delay_ms = 0;
+  int stall_ms = 0;
+  size_t head_len = 0;
+  int number = 0;
+  int len = 0;
+
+  if (body != NULL) {
+    pthread_mutex_lock(&server->lock);
+    number = ++server->requests;
+    status = server->status;
+    delay_ms = server->delay_ms;
+    stall_ms = server->stall_ms;
+    if (server->slow_until > 0 && number > server->slow_until) {
+      delay_ms = 0;
+    }
+    free(server->last_body);
+    server->last_body = body;
+    len = (int)strlen(body);
+    pthread_mutex_unlock(&server->lock);
+
+    test_server_sleep_ms(delay_ms);
+    if (delay_ms > 0 &&
+        recv(connection->fd, reply, 1, MSG_PEEK | MSG_DONTWAIT) == 0) {
+      pthread_mutex_lock(&server->lock);
+      server->aborted++;
+      pthread_mutex_unlock(&server->lock);
+    }
+    if (status != 200) {
+      snprintf(reply, sizeof(reply),
+               "{\"error\":{\"message\":\"err %d\",\"type\":\"x\"}}", status);
+    } else if (strstr(head, "/embeddings ") != NULL) {
+      snprintf(reply, sizeof(reply),
+               "{\"id\":\"e-%d\",\"object\":\"list\",\"model\":\"m\","
+               "\"data\":[{\"object\":\"embedding\",\"index\":0,"
+               "\"embedding\":[1.0,%d.0,0.5]}],"
+               "\"usage\":{\"prompt_tokens\":3,\"total_tokens\":3}}",
+               number, len % 7);
+    } else {
+      snprintf(reply, sizeof(reply),
+               "{\"id\":\"c-%d\",\"model\":\"m\",\"choices\":[{\"message\":"
+               "{\"role\":\"assistant\",\"content\":\"reply %d\"}}],"
+               "\"usage\":{\"prompt_tokens\":5,\"completion_tokens\":7,"
+               "\"total_tokens\":12}}",
+               number, number);
+    }
+    snprintf(response, sizeof(response),
+             "HTTP/1.1 %d X\r\nContent-Type: application/json\r\n"
+             "Content-Length: %zu\r\nConnection: close\r\n\r\n%s",
+             status, strlen(reply), reply);
+    /* the client may have given up already */
+    if (stall_ms > 0) {
+      head_len = strlen(response) - strlen(reply) / 2;
+      send(connection->fd, response, head_len, MSG_NOSIGNAL);
+      test_server_sleep_ms(stall_ms);
+      send(connection->fd, response + head_len, strlen(response) - head_len,
+           MSG_NOSIGNAL);
+    } else {
+      send(connection->fd, response, strlen(response), MSG_NOSIGNAL);
+    }
+  }
+
+  close(connection->fd);
+  free(connection);
+  pthread_mutex_lock(&server->lock);
+  server->active--;
+  pthread_cond_broadcast(&server->idle);
+  pthread_mutex_unlock(&server->lock);
+  return NULL;
+}
+
+static void *test_server_accept(void *arg) {
+  test_server_t *server = (test_server_t *)arg;
+  test_connection_t *connection = NULL;
+  pthread_t thread;
+  int fd = -1;
+
+  while ((fd = accept(server->fd, NULL, NULL)) >= 0) {
+    connection = (test_connection_t *)malloc(sizeof(test_connection_t));
+    if (connection == NULL) {
+      close(fd);
+      continue;
+    }
+    connection->server = server;
+    connection->fd = fd;
+    pthread_mutex_lock(&server->lock);
+    server->active++;
+    pthread_mutex_unlock(&server->lock);
+    if (pthread_create(&thread, NULL, test_server_connection, connection) !=
+        0) {
+      close(fd);
+      free(connection);
+      pthread_mutex_lock(&server->lock);
+      server->active--;
+      pthread_mutex_unlock(&server->lock);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+  return NULL;
+}
+
+/*
+* Return 0 if listening, -1 if error
+*/
+static int test_server_start(test_server_t *server) {
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+
+  memset(server, 0, sizeof(test_server_t));
+  server->status = 200;
+  pthread_mutex_init(&server->lock, NULL);
+  pthread_cond_init(&server->idle, NULL);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  server->fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (server->fd < 0 ||
+      bind(server->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(server->fd, 64) != 0 ||
+      getsockname(server->fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+    return -1;
+  }
+  server->port = ntohs(addr.sin_port);
+  snprintf(server->url, sizeof(server->url), "http://127.0.0.1:%d/v1",
+           server->port);
+  return pthread_create(&server->thread, NULL, test_server_accept, server);
+}
+
+static int test_server_requests(test_server_t *server) {
+  int requests = 0;
+
+  pthread_mutex_lock(&server->lock);
+  requests = server->requests;
+  pthread_mutex_unlock(&server->lock);
+  return requests;
+}
+
+static void test_server_stop(test_server_t *server) {
+  shutdown(server->fd, SHUT_RDWR);
+  close(server->fd);
+  pthread_join(server->thread, NULL);
+
+  pthread_mutex_lock(&server->lock);
+  while (server->active > 0) {
+    pthread_cond_wait(&server->idle, &server->lock);
+  }
+  pthread_mutex_unlock(&server->lock);
+  free(server->last_body);
+  pthread_cond_destroy(&server->idle);
+  pthread_mutex_destroy(&server->lock);
+}
+
+/*
+* Config whose requests all go to server
+*/
+static mistral_config_t *test_server_config(test_server_t *server,
+                                            mistral_backend_pool_t **pool) {
+  mistral_config_t *config = mistral_config_create("test");
+
+  *pool = mistral_backend_pool_create(MISTRAL_BALANCE_P2C);
+  if (config == NULL || *pool == NULL ||
+      mistral_backend_pool_add(*pool, server->url, "test", 1) != 0) {
+    return NULL;
+  }
+  config->backend_pool = *pool;
+  config->retry_delay_ms = 1;
+  return config;
+}
+
+#endif /* TEST_SERVER_H */